@@ -0,0 +1,624 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "../vknn/vknn.h"
+
+// Kernel micro-benchmarks. Every case is timed in three phases so that host
+// side overhead can be told apart from device time:
+//   record - bind tensors and record the command buffer (layer::forward)
+//   submit - vkQueueSubmit
+//   wait   - fence wait until the dispatch has finished
+// Throughput numbers use submit + wait, which is the closest host visible
+// approximation of execution time.
+//
+// usage: madml_bench [--device <spec>] [--iterations n] [--warmup n] [--quick] [--output file.json]
+// Run with --device type:cpu to pin the suite to lavapipe on machines without a GPU.
+
+typedef std::chrono::high_resolution_clock bench_clock;
+
+struct bench_options
+{
+    std::string device;
+    std::string output = "madml_bench.json";
+    int iterations = 20;
+    int warmup = 3;
+    bool quick = false;
+};
+
+struct bench_result
+{
+    std::string kernel;
+    std::string variant;
+    Shape shape;
+    double flops;
+    double bytes;
+    int iterations;
+    double first_us; // first forward, includes shader module and pipeline creation
+    double record_us;
+    double submit_us;
+    double wait_us;
+    double min_us;
+};
+
+static double elapsedUs(bench_clock::time_point begin, bench_clock::time_point end)
+{
+    return std::chrono::duration<double, std::micro>(end - begin).count();
+}
+
+static bench_result measure(const bench_options& opt, const std::string& kernel, const std::string& variant,
+    const Shape& shape, double flops, double bytes, layer& l, const std::function<void()>& record)
+{
+    bench_result r;
+    r.kernel = kernel;
+    r.variant = variant;
+    r.shape = shape;
+    r.flops = flops;
+    r.bytes = bytes;
+    r.iterations = opt.iterations;
+    r.record_us = 0.0;
+    r.submit_us = 0.0;
+    r.wait_us = 0.0;
+    r.min_us = 0.0;
+
+    auto t0 = bench_clock::now();
+    record();
+    l.runCommandBuffer();
+    r.first_us = elapsedUs(t0, bench_clock::now());
+
+    for (int i = 0; i < opt.warmup; ++i)
+    {
+        record();
+        l.runCommandBuffer();
+    }
+
+    for (int i = 0; i < opt.iterations; ++i)
+    {
+        auto t_begin = bench_clock::now();
+        record();
+        auto t_record = bench_clock::now();
+        l.submitCommandBuffer();
+        auto t_submit = bench_clock::now();
+        l.waitCommandBuffer();
+        auto t_wait = bench_clock::now();
+
+        r.record_us += elapsedUs(t_begin, t_record);
+        r.submit_us += elapsedUs(t_record, t_submit);
+        r.wait_us += elapsedUs(t_submit, t_wait);
+        const double run_us = elapsedUs(t_record, t_wait);
+        if (i == 0 || run_us < r.min_us)
+            r.min_us = run_us;
+    }
+
+    if (opt.iterations > 0)
+    {
+        r.record_us /= opt.iterations;
+        r.submit_us /= opt.iterations;
+        r.wait_us /= opt.iterations;
+    }
+    return r;
+}
+
+static double gflops(const bench_result& r)
+{
+    const double us = r.submit_us + r.wait_us;
+    return us > 0.0 ? r.flops / (us * 1e3) : 0.0;
+}
+
+static double gbps(const bench_result& r)
+{
+    const double us = r.submit_us + r.wait_us;
+    return us > 0.0 ? r.bytes / (us * 1e3) : 0.0;
+}
+
+static int count(const Shape& shape)
+{
+    int total = 1;
+    for (int s : shape)
+        total *= s;
+    return total;
+}
+
+static void benchGemm(const bench_options& opt, std::vector<bench_result>& results)
+{
+    const std::vector<int> sizes = opt.quick ? std::vector<int>{ 64, 256 } : std::vector<int>{ 64, 128, 256, 512, 1024 };
+    for (int sz : sizes)
+    {
+        const int M = sz, N = sz, K = sz;
+        const double flops = 2.0 * M * N * K;
+        const double bytes = 4.0 * (static_cast<double>(M) * K + static_cast<double>(K) * N + static_cast<double>(M) * N);
+        tensor b(0.f, Shape{ 1 });
+        tensor y(0.f, Shape{ M, N });
+
+        for (int v = 0; v < 3; ++v)
+        {
+            const bool transpose_x = v == 1;
+            const bool transpose_w = v == 2;
+            tensor x(1.f, transpose_x ? Shape{ K, M } : Shape{ M, K });
+            tensor w(1.f, transpose_w ? Shape{ N, K } : Shape{ K, N });
+            gemm l(1.f, 0.f, false, transpose_x, transpose_w);
+            const char* variant = transpose_x ? "xt" : transpose_w ? "wt" : "nn";
+            results.push_back(measure(opt, "gemm", variant, Shape{ M, N, K }, flops, bytes, l,
+                [&]() { l.forward(y, x, w, b); }));
+        }
+    }
+}
+
+static std::vector<int> convParams(int batch, int channels, int size, int kernel)
+{
+    const int pad = kernel / 2;
+    const int col = size + 2 * pad - kernel + 1;
+    return std::vector<int>{ batch, channels,
+        1, kernel, kernel, // kernel d h w
+        0, pad, pad, // pad d h w
+        1, 1, 1, // stride d h w
+        1, 1, 1, // dilation d h w
+        1, col, col, // col d h w
+        1, size, size }; // vol d h w
+}
+
+static void benchVol2Col(const bench_options& opt, std::vector<bench_result>& results)
+{
+    const std::vector<int> sizes = opt.quick ? std::vector<int>{ 32 } : std::vector<int>{ 32, 64, 128 };
+    const int batch = 8, channels = 16, kernel = 3;
+    for (int sz : sizes)
+    {
+        std::vector<int> params = convParams(batch, channels, sz, kernel);
+        const Shape vol_shape{ batch, channels, 1, sz, sz };
+        const Shape col_shape{ channels * kernel * kernel, batch * sz * sz };
+        tensor vol(1.f, vol_shape);
+        tensor col(0.f, col_shape);
+        const double bytes = 4.0 * (count(vol_shape) + count(col_shape));
+
+        vol2col v2c(params);
+        results.push_back(measure(opt, "vol2col", "k3", vol_shape, 0.0, bytes, v2c,
+            [&]() { v2c.forward(col, vol); }));
+
+        col2vol c2v(params);
+        results.push_back(measure(opt, "col2vol", "k3", vol_shape, static_cast<double>(count(col_shape)), bytes, c2v,
+            [&]() { c2v.forward(vol, col); }));
+    }
+}
+
+static void benchConv(const bench_options& opt, std::vector<bench_result>& results)
+{
+    const std::vector<int> sizes = opt.quick ? std::vector<int>{ 32 } : std::vector<int>{ 32, 64, 128 };
+    const int batch = 8, channels = 16, out_channels = 32, kernel = 3;
+    for (int sz : sizes)
+    {
+        std::vector<int> params = convParams(batch, channels, sz, kernel);
+        params.push_back(out_channels);
+        const Shape x_shape{ batch, channels, 1, sz, sz };
+        const Shape y_shape{ batch, out_channels, 1, sz, sz };
+        const Shape w_shape{ out_channels, channels, 1, kernel, kernel };
+        tensor x(1.f, x_shape);
+        tensor y(0.f, y_shape);
+        tensor w(1.f, w_shape);
+        tensor b(0.f, Shape{ out_channels });
+        const double flops = 2.0 * count(y_shape) * channels * kernel * kernel;
+        const double bytes = 4.0 * (count(x_shape) + count(y_shape) + count(w_shape));
+
+        conv_forward fwd(params, false);
+        results.push_back(measure(opt, "conv_implicit", "forward", x_shape, flops, bytes, fwd,
+            [&]() { fwd.forward(y, x, w, b); }));
+
+        conv_backward_data dgrad(params);
+        results.push_back(measure(opt, "conv_implicit", "backward_data", x_shape, flops, bytes, dgrad,
+            [&]() { dgrad.forward(x, y, w); }));
+
+        conv_backward_weight wgrad(params);
+        results.push_back(measure(opt, "conv_implicit", "backward_weight", x_shape, flops, bytes, wgrad,
+            [&]() { wgrad.forward(w, x, y); }));
+    }
+}
+
+static void benchDepthwise(const bench_options& opt, std::vector<bench_result>& results)
+{
+    const std::vector<int> sizes = opt.quick ? std::vector<int>{ 32 } : std::vector<int>{ 32, 64, 128 };
+    const int batch = 8, channels = 64, kernel = 3;
+    for (int sz : sizes)
+    {
+        std::vector<int> params = convParams(batch, channels, sz, kernel);
+        params.push_back(channels);
+        params.push_back(channels);
+        const Shape x_shape{ batch, channels, 1, sz, sz };
+        const Shape w_shape{ channels, 1, 1, kernel, kernel };
+        tensor x(1.f, x_shape);
+        tensor y(0.f, x_shape);
+        tensor w(1.f, w_shape);
+        tensor b(0.f, Shape{ channels });
+        const double flops = 2.0 * count(x_shape) * kernel * kernel;
+        const double bytes = 4.0 * (2 * count(x_shape) + count(w_shape));
+
+        conv_forward fwd(params, false);
+        results.push_back(measure(opt, "depthwise", "forward", x_shape, flops, bytes, fwd,
+            [&]() { fwd.forward(y, x, w, b); }));
+
+        conv_backward_data dgrad(params);
+        results.push_back(measure(opt, "depthwise", "backward_data", x_shape, flops, bytes, dgrad,
+            [&]() { dgrad.forward(x, y, w); }));
+
+        conv_backward_weight wgrad(params);
+        results.push_back(measure(opt, "depthwise", "backward_weight", x_shape, flops, bytes, wgrad,
+            [&]() { wgrad.forward(w, x, y); }));
+    }
+}
+
+static void benchTranspose(const bench_options& opt, std::vector<bench_result>& results)
+{
+    const std::vector<int> sizes = opt.quick ? std::vector<int>{ 256 } : std::vector<int>{ 256, 1024, 2048 };
+    for (int sz : sizes)
+    {
+        const Shape shape{ sz, sz };
+        tensor x(1.f, shape);
+        tensor y(0.f, shape);
+        std::vector<int> order{ 1, 0 };
+        transpose l(order);
+        results.push_back(measure(opt, "transpose", "2d", shape, 0.0, 8.0 * count(shape), l,
+            [&]() { l.forward(y, x); }));
+    }
+
+    // NCHW -> NHWC, NCHW <-> CNHW as used by convolution, and a 5D permutation
+    const Shape shape{ 16, 32, 32, 32 };
+    const Shape shape_5d{ 8, 16, 8, 16, 16 };
+    const std::vector<std::pair<std::string, std::vector<int>>> cases{
+        { "4d_0231", { 0, 2, 3, 1 } }, { "4d_1023", { 1, 0, 2, 3 } }, { "5d_04213", { 0, 4, 2, 1, 3 } }
+    };
+    for (const auto& c : cases)
+    {
+        const Shape& s = c.second.size() == 5 ? shape_5d : shape;
+        tensor x(1.f, s);
+        tensor y(0.f, s);
+        std::vector<int> order = c.second;
+        transpose l(order);
+        results.push_back(measure(opt, "transpose", c.first, s, 0.0, 8.0 * count(s), l,
+            [&]() { l.forward(y, x); }));
+    }
+}
+
+static void benchRelu(const bench_options& opt, std::vector<bench_result>& results)
+{
+    const std::vector<int> sizes = opt.quick ? std::vector<int>{ 1 << 16 } : std::vector<int>{ 1 << 12, 1 << 16, 1 << 20, 1 << 22 };
+    for (int sz : sizes)
+    {
+        const Shape shape{ sz };
+        tensor x(1.f, shape);
+        tensor w(0.f, shape);
+        tensor y(0.f, shape);
+        for (int d = 0; d < 2; ++d)
+        {
+            relu l(false, d == 1);
+            results.push_back(measure(opt, "relu", d == 1 ? "backward" : "forward", shape, static_cast<double>(sz),
+                12.0 * sz, l, [&]() { l.forward(y, x, w); }));
+        }
+    }
+}
+
+static void benchMaxReduce(const bench_options& opt, std::vector<bench_result>& results)
+{
+    const std::vector<int> sizes = opt.quick ? std::vector<int>{ 1024 } : std::vector<int>{ 1024, 16384, 65536 };
+    const int rows = 64, window = 9;
+    for (int sz : sizes)
+    {
+        tensor col(1.f, Shape{ rows, window, sz });
+        tensor y(0.f, Shape{ rows, sz });
+        tensor idx(0.f, Shape{ rows, sz });
+        max_reduce l(false);
+        const double elements = static_cast<double>(rows) * window * sz;
+        results.push_back(measure(opt, "max_reduce", "forward", Shape{ rows, window, sz }, elements,
+            4.0 * elements + 8.0 * rows * sz, l, [&]() { l.forward(y, col, idx); }));
+    }
+}
+
+// single passes of the reduction engine: along contiguous rows and down columns
+static void benchReduce(const bench_options& opt, std::vector<bench_result>& results)
+{
+    const std::vector<int> sizes = opt.quick ? std::vector<int>{ 4096 } : std::vector<int>{ 1024, 4096, 16384 };
+    const int rows = 256;
+    for (int sz : sizes)
+    {
+        tensor x(1.f, Shape{ rows, sz });
+        tensor y(0.f, Shape{ std::max(rows, sz) });
+        const double elements = static_cast<double>(rows) * sz;
+        for (int column = 0; column < 2; ++column)
+        {
+            reduce_param param = {};
+            param.outer = column ? 1 : rows;
+            param.extent = column ? rows : sz;
+            param.inner = column ? sz : 1;
+            param.splits = 1;
+            param.chunk = param.extent;
+            param.scale = 1.f;
+            reduce_pass l(param, 0, true);
+            results.push_back(measure(opt, "reduce_sum", column ? "columns" : "rows", Shape{ rows, sz }, elements,
+                4.0 * elements, l, [&]() { l.forward(y, y, x, x); }));
+        }
+    }
+}
+
+// narrow rows take a thread per sample, wide rows a workgroup per sample
+static void benchSoftmax(const bench_options& opt, std::vector<bench_result>& results)
+{
+    const std::vector<Shape> shapes = opt.quick ? std::vector<Shape>{ { 4096, 10 } } :
+        std::vector<Shape>{ { 4096, 10 }, { 1024, 1000 }, { 256, 32768 } };
+    for (const Shape& shape : shapes)
+    {
+        tensor x(1.f, shape);
+        tensor y(0.f, shape);
+        softmax l(1, false, false);
+        const double elements = static_cast<double>(count(shape));
+        results.push_back(measure(opt, "softmax", "forward", shape, 4.0 * elements, 12.0 * elements, l,
+            [&]() { l.forward(y, x, x); }));
+
+        tensor target(0.f, Shape{ shape[0] });
+        tensor loss(0.f, Shape{ shape[0] });
+        cross_entropy ce(1, false, -100);
+        results.push_back(measure(opt, "xent", "fused", shape, 5.0 * elements, 12.0 * elements, ce,
+            [&]() { ce.forward(loss, y, x, target, x, 1.f / shape[0]); }));
+    }
+}
+
+static void benchNorm(const bench_options& opt, std::vector<bench_result>& results)
+{
+    const std::vector<Shape> shapes = opt.quick ? std::vector<Shape>{ { 8, 64, 28, 28 } } :
+        std::vector<Shape>{ { 8, 64, 28, 28 }, { 32, 64, 56, 56 } };
+    for (const Shape& shape : shapes)
+    {
+        const int c = shape[1];
+        tensor x(1.f, shape);
+        tensor y(0.f, shape);
+        tensor dx(0.f, shape);
+        tensor gamma(1.f, Shape{ c });
+        tensor beta(0.f, Shape{ c });
+        tensor running_mean(0.f, Shape{ c });
+        tensor running_var(1.f, Shape{ c });
+        tensor dgamma(0.f, Shape{ c });
+        tensor dbeta(0.f, Shape{ c });
+        tensor stats(0.f, Shape{ c, 2 });
+        const double elements = static_cast<double>(count(shape));
+
+        batch_norm train(1e-5f, 0.1f, true, true, true);
+        results.push_back(measure(opt, "batch_norm", "train", shape, 6.0 * elements, 12.0 * elements, train,
+            [&]() { train.forward(y, x, gamma, beta, running_mean, running_var, stats); }));
+        batch_norm eval(1e-5f, 0.1f, true, true, false);
+        results.push_back(measure(opt, "batch_norm", "eval", shape, 2.0 * elements, 8.0 * elements, eval,
+            [&]() { eval.forward(y, x, gamma, beta, running_mean, running_var, stats); }));
+        norm_backward back(kNormBatch, 0, true);
+        results.push_back(measure(opt, "batch_norm", "backward", shape, 10.0 * elements, 20.0 * elements, back,
+            [&]() { back.forward(dx, dgamma, dbeta, x, y, gamma, stats); }));
+    }
+}
+
+static void benchRnn(const bench_options& opt, std::vector<bench_result>& results)
+{
+    // the recurrent part only, every step of the sequence in one submission
+    const std::vector<int> hiddens = opt.quick ? std::vector<int>{ 128 } : std::vector<int>{ 128, 512 };
+    const int seq = 32;
+    const int batch = 16;
+    for (int hidden : hiddens)
+    {
+        const Shape shape{ seq, batch, hidden };
+        rnn_param param = {};
+        param.seq = seq;
+        param.batch = batch;
+        param.hidden = hidden;
+        param.y_stride = hidden;
+        tensor gx(0.f, Shape{ seq, batch, 4 * hidden });
+        tensor w_hh(0.01f, Shape{ 4 * hidden, hidden });
+        tensor b_hh(0.f, Shape{ 4 * hidden });
+        tensor state(0.f, Shape{ batch, hidden });
+        tensor y(0.f, shape);
+        tensor c(0.f, shape);
+        tensor hp(0.f, shape);
+        rnn_cell cell(kRnnLstm, false, true, param);
+        const double macs = static_cast<double>(seq) * batch * 4 * hidden * hidden;
+        results.push_back(measure(opt, "lstm", "steps", shape, 2.0 * macs, 4.0 * seq * 4 * hidden * hidden, cell,
+            [&]() { cell.forward(gx, w_hh, b_hh, state, state, y, c, hp, state, state, gx, gx, gx, gx, gx, gx, gx, gx); }));
+    }
+}
+
+static void benchElementwise(const bench_options& opt, std::vector<bench_result>& results)
+{
+    const int rows = opt.quick ? 256 : 1024;
+    const Shape shape{ rows, 1024 };
+    const double elements = static_cast<double>(count(shape));
+    tensor a(1.f, shape);
+    tensor b(2.f, shape);
+    tensor row(2.f, Shape{ 1024 });
+    tensor y(0.f, shape);
+
+    elementwise contiguous(kEwAdd);
+    results.push_back(measure(opt, "add", "vec4", shape, elements, 12.0 * elements, contiguous,
+        [&]() { contiguous.forward(y, a, b, a); }));
+    elementwise broadcast(kEwAdd);
+    results.push_back(measure(opt, "add", "broadcast", shape, elements, 8.0 * elements, broadcast,
+        [&]() { broadcast.forward(y, a, row, a); }));
+    elementwise gelu(kEwGelu);
+    results.push_back(measure(opt, "gelu", "vec4", shape, 8.0 * elements, 8.0 * elements, gelu,
+        [&]() { gelu.forward(y, a, a, a); }));
+}
+
+static void benchMse(const bench_options& opt, std::vector<bench_result>& results)
+{
+    const std::vector<int> sizes = opt.quick ? std::vector<int>{ 1 << 16 } : std::vector<int>{ 1 << 12, 1 << 16, 1 << 20 };
+    for (int sz : sizes)
+    {
+        const Shape shape{ sz };
+        tensor loss(0.f, Shape{ 1 });
+        tensor l(1.f, shape);
+        tensor t(0.f, shape);
+        tensor dx(0.f, shape);
+        mse k(true);
+        results.push_back(measure(opt, "mse", "forward", shape, 3.0 * sz, 12.0 * sz, k,
+            [&]() { k.forward(loss, l, t, dx); }));
+    }
+}
+
+static void benchOptimizers(const bench_options& opt, std::vector<bench_result>& results)
+{
+    const std::vector<int> sizes = opt.quick ? std::vector<int>{ 1 << 16 } : std::vector<int>{ 1 << 12, 1 << 16, 1 << 20 };
+    for (int sz : sizes)
+    {
+        const Shape shape{ sz };
+        tensor p(1.f, shape);
+        tensor dp(1.f, shape);
+        tensor v(0.f, shape);
+        tensor m(0.f, shape);
+        tensor r(0.f, shape);
+        tensor m_hat(0.f, shape);
+        tensor r_hat(0.f, shape);
+
+        sgd s(0.01f, 0.9f, 0.f, 0.f, false);
+        results.push_back(measure(opt, "sgd", "momentum", shape, 4.0 * sz, 20.0 * sz, s,
+            [&]() { s.forward(p, dp, v); }));
+
+        adam a(0.001f, 0.9f, 0.999f, 1e-8f, 0.f, false);
+        results.push_back(measure(opt, "adam", "default", shape, 12.0 * sz, 40.0 * sz, a,
+            [&]() { a.forward(1, p, dp, m, r, m_hat, r_hat); }));
+
+        adagrad g(0.01f, 1e-10f, 0.f, 0.f);
+        results.push_back(measure(opt, "adagrad", "default", shape, 6.0 * sz, 20.0 * sz, g,
+            [&]() { g.forward(1, p, dp, v); }));
+
+        rmsprop rp(0.01f, 0.99f, 1e-8f, 0.f, 0.f, false);
+        results.push_back(measure(opt, "rmsprop", "default", shape, 7.0 * sz, 20.0 * sz, rp,
+            [&]() { rp.forward(p, dp, v); }));
+    }
+
+    // many small tensors, the case the multi-tensor kernel exists for
+    if (!bufferDeviceAddressSupported(defaultDevice()))
+        return;
+    const int count = 256, sz = 1024;
+    const Shape shape{ sz };
+    std::vector<tensor> storage;
+    for (int i = 0; i < 4 * count; ++i)
+        storage.emplace_back(i < 2 * count ? 1.f : 0.f, shape);
+    std::vector<tensor*> params, grads;
+    std::vector<std::vector<tensor*>> states(2);
+    for (int i = 0; i < count; ++i)
+    {
+        params.push_back(&storage[i]);
+        grads.push_back(&storage[count + i]);
+        states[0].push_back(&storage[2 * count + i]);
+        states[1].push_back(&storage[3 * count + i]);
+    }
+    const Shape total{ count * sz };
+    multi_tensor_adam mt(0.001f, 0.9f, 0.999f, 1e-8f, 0.f, false);
+    results.push_back(measure(opt, "multi_adam", "256x1024", total, 12.0 * count * sz, 16.0 * count * sz, mt,
+        [&]() { mt.forward(1, params, grads, states); }));
+}
+
+// A one element dispatch is dominated by fixed costs, so its timings are the
+// launch overhead every other kernel pays on top of its own work.
+static void benchLaunch(const bench_options& opt, std::vector<bench_result>& results)
+{
+    const Shape shape{ 1 };
+    tensor x(1.f, shape);
+    tensor w(0.f, shape);
+    tensor y(0.f, shape);
+    relu l(false, false);
+    results.push_back(measure(opt, "launch", "relu_1", shape, 0.0, 0.0, l, [&]() { l.forward(y, x, w); }));
+}
+
+static void writeJson(const std::string& path, int device_id, const bench_options& opt, const std::vector<bench_result>& results)
+{
+    std::ofstream out(path);
+    if (!out)
+        throw std::runtime_error("cannot open " + path);
+
+    std::string name = deviceName(device_id);
+    std::replace(name.begin(), name.end(), '"', '\'');
+    out << "{\n";
+    out << "  \"device\": \"" << name << "\",\n";
+    out << "  \"device_id\": " << device_id << ",\n";
+    out << "  \"iterations\": " << opt.iterations << ",\n";
+    out << "  \"warmup\": " << opt.warmup << ",\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const bench_result& r = results[i];
+        out << "    {\"kernel\": \"" << r.kernel << "\", \"variant\": \"" << r.variant << "\", \"shape\": [";
+        for (size_t j = 0; j < r.shape.size(); ++j)
+            out << (j ? ", " : "") << r.shape[j];
+        out << "], \"first_us\": " << r.first_us
+            << ", \"record_us\": " << r.record_us
+            << ", \"submit_us\": " << r.submit_us
+            << ", \"wait_us\": " << r.wait_us
+            << ", \"min_us\": " << r.min_us
+            << ", \"gflops\": " << gflops(r)
+            << ", \"gbps\": " << gbps(r) << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n";
+    out << "}\n";
+}
+
+static bench_options parseArgs(int argc, char** argv)
+{
+    bench_options opt;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--quick")
+            opt.quick = true;
+        else if (arg == "--device" && i + 1 < argc)
+            opt.device = argv[++i];
+        else if (arg == "--output" && i + 1 < argc)
+            opt.output = argv[++i];
+        else if (arg == "--iterations" && i + 1 < argc)
+            opt.iterations = std::stoi(argv[++i]);
+        else if (arg == "--warmup" && i + 1 < argc)
+            opt.warmup = std::stoi(argv[++i]);
+        else
+            throw std::runtime_error("unknown argument " + arg);
+    }
+    return opt;
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        const bench_options opt = parseArgs(argc, argv);
+        if (!opt.device.empty())
+            selectDevice(opt.device);
+        const int device_id = defaultDevice();
+        printf("device %d: %s\n", device_id, deviceName(device_id).c_str());
+
+        std::vector<bench_result> results;
+        benchLaunch(opt, results);
+        benchGemm(opt, results);
+        benchVol2Col(opt, results);
+        benchConv(opt, results);
+        benchDepthwise(opt, results);
+        benchTranspose(opt, results);
+        benchRelu(opt, results);
+        benchMaxReduce(opt, results);
+        benchReduce(opt, results);
+        benchSoftmax(opt, results);
+        benchNorm(opt, results);
+        benchRnn(opt, results);
+        benchElementwise(opt, results);
+        benchMse(opt, results);
+        benchOptimizers(opt, results);
+
+        printf("%-12s %-10s %10s %10s %10s %10s %10s\n", "kernel", "variant", "record_us", "submit_us", "wait_us", "GFLOP/s", "GB/s");
+        for (const bench_result& r : results)
+        {
+            printf("%-12s %-10s %10.2f %10.2f %10.2f %10.2f %10.2f\n", r.kernel.c_str(), r.variant.c_str(),
+                r.record_us, r.submit_us, r.wait_us, gflops(r), gbps(r));
+        }
+
+        writeJson(opt.output, device_id, opt, results);
+        printf("results written to %s\n", opt.output.c_str());
+    }
+    catch (const std::exception& e)
+    {
+        fprintf(stderr, "madml_bench: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -29,11 +29,22 @@ cpp_file = open('./vknn/spv_shader.cpp', 'w+')
 
 print()
 
+# a "// variant <suffix>: <flags>" line in a shader also builds <name>_<suffix>_spv
+# from the same source with the extra glslangValidator flags, e.g. -DFP16
+variant_re = re.compile(r'^//\s*variant\s+(\w+)\s*:(.*)$')
+
 lst = list()
 for root, dirs, files in os.walk("./"):
     for file in files:
         if file.endswith(".comp"):
-            lst.append(os.path.join(root, file))
+            path = os.path.join(root, file)
+            prefix = os.path.splitext(file)[0]
+            lst.append((path, prefix, ''))
+            with open(path, 'r') as src:
+                for line in src:
+                    m = variant_re.match(line.strip())
+                    if m:
+                        lst.append((path, prefix + '_' + m.group(1), ' ' + m.group(2).strip()))
 
 outfile_str = ['#include <cstdlib>\n\n']
 bin_code = list()
@@ -48,8 +59,7 @@ print(len(bin_dict))
 dir_change = len(bin_dict) != len(lst)
 
 for i in range(0, len(lst)):
-    path = lst[i]
-    prefix = os.path.splitext(os.path.split(path)[-1])[0]
+    path, prefix, flags = lst[i]
     array_name = prefix + '_spv'
     spv_txt_file = prefix + '.spv'
     if(prefix not in bin_dict.keys()):
@@ -59,11 +69,11 @@ for i in range(0, len(lst)):
     if(modified or dir_change or forced):
         bin_dict[prefix]['time'] = os.path.getmtime(path)
         bin_file = prefix + '.tmp'
-        cmd = 'glslangValidator --target-env spirv1.3 -V ' + path + ' -S comp -o ' + bin_file
+        cmd = 'glslangValidator --target-env spirv1.3 -V' + flags + ' ' + path + ' -S comp -o ' + bin_file
         if os.system(cmd) != 0:
             continue
 
-        cmd = 'glslangValidator --target-env spirv1.3 -V ' + path + ' -S comp -o ' + spv_txt_file + ' -x' + null_out
+        cmd = 'glslangValidator --target-env spirv1.3 -V' + flags + ' ' + path + ' -S comp -o ' + spv_txt_file + ' -x' + null_out
         os.system(cmd)
         bin_dict[prefix]['bin'] = []
         infile = open(spv_txt_file, 'r')
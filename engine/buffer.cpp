@@ -2,10 +2,10 @@
 #include "utils.h"
 #include "buffer.h"
 
-static uint32_t findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags properties)
+static uint32_t findMemoryType(int device_id, uint32_t memoryTypeBits, VkMemoryPropertyFlags properties)
 {
     VkPhysicalDeviceMemoryProperties memoryProperties;
-    vkGetPhysicalDeviceMemoryProperties(kPhysicalDevices[0], &memoryProperties);
+    vkGetPhysicalDeviceMemoryProperties(kPhysicalDevices[device_id], &memoryProperties);
 
     for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
     {
@@ -27,7 +27,10 @@ bool buffer::init(size_t size_in_bytes, const char* data)
     VkBufferCreateInfo bufferCreateInfo = {};
     bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bufferCreateInfo.size = size_in_bytes;
-    bufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    // transfer usage lets layers record plain buffer copies, e.g. a transpose that is only a reshape
+    bufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    if (kFeatures[m_device_id].buffer_device_address)
+        bufferCreateInfo.usage |= VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
     bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     VK_CHECK_RESULT(vkCreateBuffer(m_device, &bufferCreateInfo, nullptr, &m_buffer));
 
@@ -36,9 +39,14 @@ bool buffer::init(size_t size_in_bytes, const char* data)
     VkMemoryAllocateInfo allocateInfo = {};
     allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
     allocateInfo.allocationSize = memoryRequirements.size;
-    allocateInfo.memoryTypeIndex = findMemoryType(memoryRequirements.memoryTypeBits,
+    allocateInfo.memoryTypeIndex = findMemoryType(m_device_id, memoryRequirements.memoryTypeBits,
         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+    VkMemoryAllocateFlagsInfo allocateFlags = {};
+    allocateFlags.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+    allocateFlags.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+    if (kFeatures[m_device_id].buffer_device_address)
+        allocateInfo.pNext = &allocateFlags;
     VK_CHECK_RESULT(vkAllocateMemory(m_device, &allocateInfo, nullptr, &m_memory));
 
     if (data)
@@ -53,9 +61,20 @@ bool buffer::init(size_t size_in_bytes, const char* data)
     return true;
 }
 
-buffer::buffer(VkDevice& device, size_t size_in_bytes, const char* data)
+VkDeviceAddress buffer::getDeviceAddress() const
+{
+    if (!kFeatures[m_device_id].buffer_device_address)
+        return 0;
+    VkBufferDeviceAddressInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+    info.buffer = m_buffer;
+    return vkGetBufferDeviceAddress(m_device, &info);
+}
+
+buffer::buffer(VkDevice& device, size_t size_in_bytes, const char* data, int device_id)
 {
     m_device = device;
+    m_device_id = device_id;
     m_buffer = nullptr;
     m_memory = nullptr;
     init(size_in_bytes, data);
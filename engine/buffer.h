@@ -5,18 +5,21 @@
 class buffer
 {
 public:
-    buffer(VkDevice& device) : m_device(device), m_buffer(nullptr), m_memory(nullptr)
+    buffer(VkDevice& device, int device_id = 0) : m_device(device), m_device_id(device_id), m_buffer(nullptr), m_memory(nullptr)
     {
     };
-    buffer(VkDevice& device, size_t size_in_bytes, const char* data);
+    buffer(VkDevice& device, size_t size_in_bytes, const char* data, int device_id = 0);
     ~buffer();
     VkDeviceMemory getVkMemory() const { return m_memory; }
     VkBuffer getVkBuffer() const { return m_buffer; }
+    // 0 unless the device has bufferDeviceAddress enabled
+    VkDeviceAddress getDeviceAddress() const;
 
 private:
     buffer();
     bool init(size_t size_in_bytes, const char* data);
     VkDevice m_device;
+    int m_device_id;
     VkBuffer m_buffer;
     VkDeviceMemory m_memory;
 };
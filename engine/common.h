@@ -17,10 +17,23 @@ extern std::vector<VkPhysicalDevice> kPhysicalDevices;
 extern std::vector<VkDevice> kDevices;
 extern std::vector<VkQueue> kQueues;
 extern std::vector<VkCommandPool> kCmdPools;
+// optional features per device, written once before the device is published
+// by getDevice and read-only afterwards
+struct device_features
+{
+    bool buffer_device_address = false;
+    bool subgroup_arithmetic = false;
+    bool fp16_storage = false;
+    bool fp16_arithmetic = false;
+    bool integer_dot_product = false;
+};
+extern std::vector<device_features> kFeatures;
 extern std::mutex kContextMtx;
 extern std::mutex kDesciptorMtx;
 extern size_t number_devices();
 extern size_t avalible_memory(int device_id);
+extern VkDevice getDevice(int device_id);
+extern int defaultDevice();
 
 
 #define VK_CHECK_RESULT(f) \
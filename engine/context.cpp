@@ -1,3 +1,8 @@
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <iomanip>
+
 #include "common.h"
 #include "context.h"
 
@@ -18,12 +23,22 @@ std::vector<VkDevice> kDevices;
 std::vector<VkQueue> kQueues;
 std::vector<VkCommandPool> kCmdPools;
 std::vector<VkPhysicalDeviceProperties> kLimits;
+std::vector<uint32_t> kQueueFamilyIndices;
+std::vector<std::string> kDeviceUUIDs;
+std::vector<device_features> kFeatures;
 
 VkDebugReportCallbackEXT kDebugReportCallback;
-uint32_t kQueueFamilyIndex;
 std::vector<const char*> kEnabledLayers;
 std::mutex kContextMtx;
 
+// context and device creation use their own lock so that the fast paths in
+// createContext and getDevice never contend with queue submission
+static std::mutex kInitMtx;
+static std::atomic<bool> kCtxReady(false);
+static std::unique_ptr<std::atomic<bool>[]> kDeviceReady;
+static std::atomic<int> kDefaultDevice(0);
+static std::string kDeviceRequest;
+
 static uint32_t getComputeQueueFamilyIndex(VkPhysicalDevice& physicalDevice)
 {
     uint32_t queueFamilyCount;
@@ -86,12 +101,276 @@ VKAPI_ATTR VkBool32 VKAPI_CALL debugReportCallbackFn(VkDebugReportFlagsEXT flags
     return VK_FALSE;
 }
 
+static std::string toLower(std::string str)
+{
+    std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return str;
+}
+
+static int parseDeviceType(const std::string& type)
+{
+    const std::string t = toLower(type);
+    if (t == "discrete" || t == "gpu")
+        return VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU;
+    if (t == "integrated")
+        return VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU;
+    if (t == "virtual")
+        return VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU;
+    if (t == "cpu")
+        return VK_PHYSICAL_DEVICE_TYPE_CPU;
+    if (t == "other")
+        return VK_PHYSICAL_DEVICE_TYPE_OTHER;
+    throw std::runtime_error("unknown device type: " + type);
+}
+
+// spec is an index ("1"), a device type ("type:cpu"), or a case insensitive
+// substring of the device name ("name:radeon" or just "radeon")
+static int findDevice(const std::string& spec)
+{
+    if (spec.empty())
+        return 0;
+    if (std::all_of(spec.begin(), spec.end(), [](unsigned char c) { return std::isdigit(c); }))
+    {
+        const int id = std::stoi(spec);
+        if (id >= static_cast<int>(kPhysicalDevices.size()))
+            throw std::runtime_error("device index out of range: " + spec);
+        return id;
+    }
+
+    if (spec.compare(0, 5, "type:") == 0)
+    {
+        const int type = parseDeviceType(spec.substr(5));
+        for (size_t i = 0; i < kLimits.size(); ++i)
+        {
+            if (kLimits[i].deviceType == type)
+                return static_cast<int>(i);
+        }
+        throw std::runtime_error("no device of type " + spec.substr(5));
+    }
+
+    const std::string name = toLower(spec.compare(0, 5, "name:") == 0 ? spec.substr(5) : spec);
+    for (size_t i = 0; i < kLimits.size(); ++i)
+    {
+        if (toLower(kLimits[i].deviceName).find(name) != std::string::npos)
+            return static_cast<int>(i);
+    }
+    throw std::runtime_error("no device matching " + spec);
+}
+
 void createContext()
 {
-    kContextMtx.lock();
+    if (kCtxReady.load(std::memory_order_acquire))
+        return;
+
+    std::lock_guard<std::mutex> lock(kInitMtx);
+    if (kCtxReady.load(std::memory_order_relaxed))
+        return;
+    // the instance is kept across a failed device lookup, the context is only
+    // published once the requested device resolves so a bad request keeps throwing
     if (!kCtx)
         kCtx.reset(new context());
-    kContextMtx.unlock();
+    std::string request = kDeviceRequest;
+    if (request.empty())
+    {
+        const char* env = std::getenv("MADML_DEVICE");
+        if (env)
+            request = env;
+    }
+    kDefaultDevice.store(findDevice(request));
+    kCtxReady.store(true, std::memory_order_release);
+}
+
+static void initDevice(int device_id)
+{
+    VkPhysicalDevice PDevice = kPhysicalDevices[device_id];
+    const uint32_t queueFamilyIndex = getComputeQueueFamilyIndex(PDevice);
+    VkDeviceQueueCreateInfo queueCreateInfo = {};
+    queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueCreateInfo.queueFamilyIndex = queueFamilyIndex;
+    queueCreateInfo.queueCount = 1; // create one queue in this family. We don't need more.
+    float queuePriorities = 1.0; // we only have one queue, so this is not that imporant.
+    queueCreateInfo.pQueuePriorities = &queuePriorities;
+
+    VkDeviceCreateInfo deviceCreateInfo = {};
+
+    // Specify any desired device features here. We do not need any for this application, though.
+    VkPhysicalDeviceFeatures deviceFeatures = {};
+
+    // optional vulkan 1.1 and 1.2 features, only requested when the device reports them
+    VkPhysicalDeviceVulkan12Features supported12 = {};
+    supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    VkPhysicalDeviceVulkan11Features supported11 = {};
+    supported11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+    supported11.pNext = &supported12;
+    VkPhysicalDeviceVulkan12Features enabled12 = {};
+    enabled12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    VkPhysicalDeviceVulkan11Features enabled11 = {};
+    enabled11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+    enabled11.pNext = &enabled12;
+    std::vector<const char*> device_extensions;
+#ifdef VK_KHR_shader_integer_dot_product
+    // packed int8 dot products for the int8 kernels, headers older than the extension skip it
+    uint32_t extension_count = 0;
+    vkEnumerateDeviceExtensionProperties(PDevice, nullptr, &extension_count, nullptr);
+    std::vector<VkExtensionProperties> extensions(extension_count);
+    vkEnumerateDeviceExtensionProperties(PDevice, nullptr, &extension_count, extensions.data());
+    VkPhysicalDeviceShaderIntegerDotProductFeaturesKHR supported_dot = {};
+    supported_dot.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_INTEGER_DOT_PRODUCT_FEATURES_KHR;
+    VkPhysicalDeviceShaderIntegerDotProductFeaturesKHR enabled_dot = {};
+    enabled_dot.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_INTEGER_DOT_PRODUCT_FEATURES_KHR;
+    const bool has_dot = checkExtensionAvailability(VK_KHR_SHADER_INTEGER_DOT_PRODUCT_EXTENSION_NAME, extensions);
+    if (has_dot)
+    {
+        supported12.pNext = &supported_dot;
+        enabled12.pNext = &enabled_dot;
+    }
+#endif
+    if (kLimits[device_id].apiVersion >= VK_API_VERSION_1_2)
+    {
+        VkPhysicalDeviceFeatures2 features2 = {};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &supported11;
+        vkGetPhysicalDeviceFeatures2(PDevice, &features2);
+        enabled12.bufferDeviceAddress = supported12.bufferDeviceAddress;
+        // half buffers for the fp16 kernels, half arithmetic for the fp16_math ones
+        enabled11.storageBuffer16BitAccess = supported11.storageBuffer16BitAccess;
+        enabled12.shaderFloat16 = supported12.shaderFloat16;
+        deviceCreateInfo.pNext = &enabled11;
+#ifdef VK_KHR_shader_integer_dot_product
+        enabled_dot.shaderIntegerDotProduct = has_dot ? supported_dot.shaderIntegerDotProduct : VK_FALSE;
+        if (enabled_dot.shaderIntegerDotProduct)
+            device_extensions.push_back(VK_KHR_SHADER_INTEGER_DOT_PRODUCT_EXTENSION_NAME);
+#endif
+    }
+
+    deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceCreateInfo.enabledLayerCount = static_cast<uint32_t>(kEnabledLayers.size());
+    deviceCreateInfo.ppEnabledLayerNames = kEnabledLayers.data();
+    deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
+    deviceCreateInfo.queueCreateInfoCount = 1;
+    deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
+    deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(device_extensions.size());
+    deviceCreateInfo.ppEnabledExtensionNames = device_extensions.data();
+
+    VkDevice Device;
+    VK_CHECK_RESULT(vkCreateDevice(PDevice, &deviceCreateInfo, nullptr, &Device));
+    VkQueue Queue;
+    vkGetDeviceQueue(Device, queueFamilyIndex, 0, &Queue);
+
+    VkCommandPoolCreateInfo commandPoolCreateInfo = {};
+    commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    commandPoolCreateInfo.queueFamilyIndex = queueFamilyIndex;
+
+    VkCommandPool CmdPool;
+    VK_CHECK_RESULT(vkCreateCommandPool(Device, &commandPoolCreateInfo, nullptr, &CmdPool));
+    kDevices[device_id] = Device;
+    kQueues[device_id] = Queue;
+    kCmdPools[device_id] = CmdPool;
+    kQueueFamilyIndices[device_id] = queueFamilyIndex;
+    // kFeatures[device_id] is only read after getDevice publishes the device
+    device_features& features = kFeatures[device_id];
+    features.buffer_device_address = enabled12.bufferDeviceAddress == VK_TRUE;
+    features.fp16_storage = enabled11.storageBuffer16BitAccess == VK_TRUE;
+    features.fp16_arithmetic = features.fp16_storage && enabled12.shaderFloat16 == VK_TRUE;
+#ifdef VK_KHR_shader_integer_dot_product
+    features.integer_dot_product = enabled_dot.shaderIntegerDotProduct == VK_TRUE;
+#endif
+}
+
+VkDevice getDevice(int device_id)
+{
+    createContext();
+    if (device_id < 0 || device_id >= static_cast<int>(kPhysicalDevices.size()))
+        throw std::runtime_error("invalid device id " + std::to_string(device_id));
+    if (kDeviceReady[device_id].load(std::memory_order_acquire))
+        return kDevices[device_id];
+
+    std::lock_guard<std::mutex> lock(kInitMtx);
+    if (!kDeviceReady[device_id].load(std::memory_order_relaxed))
+    {
+        initDevice(device_id);
+        kDeviceReady[device_id].store(true, std::memory_order_release);
+    }
+    return kDevices[device_id];
+}
+
+int defaultDevice()
+{
+    createContext();
+    return kDefaultDevice.load();
+}
+
+void setDefaultDevice(int device_id)
+{
+    createContext();
+    if (device_id < 0 || device_id >= static_cast<int>(kPhysicalDevices.size()))
+        throw std::runtime_error("invalid device id " + std::to_string(device_id));
+    kDefaultDevice.store(device_id);
+}
+
+int selectDevice(const std::string& spec)
+{
+    {
+        std::lock_guard<std::mutex> lock(kInitMtx);
+        if (!kCtxReady.load(std::memory_order_relaxed))
+        {
+            // resolved when the context is published, before any device is created
+            kDeviceRequest = spec;
+            return -1;
+        }
+    }
+    const int device_id = findDevice(spec);
+    kDefaultDevice.store(device_id);
+    return device_id;
+}
+
+std::string deviceName(int device_id)
+{
+    createContext();
+    if (device_id < 0 || device_id >= static_cast<int>(kLimits.size()))
+        return std::string();
+    return kLimits[device_id].deviceName;
+}
+
+std::string deviceUUID(int device_id)
+{
+    createContext();
+    if (device_id < 0 || device_id >= static_cast<int>(kDeviceUUIDs.size()))
+        return std::string();
+    return kDeviceUUIDs[device_id];
+}
+
+bool bufferDeviceAddressSupported(int device_id)
+{
+    getDevice(device_id);
+    return kFeatures[device_id].buffer_device_address;
+}
+
+bool fp16StorageSupported(int device_id)
+{
+    getDevice(device_id);
+    return kFeatures[device_id].fp16_storage;
+}
+
+bool fp16ArithmeticSupported(int device_id)
+{
+    getDevice(device_id);
+    return kFeatures[device_id].fp16_arithmetic;
+}
+
+bool integerDotProductSupported(int device_id)
+{
+    getDevice(device_id);
+    return kFeatures[device_id].integer_dot_product;
+}
+
+bool subgroupArithmeticSupported(int device_id)
+{
+    createContext();
+    if (device_id < 0 || device_id >= static_cast<int>(kFeatures.size()))
+        return false;
+    return kFeatures[device_id].subgroup_arithmetic;
 }
 
 bool isAvailable()
@@ -110,7 +389,7 @@ bool isAvailable()
 
 size_t number_devices()
 {
-    if (kCtx)
+    if (kCtxReady.load(std::memory_order_acquire))
         return kPhysicalDevices.size();
     else
         return 0;
@@ -118,7 +397,7 @@ size_t number_devices()
 
 size_t avalible_memory(int device_id)
 {
-    if (kCtx && device_id != -1 && device_id < kLimits.size())
+    if (kCtxReady.load(std::memory_order_acquire) && device_id != -1 && device_id < kLimits.size())
         return kLimits[device_id].limits.maxStorageBufferRange;
     else
         return 0;
@@ -219,47 +498,48 @@ context::context()
     kPhysicalDevices.resize(deviceCount);
     vkEnumeratePhysicalDevices(kInstance, &deviceCount, kPhysicalDevices.data());
 
-    for (VkPhysicalDevice PDevice : kPhysicalDevices)
+    // devices are only opened when a tensor or layer first asks for them
+    kFeatures.assign(deviceCount, device_features());
+    for (uint32_t d = 0; d < deviceCount; ++d)
     {
-        VkPhysicalDeviceProperties device_properties = {};
-        vkGetPhysicalDeviceProperties(PDevice, &device_properties);
-        kQueueFamilyIndex = getComputeQueueFamilyIndex(PDevice);
-        VkDeviceQueueCreateInfo queueCreateInfo = {};
-        queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-        queueCreateInfo.queueFamilyIndex = kQueueFamilyIndex;
-        queueCreateInfo.queueCount = 1; // create one queue in this family. We don't need more.
-        float queuePriorities = 1.0; // we only have one queue, so this is not that imporant.
-        queueCreateInfo.pQueuePriorities = &queuePriorities;
-
-        VkDeviceCreateInfo deviceCreateInfo = {};
-
-        // Specify any desired device features here. We do not need any for this application, though.
-        VkPhysicalDeviceFeatures deviceFeatures = {};
-
-        deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-        deviceCreateInfo.enabledLayerCount = static_cast<uint32_t>(kEnabledLayers.size());
-        deviceCreateInfo.ppEnabledLayerNames = kEnabledLayers.data();
-        deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
-        deviceCreateInfo.queueCreateInfoCount = 1;
-        deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
-
-        VkDevice Device;
-        VK_CHECK_RESULT(vkCreateDevice(PDevice, &deviceCreateInfo, nullptr, &Device));
-        VkQueue Queue;
-        vkGetDeviceQueue(Device, kQueueFamilyIndex, 0, &Queue);
-
-        VkCommandPoolCreateInfo commandPoolCreateInfo = {};
-        commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-        commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-        commandPoolCreateInfo.queueFamilyIndex = kQueueFamilyIndex;
-
-        VkCommandPool CmdPool;
-        VK_CHECK_RESULT(vkCreateCommandPool(Device, &commandPoolCreateInfo, nullptr, &CmdPool));
-        kDevices.push_back(Device);
-        kQueues.push_back(Queue);
-        kCmdPools.push_back(CmdPool);
-        kLimits.push_back(device_properties);
+        VkPhysicalDevice PDevice = kPhysicalDevices[d];
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(PDevice, &properties);
+        kLimits.push_back(properties);
+
+        // the id and subgroup properties are vulkan 1.1, older devices are keyed
+        // by vendor and device id and run without subgroup arithmetic
+        std::ostringstream uuid;
+        if (properties.apiVersion >= VK_API_VERSION_1_1)
+        {
+            VkPhysicalDeviceSubgroupProperties subgroup_properties = {};
+            subgroup_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+            VkPhysicalDeviceIDProperties id_properties = {};
+            id_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+            id_properties.pNext = &subgroup_properties;
+            VkPhysicalDeviceProperties2 device_properties = {};
+            device_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+            device_properties.pNext = &id_properties;
+            vkGetPhysicalDeviceProperties2(PDevice, &device_properties);
+            for (int i = 0; i < VK_UUID_SIZE; ++i)
+                uuid << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(id_properties.deviceUUID[i]);
+            kFeatures[d].subgroup_arithmetic = (subgroup_properties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) &&
+                (subgroup_properties.supportedOperations & VK_SUBGROUP_FEATURE_ARITHMETIC_BIT);
+        }
+        else
+        {
+            uuid << std::hex << std::setw(8) << std::setfill('0') << properties.vendorID << std::setw(8)
+                << properties.deviceID;
+        }
+        kDeviceUUIDs.push_back(uuid.str());
     }
+    kDevices.assign(deviceCount, nullptr);
+    kQueues.assign(deviceCount, nullptr);
+    kCmdPools.assign(deviceCount, nullptr);
+    kQueueFamilyIndices.assign(deviceCount, 0);
+    kDeviceReady.reset(new std::atomic<bool>[deviceCount]);
+    for (uint32_t i = 0; i < deviceCount; ++i)
+        kDeviceReady[i].store(false);
 }
 
 context::~context()
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <string>
 #include <vector>
 enum class Format
 {
@@ -21,6 +22,26 @@ bool isAvailable();
 size_t number_devices();
 size_t avalible_memory(int device_id);
 
+// Device selection. The default device comes from MADML_DEVICE when set and
+// is used by every tensor and layer created afterwards. A spec is an index,
+// "type:discrete|integrated|virtual|cpu|other", or a device name substring.
+int defaultDevice();
+void setDefaultDevice(int device_id);
+int selectDevice(const std::string& spec);
+std::string deviceName(int device_id);
+// hex encoded VkPhysicalDeviceIDProperties::deviceUUID, stable across runs
+std::string deviceUUID(int device_id);
+// buffers on this device expose their GPU address to shaders (GL_EXT_buffer_reference)
+bool bufferDeviceAddressSupported(int device_id);
+// buffers may hold float16_t (VK_KHR_16bit_storage), required by the fp16 kernels
+bool fp16StorageSupported(int device_id);
+// shaders may also compute in float16_t (shaderFloat16)
+bool fp16ArithmeticSupported(int device_id);
+// shaders may use packed int8 dot products (VK_KHR_shader_integer_dot_product)
+bool integerDotProductSupported(int device_id);
+// compute shaders may use GL_KHR_shader_subgroup_arithmetic
+bool subgroupArithmeticSupported(int device_id);
+
 #include "tensor.h"
 #include "buffer.h"
 #include "layer.h"
@@ -6,10 +6,8 @@ std::mutex kDesciptorMtx;
 
 layer::layer()
 {
-    createContext();
-    m_device_id = 0;
-
-    m_device = kDevices[m_device_id];
+    m_device_id = defaultDevice();
+    m_device = getDevice(m_device_id);
     m_pipeline = nullptr;
     m_cmd_buffer = nullptr;
     m_descriptor_pool = nullptr;
@@ -17,6 +15,8 @@ layer::layer()
     m_descriptor_set_layout = nullptr;
     m_pipeline_layout = nullptr;
     m_shader_module = nullptr;
+    m_fence = nullptr;
+    m_pending = false;
 
     m_group_x = 1;
     m_group_y = 1;
@@ -25,6 +25,11 @@ layer::layer()
 
 layer::~layer()
 {
+    m_future.wait();
+    if (m_pending)
+        vkWaitForFences(m_device, 1, &m_fence, VK_TRUE, UINT64_MAX);
+    if (m_fence != nullptr)
+        vkDestroyFence(m_device, m_fence, nullptr);
     if (m_shader_module != nullptr)
         vkDestroyShaderModule(m_device, m_shader_module, nullptr);
     if (m_descriptor_pool != nullptr)
@@ -40,6 +45,17 @@ layer::~layer()
     //    vkDestroyDevice(m_device, nullptr);
 }
 
+bool layer::halfPrecision(const tensor& x, const tensor& y) const
+{
+    if (x.getFormat() != y.getFormat())
+        throw std::runtime_error(m_type + " operands must have the same format");
+    if (x.getFormat() != Format::kFormatFp16)
+        return false;
+    if (!fp16StorageSupported(m_device_id))
+        throw std::runtime_error(m_type + " needs 16 bit storage for fp16 tensors, which the device does not support");
+    return true;
+}
+
 void layer::initVulkanThing(int buffer_num)
 {
     createDescriptorSetLayout(buffer_num);
@@ -156,6 +172,8 @@ void layer::createCommandBuffer()
 
 void layer::recordCommandBuffer(void* push_constants, uint32_t push_constants_size)
 {
+    if (m_pipeline == VK_NULL_HANDLE)
+        throw std::runtime_error(m_type + " pipeline was not created");
     VkCommandBufferBeginInfo beginInfo = {};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
@@ -192,28 +210,64 @@ void layer::bindtensor(tensor& t, uint32_t binding)
     kContextMtx.unlock();
 }
 
-int layer::runCommandBuffer()
+VkResult layer::submitCommandBuffer()
 {
     VkSubmitInfo submit_info = {};
     submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submit_info.commandBufferCount = 1;
     submit_info.pCommandBuffers = &m_cmd_buffer;
 
-    VkFence fence;
-    VkFenceCreateInfo fence_create_info_ = {};
-    fence_create_info_.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fence_create_info_.flags = 0;
-
     m_future.wait();
-    VK_CHECK_RESULT(vkCreateFence(m_device, &fence_create_info_, nullptr, &fence));
-
+    std::lock_guard<std::mutex> lock(m_fence_mtx);
+    if (m_fence == nullptr)
     {
-        kContextMtx.lock();
-        VK_CHECK_RESULT(vkQueueSubmit(kQueues[m_device_id], 1, &submit_info, fence));
-        kContextMtx.unlock();
+        VkFenceCreateInfo fence_create_info_ = {};
+        fence_create_info_.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fence_create_info_.flags = 0;
+        VkResult result = vkCreateFence(m_device, &fence_create_info_, nullptr, &m_fence);
+        if (result != VK_SUCCESS)
+            return result;
     }
+    // the fence can only track one submission
+    VkResult result = waitFence();
+    if (result != VK_SUCCESS)
+        return result;
 
-    VK_CHECK_RESULT(vkWaitForFences(m_device, 1, &fence, VK_TRUE, 100000000000));
-    vkDestroyFence(m_device, fence, nullptr);
+    kContextMtx.lock();
+    result = vkQueueSubmit(kQueues[m_device_id], 1, &submit_info, m_fence);
+    kContextMtx.unlock();
+    if (result == VK_SUCCESS)
+        m_pending = true;
+    return result;
+}
+
+VkResult layer::waitCommandBuffer()
+{
+    std::lock_guard<std::mutex> lock(m_fence_mtx);
+    return waitFence();
+}
+
+VkResult layer::waitFence()
+{
+    if (!m_pending)
+        return VK_SUCCESS;
+    VkResult result = vkWaitForFences(m_device, 1, &m_fence, VK_TRUE, 100000000000);
+    // on VK_TIMEOUT the dispatch is still running, resetting would drop it
+    if (result != VK_SUCCESS)
+        return result;
+    result = vkResetFences(m_device, 1, &m_fence);
+    if (result == VK_SUCCESS)
+        m_pending = false;
+    return result;
+}
+
+int layer::runCommandBuffer()
+{
+    VkResult result = submitCommandBuffer();
+    if (result != VK_SUCCESS)
+        throw std::runtime_error(m_type + " submit failed with VkResult " + std::to_string(result));
+    result = waitCommandBuffer();
+    if (result != VK_SUCCESS)
+        throw std::runtime_error(m_type + " wait failed with VkResult " + std::to_string(result));
     return 1;
-}
\ No newline at end of file
+}
@@ -6,8 +6,10 @@
 #include <memory>
 #include <algorithm>
 #include <cstdarg>
-#include <future>
 #include <list>
+#include <mutex>
+
+#include "thread_pool.h"
 
 constexpr int local_sz_x = 1024;
 constexpr int max_compute_work_group_count = 1024;
@@ -26,12 +28,26 @@ public:
     void createShaderModule(const uint32_t* spv, size_t sz, const std::string& source = std::string());
     void createPipeline(uint32_t push_constants_size = 0, VkSpecializationInfo* specialization_info = nullptr);
     void createCommandBuffer();
+    // throws when the pipeline could not be created
     void recordCommandBuffer(void* push_constants = nullptr, uint32_t push_constants_size = 0);
+    // 1 once the dispatch completed, throws when submitting or waiting failed
     int runCommandBuffer();
+    // runCommandBuffer split in two so callers can overlap host work with the
+    // dispatch, or time submission and execution separately. A submit first
+    // waits out the layer's previous one, a wait that times out or fails
+    // leaves the submission pending so it can be waited on again.
+    VkResult submitCommandBuffer();
+    VkResult waitCommandBuffer();
     void bindtensor(tensor& t, uint32_t binding);
     void run();
 
 protected:
+    // true for fp16 operands, which select the _fp16 shader variants. Throws
+    // when x and y differ in format or the device cannot store half buffers.
+    bool halfPrecision(const tensor& x, const tensor& y) const;
+    // waits for and retires the pending submission, m_fence_mtx must be held
+    VkResult waitFence();
+
     VkDevice m_device;
     VkPipeline m_pipeline;
     VkCommandBuffer m_cmd_buffer;
@@ -40,6 +56,10 @@ protected:
     VkDescriptorSetLayout m_descriptor_set_layout;
     VkPipelineLayout m_pipeline_layout;
     VkShaderModule m_shader_module;
+    VkFence m_fence;
+    // guards m_fence and m_pending across threads running the same layer
+    std::mutex m_fence_mtx;
+    bool m_pending;
 
     int m_group_x;
     int m_group_y;
@@ -48,6 +68,6 @@ protected:
     int m_device_id;
 
     std::string m_type;
-    std::future<void> m_future;
-    std::vector<std::future<void>> m_futures;
+    task_future m_future;
+    std::vector<task_future> m_futures;
 };
@@ -7,34 +7,35 @@
 
 tensor::tensor(Format fmt) : m_format(fmt), m_size_in_byte(0)
 {
-    m_device_id = 0;
-    createContext();
-    m_device = kDevices[m_device_id];
+    m_device_id = defaultDevice();
+    m_device = getDevice(m_device_id);
 }
 
 tensor::tensor(char* data, const std::vector<int>& shape, Format fmt) : m_format(fmt), m_size_in_byte(0)
 {
-    m_device_id = 0;
-    createContext();
-    m_device = kDevices[m_device_id];
+    m_device_id = defaultDevice();
+    m_device = getDevice(m_device_id);
     reshape(data, shape);
 }
 
 tensor::tensor(std::vector<float>& c, const std::vector<int>& shape) : m_format(Format::kFormatFp32), m_size_in_byte(0)
 {
-    m_device_id = 0;
-    createContext();
-    m_device = kDevices[m_device_id];
+    m_device_id = defaultDevice();
+    m_device = getDevice(m_device_id);
     reshape((char*)c.data(), shape);
 }
 
 tensor::tensor(float c, const std::vector<int>& shape) : m_format(Format::kFormatFp32), m_size_in_byte(0)
 {
-    m_device_id = 0;
-    createContext();
-    m_device = kDevices[m_device_id];
-    char* c_arr = init::fill_memory_shape<float>(shape, c);
-    reshape(c_arr, shape);
+    m_device_id = defaultDevice();
+    m_device = getDevice(m_device_id);
+    reshape(nullptr, shape);
+    if (isEmpty())
+        return;
+    // buffers are host visible, fill in place rather than staging a host copy
+    float* p = static_cast<float*>(map());
+    std::fill_n(p, count(), c);
+    unMap();
 }
 
 void* tensor::map() const
@@ -75,7 +76,7 @@ tensor tensor::reshape(const char* data, const std::vector<int>& shape, bool all
         alloc = true;
     m_size_in_byte = new_size;
     if (alloc)
-        m_buffer.reset(new buffer(m_device, m_size_in_byte, data));
+        m_buffer.reset(new buffer(m_device, m_size_in_byte, data, m_device_id));
     else if (data)
     {
         void* p = map();
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <memory>
 #include <numeric>
 #include <random>
@@ -49,20 +50,19 @@ namespace init
     template <typename dType = float>
     char* fill_memory_shape(std::vector<int> shape, dType c)
     {
-        const size_t _shape = std::accumulate(std::begin(shape), std::end(shape), 1, std::multiplies<int>());
+        const size_t _shape = std::accumulate(std::begin(shape), std::end(shape), size_t(1), std::multiplies<size_t>());
         auto ret = new dType[_shape];
-        for (int i = 0; i < _shape; ++i)
-            ret[i] = reinterpret_cast<dType&>(c);
+        std::fill_n(ret, _shape, c);
         return reinterpret_cast<char*>(ret);
     }
 
     template <typename dType = float>
     char* fill_memory_iter(std::vector<int> shape)
     {
-        const size_t _shape = std::accumulate(std::begin(shape), std::end(shape), 1, std::multiplies<int>());
+        const size_t _shape = std::accumulate(std::begin(shape), std::end(shape), size_t(1), std::multiplies<size_t>());
         auto ret = new dType[_shape];
-        for (int i = 0; i < _shape; ++i)
-            ret[i] = reinterpret_cast<dType&>(i);
+        for (size_t i = 0; i < _shape; ++i)
+            ret[i] = static_cast<dType>(i);
         return reinterpret_cast<char*>(ret);
     }
 }
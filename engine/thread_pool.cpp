@@ -0,0 +1,162 @@
+#include <cstdlib>
+
+#include "thread_pool.h"
+
+static thread_local thread_pool* t_owner = nullptr;
+static thread_local size_t t_worker_index = 0;
+
+void task_future::wait() const
+{
+    if (!m_state)
+        return;
+
+    // help drain the pool instead of sleeping, a layer waiting on its init
+    // task from inside another pool task would otherwise starve the workers
+    while (!m_state->done.load(std::memory_order_acquire))
+    {
+        if (getThreadPool().runPendingTask())
+            continue;
+        std::unique_lock<std::mutex> lock(m_state->mtx);
+        m_state->cv.wait(lock, [this] { return m_state->done.load(std::memory_order_acquire); });
+    }
+
+    if (m_state->error)
+        std::rethrow_exception(m_state->error);
+}
+
+thread_pool::thread_pool(size_t num_threads) : m_pending(0), m_next_queue(0), m_stop(false)
+{
+    if (num_threads == 0)
+    {
+        const char* env = std::getenv("MADML_NUM_THREADS");
+        if (env)
+            num_threads = static_cast<size_t>(std::strtoul(env, nullptr, 10));
+    }
+    if (num_threads == 0)
+        num_threads = std::thread::hardware_concurrency();
+    if (num_threads == 0)
+        num_threads = 2;
+
+    for (size_t i = 0; i < num_threads; ++i)
+        m_queues.emplace_back(new work_queue());
+    for (size_t i = 0; i < num_threads; ++i)
+        m_workers.emplace_back(&thread_pool::workerLoop, this, i);
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mtx);
+        m_stop.store(true);
+    }
+    m_sleep_cv.notify_all();
+    for (std::thread& worker : m_workers)
+    {
+        if (worker.joinable())
+            worker.join();
+    }
+}
+
+task_future thread_pool::submit(std::function<void()> fn)
+{
+    std::shared_ptr<task_state> state = std::make_shared<task_state>();
+    std::function<void()> task = [state, fn]()
+    {
+        try
+        {
+            fn();
+        }
+        catch (...)
+        {
+            state->error = std::current_exception();
+        }
+        {
+            std::lock_guard<std::mutex> lock(state->mtx);
+            state->done.store(true, std::memory_order_release);
+        }
+        state->cv.notify_all();
+    };
+
+    // tasks spawned by a worker stay on its own queue, everything else is
+    // spread round robin and rebalanced by stealing
+    // counted before it is queued, a worker popping it right away would
+    // otherwise decrement first and wrap the counter
+    size_t index = t_owner == this ? t_worker_index : m_next_queue.fetch_add(1) % m_queues.size();
+    m_pending.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(m_queues[index]->mtx);
+        m_queues[index]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mtx);
+    }
+    m_sleep_cv.notify_one();
+    return task_future(state);
+}
+
+bool thread_pool::runPendingTask()
+{
+    std::function<void()> task;
+    size_t index = t_owner == this ? t_worker_index : m_next_queue.load() % m_queues.size();
+    if (!(t_owner == this && popTask(index, task)) && !stealTask(index, task))
+        return false;
+    m_pending.fetch_sub(1);
+    task();
+    return true;
+}
+
+bool thread_pool::popTask(size_t index, std::function<void()>& task)
+{
+    work_queue& queue = *m_queues[index];
+    std::lock_guard<std::mutex> lock(queue.mtx);
+    if (queue.tasks.empty())
+        return false;
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+}
+
+bool thread_pool::stealTask(size_t index, std::function<void()>& task)
+{
+    for (size_t i = 0; i < m_queues.size(); ++i)
+    {
+        work_queue& queue = *m_queues[(index + i) % m_queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mtx);
+        if (queue.tasks.empty())
+            continue;
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        return true;
+    }
+    return false;
+}
+
+void thread_pool::workerLoop(size_t index)
+{
+    t_owner = this;
+    t_worker_index = index;
+
+    while (true)
+    {
+        std::function<void()> task;
+        if (popTask(index, task) || stealTask(index, task))
+        {
+            m_pending.fetch_sub(1);
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_sleep_mtx);
+        m_sleep_cv.wait(lock, [this] { return m_stop.load() || m_pending.load() > 0; });
+        if (m_stop.load() && m_pending.load() == 0)
+            return;
+    }
+}
+
+thread_pool& getThreadPool()
+{
+    // never destroyed, layers torn down during static destruction still wait
+    // on their init tasks through it, its parked workers end with the process
+    static thread_pool* kThreadPool = new thread_pool();
+    return *kThreadPool;
+}
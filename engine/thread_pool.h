@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct task_state
+{
+    std::atomic<bool> done{ false };
+    std::exception_ptr error;
+    std::mutex mtx;
+    std::condition_variable cv;
+};
+
+// Handle to a task submitted to a thread_pool. Unlike std::future it is cheap
+// to copy, never blocks on destruction and a default constructed handle is
+// already complete, so layers that never schedule work can still call wait().
+class task_future
+{
+public:
+    task_future() = default;
+    explicit task_future(std::shared_ptr<task_state> state) : m_state(std::move(state)) {}
+
+    bool valid() const { return m_state != nullptr; }
+    bool ready() const { return !m_state || m_state->done.load(std::memory_order_acquire); }
+    void wait() const;
+
+private:
+    std::shared_ptr<task_state> m_state;
+};
+
+class thread_pool
+{
+public:
+    explicit thread_pool(size_t num_threads = 0);
+    ~thread_pool();
+
+    task_future submit(std::function<void()> fn);
+
+    template <typename F, typename... Args>
+    task_future async(F&& f, Args&&... args)
+    {
+        return submit(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    }
+
+    size_t size() const { return m_workers.size(); }
+    bool runPendingTask();
+
+private:
+    struct work_queue
+    {
+        std::mutex mtx;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void workerLoop(size_t index);
+    bool popTask(size_t index, std::function<void()>& task);
+    bool stealTask(size_t index, std::function<void()>& task);
+
+    std::vector<std::thread> m_workers;
+    std::vector<std::unique_ptr<work_queue>> m_queues;
+    std::atomic<size_t> m_pending;
+    std::atomic<size_t> m_next_queue;
+    std::atomic<bool> m_stop;
+    std::mutex m_sleep_mtx;
+    std::condition_variable m_sleep_cv;
+};
+
+thread_pool& getThreadPool();
@@ -4,7 +4,7 @@ from __future__ import print_function
 from __future__ import unicode_literals
 
 from .tensor import tensor
-from .init import zeros, zeros_like, ones, full_like, fill
+from .init import zeros, zeros_like, ones, full_like, fill, arange, manual_seed
 from .optimizer import SGD, adam, Adagrad, RMSprop
 
 
@@ -9,8 +9,50 @@ from typing import List, Union
 
 import numpy as np
 
+import vknn
 from .tensor import tensor
 
+# Random fills run on the device as Philox streams keyed by the global seed,
+# every fill taking the next offset, so a seed reproduces a whole model.
+_seed = random.getrandbits(63)
+_offset = 0
+
+def manual_seed(seed: int) -> None:
+    global _seed, _offset
+    _seed = int(seed)
+    _offset = 0
+    np.random.seed(_seed % 2 ** 32)
+
+# one kernel per fill mode, the values travel as push constants
+_fill_kernels = {}
+_use_device = None
+
+def _on_device() -> bool:
+    # decided once, number_physcial_devices reads zero until something has
+    # brought the context up, so bring it up here rather than ask per fill
+    global _use_device
+    if _use_device is None:
+        try:
+            vknn.default_device()
+            _use_device = vknn.number_physcial_devices() > 0
+        except RuntimeError:
+            _use_device = False
+    return _use_device
+
+def _device_fill(shape: List[int], mode: int, a: float, b: float = 0., lo: float = -2., hi: float = 2.):
+    # None without a device, the caller then fills on the host
+    global _offset
+    if not _on_device():
+        return None
+    _offset += 1
+    if mode not in _fill_kernels:
+        _fill_kernels[mode] = vknn.fill(mode)
+    kernel = _fill_kernels[mode]
+    t = tensor(None, shape)
+    kernel.forward(t.device_data, float(a), float(b), _seed, _offset, float(lo), float(hi))
+    kernel.run()
+    return t
+
 def _size(shape: List[int]) -> int:
     size = 1
     for s in shape:
@@ -18,23 +60,27 @@ def _size(shape: List[int]) -> int:
     return size
 
 def zeros(shape: List[int], dtype=float) -> tensor:
-    data = np.zeros(shape=shape).astype(dtype)
-    return tensor(data, shape)
+    return fill(shape, 0., dtype)
 
 def zeros_like(t: tensor) -> tensor:
     return zeros(t.shape)
 
 def ones(shape: List[int]) -> tensor:
-    data = np.ones(shape=shape)
-    return tensor(data, shape)
+    return fill(shape, 1.)
 
 def full_like(t: tensor, val: float) -> tensor:
-    data = [val for _ in t.size]
-    return tensor(data, t.shape)
+    return fill(t.shape, val)
+
+def fill(shape: List[int], val: float, dtype=float) -> tensor:
+    # the fill kernel writes fp32, other dtypes are filled on the host
+    t = _device_fill(shape, vknn.FILL_CONSTANT, val) if dtype == float else None
+    return t if t is not None else tensor(np.full(shape, val), shape, dtype=dtype)
 
-def fill(shape: List[int], val: float) -> tensor:
-    data = [val for _ in range(_size(shape))]
-    return tensor(data, shape)
+def arange(shape: List[int], start: float = 0., step: float = 1.) -> tensor:
+    t = _device_fill(shape, vknn.FILL_ARANGE, start, step)
+    if t is not None:
+        return t
+    return tensor((start + step * np.arange(_size(shape))).astype(np.float32).reshape(shape), shape)
 
 def calc_gain(nonlinearity: str, param: Union[float, int]=None):
     linear_fns = ['linear', 'conv1d', 'conv2d', 'conv3d', 'conv_transpose1d', 'conv_transpose2d', 'conv_transpose3d']
@@ -58,17 +104,34 @@ def calc_gain(nonlinearity: str, param: Union[float, int]=None):
 
 def uniform(a: float=0., b: float=1.):
     def init(shape: List[int]) -> tensor:
-        sz = _size(shape)
-        data = [random.uniform(a, b) for _ in range(sz)]
-        return tensor(data, shape)
+        t = _device_fill(shape, vknn.FILL_UNIFORM, a, b)
+        if t is not None:
+            return t
+        return tensor(np.random.uniform(a, b, shape).astype(np.float32), shape)
 
     return init
 
 def normal(mean=0., std=1.):
     def init(shape: List[int]) -> tensor:
-        sz = _size(shape)
-        data = [random.normalvariate(mean, std) for _ in range(sz)]
-        return tensor(data, shape)
+        t = _device_fill(shape, vknn.FILL_NORMAL, mean, std)
+        if t is not None:
+            return t
+        return tensor(np.random.normal(mean, std, shape).astype(np.float32), shape)
+
+    return init
+
+def trunc_normal(mean=0., std=1., a: float=-2., b: float=2.):
+    # normal redrawn outside [a, b], the bounds being absolute values
+    def init(shape: List[int]) -> tensor:
+        t = _device_fill(shape, vknn.FILL_TRUNCATED_NORMAL, mean, std, a, b)
+        if t is not None:
+            return t
+        data = np.random.normal(mean, std, _size(shape))
+        bad = (data < a) | (data > b)
+        while bad.any():
+            data[bad] = np.random.normal(mean, std, int(bad.sum()))
+            bad = (data < a) | (data > b)
+        return tensor(data.astype(np.float32).reshape(shape), shape)
 
     return init
 
@@ -60,7 +60,7 @@ class Manager(object):
         mod_order.append(module.name)
         print(args, kwargs)
         mod_dict = self.modules[module.name]
-        for k, v in zip(mod_dict['input'].keys(), args):
+        for k, v in zip(mod_dict['inputs'].keys(), args):
             self.modules[module.name]['inputs'][k] = v
             self.modules[module.name]['gradients']['inputs']['d'+k] = v.gradient
         for k, v in kwargs.items():
@@ -1,10 +1,12 @@
-from .activation import relu, dropout, softmax
+from .activation import relu, dropout, softmax, logsoftmax
 from .convolution import conv1d, conv2d, conv3d
 from .linear import linear
 from .loss import crossentropyloss, mseloss
-from .math import add, sub, mul, div, sigmoid
+from .math import add, sub, mul, div, pow, exp, log, sqrt, tanh, sigmoid, gelu, clamp, where, fused, reduce
 from .module import Module, Parameter
-from .pooling import maxpool1d, maxpool2d, maxpool3d
+from .normalization import BatchNorm1d, BatchNorm2d, BatchNorm3d, GroupNorm, LayerNorm
+from .pooling import maxpool1d, maxpool2d, maxpool3d, avgpool1d, avgpool2d, avgpool3d
+from .rnn import rnn, lstm, gru
 from .transform import transpose, flatten
 
 # TODO BUG: dy is not being updated
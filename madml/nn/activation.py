@@ -8,7 +8,7 @@ import numpy as np
 import vknn
 from madml import tensor
 from .module import Module
-from .testing import relu_forward, relu_backward, dropout_forward, dropout_backward
+from .testing import relu_forward, relu_backward
 
 class relu(Module):
     __constants__ = ['inplace']
@@ -66,50 +66,88 @@ class relu(Module):
         assert ((y.host_data == _y).all())
         assert ((_dx == x.gradient.host_data).all())
 
+def _philox4x32(ctr, key):
+    # numpy mirror of philox4x32 in shaders/philox.glsl, ctr is four uint32 arrays
+    m32, s32 = np.uint64(0xffffffff), np.uint64(32)
+    c = [np.asarray(x, dtype=np.uint64) for x in ctr]
+    k0, k1 = np.uint64(key[0]), np.uint64(key[1])
+    for _ in range(10):
+        p0, p1 = c[0] * np.uint64(0xD2511F53), c[2] * np.uint64(0xCD9E8D57)
+        c = [(p1 >> s32) ^ c[1] ^ k0, p1 & m32, (p0 >> s32) ^ c[3] ^ k1, p0 & m32]
+        k0, k1 = (k0 + np.uint64(0x9E3779B9)) & m32, (k1 + np.uint64(0xBB67AE85)) & m32
+    return c
+
+def philox_uniform(seed: int, offset: int, size: int) -> np.ndarray:
+    # the stream dropout.comp draws, element i is uniform(seed, offset, i // 4)[i % 4]
+    blocks = np.arange((size + 3) // 4, dtype=np.uint64)
+    zeros = np.zeros_like(blocks)
+    r = _philox4x32([blocks, zeros, zeros + (offset & 0xffffffff), zeros + (offset >> 32)],
+                    [seed & 0xffffffff, seed >> 32])
+    return (np.stack(r, axis=1).reshape(-1)[:size] >> np.uint64(8)).astype(np.float32) / np.float32(16777216.)
+
 class dropout(Module):
     __constants__ = ['prob']
     prob: float
 
     def __init__(self, probability: float = 0.1, seed: int = None) -> None:
         super(dropout, self).__init__()
-        if seed:
-            np.random.seed(seed)
         self.prob = probability
-        self.mask = None
+        # masks are regenerated from (seed, offset), the offset advancing once per forward
+        self.seed = int(np.random.randint(0, 2 ** 63, dtype=np.int64)) if seed is None else int(seed)
+        self.offset = 0
+        self.kernel = None
+        self.kernel_dx = None
 
     def forward(self, x: tensor) -> tensor:
-        self.y = self.register_output_shape(x.shape)
-        self.mask = tensor(np.random.rand(*x.shape), x.shape)
+        if self.y is None:
+            self.y = self.register_output_shape(x.shape)
+        self.offset += 1
         super(dropout, self).forward(x)
         return self.y
 
+    def _keep(self, x: tensor) -> np.ndarray:
+        return philox_uniform(self.seed, self.offset, x.host_data.size).reshape(x.shape) >= self.prob
+
     def _forward_cpu(self, x: tensor) -> tensor:
-        self.mask.host_data = self.mask.host_data < self.prob
-        tmp = x.host_data / (1 - self.prob)
-        tmp[self.mask.host_data] = 0
-        self.y.host_data = tmp
-        self.cache = [x]
+        self.y.host_data = np.where(self._keep(x), x.host_data / (1 - self.prob), 0.).astype(np.float32)
+        self.cache = [x, self.y]
+        return self.y
+
+    def _forward_gpu(self, x: tensor) -> tensor:
+        if self.kernel is None:
+            self.kernel = self.register_kernel(vknn.dropout, self.prob, self.seed)
+            self.kernel_dx = self.register_kernel(vknn.dropout, self.prob, self.seed)
+        self.kernel.forward(self.y.device_data, x.device_data, self.offset)
+        self.kernel.run()
         return self.y
 
-    def _backward_cpu(self, dx: tensor, dy: tensor) -> tensor:
-        dx.host_data = dy.host_data / (1 - self.prob)
-        dx[self.mask.host_data] = 0
+    def _backward_cpu(self, x: tensor, y: tensor) -> tensor:
+        dx, dy = x.gradient, y.gradient
+        dx.host_data = np.where(self._keep(x), dy.host_data / (1 - self.prob), 0.).astype(np.float32)
+        return dx
+
+    def _backward_gpu(self, x: tensor, y: tensor) -> tensor:
+        dx, dy = x.gradient, y.gradient
+        self.kernel_dx.forward(dx.device_data, dy.device_data, self.offset)
+        self.kernel_dx.run()
         return dx
 
     def test(self):
         x, y = self.cache
-        _y, c = dropout_forward(x.host_data, self.prob)
-        _dx = dropout_backward(y.gradient.host_data, c)
-        assert ((y.host_data == _y).all())
-        assert ((_dx == x.gradient.host_data).all())
+        keep = self._keep(x)
+        assert ((y.host_data == np.where(keep, x.host_data / (1 - self.prob), 0.)).all())
+        assert ((x.gradient.host_data == np.where(keep, y.gradient.host_data / (1 - self.prob), 0.)).all())
 
 class softmax(Module):
     __constants__ = ['axis']
     axis: int
 
-    def __init__(self, axis: int = 1):
+    def __init__(self, axis: int = 1, log: bool = False):
         super(softmax, self).__init__()
         self.axis = axis
+        self.log = log
+        self.kernel = self.register_kernel(vknn.softmax, axis, log, False)
+        self.kernel_dx = self.register_kernel(vknn.softmax, axis, log, True)
 
     def forward(self, x: tensor) -> tensor:
         self.register_forward_arg('x', x)
@@ -119,9 +157,32 @@ class softmax(Module):
 
     def _forward_cpu(self, x: tensor) -> tensor:
         x = x.host_data
-        ex = np.exp((x.T - np.max(x, self.axis)).T)
-        self.y.host_data = (ex.T / ex.sum(axis=self.axis)).T
+        shifted = x - np.max(x, axis=self.axis, keepdims=True)
+        lse = np.log(np.sum(np.exp(shifted), axis=self.axis, keepdims=True))
+        self.y.host_data = shifted - lse if self.log else np.exp(shifted - lse)
+        return self.y
+
+    def _forward_gpu(self, x: tensor) -> tensor:
+        self.kernel.forward(self.y.device_data, x.device_data, x.device_data)
+        self.kernel.run()
         return self.y
 
-    def _backward_cpu(self) -> tensor:
-        return self.y
\ No newline at end of file
+    def _backward_cpu(self, x: tensor, y: tensor) -> tensor:
+        dx, dy = x.gradient, y.gradient
+        if self.log:
+            dx.host_data = dy.host_data - np.exp(y.host_data) * np.sum(dy.host_data, axis=self.axis, keepdims=True)
+        else:
+            dot = np.sum(dy.host_data * y.host_data, axis=self.axis, keepdims=True)
+            dx.host_data = y.host_data * (dy.host_data - dot)
+        return dx
+
+    def _backward_gpu(self, x: tensor, y: tensor) -> tensor:
+        dx, dy = x.gradient, y.gradient
+        self.kernel_dx.forward(dx.device_data, y.device_data, dy.device_data)
+        self.kernel_dx.run()
+        return dx
+
+class logsoftmax(softmax):
+    def __init__(self, axis: int = 1):
+        super(logsoftmax, self).__init__(axis, True)
+
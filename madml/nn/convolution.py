@@ -15,17 +15,15 @@ from .module import Module, Parameter
 from .transform import vol2col, transpose
 
 MAX_DIMS = 3
+WINOGRAD_RTOL = 1e-3
+WINOGRAD_ATOL = 1e-4
+# kernel length along one axis from which the fft path beats the direct kernels
+FFT_MIN_KERNEL = 31
 
 def _dim_fix(arr, arg_arr, pi):
-    def parse(x):
-        return [x for _ in range(pi)] if isinstance(x, int) else [x[t] for t in range(pi)]
-
-    if isinstance(arg_arr, int):
-        arg_arr = parse(arg_arr)
-    j = 0
-    for i in range(len(arg_arr) - 1, len(arr)):
-        arr[i] = arg_arr[j]
-        j += 1
+    # the last pi entries of arr take arg_arr, an int applying to every convolved axis
+    arg_arr = [arg_arr for _ in range(pi)] if isinstance(arg_arr, int) else list(arg_arr)[-pi:]
+    arr[MAX_DIMS - pi:] = arg_arr
     return arr
 
 class ConvNd(Module):
@@ -52,9 +50,6 @@ class ConvNd(Module):
                  groups: int, bias: bool, padding_mode: str, weight_init='kaiming_uniform') -> None:
         super(ConvNd, self).__init__()
 
-        if groups != 1:
-            raise NotImplementedError("groups not implemented in conv")
-
         if in_channels % groups != 0:
             raise ValueError('in_channels must be divisible by groups')
         if out_channels % groups != 0:
@@ -93,10 +88,13 @@ class ConvNd(Module):
             self.w = self.register_weight(ones, weight_shape)
 
         self.vol_col = None
+        self.conv_y = None
+        self.conv_dx = None
+        self.conv_dw = None
+        self.conv_winograd = None
+        self.conv_fft = None
+        self.winograd_checked = False
         self._TP = [1, 0] + [i + 2 for i in range(dims)]
-        self.gemm_y = self.register_kernel(vknn.gemm, 1.0, 1.0, bias, False, False)
-        self.gemm_dw = self.register_kernel(vknn.gemm, 1.0, 1.0, False, False, True)
-        self.gemm_dc = self.register_kernel(vknn.gemm, 1.0, 1.0, False, True, False)
         self.transpose_y = self.register_module(transpose, self._TP, True)
         self.output_shape = []
 
@@ -111,31 +109,67 @@ class ConvNd(Module):
                     self.stride[-i]) + 1
                 self._vol[-i] = x.shape[-i]
             self.output_shape = [self._col[i] for i in range(-1, -(self.dims + 1), -1)]
-            self.bias = self.register_bias(self.use_bias, zeros, [self.out_channels, *self.output_shape])
+            self.bias = self.register_bias(self.use_bias, zeros, [self.out_channels])
             self.y = self.register_output_shape([self.batch_size, self.out_channels, *self.output_shape])
             self.vol_col = self.register_module(vol2col, self.batch_size, self.in_channels, self._vol, self._col,
                                                     self.kernel_size, self.stride, self.padding, self.dilation)
-        self.w.reshape([w.shape[0], -1])
-        self.y.reshape([self.w.shape[0], -1])
-        
-        self.col = self.vol_col.forward(x)
-      
+            # implicit gemm kernels read x and write y in NCDHW, no col buffer or transpose on the gpu path
+            conv_params = [self.batch_size, self.in_channels, *self.kernel_size, *self.padding, *self.stride,
+                           *self.dilation, *self._col, *self._vol, self.out_channels, self.groups]
+            self.conv_y = self.register_kernel(vknn.conv_forward, conv_params, self.use_bias)
+            self.conv_dx = self.register_kernel(vknn.conv_backward_data, conv_params)
+            self.conv_dw = self.register_kernel(vknn.conv_backward_weight, conv_params)
+            if vknn.fft_conv_supported(conv_params) and max(self.kernel_size) >= FFT_MIN_KERNEL:
+                self.conv_fft = self.register_kernel(vknn.conv_fft, conv_params, self.use_bias)
+            elif vknn.winograd_supported(conv_params):
+                tile = 4 if min(self.output_shape[-2:]) >= 16 else 2
+                self.conv_winograd = self.register_kernel(vknn.conv_winograd, conv_params, self.use_bias, tile)
+
         super(ConvNd, self).forward(x, self.w)
-        _ = self.transpose_y.forward(self.y)
-        self.y.reshape([self.out_channels, self.batch_size, *self.output_shape])
         return self.y
 
     def _forward_cpu(self, x: tensor, w: tensor) -> tensor:
-        y = np.matmul(w.host_data, self.col.host_data)
+        self.col = self.vol_col.forward(x)
+        w.reshape([self.out_channels, -1])
+        self.y.reshape([self.out_channels, -1])
+        # one matmul per group, col rows are ordered by input channel so groups are contiguous
+        w_g = w.host_data.reshape([self.groups, self.out_channels // self.groups, -1])
+        col_g = self.col.host_data.reshape([self.groups, w_g.shape[2], -1])
+        y = np.matmul(w_g, col_g).reshape([self.out_channels, -1])
         self.y.host_data = y
-        self.y.upload()
+        _ = self.transpose_y.forward(self.y)
+        self.y.reshape([self.batch_size, self.out_channels, *self.output_shape])
+        w.reset_shape()
         return self.y
 
     def _forward_gpu(self, x: tensor, w: tensor) -> tensor:
-        self.gemm_y.forward(self.y.device_data, w.device_data, self.col.device_data, self.bias.device_data)
-        self.gemm_y.run()
+        if self.conv_fft is not None:
+            self.conv_fft.forward(self.y.device_data, x.device_data, w.device_data, self.bias.device_data, w.version)
+            self.conv_fft.run()
+            return self.y
+        if self.conv_winograd is not None and not self.winograd_checked:
+            self._check_winograd(x, w)
+        if self.conv_winograd is not None:
+            self.conv_winograd.forward(self.y.device_data, x.device_data, w.device_data, self.bias.device_data,
+                                       w.version)
+            self.conv_winograd.run()
+        else:
+            self.conv_y.forward(self.y.device_data, x.device_data, w.device_data, self.bias.device_data)
+            self.conv_y.run()
         return self.y
 
+    def _check_winograd(self, x: tensor, w: tensor) -> None:
+        # winograd trades accuracy for multiplies, keep it only if it agrees with the direct kernel
+        self.winograd_checked = True
+        self.conv_y.forward(self.y.device_data, x.device_data, w.device_data, self.bias.device_data)
+        self.conv_y.run()
+        direct = self.y.download().copy()
+        self.conv_winograd.forward(self.y.device_data, x.device_data, w.device_data, self.bias.device_data,
+                                   w.version)
+        self.conv_winograd.run()
+        if not np.allclose(self.y.download(), direct, rtol=WINOGRAD_RTOL, atol=WINOGRAD_ATOL):
+            self.conv_winograd = None
+
     def _backward_cpu(self, x: tensor, w: tensor, y: tensor) -> tensor:
         dx, dw, dy = x.gradient, w.gradient, y.gradient
         y.reset_shape()
@@ -143,28 +177,27 @@ class ConvNd(Module):
         dy.reshape([self.out_channels, -1])
         dcol = self.col.gradient
 
-        dw.host_data = np.matmul(dy.host_data, self.col.host_data.T)
+        dy_g = dy.host_data.reshape([self.groups, self.out_channels // self.groups, -1])
+        col_g = self.col.host_data.reshape([self.groups, -1, dy_g.shape[2]])
+        dw.host_data = np.matmul(dy_g, col_g.transpose(0, 2, 1)).reshape([self.out_channels, -1])
         w.reset_shape()
 
-        w_reshaped = w.host_data.reshape([self.out_channels, -1])
-        dcol.host_data = np.matmul(w_reshaped.T, dy.host_data)
+        w_g = w.host_data.reshape([self.groups, self.out_channels // self.groups, -1])
+        dcol.host_data = np.matmul(w_g.transpose(0, 2, 1), dy_g).reshape([-1, dy_g.shape[2]])
 
         _dx = self.vol_col.backward()
         return dx
 
     def _backward_gpu(self, x: tensor, w: tensor, y: tensor) -> tensor:
         dx, dw, dy = x.gradient, w.gradient, y.gradient
-        y.reset_shape()
-        _dy = self.transpose_y.backward()
-        dy.reshape([self.out_channels, -1])
-        dcol = self.col.gradient
-        self.gemm_dx.forward(dcol.device_data, w.device_data, dy.device_data, self._empty_gpu_tensor_obj)
-        self.gemm_dw.forward(dw.device_data, dy.device_data, self.col.device_data, self._empty_gpu_tensor_obj)
+        self.conv_dx.forward(dx.device_data, dy.device_data, w.device_data)
+        self.conv_dw.forward(dw.device_data, x.device_data, dy.device_data)
 
-        self.gemm_dx.run()
-        self.gemm_dw.run()
-
-        _dx = self.vol_col.backward()
+        self.conv_dx.run()
+        self.conv_dw.run()
+        if self.use_bias:
+            # the bias gradient sums dy over the batch and every spatial axis
+            self.d_bias_call_gpu([0] + [i + 2 for i in range(len(dy.shape) - 2)])
         return dx
 
 class conv1d(ConvNd):
@@ -25,6 +25,10 @@ class linear(Module):
         self.w = self.register_weight(kaiming_uniform(a=math.sqrt(5), nonlinearity='linear'), [in_features, out_features])
         self.bias = self.register_bias(bias, zeros, [out_features])
         self.kernel_y = self.register_kernel(vknn.gemm, 1., 1., bias, False, False)
+        # the [out_features] bias is added per column inside the gemm instead of a separate pass
+        epilogue = vknn.gemm_epilogue()
+        epilogue.bias = vknn.BIAS_COLUMN
+        self.kernel_y.set_epilogue(epilogue)
         self.kernel_dw = self.register_kernel(vknn.gemm, 1., 1., False, True, False)
         self.kernel_dx = self.register_kernel(vknn.gemm, 1., 1., False, False, True)
 
@@ -36,6 +40,8 @@ class linear(Module):
     def _forward_cpu(self, x: tensor) -> tensor:
         for i in range(x.shape[0]):
             self.y.host_data[i] = np.matmul(x.host_data[i], self.w.host_data)
+        if self.use_bias:
+            self.y.host_data += self.bias.host_data
         return self.y
 
     def _forward_gpu(self, x: tensor) -> tensor:
@@ -48,6 +54,8 @@ class linear(Module):
         dw.host_data = np.matmul(x.host_data.T, dy.host_data)
         for i in range(x.shape[0]):
             x.gradient.host_data[i] = np.matmul(dy.host_data[i], self.w.host_data.T)
+        if self.use_bias:
+            self.d_bias_call()
         return dx
 
     def _backward_gpu(self, x: tensor, w: tensor, y: tensor) -> tensor:
@@ -57,4 +65,6 @@ class linear(Module):
 
         self.kernel_dx.run()
         self.kernel_dw.run()
+        if self.use_bias:
+            self.d_bias_call_gpu()
         return dx
\ No newline at end of file
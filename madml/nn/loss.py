@@ -7,6 +7,7 @@ from typing import List, Optional
 
 import numpy as np
 
+import vknn
 from madml import tensor
 from .module import Module
 
@@ -76,12 +77,21 @@ class crossentropyloss(_WeightedLoss):
         self.with_logit = with_logit
         self.batchsize = 1.0
         self.p = None
+        # device path: class index targets, per sample losses summed on the device
+        self.kernel = None
+        self.sample_loss = None
+        self.loss_sum = None
+        self.loss_reduce = None
+        self.target_index = None
+        self.target_gpu = None
+        self.class_weight = None
 
     def forward(self, logit: tensor, target: tensor) -> tensor:
         self.batchsize = logit.shape[0]
         self.y = self.register_output_shape([1])
         self.register_forward_arg('logit', logit)
         if not self.with_logit:
+            self.target_index = target
             C = logit.shape[1]
             target = target.onehot(label_count=C)
         self.register_forward_arg('target', target)
@@ -134,6 +144,50 @@ class crossentropyloss(_WeightedLoss):
         self.losses.append((loss, reg))
         return self.y
 
+    def _forward_gpu(self, logit: tensor, target: tensor) -> tensor:
+        # only index targets run on the device, soft targets keep the host path
+        if self.target_index is None:
+            return self._forward_cpu(logit, target)
+        samples = [logit.shape[0]] + list(logit.shape[2:])
+        if self.kernel is None:
+            self.kernel = self.register_kernel(vknn.cross_entropy, 1, self.w is not None,
+                                               -100 if self.ignore_index is None else self.ignore_index)
+            self.sample_loss = tensor([0. for _ in range(int(np.prod(samples)))], samples)
+            self.loss_sum = tensor([0.], [1])
+            self.target_gpu = tensor(np.zeros(samples, dtype=np.int32), samples, dtype=int)
+            self.loss_reduce = self.register_kernel(vknn.reduce, vknn.REDUCE_SUM, [])
+            if self.w is not None:
+                self.class_weight = tensor(np.asarray(self.w, dtype=np.float32), [logit.shape[1]])
+
+        # targets are small, the normaliser of the mean comes from the host copy,
+        # the kernel reads them as int32 class indices
+        t = np.asarray(self.target_index.host_data).reshape(samples).astype(np.int32)
+        self.target_gpu.host_data = t
+        valid = (t >= 0) & (t < logit.shape[1])
+        if self.ignore_index is not None:
+            valid &= t != self.ignore_index
+        weight = np.asarray(self.w, dtype=np.float32)[t[valid]] if self.w is not None else valid[valid]
+        scale = 1. / max(float(np.sum(weight)), 1e-12) if self.reduction == 'mean' else 1.
+
+        weight_gpu = self.class_weight if self.class_weight is not None else self.sample_loss
+        self.kernel.forward(self.sample_loss.device_data, logit.gradient.device_data, logit.device_data,
+                            self.target_gpu.device_data, weight_gpu.device_data, scale)
+        self.kernel.run()
+        self.loss_reduce.forward(self.loss_sum.device_data, self.sample_loss.device_data)
+        self.loss_reduce.run()
+
+        loss = float(self.loss_sum.download()[0]) * scale
+        reg = self.regularize()
+        self.y.host_data = np.asarray([loss + reg], dtype=np.float32)
+        self.losses.append((loss, reg))
+        return self.y
+
+    def _backward_gpu(self, x: tensor, t: tensor) -> tensor:
+        # the fused kernel wrote the gradient during the forward pass
+        if self.target_index is None:
+            return self._backward_cpu(x, t)
+        return x.gradient
+
     def _backward_cpu(self, x: tensor, t: tensor) -> tensor:
         dx = x.gradient
         max_x = np.max(x.host_data, axis=1, keepdims=True)
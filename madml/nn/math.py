@@ -3,100 +3,396 @@ from __future__ import division
 from __future__ import print_function
 from __future__ import unicode_literals
 
+from typing import List, Optional
+
+import numpy as np
+
+import vknn
 from madml import tensor
 from madml import zeros
 from .module import Module
 
-class sigmoid(Module):
-    def __init__(self):
-        super(sigmoid, self).__init__()
+def _unbroadcast(grad: np.ndarray, shape: List[int]) -> np.ndarray:
+    # sums a broadcast-shaped gradient back onto an operand of shape
+    while grad.ndim > len(shape):
+        grad = grad.sum(axis=0)
+    for i, s in enumerate(shape):
+        if s == 1 and grad.shape[i] != 1:
+            grad = grad.sum(axis=i, keepdims=True)
+    return grad.reshape(shape)
+
+class _unary(Module):
+    op = None
+
+    def __init__(self, alpha: float = 0., beta: float = 0.):
+        super(_unary, self).__init__()
+        self.alpha = alpha
+        self.beta = beta
+        self.kernel = None
+        self.kernel_dx = None
 
     def forward(self, x: tensor) -> tensor:
-        self.y = self.register_output_shape(x.shape)      
-        super(sigmoid, self).forward(x)
+        self.y = self.register_output_shape(x.shape)
+        super(_unary, self).forward(x)
         return self.y
 
     def _forward_cpu(self, x: tensor) -> tensor:
-        self.y.host_data = 1. / (1 + np.exp(-(x.host_data)))
+        self.y.host_data = self._np(x.host_data)
         return self.y
 
-    def _backward_cpu(self, x:tensor, y:tensor) -> tensor:
+    def _forward_gpu(self, x: tensor) -> tensor:
+        if self.kernel is None:
+            self.kernel = self.register_kernel(vknn.elementwise, self.op, self.alpha, self.beta, 0)
+        self.kernel.forward(self.y.device_data, x.device_data, x.device_data, x.device_data)
+        self.kernel.run()
+        return self.y
+
+    def _backward_cpu(self, x: tensor, y: tensor) -> tensor:
+        dx, dy = x.gradient, y.gradient
+        dx.host_data = self._np_grad(x.host_data, y.host_data) * dy.host_data
+        return dx
+
+    def _backward_gpu(self, x: tensor, y: tensor) -> tensor:
         dx, dy = x.gradient, y.gradient
-        dx.host_data = y.host_data * (1. - y.host_data) * dy.host_data
+        if self.kernel_dx is None:
+            self.kernel_dx = self.register_kernel(vknn.elementwise_backward, self.op, self.alpha, self.beta)
+        self.kernel_dx.forward(dx.device_data, dx.device_data, x.device_data, x.device_data, dy.device_data)
+        self.kernel_dx.run()
         return dx
 
-class add(Module):
+class _binary(Module):
+    op = None
+
     def __init__(self):
-        super(add, self).__init__()
+        super(_binary, self).__init__()
+        self.kernel = None
+        self.kernel_dx = None
 
     def forward(self, x: tensor, w: tensor) -> tensor:
-        self.y = self.register_output_shape(x.shape)
-        super(add, self).forward(x, w)
+        self.y = self.register_output_shape(list(np.broadcast_shapes(tuple(x.shape), tuple(w.shape))))
+        super(_binary, self).forward(x, w)
         return self.y
 
     def _forward_cpu(self, x: tensor, w: tensor) -> tensor:
-        self.y.host_data = x.host_data + w.host_data
+        self.y.host_data = self._np(x.host_data, w.host_data)
+        return self.y
+
+    def _forward_gpu(self, x: tensor, w: tensor) -> tensor:
+        if self.kernel is None:
+            self.kernel = self.register_kernel(vknn.elementwise, self.op, 0., 0., 0)
+        self.kernel.forward(self.y.device_data, x.device_data, w.device_data, x.device_data)
+        self.kernel.run()
         return self.y
 
     def _backward_cpu(self, x: tensor, w: tensor, y: tensor) -> tensor:
         dx, dw, dy = x.gradient, w.gradient, y.gradient
-        dx.host_data = dy.host_data
-        dw.host_data = dy.host_data
+        ga, gb = self._np_grad(x.host_data, w.host_data, dy.host_data)
+        dx.host_data = _unbroadcast(ga, x.shape)
+        dw.host_data = _unbroadcast(gb, w.shape)
+        return dx
+
+    def _backward_gpu(self, x: tensor, w: tensor, y: tensor) -> tensor:
+        dx, dw, dy = x.gradient, w.gradient, y.gradient
+        if self.kernel_dx is None:
+            self.kernel_dx = self.register_kernel(vknn.elementwise_backward, self.op, 0., 0.)
+        self.kernel_dx.forward(dx.device_data, dw.device_data, x.device_data, w.device_data, dy.device_data)
+        self.kernel_dx.run()
         return dx
 
-class sub(Module):
+class add(_binary):
+    op = vknn.EW_ADD
+
+    def _np(self, a, b):
+        return a + b
+
+    def _np_grad(self, a, b, dy):
+        return dy, dy
+
+class sub(_binary):
+    op = vknn.EW_SUB
+
+    def _np(self, a, b):
+        return a - b
+
+    def _np_grad(self, a, b, dy):
+        return dy, -dy
+
+class mul(_binary):
+    op = vknn.EW_MUL
+
+    def _np(self, a, b):
+        return a * b
+
+    def _np_grad(self, a, b, dy):
+        return dy * b, dy * a
+
+class div(_binary):
+    op = vknn.EW_DIV
+
+    def _np(self, a, b):
+        return a / b
+
+    def _np_grad(self, a, b, dy):
+        return dy / b, -dy * a / (b * b)
+
+class pow(_binary):
+    op = vknn.EW_POW
+
+    def _np(self, a, b):
+        return np.power(a, b)
+
+    def _np_grad(self, a, b, dy):
+        log_a = np.log(np.where(a > 0., a, 1.))
+        return dy * b * np.power(a, b - 1.), np.where(a > 0., dy * np.power(a, b) * log_a, 0.)
+
+class exp(_unary):
+    op = vknn.EW_EXP
+
+    def _np(self, x):
+        return np.exp(x)
+
+    def _np_grad(self, x, y):
+        return y
+
+class log(_unary):
+    op = vknn.EW_LOG
+
+    def _np(self, x):
+        return np.log(x)
+
+    def _np_grad(self, x, y):
+        return 1. / x
+
+class sqrt(_unary):
+    op = vknn.EW_SQRT
+
+    def _np(self, x):
+        return np.sqrt(x)
+
+    def _np_grad(self, x, y):
+        return 0.5 / y
+
+class tanh(_unary):
+    op = vknn.EW_TANH
+
+    def _np(self, x):
+        return np.tanh(x)
+
+    def _np_grad(self, x, y):
+        return 1. - y * y
+
+class sigmoid(_unary):
+    op = vknn.EW_SIGMOID
+
+    def _np(self, x):
+        return 1. / (1. + np.exp(-x))
+
+    def _np_grad(self, x, y):
+        return y * (1. - y)
+
+class gelu(_unary):
+    op = vknn.EW_GELU
+    _k = np.sqrt(2. / np.pi)
+
+    def _np(self, x):
+        return 0.5 * x * (1. + np.tanh(self._k * (x + 0.044715 * x ** 3)))
+
+    def _np_grad(self, x, y):
+        t = np.tanh(self._k * (x + 0.044715 * x ** 3))
+        return 0.5 * (1. + t) + 0.5 * x * (1. - t * t) * self._k * (1. + 3. * 0.044715 * x * x)
+
+class clamp(_unary):
+    op = vknn.EW_CLAMP
+
+    def __init__(self, min_val: float, max_val: float):
+        super(clamp, self).__init__(min_val, max_val)
+
+    def _np(self, x):
+        return np.clip(x, self.alpha, self.beta)
+
+    def _np_grad(self, x, y):
+        return ((x >= self.alpha) & (x <= self.beta)).astype(x.dtype)
+
+class where(Module):
     def __init__(self):
-        super(sub, self).__init__()
+        super(where, self).__init__()
+        self.kernel = self.register_kernel(vknn.elementwise, vknn.EW_WHERE, 0., 0., 0)
+        self.kernel_dx = None
+        self.kernel_dw = None
+        self.reduce_dx = None
+        self.reduce_dw = None
 
-    def forward(self, x: tensor, w: tensor) -> tensor:
-        self.y = self.register_output_shape(x.shape)      
-        super(add, self).forward(x, w)
+    def forward(self, cond: tensor, x: tensor, w: tensor) -> tensor:
+        shape = np.broadcast_shapes(tuple(cond.shape), tuple(x.shape), tuple(w.shape))
+        self.y = self.register_output_shape(list(shape))
+        super(where, self).forward(cond, x, w)
         return self.y
 
-    def _forward_cpu(self, x: tensor, w: tensor) -> tensor:
-        self.y.host_data = x.host_data - w.host_data
+    def _forward_cpu(self, cond: tensor, x: tensor, w: tensor) -> tensor:
+        self.y.host_data = np.where(cond.host_data != 0, x.host_data, w.host_data)
         return self.y
 
-    def _backward_cpu(self, x: tensor, w: tensor, y: tensor) -> tensor:
+    def _forward_gpu(self, cond: tensor, x: tensor, w: tensor) -> tensor:
+        self.kernel.forward(self.y.device_data, cond.device_data, x.device_data, w.device_data)
+        self.kernel.run()
+        return self.y
+
+    def _backward_cpu(self, cond: tensor, x: tensor, w: tensor, y: tensor) -> tensor:
         dx, dw, dy = x.gradient, w.gradient, y.gradient
-        dx.host_data = dy.host_data
-        dw.host_data = -dy.host_data
+        mask = np.broadcast_to(cond.host_data != 0, dy.shape)
+        dx.host_data = _unbroadcast(np.where(mask, dy.host_data, 0.), x.shape)
+        dw.host_data = _unbroadcast(np.where(mask, 0., dy.host_data), w.shape)
         return dx
 
-class mul(Module):
-    def __init__(self):
-        super(mul, self).__init__()
+    def _backward_gpu(self, cond: tensor, x: tensor, w: tensor, y: tensor) -> tensor:
+        # the gradients are where ops themselves, summed over broadcast axes
+        dx, dw, dy = x.gradient, w.gradient, y.gradient
+        if self.kernel_dx is None:
+            self.zero = zeros([1])
+            self.kernel_dx = self.register_kernel(vknn.elementwise, vknn.EW_WHERE, 0., 0., 0)
+            self.kernel_dw = self.register_kernel(vknn.elementwise, vknn.EW_WHERE, 0., 0., 0)
+            self.full_dx = dx if x.shape == y.shape else zeros(y.shape)
+            self.full_dw = dw if w.shape == y.shape else zeros(y.shape)
+            lead = len(y.shape)
+            axes = lambda s: [i for i in range(lead) if i < lead - len(s) or s[i - lead + len(s)] == 1]
+            if self.full_dx is not dx:
+                self.reduce_dx = self.register_kernel(vknn.reduce, vknn.REDUCE_SUM, axes(x.shape))
+            if self.full_dw is not dw:
+                self.reduce_dw = self.register_kernel(vknn.reduce, vknn.REDUCE_SUM, axes(w.shape))
+        self.kernel_dx.forward(self.full_dx.device_data, cond.device_data, dy.device_data, self.zero.device_data)
+        self.kernel_dw.forward(self.full_dw.device_data, cond.device_data, self.zero.device_data, dy.device_data)
+        self.kernel_dx.run()
+        self.kernel_dw.run()
+        if self.reduce_dx is not None:
+            self.reduce_dx.forward(dx.device_data, self.full_dx.device_data)
+            self.reduce_dx.run()
+        if self.reduce_dw is not None:
+            self.reduce_dw.forward(dw.device_data, self.full_dw.device_data)
+            self.reduce_dw.run()
+        return dx
 
-    def forward(self, x: tensor, w: tensor) -> tensor:
-        self.y = self.register_output_shape(x.shape)     
-        super(mul, self).forward(x, w)
+class fused(Module):
+    # A chain of pointwise ops as one kernel, e.g. fused('relu(x * a + b) * mask', ['x', 'a', 'b', 'mask']).
+    # Forward only, the gradient of a fused chain is left to the unfused modules.
+    _np_funcs = {
+        'relu': lambda x: np.maximum(x, 0.),
+        'sigmoid': lambda x: 1. / (1. + np.exp(-x)),
+        'tanh': np.tanh,
+        'gelu': lambda x: 0.5 * x * (1. + np.tanh(0.7978845608 * (x + 0.044715 * x ** 3))),
+        'exp': np.exp,
+        'log': np.log,
+        'sqrt': np.sqrt,
+        'abs': np.abs,
+        'pow': np.power,
+        'min': np.minimum,
+        'max': np.maximum,
+        'clamp': np.clip,
+        'where': lambda c, x, y: np.where(c != 0, x, y),
+    }
+
+    def __init__(self, expr: str, inputs: List[str]):
+        super(fused, self).__init__()
+        self.expr = expr
+        self.inputs = list(inputs)
+        self.kernel = self.register_kernel(vknn.fused_elementwise, expr, self.inputs)
+        self._code = compile(expr, '<fused>', 'eval')
+
+    def forward(self, *xs: tensor) -> tensor:
+        shape = np.broadcast_shapes(*[tuple(x.shape) for x in xs])
+        self.y = self.register_output_shape(list(shape))
+        super(fused, self).forward(*xs)
         return self.y
 
-    def _forward_cpu(self, x: tensor, w: tensor) -> tensor:
-        self.y.host_data = x.host_data * w.host_data
+    def _forward_cpu(self, *xs: tensor) -> tensor:
+        env = dict(self._np_funcs)
+        env.update({name: x.host_data for name, x in zip(self.inputs, xs)})
+        out = eval(self._code, {'__builtins__': {}}, env)
+        self.y.host_data = np.broadcast_to(out, self.y.shape).astype(np.float32)
         return self.y
 
-    def _backward_cpu(self, x: tensor, w: tensor, y: tensor) -> tensor:
-        dx, dw, dy = x.gradient, w.gradient, y.gradient
-        dx.host_data = dy.host_data / w.host_data
-        dw.host_data = dy.host_data / x.host_data
-        return dx
+    def _forward_gpu(self, *xs: tensor) -> tensor:
+        self.kernel.forward(self.y.device_data, [x.device_data for x in xs])
+        self.kernel.run()
+        return self.y
 
-class div(Module):
-    def __init__(self):
-        super(div, self).__init__()
+class reduce(Module):
+    __constants__ = ['op', 'axes', 'keepdims']
+    _ops = {
+        'sum': vknn.REDUCE_SUM,
+        'mean': vknn.REDUCE_MEAN,
+        'max': vknn.REDUCE_MAX,
+        'min': vknn.REDUCE_MIN,
+        'argmax': vknn.REDUCE_ARGMAX,
+        'l2': vknn.REDUCE_L2,
+        'logsumexp': vknn.REDUCE_LOGSUMEXP,
+    }
 
-    def forward(self, x: tensor, w: tensor) -> tensor:
-        self.y = self.register_output_shape(x.shape)      
-        super(div, self).forward(x, w)
+    def __init__(self, op: str, axes: Optional[List[int]] = None, keepdims: bool = False):
+        super(reduce, self).__init__()
+        if op not in self._ops:
+            raise ValueError("op must be one of {}, but got op='{}'".format(list(self._ops), op))
+        if op == 'argmax' and (axes is None or len(axes) != 1):
+            raise ValueError('argmax reduces over a single axis')
+        self.op = op
+        self.axes = [] if axes is None else list(axes)
+        self.keepdims = keepdims
+        self.kernel = self.register_kernel(vknn.reduce, self._ops[op], self.axes)
+
+    def _output_shape(self, shape: List[int]) -> List[int]:
+        axes = [a % len(shape) for a in self.axes] if self.axes else list(range(len(shape)))
+        if self.keepdims:
+            return [1 if i in axes else s for i, s in enumerate(shape)]
+        out = [s for i, s in enumerate(shape) if i not in axes]
+        return out if out else [1]
+
+    def forward(self, x: tensor) -> tensor:
+        if self.y is None:
+            shape = self._output_shape(x.shape)
+            if self.op == 'argmax':
+                self.y = self.outputs['y'] = zeros(shape, dtype=int)
+            else:
+                self.y = self.register_output_shape(shape)
+        super(reduce, self).forward(x)
         return self.y
 
-    def _forward_cpu(self, x: tensor, w: tensor) -> tensor:
-        self.y.host_data = x.host_data / w.host_data
+    def _forward_cpu(self, x: tensor) -> tensor:
+        axis = tuple(self.axes) if self.axes else None
+        data = x.host_data
+        if self.op == 'argmax':
+            out = np.argmax(data, axis=self.axes[0]).astype(np.int32)
+        elif self.op == 'l2':
+            out = np.sqrt(np.sum(data * data, axis=axis))
+        elif self.op == 'logsumexp':
+            m = np.max(data, axis=axis, keepdims=True)
+            out = np.log(np.sum(np.exp(data - m), axis=axis)) + np.squeeze(m, axis=axis)
+        else:
+            out = getattr(np, self.op)(data, axis=axis)
+        self.y.host_data = np.reshape(out, self.y.shape)
         return self.y
 
-    def _backward_cpu(self, x: tensor, w: tensor, y: tensor) -> tensor:
-        dx, dw, dy = x.gradient, w.gradient, y.gradient
-        dx.host_data = dy.host_data * w.host_data
-        dw.host_data = x.host_data / dy.host_data
-        return dx
\ No newline at end of file
+    def _forward_gpu(self, x: tensor) -> tensor:
+        self.kernel.forward(self.y.device_data, x.device_data)
+        self.kernel.run()
+        return self.y
+
+    def _backward_cpu(self, x: tensor, y: tensor) -> tensor:
+        dx, dy = x.gradient, y.gradient
+        axes = self.axes if self.axes else list(range(len(x.shape)))
+        keep = [1 if i in [a % len(x.shape) for a in axes] else s for i, s in enumerate(x.shape)]
+        g = np.reshape(dy.host_data, keep)
+        out = np.reshape(y.host_data, keep)
+        data = x.host_data
+        if self.op == 'sum':
+            dx.host_data = np.broadcast_to(g, x.shape).copy()
+        elif self.op == 'mean':
+            dx.host_data = np.broadcast_to(g, x.shape) * (np.prod(keep) / np.prod(x.shape))
+        elif self.op in ('max', 'min'):
+            dx.host_data = (data == out) * g
+        elif self.op == 'l2':
+            dx.host_data = data / np.maximum(out, 1e-12) * g
+        elif self.op == 'logsumexp':
+            dx.host_data = np.exp(data - out) * g
+        elif self.op == 'argmax':
+            # indices are piecewise constant in x
+            dx.host_data = np.zeros(x.shape, dtype=np.float32)
+        return dx
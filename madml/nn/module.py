@@ -38,10 +38,19 @@ class Parameter(tensor):
 
     def __init__(self, init_fn, shape: List[int], shared_devices: bool = False, bias: bool = False,
                  dtype=float) -> None:
-        super(Parameter, self).__init__(init_fn(shape).host_data, shape, dtype=dtype)
+        init = init_fn(shape)
+        if dtype == float:
+            # adopt the storage of the initial value, so a device fill never
+            # goes through the host
+            self.__dict__.update(init.__dict__)
+            self.id = id(self)
+        else:
+            super(Parameter, self).__init__(init.host_data, shape, dtype=dtype)
         self.optimizer_stuff = []
         self.shared_devices = shared_devices
         self.bias = bias
+        # bumped by the optimizer after every update so kernels can cache derived weights
+        self.version = 0
 
     def zero_grad(self, ) -> None:
         for i in range(self.size):
@@ -66,6 +75,7 @@ class Module(object):
         self.w_registry = []
         self.kernel_registry = []
         self.module_registry = []
+        self.bias_reduce = None
         manager.register_module(self)        
           
     def forward(self, *args, **kwargs) -> tensor:
@@ -100,6 +110,13 @@ class Module(object):
         dy = self.y.gradient
         self.bias.gradient.host_data = np.sum(dy.host_data, axis=0)
 
+    def d_bias_call_gpu(self, axes: Optional[List[int]] = None):
+        # sums of dy over every axis but the channel one without leaving the device
+        if self.bias_reduce is None:
+            self.bias_reduce = vknn.reduce(vknn.REDUCE_SUM, [0] if axes is None else axes)
+        self.bias_reduce.forward(self.bias.gradient.device_data, self.y.gradient.device_data)
+        self.bias_reduce.run()
+
     def parameters(self) -> List[Parameter]:
         parameters = self.parameter_cache
         for k, v in self.__dict__.items():
@@ -113,6 +130,8 @@ class Module(object):
 
     def to(self, device_id: int):
         self.device_id = device_id
+        for p in self.parameter_cache:
+            p.to(device_id)
         for m in self.module_registry:
             m.to(device_id)
         return self
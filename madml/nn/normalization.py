@@ -5,8 +5,9 @@ from __future__ import unicode_literals
 
 import numpy as np
 
+import vknn
 from madml import tensor
-from madml.init import zeros
+from madml.init import zeros, ones
 from .module import Module
 
 def _dim_fix(arr, arg_arr, pi):
@@ -40,64 +41,122 @@ class _NormBase(Module):
         self.momentum = momentum
         self.affine = affine
         self.track_running_stats = track_running_stats
+        self.training = True
         if self.affine:
-            self.w = self.register_weight(zeros, [num_features])
+            self.w = self.register_weight(ones, [num_features])
             self.bias = self.register_bias(True, zeros, [num_features])
         if self.track_running_stats:
-            self.running_mean = self.register_weight(zeros, [num_features])
-            self.running_var = self.register_weight(zeros, [num_features])
+            # running statistics are buffers, not parameters the optimizer updates
+            self.running_mean = zeros([num_features])
+            self.running_var = ones([num_features])
             self.num_batches_tracked = 0
+        # mean and 1 / std per statistics set, kept on the device for the backward pass
+        self.stats = None
+        self.kernel = None
+        self.kernel_dx = None
 
-# mu = np.mean(X, axis=0)
-# var = np.var(X, axis=0)
+    def train(self, mode: bool = True):
+        self.training = mode
+        return self
 
-# X_norm = (X - mu) / np.sqrt(var + 1e-8)
-# out = gamma * X_norm + beta
+    def eval(self):
+        return self.train(False)
 
-# cache = (X, X_norm, mu, var, gamma, beta)
-
-# running_mean = exp_running_avg(running_mean, mu, momentum)
-# running_var = exp_running_avg(running_var, var, momentum)
+    def _affine(self, x: tensor):
+        if self.affine:
+            return self.w, self.bias
+        return x, x
 
 class BatchNorm(_NormBase):
     def __init__(self, num_features: int, eps: float = 1e-5, momentum: float = 0.1, affine: bool = True,
                  track_running_stat: bool = True):
         super(BatchNorm, self).__init__(num_features, eps, momentum, affine, track_running_stat)
+        self.kernel_eval = None
 
     def forward(self, x: tensor) -> tensor:
-        self.y = self.register_output_shape(x.shape)      
+        self.y = self.register_output_shape(x.shape)
         super(BatchNorm, self).forward(x)
         return self.y
 
-    def _forward_cpu(self, x: tensor) -> tensor:
-        mu = np.mean(x.host_data, axis=0)
-        var = np.var(x.host_data, axis=0)
-        x_norm = (x.host_data - mu) / np.sqrt(var + self.esp)
+    def _axes(self, x: tensor):
+        return tuple(i for i in range(len(x.shape)) if i != 1)
 
-        self.running_mean.host_data = self.momentum * self.running_mean.host_data + (1. - self.momentum) * mu
-        self.running_var.host_data = self.momentum * self.running_var.host_data + (1. - self.momentum) * var
-        self.num_batches.tracked += 1
-        self.y.host_data = self.w.host_data * x_norm
+    def _bshape(self, x: tensor):
+        return [1, x.shape[1]] + [1 for _ in x.shape[2:]]
 
+    def _forward_cpu(self, x: tensor) -> tensor:
+        data = x.host_data
+        shape = self._bshape(x)
+        gamma = self.w.host_data.reshape(shape) if self.affine else 1.
+        beta = self.bias.host_data.reshape(shape) if self.affine else 0.
+        if not self.training and self.track_running_stats:
+            scale = gamma / np.sqrt(self.running_var.host_data.reshape(shape) + self.eps)
+            self.y.host_data = data * scale + (beta - self.running_mean.host_data.reshape(shape) * scale)
+            return self.y
+
+        mu = np.mean(data, axis=self._axes(x))
+        var = np.var(data, axis=self._axes(x))
+        x_norm = (data - mu.reshape(shape)) / np.sqrt(var.reshape(shape) + self.eps)
+        if self.track_running_stats:
+            n = data.size // x.shape[1]
+            self.running_mean.host_data = (1. - self.momentum) * self.running_mean.host_data + self.momentum * mu
+            self.running_var.host_data = (1. - self.momentum) * self.running_var.host_data + \
+                self.momentum * var * n / max(n - 1, 1)
+            self.num_batches_tracked += 1
+        self.y.host_data = gamma * x_norm + beta
         return self.y
 
-    def _backward_cpu(self, x: tensor, y: tensor) -> tensor:
-        dx, dy = x.gradient, y.gradient 
-        mu = np.mean(x.host_data, axis=0)
-        var = np.var(x.host_data, axis=0)
-        x_norm = (x.host_data - mu) / np.sqrt(var + self.esp)
+    def _forward_gpu(self, x: tensor) -> tensor:
+        gamma, beta = self._affine(x)
+        if not self.training and self.track_running_stats:
+            if self.kernel_eval is None:
+                self.kernel_eval = self.register_kernel(vknn.batch_norm, self.eps, self.momentum, self.affine, True,
+                                                        False)
+            self.kernel_eval.forward(self.y.device_data, x.device_data, gamma.device_data, beta.device_data,
+                                     self.running_mean.device_data, self.running_var.device_data, x.device_data)
+            self.kernel_eval.run()
+            return self.y
 
-        N, C = x.shape[:2]
-        x_mu = x.host_data - mu
+        if self.kernel is None:
+            self.kernel = self.register_kernel(vknn.batch_norm, self.eps, self.momentum, self.affine,
+                                               self.track_running_stats, True)
+            self.kernel_dx = self.register_kernel(vknn.norm_backward, vknn.NORM_BATCH, 0, self.affine)
+            self.stats = zeros([x.shape[1], 2])
+        running_mean = self.running_mean if self.track_running_stats else x
+        running_var = self.running_var if self.track_running_stats else x
+        self.kernel.forward(self.y.device_data, x.device_data, gamma.device_data, beta.device_data,
+                            running_mean.device_data, running_var.device_data, self.stats.device_data)
+        self.kernel.run()
+        if self.track_running_stats:
+            self.num_batches_tracked += 1
+        return self.y
 
-        std_inv = 1. / np.sqrt(var + self.eps)
-        dx_norm = dx.host_data * self.w.host_data
-        dvar = np.sum(dx_norm * x_mu, axis=0) * -.5 * std_inv ** 3
-        dmu = np.sum(dx_norm * -std_inv, axis=0) + dvar * np.mean(-2. * x_mu, axis=0)
+    def _backward_cpu(self, x: tensor, y: tensor) -> tensor:
+        dx, dy = x.gradient, y.gradient
+        axes = self._axes(x)
+        shape = self._bshape(x)
+        n = x.host_data.size // x.shape[1]
+        mu = np.mean(x.host_data, axis=axes).reshape(shape)
+        std_inv = 1. / np.sqrt(np.var(x.host_data, axis=axes).reshape(shape) + self.eps)
+        x_norm = (x.host_data - mu) * std_inv
+        gamma = self.w.host_data.reshape(shape) if self.affine else 1.
 
-        dx.host_data = (dx_norm * std_inv) + (dvar * 2 * x_mu / N) + (dmu / N)
-        self.w.gradient.host_data = np.sum(dy.host_data * x_norm, axis=0)
+        g = dy.host_data * gamma
+        dx.host_data = std_inv * (g - np.sum(g, axis=axes, keepdims=True) / n -
+                                  x_norm * np.sum(g * x_norm, axis=axes, keepdims=True) / n)
+        if self.affine:
+            self.w.gradient.host_data = np.sum(dy.host_data * x_norm, axis=axes)
+            self.bias.gradient.host_data = np.sum(dy.host_data, axis=axes)
+        return dx
 
+    def _backward_gpu(self, x: tensor, y: tensor) -> tensor:
+        dx, dy = x.gradient, y.gradient
+        gamma, _ = self._affine(x)
+        dgamma = self.w.gradient if self.affine else dx
+        dbeta = self.bias.gradient if self.affine else dx
+        self.kernel_dx.forward(dx.device_data, dgamma.device_data, dbeta.device_data, x.device_data,
+                               dy.device_data, gamma.device_data, self.stats.device_data)
+        self.kernel_dx.run()
         return dx
 
 class BatchNorm1d(BatchNorm):
@@ -115,6 +174,137 @@ class BatchNorm3d(BatchNorm):
                  track_running_stats: bool = True):
         super(BatchNorm3d, self).__init__(num_features, eps, momentum, affine, track_running_stats)
 
+class GroupNorm(_NormBase):
+    __constants__ = ['num_groups', 'num_channels', 'eps', 'affine']
+
+    def __init__(self, num_groups: int, num_channels: int, eps: float = 1e-5, affine: bool = True) -> None:
+        if num_channels % num_groups != 0:
+            raise ValueError('num_channels must be divisible by num_groups')
+        super(GroupNorm, self).__init__(num_channels, eps, 0., affine, False)
+        self.num_groups = num_groups
+        self.num_channels = num_channels
+
+    def forward(self, x: tensor) -> tensor:
+        self.y = self.register_output_shape(x.shape)
+        super(GroupNorm, self).forward(x)
+        return self.y
+
+    def _grouped(self, data: np.ndarray) -> np.ndarray:
+        return data.reshape([data.shape[0], self.num_groups, -1])
+
+    def _affine_shape(self, x: tensor):
+        return [1, x.shape[1]] + [1 for _ in x.shape[2:]]
+
+    def _forward_cpu(self, x: tensor) -> tensor:
+        xg = self._grouped(x.host_data)
+        mu = np.mean(xg, axis=2, keepdims=True)
+        var = np.var(xg, axis=2, keepdims=True)
+        x_norm = ((xg - mu) / np.sqrt(var + self.eps)).reshape(x.shape)
+        if self.affine:
+            shape = self._affine_shape(x)
+            x_norm = x_norm * self.w.host_data.reshape(shape) + self.bias.host_data.reshape(shape)
+        self.y.host_data = x_norm
+        return self.y
+
+    def _forward_gpu(self, x: tensor) -> tensor:
+        if self.kernel is None:
+            self.kernel = self.register_kernel(vknn.group_norm, self.num_groups, self.eps, self.affine)
+            self.kernel_dx = self.register_kernel(vknn.norm_backward, vknn.NORM_GROUP, self.num_groups, self.affine)
+            self.stats = zeros([x.shape[0] * self.num_groups, 2])
+        gamma, beta = self._affine(x)
+        self.kernel.forward(self.y.device_data, x.device_data, gamma.device_data, beta.device_data,
+                            self.stats.device_data)
+        self.kernel.run()
+        return self.y
+
+    def _backward_cpu(self, x: tensor, y: tensor) -> tensor:
+        dx, dy = x.gradient, y.gradient
+        xg = self._grouped(x.host_data)
+        mu = np.mean(xg, axis=2, keepdims=True)
+        std_inv = 1. / np.sqrt(np.var(xg, axis=2, keepdims=True) + self.eps)
+        x_norm = (xg - mu) * std_inv
+        g = dy.host_data
+        if self.affine:
+            g = g * self.w.host_data.reshape(self._affine_shape(x))
+        g = self._grouped(g)
+        n = xg.shape[2]
+        dx.host_data = (std_inv * (g - np.sum(g, axis=2, keepdims=True) / n -
+                                   x_norm * np.sum(g * x_norm, axis=2, keepdims=True) / n)).reshape(x.shape)
+        if self.affine:
+            axes = tuple(i for i in range(len(x.shape)) if i != 1)
+            self.w.gradient.host_data = np.sum(dy.host_data * x_norm.reshape(x.shape), axis=axes)
+            self.bias.gradient.host_data = np.sum(dy.host_data, axis=axes)
+        return dx
+
+    def _backward_gpu(self, x: tensor, y: tensor) -> tensor:
+        dx, dy = x.gradient, y.gradient
+        gamma, _ = self._affine(x)
+        dgamma = self.w.gradient if self.affine else dx
+        dbeta = self.bias.gradient if self.affine else dx
+        self.kernel_dx.forward(dx.device_data, dgamma.device_data, dbeta.device_data, x.device_data,
+                               dy.device_data, gamma.device_data, self.stats.device_data)
+        self.kernel_dx.run()
+        return dx
+
+class LayerNorm(_NormBase):
+    __constants__ = ['normalized_shape', 'eps', 'elementwise_affine']
+
+    def __init__(self, normalized_shape, eps: float = 1e-5, elementwise_affine: bool = True) -> None:
+        self.normalized_shape = [normalized_shape] if isinstance(normalized_shape, int) else list(normalized_shape)
+        self.normalized_size = int(np.prod(self.normalized_shape))
+        super(LayerNorm, self).__init__(self.normalized_size, eps, 0., elementwise_affine, False)
+
+    def forward(self, x: tensor) -> tensor:
+        self.y = self.register_output_shape(x.shape)
+        super(LayerNorm, self).forward(x)
+        return self.y
+
+    def _forward_cpu(self, x: tensor) -> tensor:
+        rows = x.host_data.reshape([-1, self.normalized_size])
+        mu = np.mean(rows, axis=1, keepdims=True)
+        x_norm = (rows - mu) / np.sqrt(np.var(rows, axis=1, keepdims=True) + self.eps)
+        if self.affine:
+            x_norm = x_norm * self.w.host_data + self.bias.host_data
+        self.y.host_data = x_norm.reshape(x.shape)
+        return self.y
+
+    def _forward_gpu(self, x: tensor) -> tensor:
+        if self.kernel is None:
+            self.kernel = self.register_kernel(vknn.layer_norm, self.normalized_size, self.eps, self.affine)
+            self.kernel_dx = self.register_kernel(vknn.norm_backward, vknn.NORM_LAYER, self.normalized_size,
+                                                  self.affine)
+            self.stats = zeros([int(np.prod(x.shape)) // self.normalized_size, 2])
+        gamma, beta = self._affine(x)
+        self.kernel.forward(self.y.device_data, x.device_data, gamma.device_data, beta.device_data,
+                            self.stats.device_data)
+        self.kernel.run()
+        return self.y
+
+    def _backward_cpu(self, x: tensor, y: tensor) -> tensor:
+        dx, dy = x.gradient, y.gradient
+        rows = x.host_data.reshape([-1, self.normalized_size])
+        dys = dy.host_data.reshape(rows.shape)
+        std_inv = 1. / np.sqrt(np.var(rows, axis=1, keepdims=True) + self.eps)
+        x_norm = (rows - np.mean(rows, axis=1, keepdims=True)) * std_inv
+        g = dys * self.w.host_data if self.affine else dys
+        n = self.normalized_size
+        dx.host_data = (std_inv * (g - np.sum(g, axis=1, keepdims=True) / n -
+                                   x_norm * np.sum(g * x_norm, axis=1, keepdims=True) / n)).reshape(x.shape)
+        if self.affine:
+            self.w.gradient.host_data = np.sum(dys * x_norm, axis=0)
+            self.bias.gradient.host_data = np.sum(dys, axis=0)
+        return dx
+
+    def _backward_gpu(self, x: tensor, y: tensor) -> tensor:
+        dx, dy = x.gradient, y.gradient
+        gamma, _ = self._affine(x)
+        dgamma = self.w.gradient if self.affine else dx
+        dbeta = self.bias.gradient if self.affine else dx
+        self.kernel_dx.forward(dx.device_data, dgamma.device_data, dbeta.device_data, x.device_data,
+                               dy.device_data, gamma.device_data, self.stats.device_data)
+        self.kernel_dx.run()
+        return dx
+
 class InstanceNorm(_NormBase):
     def __init__(self, num_features: int, eps: float = 1e-5, momentum: float = 0.1, affine: bool = False,
                  track_running_stats: bool = False) -> None:
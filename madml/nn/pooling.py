@@ -10,54 +10,48 @@ import numpy as np
 import vknn
 from madml import tensor
 from .module import Module
-from .transform import vol2col
 
 MAX_DIMS = 3
 
 def _dim_fix(arr, arg_arr, pi):
-    def parse(x):
-        return [x for _ in range(pi)] if isinstance(x, int) else [x[t] for t in range(pi)]
-
-    if isinstance(arg_arr, int):
-        arg_arr = parse(arg_arr)
-    j = 0
-    for i in range(len(arg_arr) - 1, len(arr)):
-        arr[i] = arg_arr[j]
-        j += 1
+    # the last pi entries of arr take arg_arr, an int applying to every pooled axis
+    arg_arr = [arg_arr for _ in range(pi)] if isinstance(arg_arr, int) else list(arg_arr)[-pi:]
+    arr[MAX_DIMS - pi:] = arg_arr
     return arr
 
-class _MaxPoolNd(Module):
+class _PoolNd(Module):
     __constants__ = ['kernel_size', 'stride', 'padding', 'dilation', 'return_indices', 'ceil_mode']
 
     return_indices: bool
     ceil_mode: bool
 
-    def __init__(self, dims, kernel_size: Union[int, List[int]], stride: Union[int, List[int]] = None,
+    def __init__(self, dims, mode, kernel_size: Union[int, List[int]], stride: Union[int, List[int]] = None,
                  padding: Union[int, List[int]] = 0, dilation: Union[int, List[int]] = 1, return_indices: bool = False,
-                 ceil_mode: bool = False) -> None:
-        super(_MaxPoolNd, self).__init__()
+                 ceil_mode: bool = False, count_include_pad: bool = True) -> None:
+        super(_PoolNd, self).__init__()
         self.use_gpu = True
         self.dims = dims
+        self.mode = mode
         self.kernel_size = _dim_fix([1 for _ in range(MAX_DIMS)], kernel_size, dims)
-        self.stride = _dim_fix([1 for _ in range(MAX_DIMS)], stride, dims)
+        self.stride = _dim_fix([1 for _ in range(MAX_DIMS)], kernel_size if stride is None else stride, dims)
         self.padding = _dim_fix([0 for _ in range(MAX_DIMS)], padding, dims)
         self.dilation = _dim_fix([1 for _ in range(MAX_DIMS)], dilation, dims)
         self.return_indices = return_indices
         self.ceil_mode = ceil_mode
-        self.channel_offset = 1
+        self.count_include_pad = count_include_pad
         self._col = []
         self._vol = []
         self.batch_size = 0
         self.in_channels = 0
-        self.col = None
-        self.vol_col = None
-        self.pool_kernel_y = None
-        self.pool_kernel_dcol = None
+        self.kernel = None
+        self.kernel_dx = None
+        # offset of every maximum within its input plane, written by max pooling
         self.max_idx = None
+        self.tap_idx = None
         self.output_shape = []
 
     def forward(self, x: tensor) -> tensor:
-        if self.vol_col is None:
+        if self.y is None:
             self.batch_size = x.shape[0]
             self.in_channels = x.shape[1]
             self._col = [1 for _ in range(MAX_DIMS)]
@@ -67,68 +61,89 @@ class _MaxPoolNd(Module):
                     (x.shape[-i] + 2 * self.padding[-i] - self.dilation[-i] * (self.kernel_size[-i] - 1) - 1) //
                     self.stride[-i]) + 1
                 self._vol[-i] = x.shape[-i]
-                self.channel_offset *= self.kernel_size[i]
-            self.output_shape = [self._col[i] for i in range(-1, -(self.dims + 1), -1)]
+            self.output_shape = self._col[MAX_DIMS - self.dims:]
             self.y = self.register_output_shape([self.batch_size, self.in_channels, *self.output_shape])
-
-            out_size = np.prod(self.output_shape)
-            max_idx_size = self.in_channels * self.batch_size * out_size
-            self.max_idx = tensor([0 for _ in range(max_idx_size)], [self.in_channels * self.batch_size, out_size], dtype=int)
-  
-            self.pool_kernel_y = self.register_kernel(vknn.max_reduce,  False)
-            self.pool_kernel_dcol = self.register_kernel(vknn.max_reduce, True)
-
-            self.vol_col = self.register_module(vol2col, self.batch_size, self.in_channels, self._vol, self._col,
-                                                self.kernel_size, self.stride, self.padding, self.dilation)
-        self.col = self.vol_col.forward(x)
-        self.col.reshape([self.in_channels * self.batch_size, self.channel_offset, -1])
-        self.y.reshape([self.in_channels * self.batch_size, -1])
-
-        super(_MaxPoolNd, self).forward(x)
-        self.y.reshape([self.batch_size, self.in_channels, *self.output_shape])
+            if self.mode == vknn.POOL_MAX:
+                self.max_idx = tensor(np.zeros(self.y.shape, dtype=np.int32), self.y.shape, dtype=int)
+        super(_PoolNd, self).forward(x)
         return self.y
 
+    def _params(self):
+        return [self.batch_size, self.in_channels, *self.kernel_size, *self.padding, *self.stride, *self.dilation,
+                *self._col, *self._vol]
+
+    def _windows(self, data: np.ndarray, fill: float):
+        # one strided [N, C, D, H, W] view of the padded input per tap, in tap order
+        x = data.reshape([self.batch_size, self.in_channels, *self._vol])
+        xp = np.pad(x, [(0, 0), (0, 0)] + [(p, p) for p in self.padding], constant_values=fill)
+        taps = []
+        for kd in range(self.kernel_size[0]):
+            for kh in range(self.kernel_size[1]):
+                for kw in range(self.kernel_size[2]):
+                    taps.append(tuple(slice(k * d, k * d + (c - 1) * s + 1, s) for k, d, c, s in
+                                      zip((kd, kh, kw), self.dilation, self._col, self.stride)))
+        return xp, taps
+
+    def _divisor(self):
+        if self.count_include_pad:
+            return float(np.prod(self.kernel_size))
+        ones, taps = self._windows(np.ones([self.batch_size, self.in_channels, *self._vol], np.float32), 0.)
+        return np.maximum(sum(ones[(Ellipsis, *t)] for t in taps), 1.)
+
     def _forward_cpu(self, x: tensor) -> tensor:
-        y = self.y.host_data      
-        for i in range(self.in_channels * self.batch_size):
-            tmp = self.col.host_data[i]
-            m_idx = np.argmax(tmp, axis=0)
-            self.max_idx.host_data[i] = m_idx
-            tmp = self.col.host_data[i][m_idx, range(m_idx.size)]
-            y[i] = tmp
-        self.y.host_data = y
+        fill = -np.inf if self.mode == vknn.POOL_MAX else 0.
+        xp, taps = self._windows(x.host_data, fill)
+        stack = np.stack([xp[(Ellipsis, *t)] for t in taps])
+        if self.mode == vknn.POOL_MAX:
+            self.tap_idx = np.argmax(stack, axis=0)
+            y = np.take_along_axis(stack, self.tap_idx[None], axis=0)[0]
+        else:
+            y = np.sum(stack, axis=0) / self._divisor()
+        self.y.host_data = y.reshape(self.y.shape).astype(np.float32)
         return self.y
 
     def _forward_gpu(self, x: tensor) -> tensor:
-        np_col = self.col.host_data
-        self.pool_kernel_y.forward(self.y.device_data, self.col.device_data, self.max_idx.device_data)
-        self.pool_kernel_y.run()
+        if self.kernel is None:
+            self.kernel = self.register_kernel(vknn.pool_forward, self.mode, self._params(), self.count_include_pad)
+            self.kernel_dx = self.register_kernel(vknn.pool_backward, self.mode, self._params(),
+                                                  self.count_include_pad)
+        idx = self.max_idx if self.mode == vknn.POOL_MAX else self.y
+        self.kernel.forward(self.y.device_data, x.device_data, idx.device_data)
+        self.kernel.run()
         return self.y
 
     def _backward_cpu(self, x: tensor, y: tensor) -> tensor:
         dx, dy = x.gradient, y.gradient
-        dcol = self.col.gradient
-        dcol.reshape([self.in_channels * self.batch_size, self.channel_offset, -1])
-        dy_col = dy.host_data
-        dy_col = dy_col.reshape([self.in_channels * self.batch_size, -1])
-        d_col = dcol.host_data
-        for i in range(self.in_channels * self.batch_size):
-            m_idx = self.max_idx.host_data[i]
-            d_col[i][m_idx, range(m_idx.size)] = dy_col[i]
-        dcol.host_data = d_col
-        _dx = self.vol_col.backward()
+        g = dy.host_data.reshape([self.batch_size, self.in_channels, *self._col])
+        dxp, taps = self._windows(np.zeros(x.shape, np.float32), 0.)
+        if self.mode != vknn.POOL_MAX:
+            g = g / self._divisor()
+        for i, t in enumerate(taps):
+            dxp[(Ellipsis, *t)] += g * (self.tap_idx == i) if self.mode == vknn.POOL_MAX else g
+        crop = tuple(slice(p, p + v) for p, v in zip(self.padding, self._vol))
+        dx.host_data = dxp[(Ellipsis, *crop)].reshape(x.shape)
         return dx
 
     def _backward_gpu(self, x: tensor, y: tensor) -> tensor:
         dx, dy = x.gradient, y.gradient
-        dcol = self.col.gradient
-        dcol.reshape([self.in_channels * self.batch_size, self.channel_offset, -1])
-        dy.reshape([self.in_channels * self.batch_size, -1])
-        self.pool_kernel_dcol.forward(dy.device_data, dcol.device_data, self.max_idx.device_data)
-        self.pool_kernel_dcol.run()
-        _dx = self.vol_col.backward()
+        idx = self.max_idx if self.mode == vknn.POOL_MAX else dy
+        self.kernel_dx.forward(dx.device_data, dy.device_data, idx.device_data)
+        self.kernel_dx.run()
         return dx
 
+class _MaxPoolNd(_PoolNd):
+    def __init__(self, dims, kernel_size: Union[int, List[int]], stride: Union[int, List[int]] = None,
+                 padding: Union[int, List[int]] = 0, dilation: Union[int, List[int]] = 1, return_indices: bool = False,
+                 ceil_mode: bool = False) -> None:
+        super(_MaxPoolNd, self).__init__(dims, vknn.POOL_MAX, kernel_size, stride, padding, dilation, return_indices,
+                                         ceil_mode)
+
+class _AvgPoolNd(_PoolNd):
+    def __init__(self, dims, kernel_size: Union[int, List[int]], stride: Union[int, List[int]] = None,
+                 padding: Union[int, List[int]] = 0, ceil_mode: bool = False, count_include_pad: bool = True) -> None:
+        super(_AvgPoolNd, self).__init__(dims, vknn.POOL_AVG, kernel_size, stride, padding, 1, False, ceil_mode,
+                                         count_include_pad)
+
 class maxpool1d(_MaxPoolNd):
     kernel_size: int
     stride: int
@@ -160,4 +175,19 @@ class maxpool3d(_MaxPoolNd):
     def __init__(self, kernel_size: Union[int, List[int]], stride: Optional[Union[int, List[int]]] = None,
                  padding: Union[int, List[int]] = 0, dilation: Union[int, List[int]] = 1,
                  return_indices: bool = False, ceil_mode: bool = False) -> None:
-        super(maxpool3d, self).__init__(3, kernel_size, stride, padding, dilation, return_indices, ceil_mode)
\ No newline at end of file
+        super(maxpool3d, self).__init__(3, kernel_size, stride, padding, dilation, return_indices, ceil_mode)
+
+class avgpool1d(_AvgPoolNd):
+    def __init__(self, kernel_size: int, stride: Optional[int] = None, padding: int = 0, ceil_mode: bool = False,
+                 count_include_pad: bool = True) -> None:
+        super(avgpool1d, self).__init__(1, kernel_size, stride, padding, ceil_mode, count_include_pad)
+
+class avgpool2d(_AvgPoolNd):
+    def __init__(self, kernel_size: Union[int, List[int]], stride: Optional[Union[int, List[int]]] = None,
+                 padding: Union[int, List[int]] = 0, ceil_mode: bool = False, count_include_pad: bool = True) -> None:
+        super(avgpool2d, self).__init__(2, kernel_size, stride, padding, ceil_mode, count_include_pad)
+
+class avgpool3d(_AvgPoolNd):
+    def __init__(self, kernel_size: Union[int, List[int]], stride: Optional[Union[int, List[int]]] = None,
+                 padding: Union[int, List[int]] = 0, ceil_mode: bool = False, count_include_pad: bool = True) -> None:
+        super(avgpool3d, self).__init__(3, kernel_size, stride, padding, ceil_mode, count_include_pad)
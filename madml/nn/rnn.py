@@ -3,13 +3,21 @@ from __future__ import division
 from __future__ import print_function
 from __future__ import unicode_literals
 
+import math
+
+import numpy as np
+
+import vknn
 from madml import tensor
 from madml import zeros
-from .activation import softmax
-from .linear import linear
-from .math import sigmoid, add
+from madml.init import uniform
 from .module import Module
 
+_GATES = {'LSTM': 4, 'GRU': 3, 'RNN_TANH': 1, 'RNN_RELU': 1}
+
+def _sigmoid(x: np.ndarray) -> np.ndarray:
+    return 1. / (1. + np.exp(-x))
+
 class rnnbase(Module):
     __constants__ = ['mode', 'input_size', 'hidden_size', 'num_layers', 'bias',
                      'batch_first', 'dropout', 'bidirectional']
@@ -27,6 +35,8 @@ class rnnbase(Module):
                  num_layers: int = 1, bias: bool = True, batch_first: bool = False,
                  dropout: float = 0., bidirectional: bool = False) -> None:
         super(rnnbase, self).__init__()
+        if mode not in _GATES:
+            raise ValueError("Unrecognized RNN mode: " + mode)
         self.mode = mode
         self.input_size = input_size
         self.hidden_size = hidden_size
@@ -36,103 +46,219 @@ class rnnbase(Module):
         self.dropout = float(dropout)
         self.bidirectional = bidirectional
         self.num_directions = 2 if bidirectional else 1
+        self.gate_size = _GATES[mode]
+        self.cell = {'LSTM': vknn.RNN_LSTM, 'GRU': vknn.RNN_GRU,
+                     'RNN_TANH': vknn.RNN_TANH, 'RNN_RELU': vknn.RNN_RELU}[mode]
+
+        # one (w_ih, w_hh, b_ih, b_hh) per layer and direction, gates stacked
+        # in PyTorch order along the rows
+        k = 1. / math.sqrt(hidden_size)
+        self.weights = []
+        for layer in range(num_layers):
+            layer_input_size = input_size if layer == 0 else hidden_size * self.num_directions
+            for _ in range(self.num_directions):
+                w_ih = self.register_weight(uniform(-k, k), [self.gate_size * hidden_size, layer_input_size])
+                w_hh = self.register_weight(uniform(-k, k), [self.gate_size * hidden_size, hidden_size])
+                b_ih = self.register_bias(bias, uniform(-k, k), [self.gate_size * hidden_size])
+                b_hh = self.register_bias(bias, uniform(-k, k), [self.gate_size * hidden_size])
+                self.weights.append((w_ih, w_hh, b_ih, b_hh))
+
+        self.kernels = None
+        # [seq, batch, directions * hidden] outputs of every layer but the last
+        self.layer_outputs = []
+        self.cache = {}
+
+    def forward(self, x: tensor, h: tensor = None, c: tensor = None):
+        # the kernels run sequence major, batch_first goes through a host copy
+        self.xs = tensor(np.ascontiguousarray(np.swapaxes(x.host_data, 0, 1))) if self.batch_first else x
+        seq, batch = self.xs.shape[0], self.xs.shape[1]
+        states = [self.num_layers * self.num_directions, batch, self.hidden_size]
+
+        self.ys = zeros([seq, batch, self.num_directions * self.hidden_size])
+        self.y = self.register_output_shape([x.shape[0], x.shape[1], self.num_directions * self.hidden_size])
+        self.hn = self.register_output_shape(states, 'hn')
+        self.cn = self.register_output_shape(states if self.mode == 'LSTM' else [1], 'cn')
+        if h is None:
+            h = zeros(states)
+        if c is None:
+            c = zeros(states if self.mode == 'LSTM' else [1])
+        super(rnnbase, self).forward(x, h, c)
+        if self.mode == 'LSTM':
+            return self.y, self.hn, self.cn
+        return self.y, self.hn
 
-        if mode == 'LSTM':
-            self.gate_size = 4
-        elif mode == 'GRU':
-            self.gate_size = 3
-        elif mode == 'RNN_TANH':
-            self.gate_size = 1
-        elif mode == 'RNN_RELU':
-            self.gate_size = 1
+    def _finish_forward(self) -> None:
+        if self.batch_first:
+            self.y.host_data = np.swapaxes(self.ys.host_data, 0, 1)
         else:
-            raise ValueError("Unrecognized RNN mode: " + mode)
+            self.y.host_data = self.ys.host_data
 
-        self.kernels = []
-        self.output = []
-        for layer in range(num_layers):
-            directions = []
+    def _forward_cpu(self, x: tensor, h: tensor, c: tensor):
+        inp = self.xs.host_data
+        hn, cn = self.hn.host_data, self.cn.host_data
+        for layer in range(self.num_layers):
+            out = np.zeros([inp.shape[0], inp.shape[1], self.num_directions * self.hidden_size], dtype=np.float32)
             for direction in range(self.num_directions):
-                layer_input_size = input_size if layer == 0 else hidden_size
-                gates = []
-                for gate in self.gate_size:
-                    w_ih = self.register_module(linear, layer_input_size, hidden_size, self.bias)
-                    w_hh = self.register_module(linear, hidden_size, hidden_size, self.bias)
-                    a_ih_hh = self.register_module(linear, add)
-                    gates.append([w_ih, w_hh, a_ih_hh])
-                self.output.append(self.register_module(linear, hidden_size, hidden_size, self.bias))
-                directions.append(gates)
-            self.kernels.append(directions)
-
-        RELU = lambda x: np.max(x, 0.0)
-
-        self.activation1 = sigmoid()
-        self.activation2 = np.tanh if mode == 'RNN_TANH' else RELU
-        self.activation3 = softmax(0)
-
-    def forward(self, x: tensor, h: tensor=None, c: tensor=None):
-        max_batch_size = x.shape[0] if self.batch_first else x.shape[1]
-
-        self.y = self.register_output_shape([self.num_layers * self.num_directions, max_batch_size, self.hidden_siz])
-        if h is None:
-            h = zeros([self.num_layers * self.num_directions, max_batch_size, self.hidden_size])
-        if c is None and self.mode == 'LSTM':
-            c = zeros([self.num_layers * self.num_directions, max_batch_size, self.hidden_size])
-        return super(rnnbase, self).forward(x, h, c)
+                idx = layer * self.num_directions + direction
+                w_ih, w_hh, b_ih, b_hh = (p.host_data for p in self.weights[idx])
+                if not self.bias:
+                    b_ih, b_hh = 0., 0.
+                h_t = h.host_data[idx]
+                c_t = c.host_data[idx] if self.mode == 'LSTM' else None
+                steps = range(inp.shape[0] - 1, -1, -1) if direction == 1 else range(inp.shape[0])
+                saved = []
+                for t in steps:
+                    gx = np.matmul(inp[t], w_ih.T) + b_ih
+                    gh = np.matmul(h_t, w_hh.T) + b_hh
+                    h_prev, c_prev = h_t, c_t
+                    if self.mode == 'LSTM':
+                        i, f, g, o = np.split(gx + gh, 4, axis=1)
+                        i, f, g, o = _sigmoid(i), _sigmoid(f), np.tanh(g), _sigmoid(o)
+                        c_t = f * c_prev + i * g
+                        h_t = o * np.tanh(c_t)
+                        gates = (i, f, g, o)
+                    elif self.mode == 'GRU':
+                        xr, xz, xn = np.split(gx, 3, axis=1)
+                        hr, hz, hn_t = np.split(gh, 3, axis=1)
+                        r, z = _sigmoid(xr + hr), _sigmoid(xz + hz)
+                        n = np.tanh(xn + r * hn_t)
+                        h_t = (1. - z) * n + z * h_prev
+                        gates = (r, z, n, hn_t)
+                    else:
+                        a = gx + gh
+                        h_t = np.tanh(a) if self.mode == 'RNN_TANH' else np.maximum(a, 0.)
+                        gates = (h_t,)
+                    out[t, :, direction * self.hidden_size:(direction + 1) * self.hidden_size] = h_t
+                    saved.append((t, h_prev, c_prev, c_t, gates))
+                hn[idx] = h_t
+                if self.mode == 'LSTM':
+                    cn[idx] = c_t
+                self.cache[idx] = (inp, saved)
+            inp = out
+        self.hn.host_data = hn
+        self.cn.host_data = cn
+        self.ys.host_data = inp
+        self._finish_forward()
+        return self.y
+
+    def _forward_gpu(self, x: tensor, h: tensor, c: tensor):
+        seq, batch = self.xs.shape[0], self.xs.shape[1]
+        width = self.num_directions * self.hidden_size
+        if self.kernels is None:
+            self.kernels = []
+            for layer in range(self.num_layers):
+                layer_input_size = self.input_size if layer == 0 else width
+                for direction in range(self.num_directions):
+                    self.kernels.append(self.register_kernel(vknn.rnn, self.cell, layer_input_size, self.hidden_size,
+                                                             self.bias, direction == 1, width,
+                                                             direction * self.hidden_size,
+                                                             layer * self.num_directions + direction))
+            self.layer_outputs = [zeros([seq, batch, width]) for _ in range(self.num_layers - 1)]
 
-    def _forward_cpu(self, x: tensor, hx: tensor, cx: tensor):
         for layer in range(self.num_layers):
+            inp = self.xs if layer == 0 else self.layer_outputs[layer - 1]
+            out = self.ys if layer == self.num_layers - 1 else self.layer_outputs[layer]
             for direction in range(self.num_directions):
-                gates = []
-                for gate in range(self.gates - 1):
-                    tx = self.kernel[layer][direction][gate][0].forward(x)
-                    th = self.kernel[layer][direction][gate][1].forward(hx[layer * self.num_directions + direction])
-                    thx = self.kernel[layer][direction][gate][2].forward(tx, th)
-                    tha = self.activation1.forward(thx)
-                    gates.append(tha)
-                tx = self.kernel[layer][direction][-1][0].forward(x)
-                th = self.kernel[layer][direction][-1][1].forward(hx[layer * self.num_directions + direction])
+                idx = layer * self.num_directions + direction
+                w_ih, w_hh, b_ih, b_hh = self.weights[idx]
+                self.kernels[idx].forward(out.device_data, self.hn.device_data, self.cn.device_data, inp.device_data,
+                                          h.device_data, c.device_data, w_ih.device_data, w_hh.device_data,
+                                          b_ih.device_data, b_hh.device_data)
+                self.kernels[idx].run()
+        self._finish_forward()
+        return self.y
 
-                if self.mode == 'LSTM':
-                    thx = self.kernel[layer][direction][-1][2].forward(tx, th)
-                    tha = self.activation2(thx.host_data)
-                    c = cx.host_data[layer * self.num_directions + direction]
-                    hi = gates[0].host_data
-                    hf = gates[1].host_data
-                    ho = gates[2].host_data
-                    hg = tha
-                    c = hf * c + hi * hg
-                    h = ho * self.activation2(c)
-                    hx.host_data[layer * self.num_direction + direction] = h
-                    cx.host_data[layer * self.num_direction + direction] = c
-                elif self.mode == 'GRU':
-                    hr = gates[0].host_data
-                    hz = gates[1].host_data
-                    th.host_data = hr * th.host_data
-                    thx = self.kernel[layer][direction][-1][2].forward(tx, th)
-                    tha = self.activation2(thx.host_data)
-                    h = (1 - hz) * hn + hz * hx[layer * self.num_directions + direction]
-                    hx.host_data[layer * self.num_directions + direction] = h
-                else:
-                    thx = self.kernel[layer][direction][-1][2].forward(tx, th)
-                    thx.host_data = self.activation2(thx.host_data)
-                    hx.host_data[layer * self.num_directions + direction] = thx.host_data
-
-                yx = self.output[layer * self.num_directions + direction].forward(hx)
-                gates.clear()
+    def _seq_grad(self) -> tensor:
+        dy = self.y.gradient
+        if self.batch_first:
+            self.ys.gradient.host_data = np.swapaxes(dy.host_data, 0, 1)
+            return self.ys.gradient
+        return dy
+
+    def _set_input_grad(self, x: tensor) -> tensor:
+        if self.batch_first:
+            x.gradient.host_data = np.swapaxes(self.xs.gradient.host_data, 0, 1)
+        return x.gradient
 
-        if self.mode == 'LSTM':
-            return self.y, hx, cx
-        return self.y, hx
     def _backward_cpu(self, x: tensor, h: tensor, c: tensor, y: tensor) -> tensor:
-        dx, dh, dc, dy = x.gradient, h.gradient, c.gradient, y.gradient
-        for layer in range(self.num_layers):
+        dout = self._seq_grad().host_data
+        dhn = self.hn.gradient.host_data
+        dcn = self.cn.gradient.host_data
+        dh0 = np.zeros_like(h.host_data)
+        dc0 = np.zeros_like(c.host_data)
+        for layer in range(self.num_layers - 1, -1, -1):
+            dinp = None
             for direction in range(self.num_directions):
-                gates = []
-                for gate in range(self.grates -1):
-                    pass
+                idx = layer * self.num_directions + direction
+                params = self.weights[idx]
+                w_ih, w_hh = params[0].host_data, params[1].host_data
+                inp, saved = self.cache[idx]
+                if dinp is None:
+                    dinp = np.zeros_like(inp)
+                dw_ih, dw_hh = np.zeros_like(w_ih), np.zeros_like(w_hh)
+                db_ih, db_hh = np.zeros(w_ih.shape[0]), np.zeros(w_hh.shape[0])
+                dh_next = dhn[idx]
+                dc_next = dcn[idx] if self.mode == 'LSTM' else None
+                for t, h_prev, c_prev, c_t, gates in reversed(saved):
+                    dh = dout[t, :, direction * self.hidden_size:(direction + 1) * self.hidden_size] + dh_next
+                    dh_direct = 0.
+                    if self.mode == 'LSTM':
+                        i, f, g, o = gates
+                        tc = np.tanh(c_t)
+                        dc = dc_next + dh * o * (1. - tc * tc)
+                        dgx = np.concatenate([dc * g * i * (1. - i), dc * c_prev * f * (1. - f),
+                                              dc * i * (1. - g * g), dh * tc * o * (1. - o)], axis=1)
+                        dgh = dgx
+                        dc_next = dc * f
+                    elif self.mode == 'GRU':
+                        r, z, n, hn_t = gates
+                        dn = dh * (1. - z) * (1. - n * n)
+                        dr = dn * hn_t * r * (1. - r)
+                        dz = dh * (h_prev - n) * z * (1. - z)
+                        dgx = np.concatenate([dr, dz, dn], axis=1)
+                        dgh = np.concatenate([dr, dz, dn * r], axis=1)
+                        dh_direct = dh * z
+                    else:
+                        h_t = gates[0]
+                        dgx = dh * (1. - h_t * h_t) if self.mode == 'RNN_TANH' else dh * (h_t > 0.)
+                        dgh = dgx
+                    dw_ih += np.matmul(dgx.T, inp[t])
+                    dw_hh += np.matmul(dgh.T, h_prev)
+                    db_ih += np.sum(dgx, axis=0)
+                    db_hh += np.sum(dgh, axis=0)
+                    dinp[t] += np.matmul(dgx, w_ih)
+                    dh_next = np.matmul(dgh, w_hh) + dh_direct
+                dh0[idx] = dh_next
+                if self.mode == 'LSTM':
+                    dc0[idx] = dc_next
+                params[0].gradient.host_data = dw_ih
+                params[1].gradient.host_data = dw_hh
+                if self.bias:
+                    params[2].gradient.host_data = db_ih
+                    params[3].gradient.host_data = db_hh
+            dout = dinp
+        h.gradient.host_data = dh0
+        c.gradient.host_data = dc0
+        self.xs.gradient.host_data = dout
+        return self._set_input_grad(x)
 
-        return dx
+    def _backward_gpu(self, x: tensor, h: tensor, c: tensor, y: tensor) -> tensor:
+        dout = self._seq_grad()
+        for layer in range(self.num_layers - 1, -1, -1):
+            inp = self.xs if layer == 0 else self.layer_outputs[layer - 1]
+            out_grad = dout if layer == self.num_layers - 1 else self.layer_outputs[layer].gradient
+            for direction in range(self.num_directions):
+                idx = layer * self.num_directions + direction
+                w_ih, w_hh, b_ih, b_hh = self.weights[idx]
+                # the second direction adds its share to the input gradient
+                self.kernels[idx].backward(inp.gradient.device_data, h.gradient.device_data, c.gradient.device_data,
+                                           w_ih.gradient.device_data, w_hh.gradient.device_data,
+                                           b_ih.gradient.device_data, b_hh.gradient.device_data, inp.device_data,
+                                           h.device_data, c.device_data, w_ih.device_data, w_hh.device_data,
+                                           out_grad.device_data, self.hn.gradient.device_data,
+                                           self.cn.gradient.device_data, direction > 0)
+                self.kernels[idx].run_backward()
+        return self._set_input_grad(x)
 
 class rnn(rnnbase):
     def __init__(self, input_size: int, hidden_size: int,
@@ -157,4 +283,4 @@ class gru(rnnbase):
     def __init__(self, input_size: int, hidden_size: int,
                  num_layers: int=1, bias: bool=True, batch_first: bool=False,
                  dropout: float=0., bidirectional: bool=False):
-        super(gru, self).__init__('GRU', input_size, hidden_size, num_layers, bias, batch_first, dropout, bidirectional)
\ No newline at end of file
+        super(gru, self).__init__('GRU', input_size, hidden_size, num_layers, bias, batch_first, dropout, bidirectional)
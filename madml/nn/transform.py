@@ -47,8 +47,11 @@ class vol2col(Module):
         
         self.vol_col = self.register_kernel(vknn.vol2col, [batch_size, in_channels, *kernel_size, *padding, *stride,
                                                            *dilation, *_col, *_vol, ])
+        # accumulates into the input gradient like _col2vol on the host, backward
+        # clears the gradient first as no other module writes it
         self.col_vol = self.register_kernel(vknn.col2vol, [batch_size, in_channels, *kernel_size, *padding, *stride,
-                                                           *dilation, *_col, *_vol, ])
+                                                           *dilation, *_col, *_vol, ], True)
+        self.dx_zero = self.register_kernel(vknn.fill, vknn.FILL_CONSTANT)
 
     def forward(self, x: tensor) -> tensor:
         super(vol2col, self).forward(x)
@@ -68,7 +71,7 @@ class vol2col(Module):
 
     def _backward_cpu(self, x: tensor, y: tensor):
         dx = x.gradient
-        npdx = x.gradient.host_data.ravel()
+        npdx = np.zeros(x.size, dtype=np.float32)
         dcol = y.gradient.host_data.ravel()
         _col2vol(npdx, dcol, self.batch_size, self.in_channels,
                  self.n_output_plane, self.index_length, nbt.List(self._vol), nbt.List(self._col),
@@ -79,6 +82,8 @@ class vol2col(Module):
     def _backward_gpu(self, x: tensor, y: tensor):
         dx = x.gradient
         dcol = y.gradient
+        self.dx_zero.forward(dx.device_data, 0.)
+        self.dx_zero.run()
         self.col_vol.forward(dx.device_data, dcol.device_data)
         self.col_vol.run()
         return dx
@@ -103,6 +108,9 @@ class col2vol(vol2col):
                  padding: List,
                  dilation: List):
         super(col2vol, self).__init__(batch_size, in_channels, _vol, _col, kernel_size, stride, padding, dilation)
+        # forward overwrites y instead of accumulating into it
+        self.col_vol_y = self.register_kernel(vknn.col2vol, [batch_size, in_channels, *kernel_size, *padding,
+                                                             *stride, *dilation, *_col, *_vol, ], False)
 
     def _forward_cpu(self, x: tensor) -> tensor:
         _col2vol(x.host_data.ravel(), self.y.host_data.ravel(), self.batch_size, self.in_channels,
@@ -110,8 +118,8 @@ class col2vol(vol2col):
                  nbt.List(self.kernel_size), nbt.List(self.stride), nbt.List(self.padding), nbt.List(self.dilation))
 
     def _forward_gpu(self, x: tensor) -> tensor:
-        self.col_vol.forward(self.y.device_data, x.device_data)
-        self.col_vol.run()
+        self.col_vol_y.forward(self.y.device_data, x.device_data)
+        self.col_vol_y.run()
         return self.y
 
     def _backward_cpu(self, x: tensor, y: tensor) -> tensor:
@@ -135,30 +143,35 @@ class col2vol(vol2col):
 class transpose(Module):
     __constants__ = ['axes']
     axes: List
-    stride: List
+    inverse_axes: List
     old_shape: List
     new_shape: List
 
     def __init__(self, axes: List[int], in_place: bool) -> None:
         super(transpose, self).__init__()
         self.axes = axes
+        self.inverse_axes = [0 for _ in axes]
+        for i, a in enumerate(axes):
+            self.inverse_axes[a] = i
         self.old_shape = []
         self.new_shape = []
-        self.stride = [1 for _ in range(len(axes) * 3)]
         self.in_place = in_place
+        self.reshape_only = False
         self.kernel = self.register_kernel(vknn.transpose, self.axes)
-        self.kernel_dx = self.register_kernel(vknn.transpose, self.axes)
+        self.kernel_dx = self.register_kernel(vknn.transpose, self.inverse_axes)
 
     def forward(self, x: tensor) -> tensor:
         assert (len(x.shape) == len(self.axes))
+        if not self.new_shape:
+            self.old_shape = [s for s in x.shape]
+            self.new_shape = [self.old_shape[self.axes[i]] for i in range(len(self.axes))]
+            # unit axes and axes that stay adjacent do not move any data
+            self.reshape_only = vknn.transpose_is_reshape(self.old_shape, self.axes)
         if self.in_place:
             self.y = self.register_output(x)
         elif self.y is None:
             self.y = self.register_output_shape(self.new_shape)
-        if not self.new_shape:
-            self.old_shape = [s for s in x.shape]
-            self.new_shape = [self.old_shape[self.axes[i]] for i in range(len(self.axes))]
-        
+
         super(transpose, self).forward(x)
         return self.y
 
@@ -167,28 +180,23 @@ class transpose(Module):
         return self.y
 
     def _forward_gpu(self, x: tensor) -> tensor:
-        self.kernel.forward(self.y.device_data, x.device_data)
-        self.kernel.run()
+        if not (self.reshape_only and self.in_place):
+            self.kernel.forward(self.y.device_data, x.device_data)
+            self.kernel.run()
         self.y.reshape(self.new_shape)
         return self.y
 
     def _backward_cpu(self, dx: tensor, dy: tensor) -> tensor:
-        dx.host_data = np.transpose(dy.host_data, self.axes)
+        dx.host_data = np.transpose(dy.host_data, self.inverse_axes)
         return dx
 
     def _backward_gpu(self, dx: tensor, dy: tensor) -> tensor:
-        self.kernel_dx.forward(dx.device_data, dy.device_data)
-        self.kernel_dx.run()
+        if not (self.reshape_only and self.in_place):
+            self.kernel_dx.forward(dx.device_data, dy.device_data)
+            self.kernel_dx.run()
+        dx.reshape(self.old_shape)
         return dx
 
-    def prepare_stride(self, shape_before: List, shape_after: List) -> None:
-        dims = len(self.axes)
-        self.stride[2 * dims - 1] = 1
-        self.stride[3 * dims - 1] = 1
-        for i in range(dims - 2, 0, -1):
-            self.stride[dims * 2 + i] = self.stride[dims * 2 + i + 1] * shape_before[i + 1]
-            self.stride[dims + i] = self.stride[dims + i + 1] * shape_after[i + 1]
-
 
 class flatten(Module):
     def __init__(self) -> None:
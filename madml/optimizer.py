@@ -53,6 +53,7 @@ class Optimizer(object):
         self.counter = 1
         self.device_id = -1
         self._kernels = []
+        self._fused = None
 
     def zero_grad(self) -> None:
         if DEBUG:
@@ -63,12 +64,50 @@ class Optimizer(object):
     def step_cpu(self, i, p: Parameter, closure=None):
         pass
 
+    def _fused_kernel(self):
+        # the fused kernels follow step_cpu, whose L2 term is dl2_reg(p, lr), so
+        # lr is also what they get as weight decay
+        return None
+
+    def _fused_states(self, p: Parameter) -> List[tensor]:
+        # state slots of the fused kernel in order, backed by the per parameter state
+        return p.optimizer_stuff
+
+    def _device(self) -> int:
+        # the device the parameters live on, -1 for the host
+        devices = set(p.device_id for p in self.params)
+        if len(devices) > 1:
+            raise ValueError("optimizer parameters are on different devices: {}".format(sorted(devices)))
+        return devices.pop() if devices else -1
+
+    def step_fused(self) -> bool:
+        # one dispatch for every parameter when the device exposes buffer addresses
+        if self.device_id == -1 or not vknn.buffer_device_address_supported(self.device_id):
+            return False
+        if self._fused is None:
+            self._fused = self._fused_kernel()
+            if self._fused is None:
+                return False
+        states = [self._fused_states(p) for p in self.params]
+        self._fused.forward(self.counter, [p.device_data for p in self.params],
+                            [p.gradient.device_data for p in self.params],
+                            [[s[k].device_data for s in states] for k in range(self._fused.state_slots())])
+        self._fused.run()
+        return True
+
     def step(self, closure=None):
+        self.device_id = self._device()
+        if self.step_fused():
+            for p in self.params:
+                p.version += 1
+            self.counter += 1
+            return
         for i, p in enumerate(self.params):
             if self.device_id == -1:
                 p.future = OPTIMIZER_EXECUTOR.submit(self.step_cpu, i, p, closure)
             else:
                 p.future = OPTIMIZER_EXECUTOR.submit(self.step_gpu, i, p, closure)
+            p.version += 1
         self.counter += 1
 
 class SGD(Optimizer):
@@ -86,13 +125,16 @@ class SGD(Optimizer):
         defaults = dict(lr=lr, momentum=momentum, dampening=dampening, weight_decay=weight_decay, nesterov=nesterov)
         super(SGD, self).__init__(params, defaults)
 
-        if momentum > 0.0:
-            for p in self.params:
-                p.optimizer_stuff = [tensor([0.0 for _ in range(p.size)], p.shape, requires_grad=nesterov)]
+        # the device kernel always writes a velocity, the host step only reads it with momentum
+        for p in self.params:
+            p.optimizer_stuff = [tensor([0.0 for _ in range(p.size)], p.shape, requires_grad=nesterov)]
+
+    def _fused_kernel(self):
+        return vknn.multi_tensor_sgd(self.defaults['lr'], self.defaults['momentum'], self.defaults['lr'])
 
     def step_gpu(self, i: int, p: Parameter, closure=None) -> None:
         if len(self._kernels) <= i:
-            self._kernels.append(vknn.sgd(self.defaults['lr'], self.defaults['momentum'], self.defaults['dampening'], self.defaults['weight_decay'], self.defaults['nestrov']))
+            self._kernels.append(vknn.sgd(self.defaults['lr'], self.defaults['momentum'], self.defaults['dampening'], self.defaults['weight_decay'], self.defaults['nesterov']))
         self._kernels[i].forward(p.device_data, p.gradient.device_data, p.optimizer_stuff[0].device_data)
         self._kernels[i].run()
 
@@ -137,11 +179,20 @@ class adam(Optimizer):
             p.optimizer_stuff = [tensor([0.0 for _ in range(p.size)], p.shape, requires_grad=True),
                                  tensor([0.0 for _ in range(p.size)], p.shape, requires_grad=True)]
 
+    def _fused_kernel(self):
+        return vknn.multi_tensor_adam(self.defaults['lr'], self.defaults['betas'][0], self.defaults['betas'][1],
+                                      self.defaults['eps'], self.defaults['lr'], self.defaults['amsgrad'])
+
+    def _fused_states(self, p: Parameter) -> List[tensor]:
+        # the amsgrad running max lives in the gradient of the second moment, as on the host
+        m, r = p.optimizer_stuff
+        return [m, r, r.gradient] if self.defaults['amsgrad'] else [m, r]
+
     def step_gpu(self, i: int, p: Parameter, closure=None) -> None:
         if len(self._kernels) <= i:
             self._kernels.append(vknn.adam(self.defaults['lr'], self.defaults['betas'][0], self.defaults['betas'][1],
-                                           self.defaults['eps'], self.defaults['weight_decay'], self.defaults['asmgrad']))
-        self._kernels[i].forward(p.device_data, p.gradient.device_data, p.optimizer_stuff[0].device_data, p.optimizer_stuff[1].device_data,
+                                           self.defaults['eps'], self.defaults['weight_decay'], self.defaults['amsgrad']))
+        self._kernels[i].forward(self.counter, p.device_data, p.gradient.device_data, p.optimizer_stuff[0].device_data, p.optimizer_stuff[1].device_data,
                               p.optimizer_stuff[0].gradient.device_data, p.optimizer_stuff[1].gradient.device_data)
         self._kernels[i].run()
 
@@ -159,7 +210,7 @@ class adam(Optimizer):
 
         if self.defaults['amsgrad']:
             r_k_hat = p.optimizer_stuff[1].gradient.host_data
-            r_k_hat = np.max(r, r_k_hat)
+            r_k_hat = np.maximum(r, r_k_hat)
             p.host_data -= self.defaults['lr'] / (np.sqrt(r_k_hat) + self.defaults['eps']) * m
 
         else:
@@ -191,7 +242,7 @@ class Adagrad(Optimizer):
         defaults = dict(lr=lr, lr_decay=lr_decay, eps=eps, weight_decay=weight_decay,
                         initial_accumulator_value=initial_accumulator_value)
         super(Adagrad, self).__init__(params, defaults)
-        self.counter = inital_accumulator_value
+        self.counter = initial_accumulator_value
         for p in self.params:
             p.optimizer_stuff = [tensor([0.0 for _ in range(p.size)], p.shape, requires_grad=False)]
 
@@ -206,6 +257,9 @@ class Adagrad(Optimizer):
         if DEBUG:
             print_p(p)
 
+    def _fused_kernel(self):
+        return vknn.multi_tensor_adagrad(self.defaults['lr'], self.defaults['eps'], self.defaults['lr'])
+
     def step_gpu(self, i: int, p: Parameter, closure=None) -> None:
         if len(self._kernels) <= i:
             self._kernels.append(vknn.adagrad(self.defaults['lr'], self.defaults['eps'], self.defaults['lr_decay'], self.defaults['weight_decay']))
@@ -231,7 +285,7 @@ class RMSprop(Optimizer):
 
         super(RMSprop, self).__init__(params, defaults)
 
-        for x, p in self.params.items():
+        for p in self.params:
             p.optimizer_stuff = [tensor([0.0 for _ in range(p.size)], p.shape, requires_grad=False)]
 
     def step_cpu(self, i: int, p: Parameter, closure=None) -> None:
@@ -248,8 +302,12 @@ class RMSprop(Optimizer):
         if DEBUG:
             print_p(p)
 
+    def _fused_kernel(self):
+        return vknn.multi_tensor_rmsprop(self.defaults['lr'], self.defaults['alpha'], self.defaults['eps'],
+                                         self.defaults['lr'])
+
     def step_gpu(self, i: int, p:Parameter, closure=None) -> None:
         if len(self._kernels) <= i:
-            self._kernels.append(vknn.rmsprop(self.defaults['lr'], self.defaults['alpha'], self.defaults['eps'], self.defaults['weight_decay'], self.defaults['centered']))
+            self._kernels.append(vknn.rmsprop(self.defaults['lr'], self.defaults['alpha'], self.defaults['eps'], self.defaults['weight_decay'], self.defaults['momentum'], self.defaults['centered']))
         self._kernels[i].forward(p.device_data, p.gradient.device_data, p.optimizer_stuff[0].device_data)
         self._kernels[i].run()
\ No newline at end of file
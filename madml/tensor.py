@@ -22,6 +22,8 @@ def _convert_to_np_dtype(type):
         return np.int32
     elif type == float:
         return np.float32
+    elif type == np.float16:
+        return np.float16
     elif type == bool:
         return np.bool
     elif type == bytes:
@@ -41,6 +43,9 @@ def _convert_to_float(size: int, arr: List[bytes]) -> List[float]:
 def _download(host: np.ndarray, device: vknn.tensor) -> None:
     if host.dtype == np.float32:
         return vknn.tensor_to_np_float(device, host)
+    elif host.dtype == np.float16:
+        # half travels as its bit pattern, the view writes through to host
+        return vknn.tensor_to_np_half(device, host.view(np.uint16))
     elif host.dtype == np.float64:
         host = host.astype(np.float32)
         return _download(host, device)
@@ -58,6 +63,8 @@ def _download(host: np.ndarray, device: vknn.tensor) -> None:
 def _upload(host: np.ndarray, device: vknn.tensor) -> None:
     if host.dtype == np.float32:
         return vknn.np_to_tensor_float(device, host)
+    elif host.dtype == np.float16:
+        return vknn.np_to_tensor_half(device, host.view(np.uint16))
     elif host.dtype == np.float64:
         host = host.astype(np.float32)
         return _upload(host, device)
@@ -73,9 +80,17 @@ def _upload(host: np.ndarray, device: vknn.tensor) -> None:
         raise TypeError(" dtype: {0} is not Implemented".format(host.dtype))
 
 class gpu_tensor(object):
-    def __init__(self, data: np.ndarray):
-        if data.dtype == np.float32:
+    def __init__(self, data: np.ndarray, uninitialized: bool = False):
+        if uninitialized:
+            # allocated only, a device kernel writes the contents
+            if data.dtype == np.float16:
+                self.data = vknn.empty_half(list(data.shape))
+            else:
+                self.data = vknn.empty_float(list(data.shape))
+        elif data.dtype == np.float32:
             self.data = vknn.init_float(data)
+        elif data.dtype == np.float16:
+            self.data = vknn.init_half(np.ascontiguousarray(data).view(np.uint16))
         elif data.dtype == np.int32 or data.dtype == np.uint32:
             self.data = vknn.init_int(data)
         elif data.dtype == np.bool:
@@ -104,8 +119,13 @@ class tensor(object):
     id : int
     device_id : int
 
-    def __init__(self, data: Union[List[Union[float, int, bytes, bool]], np.ndarray], shape=None,
+    def __init__(self, data: Union[List[Union[float, int, bytes, bool]], np.ndarray, None], shape=None,
                  requires_grad: bool=True, dtype=float, device_id=-1) -> None:
+        # data None allocates the tensor on the device only, its host copy is
+        # downloaded on first read once a kernel has written it
+        device_only = data is None
+        if device_only:
+            data = np.empty(shape, dtype=_convert_to_np_dtype(dtype))
         if shape is None and not isinstance(data, np.ndarray):
             raise AttributeError("shape is undefined: must initalize with np.ndarray or flat list with shape")
 
@@ -114,12 +134,12 @@ class tensor(object):
         else:
             shape = data.shape
         self.shape = [int(s) for s in shape]
-        self._host_memory = data.astype(_convert_to_np_dtype(dtype)).reshape(self.shape)
-        self._device_memory = gpu_tensor(self._host_memory)
+        self._host_memory = data.astype(_convert_to_np_dtype(dtype), copy=not device_only).reshape(self.shape)
+        self._device_memory = gpu_tensor(self._host_memory, device_only)
         self._init_shape = self.shape
         self.size = 1
 
-        self.gpu_access = False
+        self.gpu_access = device_only
         self.cpu_access = False
 
         for s in self.shape:
@@ -226,8 +246,8 @@ class tensor(object):
         self.future
         if self.gpu_access:
             self.download()
-            self.gpu_acess = False
-        self.cpu_acess = True
+            self.gpu_access = False
+        self.cpu_access = True
         return self._host_memory
 
     @host_data.setter
@@ -235,6 +255,7 @@ class tensor(object):
         assert (value.size == self._host_memory.size)
         self.shape = [int(s) for s in value.shape]
         self._host_memory = value.astype(self._host_memory.dtype)
+        self.gpu_access = False
         self.cpu_access = True
 
     @property
@@ -315,6 +336,6 @@ class tensor(object):
         new_shape.insert(axis, 1)
         self.reshape(new_shape)
 
-    def to(idx:int):
+    def to(self, idx: int):
         self.device_id = idx
         return self
\ No newline at end of file
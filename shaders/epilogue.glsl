@@ -0,0 +1,21 @@
+// Epilogue shared by the GEMM and convolution kernels, applied to every
+// accumulator right before it is stored, after the bias has been added:
+//   d = act(v + residual) * EPI_SCALE
+// The including shader declares the specialization constants:
+//   EPI_ACT       0 none, 1 relu, 2 leaky relu with slope EPI_SLOPE, 3 sigmoid
+//   EPI_RESIDUAL  read the residual operand R at the output index
+//   EPI_SLOPE     negative slope of the leaky relu
+//   EPI_SCALE     output scaling
+
+float epilogue(float v, uint index)
+{
+	if (EPI_RESIDUAL)
+		v += float(R[index]);
+	if (EPI_ACT == 1)
+		v = max(v, 0.0);
+	else if (EPI_ACT == 2)
+		v = v >= 0.0 ? v : v * EPI_SLOPE;
+	else if (EPI_ACT == 3)
+		v = 1.0 / (1.0 + exp(-v));
+	return v * EPI_SCALE;
+}
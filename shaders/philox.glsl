@@ -0,0 +1,36 @@
+// Philox4x32-10 counter-based random numbers (Salmon et al., Random123).
+// Every (counter, key) pair maps to four independent uint32 values, so a
+// kernel can regenerate any element of a random stream from its index with
+// no state in memory. Kernels use the key as the seed and put the element
+// block and the call offset in the counter:
+//   philoxUniform(seed, offset, i) -> 4 floats in [0, 1) for elements 4i..4i+3
+// seed and offset are 64 bit values split into (lo, hi) words. madml.nn
+// mirrors this generator in numpy so host and device streams agree.
+
+const uint PHILOX_M0 = 0xD2511F53u;
+const uint PHILOX_M1 = 0xCD9E8D57u;
+const uint PHILOX_W0 = 0x9E3779B9u;
+const uint PHILOX_W1 = 0xBB67AE85u;
+
+uvec4 philox4x32(uvec4 ctr, uvec2 key)
+{
+	for (int r = 0; r < 10; ++r) {
+		uint hi0, lo0, hi1, lo1;
+		umulExtended(PHILOX_M0, ctr.x, hi0, lo0);
+		umulExtended(PHILOX_M1, ctr.z, hi1, lo1);
+		ctr = uvec4(hi1 ^ ctr.y ^ key.x, lo1, hi0 ^ ctr.w ^ key.y, lo0);
+		key += uvec2(PHILOX_W0, PHILOX_W1);
+	}
+	return ctr;
+}
+
+// top 24 bits, so every value is exact in float and 1.0 is never reached
+vec4 philoxToUniform(uvec4 r)
+{
+	return vec4(r >> 8u) * (1.0 / 16777216.0);
+}
+
+vec4 philoxUniform(uvec2 seed, uvec2 offset, uint block)
+{
+	return philoxToUniform(philox4x32(uvec4(block, 0u, offset.x, offset.y), seed));
+}
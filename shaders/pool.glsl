@@ -0,0 +1,77 @@
+// Pooling window geometry shared by pool.comp and pool_backward.comp. The
+// input is planes = batch * channels NCDHW slices of depth_vol x height_vol x
+// width_vol, the output slices are depth_col x height_col x width_col. Output
+// (od, oh, ow) reads the taps (kd, kh, kw) at
+//   od * stride_d - pad_d + kd * dilation_d, and likewise for h and w,
+// in that order, so input offsets grow with the tap index. MODE 0 is max
+// pooling, MODE 1 average pooling, which divides by the whole window with
+// count_include_pad and by the taps inside the volume otherwise.
+
+layout(push_constant) uniform pushBlock {
+	uint planes;
+	uint kernel_d;
+	uint kernel_h;
+	uint kernel_w;
+	uint pad_d;
+	uint pad_h;
+	uint pad_w;
+	uint stride_d;
+	uint stride_h;
+	uint stride_w;
+	uint dilation_d;
+	uint dilation_h;
+	uint dilation_w;
+	uint depth_col;
+	uint height_col;
+	uint width_col;
+	uint depth_vol;
+	uint height_vol;
+	uint width_vol;
+	uint count_include_pad;
+};
+
+layout(constant_id = 0) const uint MODE = 0;
+
+const uint MODE_MAX = 0;
+const float LOWEST = -3.402823466e38;
+
+uvec3 outputCoord(uint q)
+{
+	return uvec3(q / (width_col * height_col), (q / width_col) % height_col, q % width_col);
+}
+
+ivec3 windowOrigin(uvec3 o)
+{
+	return ivec3(o) * ivec3(stride_d, stride_h, stride_w) - ivec3(pad_d, pad_h, pad_w);
+}
+
+// offset of tap t within the input plane, -1 in the padding
+int tapOffset(ivec3 origin, uint t)
+{
+	uint kw = t % kernel_w;
+	uint kh = (t / kernel_w) % kernel_h;
+	uint kd = t / (kernel_w * kernel_h);
+	ivec3 p = origin + ivec3(kd * dilation_d, kh * dilation_h, kw * dilation_w);
+	if (any(lessThan(p, ivec3(0))) || any(greaterThanEqual(p, ivec3(depth_vol, height_vol, width_vol))))
+		return -1;
+	return (p.x * int(height_vol) + p.y) * int(width_vol) + p.z;
+}
+
+int axisTaps(int origin, uint kernel, uint dilation, uint size)
+{
+	int n = 0;
+	for (uint k = 0; k < kernel; ++k) {
+		int p = origin + int(k * dilation);
+		n += p >= 0 && p < int(size) ? 1 : 0;
+	}
+	return n;
+}
+
+float avgDivisor(ivec3 origin)
+{
+	if (count_include_pad != 0)
+		return float(kernel_d * kernel_h * kernel_w);
+	int n = axisTaps(origin.x, kernel_d, dilation_d, depth_vol) * axisTaps(origin.y, kernel_h, dilation_h, height_vol) *
+		axisTaps(origin.z, kernel_w, dilation_w, width_vol);
+	return float(max(n, 1));
+}
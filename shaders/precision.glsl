@@ -0,0 +1,26 @@
+// Element types of the kernels that have half precision variants.
+// compile_shaders.py builds <name>_fp16_spv with -DFP16 and, where a shader
+// asks for it, <name>_fp16_math_spv with -DFP16 -DFP16_MATH.
+//   FP16       buffers hold float16_t (VK_KHR_16bit_storage), math stays float
+//   FP16_MATH  shared memory and math in float16_t as well (shaderFloat16)
+// STORE_T and STORE4_T are the buffer element types, MATH_T the type the
+// kernel computes in. Loads convert with float(x) or MATH_T(x), stores with
+// STORE_T(v), all of which are no-ops in the float build.
+
+#ifdef FP16
+#extension GL_EXT_shader_16bit_storage : require
+#define STORE_T float16_t
+#define STORE4_T f16vec4
+#else
+#define STORE_T float
+#define STORE4_T vec4
+#endif
+
+#ifdef FP16_MATH
+#extension GL_EXT_shader_explicit_arithmetic_types_float16 : require
+#define MATH_T float16_t
+#define MATH4_T f16vec4
+#else
+#define MATH_T float
+#define MATH4_T vec4
+#endif
@@ -0,0 +1,232 @@
+// Reduction of X viewed as [outer, extent, inner] over the middle axis into
+// Y viewed as [outer, splits, inner]. With splits > 1 every output is split
+// into chunks of at most chunk elements and a second pass reduces the partial
+// results. OP selects the reduction:
+//   0 sum, 1 max, 2 min, 3 argmax, 4 sum of squares, 5 logsumexp
+// FIRST marks the pass that reads the input tensor, later passes read partial
+// results: sum of squares stops squaring and argmax reads the partial indices
+// from XI. LAYOUT selects the work split:
+//   0 rows:    one workgroup per output, for a contiguous reduced axis
+//   1 columns: one workgroup per 32 consecutive outputs, for inner >= 32
+//   2 serial:  one thread per output, for short reduced axes
+// The final pass multiplies by scale (mean) and takes the square root when
+// post is 1 (L2 norm). Logsumexp partials are stored as log values so every
+// pass combines them the same way.
+// The including shader defines USE_SUBGROUP when the device has subgroup
+// arithmetic, otherwise the rows layout reduces through a shared-memory tree.
+
+layout(push_constant) uniform pushBlock {
+	uint outer;
+	uint extent;
+	uint inner;
+	uint splits;
+	uint chunk;
+	float scale;
+	uint post;
+};
+
+layout(constant_id = 0) const uint OP = 0;
+layout(constant_id = 1) const bool FIRST = true;
+layout(constant_id = 2) const uint LAYOUT = 0;
+
+layout (local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+layout (binding = 0) readonly buffer ssbX { float X[]; };
+layout (binding = 1) readonly buffer ssbXI { uint XI[]; };
+layout (binding = 2) writeonly buffer ssbY { float Y[]; };
+layout (binding = 3) writeonly buffer ssbYI { uint YI[]; };
+
+const uint THREADS = 256;
+const uint COLS = 32;
+const uint OP_SUM = 0;
+const uint OP_MAX = 1;
+const uint OP_MIN = 2;
+const uint OP_ARGMAX = 3;
+const uint OP_SUMSQ = 4;
+const uint OP_LSE = 5;
+const float LOWEST = -3.402823466e38;
+const float HIGHEST = 3.402823466e38;
+
+// v is the running value (sum, max, min, or the max of logsumexp), s the
+// logsumexp sum scaled by exp(-v) and i the argmax index
+struct state
+{
+	float v;
+	float s;
+	uint i;
+};
+
+shared float sv[THREADS];
+shared float ss[THREADS];
+shared uint si[THREADS];
+
+state identity()
+{
+	if (OP == OP_MAX || OP == OP_ARGMAX || OP == OP_LSE)
+		return state(LOWEST, 0.0, 0xffffffff);
+	if (OP == OP_MIN)
+		return state(HIGHEST, 0.0, 0xffffffff);
+	return state(0.0, 0.0, 0);
+}
+
+state load(uint index, uint r)
+{
+	float x = X[index];
+	if (OP == OP_SUMSQ && FIRST)
+		return state(x * x, 0.0, 0);
+	if (OP == OP_ARGMAX)
+		return state(x, 0.0, FIRST ? r : XI[index]);
+	return state(x, 1.0, 0);
+}
+
+state combine(state a, state b)
+{
+	if (OP == OP_SUM || OP == OP_SUMSQ)
+		return state(a.v + b.v, 0.0, 0);
+	if (OP == OP_MAX)
+		return state(max(a.v, b.v), 0.0, 0);
+	if (OP == OP_MIN)
+		return state(min(a.v, b.v), 0.0, 0);
+	if (OP == OP_ARGMAX)
+		return (b.v > a.v || (b.v == a.v && b.i < a.i)) ? b : a;
+	float m = max(a.v, b.v);
+	return state(m, a.s * exp(a.v - m) + b.s * exp(b.v - m), 0);
+}
+
+void store(uint index, state a)
+{
+	if (OP == OP_ARGMAX) {
+		Y[index] = a.v;
+		YI[index] = a.i;
+		return;
+	}
+	float v = OP == OP_LSE ? a.v + log(a.s) : a.v;
+	if (post == 1)
+		v = sqrt(v);
+	Y[index] = v * scale;
+}
+
+void share(uint slot, state a)
+{
+	sv[slot] = a.v;
+	ss[slot] = a.s;
+	si[slot] = a.i;
+}
+
+state shared_at(uint slot)
+{
+	return state(sv[slot], ss[slot], si[slot]);
+}
+
+#ifdef USE_SUBGROUP
+state subgroupReduce(state a)
+{
+	if (OP == OP_SUM || OP == OP_SUMSQ)
+		return state(subgroupAdd(a.v), 0.0, 0);
+	if (OP == OP_MAX)
+		return state(subgroupMax(a.v), 0.0, 0);
+	if (OP == OP_MIN)
+		return state(subgroupMin(a.v), 0.0, 0);
+	float m = subgroupMax(a.v);
+	if (OP == OP_ARGMAX)
+		return state(m, 0.0, subgroupMin(a.v == m ? a.i : 0xffffffff));
+	return state(m, subgroupAdd(a.s * exp(a.v - m)), 0);
+}
+#endif
+
+// reduces a across the workgroup, the result is valid in thread 0
+state groupReduce(state a, uint tid)
+{
+#ifdef USE_SUBGROUP
+	a = subgroupReduce(a);
+	barrier();
+	if (subgroupElect())
+		share(gl_SubgroupID, a);
+	barrier();
+	if (tid == 0)
+		for (uint k = 1; k < gl_NumSubgroups; ++k)
+			a = combine(a, shared_at(k));
+#else
+	barrier();
+	share(tid, a);
+	barrier();
+	for (uint s = THREADS / 2; s > 0; s >>= 1) {
+		if (tid < s)
+			share(tid, combine(shared_at(tid), shared_at(tid + s)));
+		barrier();
+	}
+	a = shared_at(0);
+#endif
+	return a;
+}
+
+void rows(uint tid)
+{
+	const uint outputs = outer * inner * splits;
+	for (uint w = gl_WorkGroupID.x; w < outputs; w += gl_NumWorkGroups.x) {
+		uint s = w % splits;
+		uint i = (w / splits) % inner;
+		uint o = w / (splits * inner);
+		uint end = min(extent, (s + 1) * chunk);
+		state a = identity();
+		for (uint r = s * chunk + tid; r < end; r += THREADS)
+			a = combine(a, load((o * extent + r) * inner + i, r));
+		a = groupReduce(a, tid);
+		if (tid == 0)
+			store((o * splits + s) * inner + i, a);
+	}
+}
+
+void columns(uint tid)
+{
+	const uint lx = tid % COLS;
+	const uint ly = tid / COLS;
+	const uint ROWS = THREADS / COLS;
+	const uint blocks = (inner + COLS - 1) / COLS;
+	const uint outputs = outer * blocks * splits;
+	for (uint w = gl_WorkGroupID.x; w < outputs; w += gl_NumWorkGroups.x) {
+		uint s = w % splits;
+		uint i = ((w / splits) % blocks) * COLS + lx;
+		uint o = w / (splits * blocks);
+		uint end = min(extent, (s + 1) * chunk);
+		state a = identity();
+		if (i < inner)
+			for (uint r = s * chunk + ly; r < end; r += ROWS)
+				a = combine(a, load((o * extent + r) * inner + i, r));
+		barrier();
+		share(tid, a);
+		barrier();
+		for (uint h = ROWS / 2; h > 0; h >>= 1) {
+			if (ly < h)
+				share(tid, combine(shared_at(tid), shared_at(tid + h * COLS)));
+			barrier();
+		}
+		if (ly == 0 && i < inner)
+			store((o * splits + s) * inner + i, shared_at(tid));
+	}
+}
+
+void serial()
+{
+	const uint outputs = outer * inner * splits;
+	for (uint w = gl_GlobalInvocationID.x; w < outputs; w += gl_NumWorkGroups.x * THREADS) {
+		uint i = w % inner;
+		uint s = (w / inner) % splits;
+		uint o = w / (inner * splits);
+		uint end = min(extent, (s + 1) * chunk);
+		state a = identity();
+		for (uint r = s * chunk; r < end; ++r)
+			a = combine(a, load((o * extent + r) * inner + i, r));
+		store((o * splits + s) * inner + i, a);
+	}
+}
+
+void main() {
+	uint tid = gl_LocalInvocationID.x;
+	if (LAYOUT == 0)
+		rows(tid);
+	else if (LAYOUT == 1)
+		columns(tid);
+	else
+		serial();
+}
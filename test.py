@@ -159,6 +159,626 @@ class TestModules(unittest.TestCase):
         dx = dlogit.host_data
         self.assertTrue((np.sum(y) == np.sum(dx)).all())
 
+    def test_philox(self):
+        from madml.nn.activation import _philox4x32
+        r = _philox4x32([[0], [0], [0], [0]], [0, 0])
+        self.assertTrue([int(v[0]) for v in r] == [0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8])
+        ones = 0xffffffff
+        r = _philox4x32([[ones], [ones], [ones], [ones]], [ones, ones])
+        self.assertTrue([int(v[0]) for v in r] == [0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd])
+
+def has_device():
+    try:
+        import vknn
+        return vknn.number_physcial_devices() > 0
+    except (ImportError, AttributeError):
+        return False
+
+def numeric_grad(f, x, dy, eps=1e-3):
+    # central differences of sum(f(x) * dy)
+    g = np.zeros(x.shape)
+    x = x.astype(np.float64)
+    for i in np.ndindex(*x.shape):
+        old = x[i]
+        x[i] = old + eps
+        hi = np.sum(f(x).astype(np.float64) * dy)
+        x[i] = old - eps
+        lo = np.sum(f(x).astype(np.float64) * dy)
+        x[i] = old
+        g[i] = (hi - lo) / (2 * eps)
+    return g
+
+def _conv_taps(x, w, padding, stride, dilation, groups):
+    # zero padded x and, per group and kernel tap, the channel slices and the strided window it reads
+    xp = np.pad(x, [(0, 0), (0, 0), (padding[0], padding[0]), (padding[1], padding[1])])
+    oh = (xp.shape[2] - dilation[0] * (w.shape[2] - 1) - 1) // stride[0] + 1
+    ow = (xp.shape[3] - dilation[1] * (w.shape[3] - 1) - 1) // stride[1] + 1
+    cg, og = x.shape[1] // groups, w.shape[0] // groups
+    taps = []
+    for g in range(groups):
+        for kh in range(w.shape[2]):
+            for kw in range(w.shape[3]):
+                h0, w0 = kh * dilation[0], kw * dilation[1]
+                window = (slice(h0, h0 + stride[0] * (oh - 1) + 1, stride[0]),
+                          slice(w0, w0 + stride[1] * (ow - 1) + 1, stride[1]))
+                taps.append((slice(g * cg, (g + 1) * cg), slice(g * og, (g + 1) * og), kh, kw, window))
+    return xp, oh, ow, taps
+
+def conv_reference(x, w, b, padding, stride=(1, 1), dilation=(1, 1), groups=1):
+    # direct NCHW cross-correlation
+    xp, oh, ow, taps = _conv_taps(x, w, padding, stride, dilation, groups)
+    y = np.zeros([x.shape[0], w.shape[0], oh, ow])
+    for c, o, kh, kw, (hs, ws) in taps:
+        y[:, o] += np.einsum('oc,nchw->nohw', w[o, :, kh, kw], xp[:, c, hs, ws])
+    return y + b.reshape([1, -1, 1, 1])
+
+def conv_grad_reference(x, w, dy, padding, stride=(1, 1), dilation=(1, 1), groups=1):
+    # adjoints of conv_reference with respect to x and w
+    xp, _, _, taps = _conv_taps(x, w, padding, stride, dilation, groups)
+    dxp = np.zeros(xp.shape)
+    dw = np.zeros(w.shape)
+    for c, o, kh, kw, (hs, ws) in taps:
+        dw[o, :, kh, kw] += np.einsum('nohw,nchw->oc', dy[:, o], xp[:, c, hs, ws])
+        dxp[:, c, hs, ws] += np.einsum('oc,nohw->nchw', w[o, :, kh, kw], dy[:, o])
+    return dxp[:, :, padding[0]:padding[0] + x.shape[2], padding[1]:padding[1] + x.shape[3]], dw
+
+def conv_kernels(x, w, b, dy, padding, stride=(1, 1), dilation=(1, 1), groups=1):
+    # y, dx and dw of the implicit gemm kernels on NCHW operands
+    import madml
+    import vknn
+    oh, ow = dy.shape[2:]
+    params = [x.shape[0], x.shape[1], 1, w.shape[2], w.shape[3], 0, *padding, 1, *stride, 1, *dilation,
+              1, oh, ow, 1, x.shape[2], x.shape[3], w.shape[0], groups]
+    y = madml.tensor(np.zeros(dy.shape, np.float32))
+    dx = madml.tensor(np.zeros(x.shape, np.float32))
+    dw = madml.tensor(np.zeros(w.shape, np.float32))
+    x_t, w_t, dy_t = madml.tensor(x), madml.tensor(w), madml.tensor(dy)
+    forward = vknn.conv_forward(params, True)
+    forward.forward(y.device_data, x_t.device_data, w_t.device_data, madml.tensor(b).device_data)
+    forward.run()
+    backward_data = vknn.conv_backward_data(params)
+    backward_data.forward(dx.device_data, dy_t.device_data, w_t.device_data)
+    backward_data.run()
+    backward_weight = vknn.conv_backward_weight(params)
+    backward_weight.forward(dw.device_data, x_t.device_data, dy_t.device_data)
+    backward_weight.run()
+    return y.download().reshape(dy.shape), dx.download().reshape(x.shape), dw.download().reshape(w.shape)
+
+@unittest.skipUnless(has_device(), 'needs a vulkan device')
+class TestKernels(unittest.TestCase):
+    def test_normalization(self):
+        import madml
+        import madml.nn as nn
+        cases = [(nn.BatchNorm2d(3), [4, 3, 5, 5]), (nn.GroupNorm(2, 4), [2, 4, 3, 3]), (nn.LayerNorm(6), [4, 6])]
+        for module, shape in cases:
+            with self.subTest(module=type(module).__name__):
+                x_np = np.random.randn(*shape).astype(np.float32)
+                dy = np.random.randn(*shape).astype(np.float32)
+                x = madml.tensor(x_np)
+                module.forward(x)
+                y_cpu = module._forward_cpu(x).host_data.copy()
+                y_gpu = module._forward_gpu(x).download().copy()
+                self.assertTrue(np.allclose(y_cpu, y_gpu, atol=1e-4))
+
+                module.y.gradient.host_data = dy
+                dx_cpu = module._backward_cpu(x, module.y).host_data.copy()
+                dw_cpu = module.w.gradient.host_data.copy()
+                db_cpu = module.bias.gradient.host_data.copy()
+                dx_gpu = module._backward_gpu(x, module.y).download().copy()
+                self.assertTrue(np.allclose(dx_cpu, dx_gpu, atol=1e-3))
+                self.assertTrue(np.allclose(dw_cpu, module.w.gradient.download(), atol=1e-3))
+                self.assertTrue(np.allclose(db_cpu, module.bias.gradient.download(), atol=1e-3))
+
+                num = numeric_grad(lambda d: module._forward_cpu(madml.tensor(d)).host_data.copy(), x_np, dy)
+                self.assertTrue(np.allclose(dx_gpu, num, atol=1e-2))
+
+    def test_rnn(self):
+        import madml
+        import madml.nn as nn
+        seq, batch, inp, hidden = 3, 2, 4, 5
+        for module in [nn.lstm(inp, hidden), nn.gru(inp, hidden)]:
+            with self.subTest(mode=module.mode):
+                h = madml.zeros([1, batch, hidden])
+                c = madml.zeros([1, batch, hidden] if module.mode == 'LSTM' else [1])
+                x_np = np.random.randn(seq, batch, inp).astype(np.float32)
+                dy = np.random.randn(seq, batch, hidden).astype(np.float32)
+                x = madml.tensor(x_np)
+                module.forward(x, h, c)
+                y_cpu = module._forward_cpu(x, h, c).host_data.copy()
+                y_gpu = module._forward_gpu(x, h, c).host_data.copy()
+                self.assertTrue(np.allclose(y_cpu, y_gpu, atol=1e-4))
+
+                module.y.gradient.host_data = dy
+                dx_cpu = module._backward_cpu(x, h, c, module.y).host_data.copy()
+                dw_cpu = module.weights[0][0].gradient.host_data.copy()
+                dx_gpu = module._backward_gpu(x, h, c, module.y).download().copy()
+                self.assertTrue(np.allclose(dx_cpu, dx_gpu, atol=1e-3))
+                self.assertTrue(np.allclose(dw_cpu, module.weights[0][0].gradient.download(), atol=1e-3))
+
+                def f(d):
+                    t = madml.tensor(d)
+                    module.forward(t, h, c)
+                    return module._forward_cpu(t, h, c).host_data.copy()
+                self.assertTrue(np.allclose(dx_gpu, numeric_grad(f, x_np, dy), atol=1e-2))
+
+    def test_conv_fft(self):
+        import madml
+        import vknn
+        batch, channels, out_channels, width, kernel, pad = 2, 3, 4, 64, 31, 15
+        params = [batch, channels, 1, 1, kernel, 0, 0, pad, 1, 1, 1, 1, 1, 1, 1, 1, width, 1, 1, width,
+                  out_channels, 1]
+        self.assertTrue(vknn.fft_conv_supported(params))
+        x = np.random.randn(batch, channels, 1, width).astype(np.float32)
+        w = np.random.randn(out_channels, channels, 1, kernel).astype(np.float32)
+        b = np.random.randn(out_channels).astype(np.float32)
+        y = madml.tensor(np.zeros([batch, out_channels, 1, width], np.float32))
+        kernel = vknn.conv_fft(params, True)
+        kernel.forward(y.device_data, madml.tensor(x).device_data, madml.tensor(w).device_data,
+                       madml.tensor(b).device_data, 0)
+        kernel.run()
+        ref = conv_reference(x, w, b, [0, pad])
+        self.assertTrue(np.allclose(y.download().reshape(ref.shape), ref, atol=1e-3 * np.abs(ref).max()))
+
+    def test_conv_winograd(self):
+        import madml
+        import vknn
+        batch, channels, out_channels, size = 2, 3, 4, 9
+        params = [batch, channels, 1, 3, 3, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, size, size, 1, size, size,
+                  out_channels, 1]
+        self.assertTrue(vknn.winograd_supported(params))
+        x = np.random.randn(batch, channels, size, size).astype(np.float32)
+        w = np.random.randn(out_channels, channels, 3, 3).astype(np.float32)
+        b = np.random.randn(out_channels).astype(np.float32)
+        y = madml.tensor(np.zeros([batch, out_channels, size, size], np.float32))
+        kernel = vknn.conv_winograd(params, True, 2)
+        kernel.forward(y.device_data, madml.tensor(x).device_data, madml.tensor(w).device_data,
+                       madml.tensor(b).device_data, 0)
+        kernel.run()
+        ref = conv_reference(x, w, b, [1, 1])
+        self.assertTrue(np.allclose(y.download().reshape(ref.shape), ref, atol=1e-3 * np.abs(ref).max()))
+
+    def test_gemm_fused(self):
+        import madml
+        import vknn
+        m, k, n = 37, 29, 45
+        x = np.random.randn(m, k).astype(np.float32)
+        w = np.random.randn(k, n).astype(np.float32)
+        b = np.random.randn(n).astype(np.float32)
+        r = np.random.randn(m, n).astype(np.float32)
+        y = madml.tensor(np.zeros([m, n], np.float32))
+        epilogue = vknn.gemm_epilogue()
+        epilogue.bias = vknn.BIAS_COLUMN
+        epilogue.activation = vknn.ACT_RELU
+        epilogue.residual = True
+        epilogue.scale = 0.5
+        kernel = vknn.gemm(1., 1., True, False, False)
+        kernel.set_epilogue(epilogue)
+        kernel.forward_fused(y.device_data, madml.tensor(x).device_data, madml.tensor(w).device_data,
+                             madml.tensor(b).device_data, madml.tensor(r).device_data)
+        kernel.run()
+        ref = np.maximum(np.matmul(x, w) + b + r, 0.) * 0.5
+        self.assertTrue(np.allclose(y.download(), ref, atol=1e-4 * k))
+
+    def test_gemm_int8(self):
+        import madml
+        import vknn
+        m, k, n = 16, 30, 12
+        k_padded = (k + 3) // 4 * 4
+        x = np.random.uniform(-1, 1, size=[m, k]).astype(np.float32)
+        w = np.random.uniform(-1, 1, size=[n, k]).astype(np.float32)
+        b = np.random.randn(n).astype(np.float32)
+        x_scale = 1. / 127.
+        x_q = vknn.init_char(np.zeros(m * k_padded, dtype=np.int8))
+        quantize = vknn.quantize(x_scale, 0, k, k_padded, False)
+        quantize.forward(x_q, madml.tensor(x).device_data)
+        quantize.run()
+        w_q = vknn.quantize_weights(madml.tensor(w).device_data)
+        y = madml.tensor(np.zeros([m, n], np.float32))
+        kernel = vknn.gemm_int8(x_scale, 0, 1., 0, True, False, False)
+        kernel.forward(y.device_data, x_q, w_q, madml.tensor(b).device_data)
+        kernel.run()
+        # every product is off by at most half a step of each operand, |x| and |w| are bounded by one
+        w_scale = np.abs(w).max() / 127.
+        ref = np.matmul(x, w.T) + b
+        self.assertTrue(np.allclose(y.download(), ref, rtol=0., atol=k * (x_scale + w_scale)))
+
+    def test_pool(self):
+        import madml
+        import madml.nn as nn
+        for module in [nn.maxpool2d(3, 2, 1), nn.avgpool2d(3, 2, 1, count_include_pad=False)]:
+            with self.subTest(module=type(module).__name__):
+                x_np = np.random.randn(2, 3, 7, 7).astype(np.float32)
+                x = madml.tensor(x_np)
+                module.forward(x)
+                y_cpu = module._forward_cpu(x).host_data.copy()
+                y_gpu = module._forward_gpu(x).download().copy()
+                self.assertTrue(np.allclose(y_cpu, y_gpu, atol=1e-5))
+
+                dy = np.random.randn(*module.y.shape).astype(np.float32)
+                module.y.gradient.host_data = dy
+                dx_cpu = module._backward_cpu(x, module.y).host_data.copy()
+                dx_gpu = module._backward_gpu(x, module.y).download().copy()
+                self.assertTrue(np.allclose(dx_cpu, dx_gpu, atol=1e-5))
+                if isinstance(module, nn.avgpool2d):
+                    num = numeric_grad(lambda d: module._forward_cpu(madml.tensor(d)).host_data.copy(), x_np, dy)
+                    self.assertTrue(np.allclose(dx_gpu, num, atol=1e-2))
+
+    def test_dropout(self):
+        import madml
+        import madml.nn as nn
+        from madml.nn.activation import philox_uniform
+        p, seed = 0.3, 1234
+        x_np = np.random.randn(5, 37).astype(np.float32)
+        x = madml.tensor(x_np)
+        module = nn.dropout(p, seed)
+        module.forward(x)
+        y = module._forward_gpu(x).download().copy()
+        keep = philox_uniform(seed, module.offset, x_np.size).reshape(x_np.shape) >= p
+        self.assertTrue(np.allclose(y, np.where(keep, x_np / (1 - p), 0.), atol=1e-6))
+
+        dy = np.random.randn(5, 37).astype(np.float32)
+        module.y.gradient.host_data = dy
+        dx = module._backward_gpu(x, module.y).download()
+        self.assertTrue(np.allclose(dx, np.where(keep, dy / (1 - p), 0.), atol=1e-6))
+
+        # the next forward draws a fresh mask
+        module.forward(x)
+        y_next = module._forward_gpu(x).download()
+        self.assertTrue(((y_next != 0) != keep).any())
+
+    def test_col2vol(self):
+        import madml
+        import vknn
+        import numba.typed as nbt
+        from madml.nn.transform import _col2vol
+        batch, channels = 2, 3
+        kernel, stride, padding, dilation = [1, 3, 3], [1, 2, 2], [0, 1, 1], [1, 1, 1]
+        vol, col = [1, 7, 7], [1, 4, 4]
+        params = [batch, channels, *kernel, *padding, *stride, *dilation, *col, *vol]
+        n_output_plane = channels * int(np.prod(kernel))
+        col_np = np.random.randn(batch, n_output_plane, int(np.prod(col))).astype(np.float32)
+        ref = np.zeros(batch * channels * int(np.prod(vol)), np.float32)
+        _col2vol(ref, col_np.ravel(), batch, channels, n_output_plane, n_output_plane, nbt.List(vol),
+                 nbt.List(col), nbt.List(kernel), nbt.List(stride), nbt.List(padding), nbt.List(dilation))
+
+        for accumulate in [False, True]:
+            with self.subTest(accumulate=accumulate):
+                # a stale volume is overwritten, or added to when accumulating
+                y = madml.tensor(np.full(ref.shape, 7., np.float32))
+                kernel_col2vol = vknn.col2vol(params, accumulate)
+                kernel_col2vol.forward(y.device_data, madml.tensor(col_np).device_data)
+                kernel_col2vol.run()
+                expected = ref + 7. if accumulate else ref
+                self.assertTrue(np.allclose(y.download().ravel(), expected, atol=1e-5))
+
+    def test_fill(self):
+        import madml
+        import madml.init as init
+        # device filled, then written and read back on the host and round tripped through the device
+        self.assertTrue(init._on_device())
+        t = madml.fill([4, 5], 2.)
+        self.assertTrue((t.host_data == 2.).all())
+        t.host_data[1] = 3.
+        expected = np.full([4, 5], 2., np.float32)
+        expected[1] = 3.
+        self.assertTrue((t.host_data == expected).all())
+        t.device_data
+        self.assertTrue((t.download() == expected).all())
+        t.host_data = np.arange(20, dtype=np.float32).reshape([4, 5])
+        t.device_data
+        self.assertTrue((t.download() == np.arange(20).reshape([4, 5])).all())
+
+        madml.manual_seed(7)
+        a = init.uniform(-1., 1.)([1000]).host_data.copy()
+        madml.manual_seed(7)
+        b = init.uniform(-1., 1.)([1000]).host_data.copy()
+        self.assertTrue((a == b).all() and (a >= -1.).all() and (a <= 1.).all())
+        c = init.trunc_normal(0., 1., -2., 2.)([1000]).host_data
+        self.assertTrue((np.abs(c) <= 2.).all())
+
+    def test_fused_optimizer(self):
+        import madml
+        import vknn
+        from madml.nn import Parameter
+        if not vknn.buffer_device_address_supported(0):
+            self.skipTest('needs buffer device addresses')
+        # the last shape spans two chunks of the fused kernel
+        shapes = [[5, 7], [4], [5000]]
+        configs = [(madml.SGD, dict(lr=0.1)), (madml.SGD, dict(lr=0.1, momentum=0.9)),
+                   (madml.adam, dict(lr=0.01)), (madml.adam, dict(lr=0.01, amsgrad=True)),
+                   (madml.Adagrad, dict(lr=0.01)), (madml.RMSprop, dict(lr=0.01))]
+        for optimizer, kwargs in configs:
+            with self.subTest(optimizer=optimizer.__name__, **kwargs):
+                data = [np.random.uniform(-1, 1, s).astype(np.float32) for s in shapes]
+                host = [Parameter(lambda s, d=d: madml.tensor(d.copy()), list(d.shape)) for d in data]
+                device = [Parameter(lambda s, d=d: madml.tensor(d.copy()), list(d.shape)).to(0) for d in data]
+                host_opt, device_opt = optimizer(host, **kwargs), optimizer(device, **kwargs)
+                self.assertTrue(device_opt._device() == 0)
+                for _ in range(3):
+                    # positive, the adagrad rule takes the root of the gradient sum
+                    grads = [np.random.uniform(0, 1, s).astype(np.float32) for s in shapes]
+                    for h, d, g in zip(host, device, grads):
+                        h.gradient.host_data = g.copy()
+                        d.gradient.host_data = g.copy()
+                    for i, p in enumerate(host):
+                        host_opt.step_cpu(i, p)
+                    host_opt.counter += 1
+                    device_opt.step()
+                    self.assertTrue(device_opt._fused is not None)
+                for h, d in zip(host, device):
+                    self.assertTrue(np.allclose(h.host_data, d.host_data, rtol=1e-4, atol=1e-4))
+
+    def test_gemm_layout(self):
+        import madml
+        import vknn
+        # square operands, the layout comes from the flags alone
+        x = np.random.randn(48, 48).astype(np.float32)
+        w = np.random.randn(48, 48).astype(np.float32)
+        b = np.random.randn(48).astype(np.float32)
+        for trans_x, trans_w in [(False, False), (True, False), (False, True)]:
+            with self.subTest(trans_x=trans_x, trans_w=trans_w):
+                y = madml.tensor(np.zeros([48, 48], np.float32))
+                kernel = vknn.gemm(1., 1., True, trans_x, trans_w)
+                kernel.forward(y.device_data, madml.tensor(x).device_data, madml.tensor(w).device_data,
+                               madml.tensor(b).device_data)
+                kernel.run()
+                ref = np.matmul(x.T if trans_x else x, w.T if trans_w else w) + b
+                self.assertTrue(np.allclose(y.download(), ref, atol=1e-3))
+
+    def test_linear_paths(self):
+        import madml
+        import madml.nn as nn
+        module = nn.linear(6, 4, bias=True)
+        module.bias.host_data = np.random.randn(4).astype(np.float32)
+        x = madml.tensor(np.random.randn(5, 6).astype(np.float32))
+        module.forward(x)
+        y_cpu = module._forward_cpu(x).host_data.copy()
+        y_gpu = module._forward_gpu(x).download().copy()
+        ref = np.matmul(x.host_data, module.w.host_data) + module.bias.host_data
+        self.assertTrue(np.allclose(y_cpu, ref, atol=1e-5))
+        self.assertTrue(np.allclose(y_gpu, ref, atol=1e-4))
+
+        module.y.gradient.host_data = np.random.randn(5, 4).astype(np.float32)
+        dx_cpu = module._backward_cpu(x, module.w, module.y).host_data.copy()
+        dw_cpu = module.w.gradient.host_data.copy()
+        db_cpu = module.bias.gradient.host_data.copy()
+        dx_gpu = module._backward_gpu(x, module.w, module.y).download()
+        self.assertTrue(np.allclose(dx_cpu, dx_gpu, atol=1e-4))
+        self.assertTrue(np.allclose(dw_cpu, module.w.gradient.download(), atol=1e-4))
+        self.assertTrue(np.allclose(db_cpu, module.bias.gradient.download(), atol=1e-4))
+
+    def test_reduce(self):
+        import madml
+        import madml.nn as nn
+        x_np = np.random.randn(3, 5, 4, 6).astype(np.float32)
+
+        def logsumexp(d, axis):
+            m = np.max(d, axis=axis, keepdims=True)
+            return np.log(np.sum(np.exp(d - m), axis=axis)) + np.squeeze(m, axis=axis)
+        # a non-last axis, two runs in one plan, and a long run split across workgroups
+        long_np = np.random.randn(10000, 3).astype(np.float32)
+        cases = [('argmax', [1], x_np, np.argmax(x_np, axis=1)),
+                 ('logsumexp', [1], x_np, logsumexp(x_np, 1)),
+                 ('logsumexp', [0, 2], x_np, logsumexp(x_np, (0, 2))),
+                 ('max', [-2], x_np, np.max(x_np, axis=2)),
+                 ('mean', [0], long_np, np.mean(long_np, axis=0))]
+        for op, axes, data, ref in cases:
+            with self.subTest(op=op, axes=axes):
+                module = nn.reduce(op, axes)
+                x = madml.tensor(data)
+                module.forward(x)
+                y_cpu = module._forward_cpu(x).host_data.copy()
+                y_gpu = module._forward_gpu(x).download().copy()
+                if op == 'argmax':
+                    self.assertTrue((y_cpu == ref).all() and (y_gpu == ref).all())
+                else:
+                    self.assertTrue(np.allclose(y_cpu, ref, atol=1e-4))
+                    self.assertTrue(np.allclose(y_gpu, ref, atol=1e-4))
+
+    def test_softmax_crossentropy(self):
+        import madml
+        import madml.nn as nn
+        import vknn
+
+        def log_softmax(d, axis):
+            shifted = d - np.max(d, axis=axis, keepdims=True)
+            return shifted - np.log(np.sum(np.exp(shifted), axis=axis, keepdims=True))
+        # a non-last axis, and a row wide enough to take a workgroup
+        for shape, axis, log in [([4, 7, 5], 1, False), ([4, 7, 5], 1, True), ([3, 300], 1, False)]:
+            with self.subTest(shape=shape, log=log):
+                x_np = np.random.randn(*shape).astype(np.float32)
+                dy = np.random.randn(*shape).astype(np.float32)
+                module = nn.softmax(axis, log)
+                x = madml.tensor(x_np)
+                module.forward(x)
+                ref = log_softmax(x_np, axis)
+                ref = ref if log else np.exp(ref)
+                self.assertTrue(np.allclose(module._forward_cpu(x).host_data, ref, atol=1e-5))
+                self.assertTrue(np.allclose(module._forward_gpu(x).download(), ref, atol=1e-5))
+
+                module.y.gradient.host_data = dy
+                dx_cpu = module._backward_cpu(x, module.y).host_data.copy()
+                dx_gpu = module._backward_gpu(x, module.y).download()
+                self.assertTrue(np.allclose(dx_cpu, dx_gpu, atol=1e-5))
+                num = numeric_grad(lambda d: log_softmax(d, axis) if log else np.exp(log_softmax(d, axis)), x_np, dy)
+                self.assertTrue(np.allclose(dx_gpu, num, atol=1e-2))
+
+        # weighted, with an ignored sample, the gradient scaled by the mean normaliser
+        n, c, ignore = 6, 5, 2
+        x_np = np.random.randn(n, c).astype(np.float32)
+        t_np = np.random.randint(0, c, size=n).astype(np.int32)
+        t_np[1] = ignore
+        w_np = np.random.uniform(0.5, 2., c).astype(np.float32)
+        valid = t_np != ignore
+        scale = 1. / np.sum(w_np[t_np[valid]])
+        p = np.exp(log_softmax(x_np, 1))
+        sample_w = np.where(valid, w_np[t_np], 0.)
+        loss_ref = -sample_w * log_softmax(x_np, 1)[np.arange(n), t_np]
+        dx_ref = sample_w[:, None] * (p - np.eye(c)[t_np]) * scale
+
+        loss = madml.tensor(np.zeros([n], np.float32))
+        dx = madml.tensor(np.zeros([n, c], np.float32))
+        kernel = vknn.cross_entropy(1, True, ignore)
+        kernel.forward(loss.device_data, dx.device_data, madml.tensor(x_np).device_data,
+                       madml.tensor(t_np, dtype=int).device_data, madml.tensor(w_np).device_data, scale)
+        kernel.run()
+        self.assertTrue(np.allclose(loss.download(), loss_ref, atol=1e-5))
+        self.assertTrue(np.allclose(dx.download(), dx_ref, atol=1e-5))
+
+    def test_elementwise_broadcast(self):
+        import madml
+        import madml.nn as nn
+        # trailing, leading, interior and scalar broadcasts
+        shapes = [([4, 1, 5], [3, 1]), ([2, 3, 4], [4]), ([3, 1], [1, 6]), ([5], [1])]
+        ops = [(nn.add, np.add), (nn.sub, np.subtract), (nn.mul, np.multiply), (nn.div, np.divide)]
+        for a_shape, b_shape in shapes:
+            for op, ref_op in ops:
+                with self.subTest(op=op.__name__, a=a_shape, b=b_shape):
+                    a_np = np.random.randn(*a_shape).astype(np.float32)
+                    # kept away from zero for div
+                    b_np = np.random.uniform(0.5, 2., b_shape).astype(np.float32)
+                    a, b = madml.tensor(a_np), madml.tensor(b_np)
+                    module = op()
+                    module.forward(a, b)
+                    ref = ref_op(a_np, b_np)
+                    self.assertTrue(list(module.y.shape) == list(ref.shape))
+                    self.assertTrue(np.allclose(module._forward_cpu(a, b).host_data, ref, atol=1e-5))
+                    self.assertTrue(np.allclose(module._forward_gpu(a, b).download(), ref, atol=1e-5))
+
+                    dy = np.random.randn(*ref.shape).astype(np.float32)
+                    module.y.gradient.host_data = dy
+                    module._backward_cpu(a, b, module.y)
+                    da_cpu, db_cpu = a.gradient.host_data.copy(), b.gradient.host_data.copy()
+                    module._backward_gpu(a, b, module.y)
+                    self.assertTrue(np.allclose(da_cpu, a.gradient.download(), atol=1e-4))
+                    self.assertTrue(np.allclose(db_cpu, b.gradient.download(), atol=1e-4))
+                    self.assertTrue(np.allclose(da_cpu, numeric_grad(lambda d: ref_op(d, b_np), a_np, dy), atol=1e-2))
+                    self.assertTrue(np.allclose(db_cpu, numeric_grad(lambda d: ref_op(a_np, d), b_np, dy), atol=1e-2))
+
+    def test_fused(self):
+        import tempfile
+        import madml
+        import madml.nn as nn
+        # a fresh expression misses the memory cache, the disk cache points at an empty directory
+        old_cache = os.environ.get('MADML_KERNEL_CACHE')
+        with tempfile.TemporaryDirectory() as cache:
+            os.environ['MADML_KERNEL_CACHE'] = cache
+            try:
+                module = nn.fused('x * {}.5'.format(np.random.randint(1 << 30)), ['x'])
+                x = madml.tensor(np.random.randn(8).astype(np.float32))
+                module.forward(x)
+                try:
+                    module._forward_gpu(x)
+                    has_shaderc = True
+                    self.assertTrue(os.path.exists(os.path.join(cache, '.madml_fused_' + module.kernel.hash + '.spv')))
+                except RuntimeError as e:
+                    # only a build without shaderc may miss, and it says why
+                    has_shaderc = False
+                    self.assertTrue('USE_SHADERC' in str(e) and module.kernel.hash in str(e))
+            finally:
+                if old_cache is None:
+                    del os.environ['MADML_KERNEL_CACHE']
+                else:
+                    os.environ['MADML_KERNEL_CACHE'] = old_cache
+
+        with self.assertRaises(RuntimeError):
+            nn.fused('relu(x * ', ['x'])
+        with self.assertRaises(RuntimeError):
+            nn.fused('x + unknown', ['x'])
+        if not has_shaderc:
+            self.skipTest('needs shaderc to compile fused kernels')
+
+        x_np = np.random.randn(4, 1, 6).astype(np.float32)
+        a_np = np.random.randn(3, 1).astype(np.float32)
+        b_np = np.random.randn(6).astype(np.float32)
+        mask_np = (np.random.rand(4, 3, 6) > 0.5).astype(np.float32)
+        ref = np.maximum(x_np * a_np + b_np, 0.) * mask_np - np.clip(-x_np, -0.5, 0.5) / (1. + np.exp(-b_np))
+        module = nn.fused('relu(x * a + b) * mask - clamp(-x, -0.5, 0.5) / (1.0 + exp(-b))', ['x', 'a', 'b', 'mask'])
+        xs = [madml.tensor(d) for d in [x_np, a_np, b_np, mask_np]]
+        module.forward(*xs)
+        self.assertTrue(list(module.y.shape) == [4, 3, 6])
+        self.assertTrue(np.allclose(module._forward_cpu(*xs).host_data, ref, atol=1e-5))
+        self.assertTrue(np.allclose(module._forward_gpu(*xs).download(), ref, atol=1e-5))
+
+    def test_transpose(self):
+        import madml
+        import madml.nn as nn
+        import vknn
+        # NCHW to CNHW and back, NHWC merges H and W, the unit axis moves no data
+        cases = [([2, 3, 4, 5], [1, 0, 2, 3]), ([3, 2, 4, 5], [1, 0, 2, 3]), ([2, 3, 4, 5], [0, 2, 3, 1]),
+                 ([2, 1, 5, 6], [1, 0, 2, 3])]
+        for shape, axes in cases:
+            with self.subTest(shape=shape, axes=axes):
+                x_np = np.random.randn(*shape).astype(np.float32)
+                ref = np.transpose(x_np, axes)
+                reshape = vknn.transpose_is_reshape(shape, axes)
+                self.assertTrue(reshape == (shape[1] == 1))
+                module = nn.transpose(axes, False)
+                x = madml.tensor(x_np)
+                module.forward(x)
+                self.assertTrue(module.y.shape == list(ref.shape))
+                self.assertTrue((module._forward_cpu(x).host_data == ref).all())
+                self.assertTrue((module._forward_gpu(x).download().reshape(ref.shape) == ref).all())
+
+                dy = np.random.randn(*ref.shape).astype(np.float32)
+                module.y.gradient.host_data = dy
+                dx = module._backward_gpu(x.gradient, module.y.gradient).download()
+                self.assertTrue((dx.reshape(shape) == np.transpose(dy, module.inverse_axes)).all())
+
+                if reshape:
+                    # in place, only the shape changes
+                    module = nn.transpose(axes, True)
+                    x = madml.tensor(x_np)
+                    module.forward(x)
+                    y = module._forward_gpu(x)
+                    self.assertTrue(y.shape == list(ref.shape))
+                    self.assertTrue((y.download().reshape(ref.shape) == ref).all())
+
+    def test_conv_implicit(self):
+        # unit stride, strided, dilated and grouped
+        cases = [((1, 1), (1, 1), (1, 1), 1), ((1, 0), (2, 2), (1, 1), 1), ((2, 2), (1, 1), (2, 2), 1),
+                 ((1, 1), (1, 2), (1, 1), 2)]
+        for padding, stride, dilation, groups in cases:
+            with self.subTest(padding=padding, stride=stride, dilation=dilation, groups=groups):
+                x = np.random.randn(2, 4, 9, 11).astype(np.float32)
+                w = np.random.randn(6, 4 // groups, 3, 3).astype(np.float32)
+                b = np.random.randn(6).astype(np.float32)
+                ref = conv_reference(x, w, b, padding, stride, dilation, groups)
+                dy = np.random.randn(*ref.shape).astype(np.float32)
+                dx_ref, dw_ref = conv_grad_reference(x, w, dy, padding, stride, dilation, groups)
+                y, dx, dw = conv_kernels(x, w, b, dy, padding, stride, dilation, groups)
+                self.assertTrue(np.allclose(y, ref, atol=1e-3))
+                self.assertTrue(np.allclose(dx, dx_ref, atol=1e-3))
+                self.assertTrue(np.allclose(dw, dw_ref, atol=1e-3))
+
+    def test_conv_depthwise(self):
+        import madml
+        import madml.nn as nn
+        channels, size = 4, 20
+        # several 16x16 output tiles, a channel multiplier, strided, and a dilated patch too wide
+        # for the shared tile that falls back to the grouped gemm
+        cases = [(1, 3, (1, 1), (1, 1), (1, 1)), (2, 3, (1, 1), (1, 1), (1, 1)), (1, 5, (2, 2), (2, 2), (1, 1)),
+                 (1, 7, (18, 18), (1, 1), (6, 6))]
+        for multiplier, kernel, padding, stride, dilation in cases:
+            with self.subTest(multiplier=multiplier, kernel=kernel, stride=stride, dilation=dilation):
+                x = np.random.randn(2, channels, size, size).astype(np.float32)
+                w = np.random.randn(channels * multiplier, 1, kernel, kernel).astype(np.float32)
+                b = np.random.randn(channels * multiplier).astype(np.float32)
+                ref = conv_reference(x, w, b, padding, stride, dilation, channels)
+                dy = np.random.randn(*ref.shape).astype(np.float32)
+                dx_ref, dw_ref = conv_grad_reference(x, w, dy, padding, stride, dilation, channels)
+                y, dx, dw = conv_kernels(x, w, b, dy, padding, stride, dilation, channels)
+                self.assertTrue(np.allclose(y, ref, atol=1e-3))
+                self.assertTrue(np.allclose(dx, dx_ref, atol=1e-3))
+                self.assertTrue(np.allclose(dw, dw_ref, atol=1e-3))
+
+        module = nn.conv2d(channels, channels, 3, padding=1, groups=channels)
+        x = madml.tensor(np.random.randn(2, channels, size, size).astype(np.float32))
+        module.forward(x)
+        ref = conv_reference(x.host_data, module.w.host_data, np.zeros(channels), (1, 1), groups=channels)
+        self.assertTrue(np.allclose(module._forward_gpu(x, module.w).download().reshape(ref.shape), ref, atol=1e-3))
+        self.assertTrue(np.allclose(module._forward_cpu(x, module.w).host_data, ref, atol=1e-3))
+
 def load_mnist():
     filename = [["training_images", "train-images-idx3-ubyte.gz"],
                 ["test_images", "t10k-images-idx3-ubyte.gz"],
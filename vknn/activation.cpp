@@ -4,7 +4,8 @@
 
 relu::relu(bool in_place, bool derivative) : m_inplace(in_place), m_derivative(derivative)
 {
-    m_future = std::async(&relu::initVulkanThing, &*this, 3);
+    m_future = getThreadPool().async(&relu::initVulkanThing, &*this, 3);
+    m_type = "relu";
     m_param.alpha = 1.f;
     m_futures.resize(3);
 }
@@ -19,9 +20,14 @@ void relu::forward(tensor& y, tensor& x, tensor& w)
         if (m_group_x > max_compute_work_group_count)
             m_group_x = max_compute_work_group_count - 1;
 
+        const bool half = halfPrecision(x, m_inplace ? x : y);
         m_future.wait();
-        if (m_derivative)
+        if (m_derivative && half)
+            createShaderModule(d_relu_fp16_spv, sizeof(d_relu_fp16_spv));
+        else if (m_derivative)
             createShaderModule(d_relu_spv, sizeof(d_relu_spv));
+        else if (half)
+            createShaderModule(relu_fp16_spv, sizeof(relu_fp16_spv));
         else
             createShaderModule(relu_spv, sizeof(relu_spv));
         createPipeline(sizeof(single_param));
@@ -36,4 +42,105 @@ void relu::forward(tensor& y, tensor& x, tensor& w)
         bindtensor(y, 2);
 
     recordCommandBuffer(static_cast<void*>(&m_param), sizeof(single_param));
-}
\ No newline at end of file
+}
+
+dropout::dropout(float prob, uint64_t seed)
+{
+    if (prob < 0.f || prob >= 1.f)
+        throw std::runtime_error("dropout probability must be in [0, 1)");
+    m_future = getThreadPool().async(&dropout::initVulkanThing, &*this, 2);
+    m_type = "dropout";
+    m_param = {};
+    m_param.seed_lo = static_cast<uint32_t>(seed);
+    m_param.seed_hi = static_cast<uint32_t>(seed >> 32);
+    m_param.prob = prob;
+    m_param.scale = 1.f / (1.f - prob);
+}
+
+void dropout::forward(tensor& y, tensor& x, uint64_t offset)
+{
+    if (y.count() != x.count())
+        throw std::runtime_error("dropout input and output differ in size");
+    m_param.offset_lo = static_cast<uint32_t>(offset);
+    m_param.offset_hi = static_cast<uint32_t>(offset >> 32);
+    if (m_pipeline == nullptr)
+    {
+        m_param.total = x.count();
+        m_group_x = std::min(static_cast<int>(alignSize(m_param.total, 1024) / 1024), max_compute_work_group_count);
+        const bool half = halfPrecision(x, y);
+        m_future.wait();
+        if (half)
+            createShaderModule(dropout_fp16_spv, sizeof(dropout_fp16_spv));
+        else
+            createShaderModule(dropout_spv, sizeof(dropout_spv));
+        createPipeline(sizeof(dropout_param));
+    }
+
+    bindtensor(x, 0);
+    bindtensor(y, 1);
+    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(dropout_param));
+}
+
+softmax_param softmaxShape(const Shape& shape, int axis)
+{
+    const int rank = static_cast<int>(shape.size());
+    if (axis < 0)
+        axis += rank;
+    if (axis < 0 || axis >= rank)
+        throw std::runtime_error("softmax axis out of range");
+    softmax_param param = {};
+    param.outer = 1;
+    param.inner = 1;
+    for (int a = 0; a < axis; ++a)
+        param.outer *= shape[a];
+    for (int a = axis + 1; a < rank; ++a)
+        param.inner *= shape[a];
+    param.classes = shape[axis];
+    param.ignore_index = -100;
+    param.grad_scale = 1.f;
+    return param;
+}
+
+softmax::softmax(int axis, bool log, bool derivative) : m_axis(axis), m_log(log), m_derivative(derivative)
+{
+    m_future = getThreadPool().async(&softmax::initVulkanThing, &*this, 5);
+    m_type = m_log ? "log_softmax" : "softmax";
+}
+
+void softmax::forward(tensor& y, tensor& x, tensor& dy)
+{
+    if (m_pipeline == nullptr)
+    {
+        m_param = softmaxShape(x.getShape(), m_axis);
+        const uint32_t samples = m_param.outer * m_param.inner;
+        const uint32_t wide = m_param.inner == 1 && m_param.classes >= kSoftmaxWideRow ? 1 : 0;
+        m_group_x = static_cast<int>(wide ? samples : alignSize(samples, 256) / 256);
+        m_group_x = std::min(m_group_x, max_compute_work_group_count);
+
+        std::vector<uint32_t> spec_data{ (m_derivative ? 2u : 0u) + (m_log ? 1u : 0u), wide, 0 };
+        std::vector<VkSpecializationMapEntry> spec_entries(spec_data.size());
+        for (uint32_t i = 0; i < spec_entries.size(); ++i)
+        {
+            spec_entries[i].constantID = i;
+            spec_entries[i].offset = i * sizeof(uint32_t);
+            spec_entries[i].size = sizeof(uint32_t);
+        }
+        VkSpecializationInfo spec_info;
+        spec_info.mapEntryCount = static_cast<uint32_t>(spec_entries.size());
+        spec_info.pMapEntries = spec_entries.data();
+        spec_info.dataSize = spec_data.size() * sizeof(uint32_t);
+        spec_info.pData = spec_data.data();
+
+        m_future.wait();
+        createShaderModule(softmax_spv, sizeof(softmax_spv));
+        createPipeline(sizeof(softmax_param), &spec_info);
+    }
+
+    // bindings the mode does not read still need a valid buffer
+    bindtensor(x, 0);
+    bindtensor(m_derivative ? dy : x, 1);
+    bindtensor(x, 2);
+    bindtensor(y, 3);
+    bindtensor(y, 4);
+    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(softmax_param));
+}
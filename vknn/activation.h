@@ -2,6 +2,7 @@
 
 #include "vknn.h"
 #include "../engine/layer.h"
+#include "softmax_param.h"
 
 struct single_param
 {
@@ -17,4 +18,41 @@ class relu : public layer
 public:
     explicit relu(bool in_place, bool derivative);
     void forward(tensor& y, tensor& x, tensor& w);
-};
\ No newline at end of file
+};
+
+struct dropout_param
+{
+    uint32_t total;
+    uint32_t seed_lo;
+    uint32_t seed_hi;
+    uint32_t offset_lo;
+    uint32_t offset_hi;
+    float prob;
+    float scale;
+};
+
+// y = x * keep / (1 - p) with the keep mask drawn from a Philox stream keyed
+// by seed, see philox.glsl. Nothing is stored between passes: the backward
+// pass is forward(dx, dy, offset) with the offset of the forward call, which
+// regenerates the same mask. Callers advance offset once per forward call.
+class dropout : public layer
+{
+    dropout_param m_param;
+public:
+    dropout(float prob, uint64_t seed);
+    void forward(tensor& y, tensor& x, uint64_t offset);
+};
+
+// forward(y, x, x) computes softmax or log softmax along axis, with derivative
+// set forward(dx, y, dy) takes the forward output and its gradient
+class softmax : public layer
+{
+    softmax_param m_param;
+    int m_axis;
+    bool m_log;
+    bool m_derivative;
+public:
+    softmax(int axis, bool log, bool derivative);
+    void forward(tensor& y, tensor& x, tensor& dy);
+};
+
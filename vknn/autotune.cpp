@@ -0,0 +1,245 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+#include "../engine/common.h"
+#include "../engine/utils.h"
+#include "autotune.h"
+
+static std::mutex kTuneMtx;
+static std::map<std::string, gemm_tile_config> kTuneDb;
+static std::string kTuneDbPath;
+static bool kTuneDbLoaded = false;
+static std::atomic<int> kAutotune(-1);
+
+static uint32_t bucket(uint32_t dim)
+{
+    uint32_t b = 1;
+    while (b < dim)
+        b <<= 1;
+    return b;
+}
+
+static std::string tuneKey(const std::string& uuid, uint32_t m, uint32_t n, uint32_t k, bool trans_a, bool trans_b)
+{
+    std::ostringstream key;
+    key << uuid << " " << bucket(m) << " " << bucket(n) << " " << bucket(k) << " " << trans_a << " " << trans_b;
+    return key.str();
+}
+
+static std::string defaultDbPath()
+{
+    const char* env = std::getenv("MADML_TUNING_DB");
+    if (env)
+        return env;
+    const char* home = std::getenv("HOME");
+    if (!home)
+        home = std::getenv("USERPROFILE");
+    if (home)
+        return std::string(home) + "/.madml_tuning.db";
+    return ".madml_tuning.db";
+}
+
+// one entry per line: <uuid> <m> <n> <k> <trans_a> <trans_b> <tile_m> <tile_n> <tile_k> <wpt_m> <wpt_n>
+static void readDb(const std::string& path)
+{
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::istringstream fields(line);
+        std::string uuid;
+        uint32_t m, n, k, trans_a, trans_b;
+        gemm_tile_config cfg;
+        if (!(fields >> uuid >> m >> n >> k >> trans_a >> trans_b >> cfg.tile_m >> cfg.tile_n >> cfg.tile_k >> cfg.wpt_m >> cfg.wpt_n))
+            continue;
+        kTuneDb[tuneKey(uuid, m, n, k, trans_a != 0, trans_b != 0)] = cfg;
+    }
+}
+
+// written to a temp file next to the database and renamed over it, so a
+// crash or a second process never sees a half-written database
+static void writeDb()
+{
+    std::ostringstream tmp;
+    tmp << kTuneDbPath << ".tmp" << std::hash<std::thread::id>()(std::this_thread::get_id()) << "_"
+        << std::chrono::steady_clock::now().time_since_epoch().count();
+    const std::string tmp_path = tmp.str();
+    {
+        std::ofstream out(tmp_path, std::ios::trunc);
+        for (const auto& entry : kTuneDb)
+        {
+            const gemm_tile_config& cfg = entry.second;
+            out << entry.first << " " << cfg.tile_m << " " << cfg.tile_n << " " << cfg.tile_k << " " << cfg.wpt_m << " " << cfg.wpt_n << "\n";
+        }
+        out.close();
+        if (!out)
+        {
+            std::cerr << "autotune: cannot write " << tmp_path << "\n";
+            std::remove(tmp_path.c_str());
+            return;
+        }
+    }
+    // rename does not replace an existing file on windows
+    if (std::rename(tmp_path.c_str(), kTuneDbPath.c_str()) != 0 &&
+        (std::remove(kTuneDbPath.c_str()) != 0 || std::rename(tmp_path.c_str(), kTuneDbPath.c_str()) != 0))
+    {
+        std::cerr << "autotune: cannot replace " << kTuneDbPath << "\n";
+        std::remove(tmp_path.c_str());
+    }
+}
+
+static void ensureDbLoaded()
+{
+    if (kTuneDbLoaded)
+        return;
+    if (kTuneDbPath.empty())
+        kTuneDbPath = defaultDbPath();
+    readDb(kTuneDbPath);
+    kTuneDbLoaded = true;
+}
+
+void setGemmAutotune(bool enable)
+{
+    kAutotune.store(enable ? 1 : 0);
+}
+
+bool gemmAutotuneEnabled()
+{
+    int enabled = kAutotune.load();
+    if (enabled < 0)
+    {
+        const char* env = std::getenv("MADML_AUTOTUNE");
+        enabled = env && std::atoi(env) != 0 ? 1 : 0;
+        kAutotune.store(enabled);
+    }
+    return enabled != 0;
+}
+
+void loadGemmTuningDb(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(kTuneMtx);
+    kTuneDb.clear();
+    kTuneDbPath = path;
+    readDb(kTuneDbPath);
+    kTuneDbLoaded = true;
+}
+
+bool lookupGemmTile(int device_id, uint32_t m, uint32_t n, uint32_t k, bool trans_a, bool trans_b, gemm_tile_config& cfg)
+{
+    const std::string key = tuneKey(deviceUUID(device_id), m, n, k, trans_a, trans_b);
+    std::lock_guard<std::mutex> lock(kTuneMtx);
+    ensureDbLoaded();
+    auto it = kTuneDb.find(key);
+    if (it == kTuneDb.end())
+        return false;
+    cfg = it->second;
+    return true;
+}
+
+std::vector<gemm_tile_config> gemmTileCandidates(uint32_t m, uint32_t n, uint32_t k)
+{
+    // tiles much larger than the problem only add idle threads
+    const uint32_t max_m = std::max<uint32_t>(16, 2 * bucket(m));
+    const uint32_t max_n = std::max<uint32_t>(16, 2 * bucket(n));
+    const uint32_t max_k = std::max<uint32_t>(8, bucket(k));
+
+    std::vector<gemm_tile_config> candidates;
+    for (uint32_t tile_m : { 16u, 32u, 64u, 128u })
+    {
+        for (uint32_t tile_n : { 16u, 32u, 64u, 128u })
+        {
+            for (uint32_t tile_k : { 8u, 16u, 32u })
+            {
+                // shared tiles must fit the 16KB every vulkan device guarantees
+                if (tile_m > max_m || tile_n > max_n || tile_k > max_k || (tile_m + tile_n) * tile_k * 4 > 16384)
+                    continue;
+                for (uint32_t threads : { 8u, 16u })
+                {
+                    if (tile_m < threads || tile_n < threads || tile_m / threads > 8 || tile_n / threads > 8)
+                        continue;
+                    gemm_tile_config cfg;
+                    cfg.tile_m = tile_m;
+                    cfg.tile_n = tile_n;
+                    cfg.tile_k = tile_k;
+                    cfg.wpt_m = tile_m / threads;
+                    cfg.wpt_n = tile_n / threads;
+                    candidates.push_back(cfg);
+                }
+            }
+        }
+    }
+    return candidates;
+}
+
+gemm_tile_config tuneGemm(uint32_t batch, uint32_t m, uint32_t n, uint32_t k, bool trans_a, bool trans_b)
+{
+    const int device_id = defaultDevice();
+    gemm_tile_config best = selectGemmTile(m, n, k);
+    if (lookupGemmTile(device_id, m, n, k, trans_a, trans_b, best))
+        return best;
+
+    batch = std::max<uint32_t>(batch, 1);
+    std::vector<int> params = {
+        static_cast<int>(batch), static_cast<int>(m), static_cast<int>(n), static_cast<int>(k),
+        static_cast<int>(trans_a ? m : k), static_cast<int>(trans_b ? k : n), static_cast<int>(n), static_cast<int>(n),
+        static_cast<int>(m * k), static_cast<int>(k * n), 0, static_cast<int>(m * n)
+    };
+    tensor a(1.f, Shape{ static_cast<int>(batch * m * k) });
+    tensor b(1.f, Shape{ static_cast<int>(batch * k * n) });
+    tensor c(0.f, Shape{ 1 });
+    tensor d(0.f, Shape{ static_cast<int>(batch * m * n) });
+
+    double best_us = -1.0;
+    for (const gemm_tile_config& cfg : gemmTileCandidates(m, n, k))
+    {
+        // a tile the device cannot build throws from forward, one it cannot
+        // run fails the submit or the wait
+        std::unique_ptr<gemm_strided_batched> l;
+        try
+        {
+            l.reset(new gemm_strided_batched(1.f, 0.f, false, trans_a, trans_b, params));
+            l->setTile(cfg);
+            l->forward(d, a, b, c);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "autotune: skipping tile " << cfg.tile_m << "x" << cfg.tile_n << "x" << cfg.tile_k << ": " << e.what() << "\n";
+            continue;
+        }
+
+        double us = 0.0;
+        try
+        {
+            l->runCommandBuffer();
+            for (int i = 0; i < 5; ++i)
+            {
+                auto begin = std::chrono::high_resolution_clock::now();
+                l->runCommandBuffer();
+                const double t = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - begin).count();
+                if (i == 0 || t < us)
+                    us = t;
+            }
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "autotune: skipping tile " << cfg.tile_m << "x" << cfg.tile_n << "x" << cfg.tile_k << ": " << e.what() << "\n";
+            continue;
+        }
+        if (best_us < 0.0 || us < best_us)
+        {
+            best_us = us;
+            best = cfg;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(kTuneMtx);
+    ensureDbLoaded();
+    kTuneDb[tuneKey(deviceUUID(device_id), m, n, k, trans_a, trans_b)] = best;
+    writeDb();
+    return best;
+}
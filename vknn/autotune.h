@@ -0,0 +1,22 @@
+#pragma once
+
+#include "vknn.h"
+#include "gemm.h"
+
+// GEMM tile autotuner. Winners are stored per device UUID and shape bucket
+// (each of m, n, k rounded up to a power of two) in a text database, read
+// once on first lookup and rewritten whenever a new bucket is tuned. The
+// database lives at MADML_TUNING_DB, or ~/.madml_tuning.db when unset.
+//
+// Tuning on first use of a bucket is off unless MADML_AUTOTUNE=1 or
+// setGemmAutotune(true); tuneGemm can always be called ahead of time.
+
+void setGemmAutotune(bool enable);
+bool gemmAutotuneEnabled();
+
+void loadGemmTuningDb(const std::string& path);
+bool lookupGemmTile(int device_id, uint32_t m, uint32_t n, uint32_t k, bool trans_a, bool trans_b, gemm_tile_config& cfg);
+
+// benchmarks every candidate tile on the default device and records the fastest
+gemm_tile_config tuneGemm(uint32_t batch, uint32_t m, uint32_t n, uint32_t k, bool trans_a, bool trans_b);
+std::vector<gemm_tile_config> gemmTileCandidates(uint32_t m, uint32_t n, uint32_t k);
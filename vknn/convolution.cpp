@@ -7,7 +7,7 @@ constexpr int local_sz_y_conv = 64;
 
 vol2col::vol2col(std::vector<int>& params)
 {
-    m_future = std::async(&vol2col::initVulkanThing, &*this, 2);
+    m_future = getThreadPool().async(&vol2col::initVulkanThing, &*this, 2);
     m_type = "vol2col";
 
     m_param.batchsize = params[0];
@@ -18,7 +18,7 @@ vol2col::vol2col(std::vector<int>& params)
     m_param.kernel_w = params[4];
 
     m_param.pad_d = params[5];
-    m_param.pad_h = params[9];
+    m_param.pad_h = params[6];
     m_param.pad_w = params[7];
 
     m_param.stride_d = params[8];
@@ -58,8 +58,12 @@ void vol2col::forward(tensor& col, tensor& vol)
         if (m_group_y > max_compute_work_group_count)
             m_group_y = max_compute_work_group_count;
         m_group_z = 1;
+        const bool half = halfPrecision(vol, col);
         m_future.wait();
-        createShaderModule(vol2col_spv, sizeof(vol2col_spv));
+        if (half)
+            createShaderModule(vol2col_fp16_spv, sizeof(vol2col_fp16_spv));
+        else
+            createShaderModule(vol2col_spv, sizeof(vol2col_spv));
         createPipeline(sizeof(vol2col_param));
     }
 
@@ -68,9 +72,9 @@ void vol2col::forward(tensor& col, tensor& vol)
     recordCommandBuffer(static_cast<void*>(&m_param), sizeof(vol2col_param));
 }
 
-col2vol::col2vol(std::vector<int>& params)
+col2vol::col2vol(std::vector<int>& params, bool accumulate) : m_accumulate(accumulate)
 {
-    m_future = std::async(&vol2col::initVulkanThing, &*this, 2);
+    m_future = getThreadPool().async(&col2vol::initVulkanThing, &*this, 2);
     m_type = "col2vol";
     m_param.batchsize = params[0];
     m_param.channels = params[1];
@@ -80,7 +84,7 @@ col2vol::col2vol(std::vector<int>& params)
     m_param.kernel_w = params[4];
 
     m_param.pad_d = params[5];
-    m_param.pad_h = params[9];
+    m_param.pad_h = params[6];
     m_param.pad_w = params[7];
 
     m_param.stride_d = params[8];
@@ -104,26 +108,272 @@ void col2vol::forward(tensor& vol, tensor& col)
 {
     if (m_pipeline == nullptr)
     {
-        size_t tmp = m_param.channels;
-        tmp *= static_cast<size_t>(m_param.kernel_h);
-        tmp *= static_cast<size_t>(m_param.kernel_w);
-        tmp *= static_cast<size_t>(m_param.kernel_d);
+        // one thread per vol element
+        m_param.total = m_param.batchsize * m_param.channels * m_param.depth_vol * m_param.height_vol * m_param.width_vol;
+        m_group_x = static_cast<int>(alignSize(m_param.total, 256)) / 256;
+        if (m_group_x > max_compute_work_group_count)
+            m_group_x = max_compute_work_group_count;
+        m_group_y = 1;
+        m_group_z = 1;
 
-        m_group_x = static_cast<int>(alignSize(tmp, local_sz_x_conv)) / local_sz_x_conv;
+        std::vector<uint32_t> spec_data{ m_accumulate ? 1u : 0u };
+        std::vector<VkSpecializationMapEntry> spec_entries(spec_data.size());
+        for (uint32_t i = 0; i < spec_entries.size(); ++i)
+        {
+            spec_entries[i].constantID = i;
+            spec_entries[i].offset = i * sizeof(uint32_t);
+            spec_entries[i].size = sizeof(uint32_t);
+        }
+        VkSpecializationInfo spec_info;
+        spec_info.mapEntryCount = static_cast<uint32_t>(spec_entries.size());
+        spec_info.pMapEntries = spec_entries.data();
+        spec_info.dataSize = spec_data.size() * sizeof(uint32_t);
+        spec_info.pData = spec_data.data();
+
+        const bool half = halfPrecision(vol, col);
+        m_future.wait();
+        if (half)
+            createShaderModule(col2vol_fp16_spv, sizeof(col2vol_fp16_spv));
+        else
+            createShaderModule(col2vol_spv, sizeof(col2vol_spv));
+        createPipeline(sizeof(vol2col_param), &spec_info);
+    }
+    if (static_cast<uint32_t>(vol.count()) < m_param.total)
+        throw std::runtime_error("col2vol output is smaller than its params");
+
+    bindtensor(col, 0);
+    bindtensor(vol, 1);
+    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(vol2col_param));
+}
+
+conv_implicit::conv_implicit(std::vector<int>& params, uint32_t mode) : m_mode(mode)
+{
+    if (params.size() != 21 && params.size() != 22)
+        throw std::runtime_error("conv expects vol2col params followed by out_channels and groups");
+    m_future = getThreadPool().async(&conv_implicit::initVulkanThing, &*this, 5);
+    m_param.batchsize = params[0];
+    m_param.in_channels = params[1];
+
+    m_param.kernel_d = params[2];
+    m_param.kernel_h = params[3];
+    m_param.kernel_w = params[4];
+
+    m_param.pad_d = params[5];
+    m_param.pad_h = params[6];
+    m_param.pad_w = params[7];
+
+    m_param.stride_d = params[8];
+    m_param.stride_h = params[9];
+    m_param.stride_w = params[10];
+
+    m_param.dilation_d = params[11];
+    m_param.dilation_h = params[12];
+    m_param.dilation_w = params[13];
+
+    m_param.depth_col = params[14];
+    m_param.height_col = params[15];
+    m_param.width_col = params[16];
+
+    m_param.depth_vol = params[17];
+    m_param.height_vol = params[18];
+    m_param.width_vol = params[19];
+
+    m_param.out_channels = params[20];
+    m_param.use_bias = 0;
+    m_param.groups = params.size() == 22 ? params[21] : 1;
+    m_epilogue.bias = kBiasRow;
+    if (m_param.groups == 0 || m_param.in_channels % m_param.groups != 0 || m_param.out_channels % m_param.groups != 0)
+        throw std::runtime_error("conv channels must be divisible by groups");
+}
+
+bool conv_implicit::depthwise() const
+{
+    // the forward input patch of a 16x16 output tile has to fit the 48x48 shared tile
+    const uint32_t patch_h = 15 * m_param.stride_h + (m_param.kernel_h - 1) * m_param.dilation_h + 1;
+    const uint32_t patch_w = 15 * m_param.stride_w + (m_param.kernel_w - 1) * m_param.dilation_w + 1;
+    return m_param.groups == m_param.in_channels &&
+        m_param.kernel_d == 1 && m_param.stride_d == 1 && m_param.pad_d == 0 &&
+        m_param.kernel_h * m_param.kernel_w <= 49 && patch_h <= 48 && patch_w <= 48;
+}
+
+void conv_implicit::createConvPipeline()
+{
+    const uint32_t kk = m_param.kernel_d * m_param.kernel_h * m_param.kernel_w;
+    const uint32_t p = m_param.depth_col * m_param.height_col * m_param.width_col;
+    const uint32_t v = m_param.depth_vol * m_param.height_vol * m_param.width_vol;
+
+    if (depthwise())
+    {
+        uint32_t spec_data[8] = {
+            m_param.kernel_h, m_param.kernel_w, m_mode,
+            m_epilogue.activation, m_epilogue.residual, 0, 0, m_epilogue.bias == kBiasElement
+        };
+        memcpy(&spec_data[5], &m_epilogue.slope, sizeof(float));
+        memcpy(&spec_data[6], &m_epilogue.scale, sizeof(float));
+        VkSpecializationMapEntry entries[8];
+        for (uint32_t i = 0; i < 8; ++i)
+        {
+            entries[i].constantID = i;
+            entries[i].offset = i * sizeof(uint32_t);
+            entries[i].size = sizeof(uint32_t);
+        }
+        VkSpecializationInfo spec_info = {};
+        spec_info.mapEntryCount = 8;
+        spec_info.pMapEntries = entries;
+        spec_info.dataSize = sizeof(spec_data);
+        spec_info.pData = spec_data;
+
+        if (m_mode == 2)
+        {
+            m_group_x = m_param.out_channels;
+            m_group_y = 1;
+            m_group_z = 1;
+        }
+        else
+        {
+            const uint32_t h = m_mode == 0 ? m_param.height_col : m_param.height_vol;
+            const uint32_t w = m_mode == 0 ? m_param.width_col : m_param.width_vol;
+            const uint32_t planes = m_param.batchsize * (m_mode == 0 ? m_param.out_channels * m_param.depth_col : m_param.in_channels * m_param.depth_vol);
+            m_group_x = static_cast<int>(alignSize(w, 16)) / 16;
+            m_group_y = static_cast<int>(alignSize(h, 16)) / 16;
+            m_group_z = planes;
+        }
         if (m_group_x > max_compute_work_group_count)
             m_group_x = max_compute_work_group_count;
-        m_group_y = static_cast<int>(alignSize(m_param.batchsize, local_sz_y_conv)) / local_sz_y_conv;
         if (m_group_y > max_compute_work_group_count)
             m_group_y = max_compute_work_group_count;
-        m_group_z = 1;
+        if (m_group_z > max_compute_work_group_count)
+            m_group_z = max_compute_work_group_count;
+
         m_future.wait();
-        createShaderModule(col2vol_spv, sizeof(col2vol_spv));
-        createPipeline(sizeof(vol2col_param));
+        createShaderModule(conv_depthwise_spv, sizeof(conv_depthwise_spv));
+        createPipeline(sizeof(conv_param), &spec_info);
+        return;
     }
 
-    bindtensor(vol, 0);
-    bindtensor(col, 1);
-    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(vol2col_param));
+    const uint32_t cig = m_param.in_channels / m_param.groups;
+    const uint32_t cog = m_param.out_channels / m_param.groups;
+    uint32_t m, n, k;
+    if (m_mode == 0)
+    {
+        m = cog;
+        n = m_param.batchsize * p;
+        k = cig * kk;
+    }
+    else if (m_mode == 1)
+    {
+        m = cig;
+        n = m_param.batchsize * v;
+        k = cog * kk;
+    }
+    else
+    {
+        m = cog;
+        n = cig * kk;
+        k = m_param.batchsize * p;
+    }
+
+    const gemm_tile_config cfg = selectGemmTile(m, n, k);
+    uint32_t spec_data[13] = {
+        cfg.tile_m, cfg.tile_n, cfg.tile_k, cfg.wpt_m, cfg.wpt_n, m_mode,
+        cfg.tile_n / cfg.wpt_n, cfg.tile_m / cfg.wpt_m,
+        m_epilogue.activation, m_epilogue.residual, 0, 0, m_epilogue.bias == kBiasElement
+    };
+    memcpy(&spec_data[10], &m_epilogue.slope, sizeof(float));
+    memcpy(&spec_data[11], &m_epilogue.scale, sizeof(float));
+    VkSpecializationMapEntry entries[13];
+    for (uint32_t i = 0; i < 13; ++i)
+    {
+        entries[i].constantID = i;
+        entries[i].offset = i * sizeof(uint32_t);
+        entries[i].size = sizeof(uint32_t);
+    }
+    VkSpecializationInfo spec_info = {};
+    spec_info.mapEntryCount = 13;
+    spec_info.pMapEntries = entries;
+    spec_info.dataSize = sizeof(spec_data);
+    spec_info.pData = spec_data;
+
+    m_group_x = static_cast<int>(alignSize(n, cfg.tile_n)) / cfg.tile_n;
+    m_group_y = static_cast<int>(alignSize(m, cfg.tile_m)) / cfg.tile_m;
+    m_group_z = m_param.groups;
+    if (m_group_x > max_compute_work_group_count)
+        m_group_x = max_compute_work_group_count;
+    if (m_group_y > max_compute_work_group_count)
+        m_group_y = max_compute_work_group_count;
+    if (m_group_z > max_compute_work_group_count)
+        m_group_z = max_compute_work_group_count;
+
+    m_future.wait();
+    createShaderModule(conv_implicit_spv, sizeof(conv_implicit_spv));
+    createPipeline(sizeof(conv_param), &spec_info);
+}
+
+conv_forward::conv_forward(std::vector<int>& params, bool use_bias) : conv_implicit(params, 0)
+{
+    m_type = "conv_forward";
+    m_param.use_bias = use_bias;
+}
+
+void conv_forward::setEpilogue(const gemm_epilogue& epilogue)
+{
+    if (epilogue.bias >= kBiasColumn || epilogue.activation > kActSigmoid)
+        throw std::runtime_error("conv epilogue takes a per channel or per element bias");
+    m_epilogue = epilogue;
+}
+
+void conv_forward::forward(tensor& y, tensor& x, tensor& w, tensor& b)
+{
+    forwardFused(y, x, w, b, y);
+}
+
+void conv_forward::forwardFused(tensor& y, tensor& x, tensor& w, tensor& b, tensor& r)
+{
+    if (m_pipeline == nullptr)
+        createConvPipeline();
+
+    bindtensor(x, 0);
+    bindtensor(w, 1);
+    bindtensor(b, 2);
+    bindtensor(y, 3);
+    bindtensor(r, 4);
+    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(conv_param));
+}
+
+conv_backward_data::conv_backward_data(std::vector<int>& params) : conv_implicit(params, 1)
+{
+    m_type = "conv_backward_data";
+}
+
+void conv_backward_data::forward(tensor& dx, tensor& dy, tensor& w)
+{
+    if (m_pipeline == nullptr)
+        createConvPipeline();
+
+    bindtensor(dy, 0);
+    bindtensor(w, 1);
+    bindtensor(w, 2);
+    bindtensor(dx, 3);
+    bindtensor(dx, 4);
+    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(conv_param));
+}
+
+conv_backward_weight::conv_backward_weight(std::vector<int>& params) : conv_implicit(params, 2)
+{
+    m_type = "conv_backward_weight";
+}
+
+void conv_backward_weight::forward(tensor& dw, tensor& x, tensor& dy)
+{
+    if (m_pipeline == nullptr)
+        createConvPipeline();
+
+    bindtensor(x, 0);
+    bindtensor(dy, 1);
+    bindtensor(dy, 2);
+    bindtensor(dw, 3);
+    bindtensor(dw, 4);
+    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(conv_param));
 }
 
 void cpu_vol2col(py::array_t<float, py::array::c_style | py::array::forcecast> vol,
@@ -141,7 +391,7 @@ void cpu_vol2col(py::array_t<float, py::array::c_style | py::array::forcecast> v
     int kernel_w = params[4];
 
     int pad_d = params[5];
-    int pad_h = params[9];
+    int pad_h = params[6];
     int pad_w = params[7];
 
     int stride_d = params[8];
@@ -208,7 +458,7 @@ void cpu_col2vol(py::array_t<float, py::array::c_style | py::array::forcecast> v
     int kernel_w = params[4];
 
     int pad_d = params[5];
-    int pad_h = params[9];
+    int pad_h = params[6];
     int pad_w = params[7];
 
     int stride_d = params[8];
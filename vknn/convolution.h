@@ -2,6 +2,8 @@
 
 #include "vknn.h"
 #include "../engine/layer.h"
+#include "gemm.h"
+#include "epilogue.h"
 
 struct vol2col_param
 {
@@ -36,14 +38,87 @@ public:
     void forward(tensor& col, tensor& vol);
 };
 
+// Gathers every vol element from the col entries that read it, one thread
+// per element, so overlapping windows never race. With accumulate the sums
+// are added to vol, e.g. an input gradient, otherwise vol is overwritten.
 class col2vol : public layer
 {
     vol2col_param m_param;
+    bool m_accumulate;
 public:
-    explicit col2vol(std::vector<int>& params);
+    explicit col2vol(std::vector<int>& params, bool accumulate = false);
     void forward(tensor& vol, tensor& col);
 };
 
+struct conv_param
+{
+    uint32_t batchsize;
+    uint32_t in_channels;
+    uint32_t out_channels;
+    uint32_t kernel_d;
+    uint32_t kernel_h;
+    uint32_t kernel_w;
+    uint32_t pad_d;
+    uint32_t pad_h;
+    uint32_t pad_w;
+    uint32_t stride_d;
+    uint32_t stride_h;
+    uint32_t stride_w;
+    uint32_t dilation_d;
+    uint32_t dilation_h;
+    uint32_t dilation_w;
+    uint32_t depth_col;
+    uint32_t height_col;
+    uint32_t width_col;
+    uint32_t depth_vol;
+    uint32_t height_vol;
+    uint32_t width_vol;
+    uint32_t use_bias;
+    uint32_t groups;
+};
+
+// Implicit GEMM convolution on NCDHW tensors, im2col addresses are computed in
+// the kernel instead of going through a col buffer. params use the vol2col
+// layout followed by out_channels and optionally groups. Grouped convolutions
+// batch one GEMM per group into a single dispatch; depthwise convolutions that
+// fit conv_depthwise.comp go through the direct kernel instead.
+class conv_implicit : public layer
+{
+protected:
+    conv_param m_param;
+    uint32_t m_mode;
+    gemm_epilogue m_epilogue;
+    void createConvPipeline();
+public:
+    conv_implicit(std::vector<int>& params, uint32_t mode);
+    bool depthwise() const;
+};
+
+class conv_forward : public conv_implicit
+{
+public:
+    conv_forward(std::vector<int>& params, bool use_bias);
+    void forward(tensor& y, tensor& x, tensor& w, tensor& b);
+    // r is only read when the epilogue has a residual
+    void forwardFused(tensor& y, tensor& x, tensor& w, tensor& b, tensor& r);
+    // must be called before the first forward
+    void setEpilogue(const gemm_epilogue& epilogue);
+};
+
+class conv_backward_data : public conv_implicit
+{
+public:
+    explicit conv_backward_data(std::vector<int>& params);
+    void forward(tensor& dx, tensor& dy, tensor& w);
+};
+
+class conv_backward_weight : public conv_implicit
+{
+public:
+    explicit conv_backward_weight(std::vector<int>& params);
+    void forward(tensor& dw, tensor& x, tensor& dy);
+};
+
 void cpu_vol2col(py::array_t<float, py::array::c_style | py::array::forcecast> vol,
     py::array_t<float, py::array::c_style | py::array::forcecast> col,
     int n_output_plane, int index_length, std::vector<int>& params);
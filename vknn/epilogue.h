@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+
+enum epilogue_bias
+{
+    kBiasElement = 0,
+    kBiasRow = 1,
+    kBiasColumn = 2
+};
+
+enum epilogue_activation
+{
+    kActNone = 0,
+    kActRelu = 1,
+    kActLeakyRelu = 2,
+    kActSigmoid = 3
+};
+
+// Fused output stage of the tiled GEMM and convolution kernels,
+// d = activation(acc + bias + residual) * scale. It is compiled into the
+// pipeline through specialization constants, so it has to be set before the
+// first forward. Convolutions are GEMMs with one row per output channel, so
+// they default to kBiasRow and take kBiasElement for a full [n, c, d, h, w] bias.
+struct gemm_epilogue
+{
+    uint32_t bias = kBiasElement;
+    uint32_t activation = kActNone;
+    bool residual = false;
+    float slope = 0.01f;
+    float scale = 1.0f;
+};
@@ -0,0 +1,187 @@
+#include "../engine/common.h"
+#include "../engine/utils.h"
+#include "fft.h"
+
+constexpr int local_sz_x_fft = 256;
+
+static uint32_t fftSize(uint32_t n)
+{
+    uint32_t size = 1;
+    while (size < n)
+        size <<= 1;
+    return size;
+}
+
+fft_kernel::fft_kernel(const fft_param& param, fft_stage stage) : m_param(param), m_stage(stage)
+{
+    m_future = getThreadPool().async(&fft_kernel::initVulkanThing, &*this, 3);
+    m_type = "fft_kernel";
+}
+
+void fft_kernel::forward(tensor& t0, tensor& t1, tensor& t2)
+{
+    if (m_pipeline == nullptr)
+    {
+        const size_t spectrum = static_cast<size_t>(m_param.fft_h) * m_param.fft_w;
+        if (m_stage == fft_stage::kTransform)
+        {
+            // one workgroup per line
+            m_group_x = static_cast<int>(m_param.planes * (m_param.axis == 0 ? m_param.fft_h : m_param.fft_w));
+        }
+        else
+        {
+            size_t total = 0;
+            if (m_stage == fft_stage::kPack)
+                total = m_param.planes * spectrum;
+            else if (m_stage == fft_stage::kUnpack)
+                total = static_cast<size_t>(m_param.planes) * m_param.height * m_param.width;
+            else
+                total = static_cast<size_t>(m_param.batchsize) * m_param.out_channels * m_param.depth * spectrum;
+            m_group_x = static_cast<int>(alignSize(total, local_sz_x_fft)) / local_sz_x_fft;
+        }
+        if (m_group_x > max_compute_work_group_count)
+            m_group_x = max_compute_work_group_count;
+
+        const uint32_t mode = m_stage == fft_stage::kUnpack ? 1 : 0;
+        VkSpecializationMapEntry entry = { 0, 0, sizeof(uint32_t) };
+        VkSpecializationInfo spec_info = {};
+        spec_info.mapEntryCount = 1;
+        spec_info.pMapEntries = &entry;
+        spec_info.dataSize = sizeof(uint32_t);
+        spec_info.pData = &mode;
+
+        m_future.wait();
+        if (m_stage == fft_stage::kTransform)
+            createShaderModule(fft_stockham_spv, sizeof(fft_stockham_spv));
+        else if (m_stage == fft_stage::kMultiply)
+            createShaderModule(fft_cmac_spv, sizeof(fft_cmac_spv));
+        else
+            createShaderModule(fft_pack_spv, sizeof(fft_pack_spv));
+        createPipeline(sizeof(fft_param), &spec_info);
+    }
+
+    bindtensor(t0, 0);
+    bindtensor(t1, 1);
+    bindtensor(t2, 2);
+    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(fft_param));
+}
+
+bool fftConvSupported(std::vector<int>& params)
+{
+    // kernel d, pad d, stride d h w, dilation d h w, groups
+    const bool ungrouped = params.size() == 21 || (params.size() == 22 && params[21] == 1);
+    return ungrouped && params[2] == 1 && params[5] == 0 &&
+        params[8] == 1 && params[9] == 1 && params[10] == 1 &&
+        params[11] == 1 && params[12] == 1 && params[13] == 1;
+}
+
+conv_fft::conv_fft(std::vector<int>& params, bool use_bias) : m_weight_version(-1), m_filter_pending(false)
+{
+    if (!fftConvSupported(params))
+        throw std::runtime_error("fft convolution needs an ungrouped 2D kernel with unit stride and dilation");
+
+    const uint32_t kernel_h = params[3];
+    const uint32_t kernel_w = params[4];
+    m_param = {};
+    m_param.batchsize = params[0];
+    m_param.in_channels = params[1];
+    m_param.pad_h = params[6];
+    m_param.pad_w = params[7];
+    m_param.depth = params[14];
+    m_param.out_channels = params[20];
+    m_param.use_bias = use_bias;
+    // the circular correlation must not wrap into the padded input
+    m_param.fft_h = fftSize(params[18] + 2 * m_param.pad_h);
+    m_param.fft_w = fftSize(params[19] + 2 * m_param.pad_w);
+
+    fft_param pack_x = m_param;
+    pack_x.planes = m_param.batchsize * m_param.in_channels * m_param.depth;
+    pack_x.height = params[18];
+    pack_x.width = params[19];
+
+    fft_param pack_w = m_param;
+    pack_w.planes = m_param.out_channels * m_param.in_channels;
+    pack_w.height = kernel_h;
+    pack_w.width = kernel_w;
+    pack_w.pad_h = 0;
+    pack_w.pad_w = 0;
+
+    fft_param unpack_y = m_param;
+    unpack_y.planes = m_param.batchsize * m_param.out_channels * m_param.depth;
+    unpack_y.height = params[15];
+    unpack_y.width = params[16];
+
+    m_pack_x.reset(new fft_kernel(pack_x, fft_stage::kPack));
+    m_pack_w.reset(new fft_kernel(pack_w, fft_stage::kPack));
+    m_unpack_y.reset(new fft_kernel(unpack_y, fft_stage::kUnpack));
+    m_multiply.reset(new fft_kernel(m_param, fft_stage::kMultiply));
+
+    for (uint32_t axis = 0; axis < 2; ++axis)
+    {
+        if ((axis == 0 ? m_param.fft_w : m_param.fft_h) == 1)
+            continue;
+        pack_x.axis = pack_w.axis = unpack_y.axis = axis;
+        unpack_y.inverse = 1;
+        m_fft_x[axis].reset(new fft_kernel(pack_x, fft_stage::kTransform));
+        m_fft_w[axis].reset(new fft_kernel(pack_w, fft_stage::kTransform));
+        m_ifft_y[axis].reset(new fft_kernel(unpack_y, fft_stage::kTransform));
+    }
+}
+
+void conv_fft::forward(tensor& y, tensor& x, tensor& w, tensor& b, int weight_version)
+{
+    if (m_xf.isEmpty())
+    {
+        const int fft_h = m_param.fft_h;
+        const int fft_w = m_param.fft_w;
+        const int x_planes = m_param.batchsize * m_param.in_channels * m_param.depth;
+        const int w_planes = m_param.out_channels * m_param.in_channels;
+        const int y_planes = m_param.batchsize * m_param.out_channels * m_param.depth;
+        m_xf = tensor(0.f, Shape{ x_planes, fft_h, fft_w, 2 });
+        m_wf = tensor(0.f, Shape{ w_planes, fft_h, fft_w, 2 });
+        m_yf = tensor(0.f, Shape{ y_planes, fft_h, fft_w, 2 });
+        m_scratch = tensor(0.f, Shape{ std::max(x_planes, std::max(w_planes, y_planes)), fft_h, fft_w, 2 });
+    }
+
+    // the filter spectrum is reused until the caller reports new weights
+    if (weight_version != m_weight_version)
+    {
+        m_pack_w->forward(w, m_wf, b);
+        for (auto& t : m_fft_w)
+            if (t)
+                t->forward(m_wf, m_scratch, m_scratch);
+        m_weight_version = weight_version;
+        m_filter_pending = true;
+    }
+    m_pack_x->forward(x, m_xf, b);
+    for (auto& t : m_fft_x)
+        if (t)
+            t->forward(m_xf, m_scratch, m_scratch);
+    m_multiply->forward(m_xf, m_wf, m_yf);
+    for (auto& t : m_ifft_y)
+        if (t)
+            t->forward(m_yf, m_scratch, m_scratch);
+    m_unpack_y->forward(y, m_yf, b);
+}
+
+int conv_fft::runCommandBuffer()
+{
+    if (m_filter_pending)
+    {
+        m_pack_w->runCommandBuffer();
+        for (auto& t : m_fft_w)
+            if (t)
+                t->runCommandBuffer();
+        m_filter_pending = false;
+    }
+    m_pack_x->runCommandBuffer();
+    for (auto& t : m_fft_x)
+        if (t)
+            t->runCommandBuffer();
+    m_multiply->runCommandBuffer();
+    for (auto& t : m_ifft_y)
+        if (t)
+            t->runCommandBuffer();
+    m_unpack_y->runCommandBuffer();
+    return 1;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "vknn.h"
+#include "../engine/layer.h"
+
+// shared push constants of the fft stages, each stage reads the fields it needs
+struct fft_param
+{
+    uint32_t planes;
+    uint32_t height;
+    uint32_t width;
+    uint32_t pad_h;
+    uint32_t pad_w;
+    uint32_t fft_h;
+    uint32_t fft_w;
+    uint32_t axis;
+    uint32_t inverse;
+    uint32_t batchsize;
+    uint32_t in_channels;
+    uint32_t out_channels;
+    uint32_t depth;
+    uint32_t use_bias;
+};
+
+enum class fft_stage
+{
+    kPack = 0,
+    kUnpack = 1,
+    kTransform = 2,
+    kMultiply = 3
+};
+
+// pack/unpack: forward(real, complex, bias), transform: forward(data, scratch, scratch),
+// multiply: forward(x, w, y)
+class fft_kernel : public layer
+{
+    fft_param m_param;
+    fft_stage m_stage;
+public:
+    fft_kernel(const fft_param& param, fft_stage stage);
+    void forward(tensor& t0, tensor& t1, tensor& t2);
+};
+
+// Stride 1, dilation 1 convolution in the frequency domain for large 1D and
+// 2D kernels. Input and filter are zero padded to power-of-two fft_h x fft_w
+// planes, transformed with a Stockham FFT, multiplied and summed over input
+// channels, transformed back and cropped. The filter spectrum is cached and
+// only recomputed when weight_version changes. params use the conv_forward
+// layout (vol2col params followed by out_channels and optionally groups).
+class conv_fft
+{
+    fft_param m_param;
+    int m_weight_version;
+    bool m_filter_pending;
+
+    tensor m_xf;
+    tensor m_wf;
+    tensor m_yf;
+    tensor m_scratch;
+    std::unique_ptr<fft_kernel> m_pack_x;
+    std::unique_ptr<fft_kernel> m_pack_w;
+    std::unique_ptr<fft_kernel> m_unpack_y;
+    std::unique_ptr<fft_kernel> m_multiply;
+    // along w then h, the h transforms are absent for 1D signals
+    std::unique_ptr<fft_kernel> m_fft_x[2];
+    std::unique_ptr<fft_kernel> m_fft_w[2];
+    std::unique_ptr<fft_kernel> m_ifft_y[2];
+
+public:
+    conv_fft(std::vector<int>& params, bool use_bias);
+    void forward(tensor& y, tensor& x, tensor& w, tensor& b, int weight_version);
+    int runCommandBuffer();
+};
+
+bool fftConvSupported(std::vector<int>& params);
@@ -0,0 +1,69 @@
+#include "../engine/common.h"
+#include "../engine/utils.h"
+#include "fill.h"
+
+fill::fill(int mode) : m_mode(mode), m_half(false)
+{
+    if (mode < kFillConstant || mode > kFillTruncatedNormal)
+        throw std::runtime_error("unknown fill mode");
+    m_future = getThreadPool().async(&fill::initVulkanThing, &*this, 1);
+    m_type = "fill";
+    m_param = {};
+}
+
+void fill::forward(tensor& y, float a, float b, uint64_t seed, uint64_t offset, float lo, float hi)
+{
+    if ((m_mode == kFillNormal || m_mode == kFillTruncatedNormal) && b < 0.f)
+        throw std::runtime_error("fill deviation must not be negative");
+    if (m_mode == kFillTruncatedNormal && !(lo < hi))
+        throw std::runtime_error("truncated normal fill needs lo < hi");
+    m_param.a = a;
+    m_param.b = b;
+    m_param.lo = lo;
+    m_param.hi = hi;
+    m_param.seed_lo = static_cast<uint32_t>(seed);
+    m_param.seed_hi = static_cast<uint32_t>(seed >> 32);
+    m_param.offset_lo = static_cast<uint32_t>(offset);
+    m_param.offset_hi = static_cast<uint32_t>(offset >> 32);
+    // one fill may write many tensors, e.g. every zero initialised buffer of a model
+    m_param.total = y.count();
+    m_group_x = std::min(static_cast<int>(alignSize(m_param.total, 1024) / 1024), max_compute_work_group_count);
+    if (m_pipeline != nullptr && halfPrecision(y, y) != m_half)
+        throw std::runtime_error("fill was built for another tensor format");
+    if (m_pipeline == nullptr)
+    {
+        std::vector<uint32_t> spec_data{ static_cast<uint32_t>(m_mode) };
+        std::vector<VkSpecializationMapEntry> spec_entries(spec_data.size());
+        for (uint32_t i = 0; i < spec_entries.size(); ++i)
+        {
+            spec_entries[i].constantID = i;
+            spec_entries[i].offset = i * sizeof(uint32_t);
+            spec_entries[i].size = sizeof(uint32_t);
+        }
+        VkSpecializationInfo spec_info;
+        spec_info.mapEntryCount = static_cast<uint32_t>(spec_entries.size());
+        spec_info.pMapEntries = spec_entries.data();
+        spec_info.dataSize = spec_data.size() * sizeof(uint32_t);
+        spec_info.pData = spec_data.data();
+
+        m_half = halfPrecision(y, y);
+        if (!m_half && y.getFormat() != Format::kFormatFp32)
+            throw std::runtime_error("fill writes fp32 or fp16 tensors");
+        m_future.wait();
+        if (m_half)
+            createShaderModule(fill_fp16_spv, sizeof(fill_fp16_spv));
+        else
+            createShaderModule(fill_spv, sizeof(fill_spv));
+        createPipeline(sizeof(fill_param), &spec_info);
+    }
+
+    bindtensor(y, 0);
+    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(fill_param));
+}
+
+tensor emptyTensor(const std::vector<int>& shape, Format fmt)
+{
+    tensor t(fmt);
+    t.reshape(nullptr, shape, true, fmt);
+    return t;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "vknn.h"
+#include "../engine/layer.h"
+
+enum fill_mode
+{
+    kFillConstant = 0,
+    kFillArange = 1,
+    kFillUniform = 2,
+    kFillNormal = 3,
+    kFillTruncatedNormal = 4
+};
+
+struct fill_param
+{
+    uint32_t total;
+    uint32_t seed_lo;
+    uint32_t seed_hi;
+    uint32_t offset_lo;
+    uint32_t offset_hi;
+    float a;
+    float b;
+    float lo;
+    float hi;
+};
+
+// Writes a tensor on the device without a host copy: a constant a, a + i * b,
+// uniform in [a, b), normal with mean a and deviation b, or that normal
+// truncated to [lo, hi]. Random fills come from the Philox stream of
+// philox.glsl keyed by seed, forward at a given offset is reproducible and
+// distinct offsets give independent tensors. The values are push constants,
+// so one fill per mode writes any number of tensors of the format it was
+// first used with.
+class fill : public layer
+{
+    fill_param m_param;
+    int m_mode;
+    bool m_half;
+public:
+    explicit fill(int mode);
+    void forward(tensor& y, float a, float b = 0.f, uint64_t seed = 0, uint64_t offset = 0, float lo = -2.f,
+        float hi = 2.f);
+};
+
+// uninitialised device tensor, for outputs a kernel writes in full
+tensor emptyTensor(const std::vector<int>& shape, Format fmt = Format::kFormatFp32);
+
+template<typename T>
+tensor empty_tensor(const std::vector<int>& shape)
+{
+    if (std::is_same<T, float>::value)
+        return emptyTensor(shape, Format::kFormatFp32);
+    else if (std::is_same<T, uint16_t>::value)
+        return emptyTensor(shape, Format::kFormatFp16);
+    else
+        return tensor(Format::kFormatInvalid);
+}
@@ -0,0 +1,417 @@
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+
+#include "../engine/common.h"
+#include "../engine/utils.h"
+#include "fusion.h"
+
+struct fused_pipeline
+{
+    VkPipeline pipeline;
+    VkPipelineLayout pipeline_layout;
+    VkDescriptorSetLayout set_layout;
+};
+
+static std::mutex kFusionMtx;
+static std::map<std::string, std::vector<uint32_t>> kFusionSpirv;
+static std::map<std::pair<int, std::string>, fused_pipeline> kFusionPipelines;
+
+// name, arity
+static const std::map<std::string, int> kFusionFunctions = {
+    { "relu", 1 }, { "sigmoid", 1 }, { "tanh", 1 }, { "gelu", 1 }, { "exp", 1 }, { "log", 1 },
+    { "sqrt", 1 }, { "abs", 1 }, { "pow", 2 }, { "min", 2 }, { "max", 2 }, { "clamp", 3 }, { "where", 3 }
+};
+
+// Recursive descent over the expression, emitting GLSL in terms of the
+// arguments v0..vN and the element type T.
+class fusion_parser
+{
+    const std::string& m_expr;
+    const std::vector<std::string>& m_inputs;
+    size_t m_pos;
+
+    void skip()
+    {
+        while (m_pos < m_expr.size() && isspace(static_cast<unsigned char>(m_expr[m_pos])))
+            ++m_pos;
+    }
+
+    bool accept(char c)
+    {
+        skip();
+        if (m_pos < m_expr.size() && m_expr[m_pos] == c)
+        {
+            ++m_pos;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c)
+    {
+        if (!accept(c))
+            fail(std::string("expected '") + c + "'");
+    }
+
+    [[noreturn]] void fail(const std::string& what) const
+    {
+        throw std::runtime_error("fused_elementwise: " + what + " at " + std::to_string(m_pos) + " in \"" + m_expr + "\"");
+    }
+
+    std::string number()
+    {
+        const char* begin = m_expr.c_str() + m_pos;
+        char* end = nullptr;
+        const double value = std::strtod(begin, &end);
+        if (end == begin)
+            fail("expected a number");
+        m_pos += end - begin;
+        std::ostringstream out;
+        out << std::setprecision(9) << static_cast<float>(value);
+        std::string text = out.str();
+        if (text.find_first_of(".e") == std::string::npos)
+            text += ".0";
+        return "T(" + text + ")";
+    }
+
+    std::string primary()
+    {
+        skip();
+        if (m_pos >= m_expr.size())
+            fail("unexpected end");
+        const char c = m_expr[m_pos];
+        if (accept('('))
+        {
+            std::string inner = sum();
+            expect(')');
+            return inner;
+        }
+        if (isdigit(static_cast<unsigned char>(c)) || c == '.')
+            return number();
+        if (!isalpha(static_cast<unsigned char>(c)) && c != '_')
+            fail(std::string("unexpected '") + c + "'");
+
+        const size_t begin = m_pos;
+        while (m_pos < m_expr.size() && (isalnum(static_cast<unsigned char>(m_expr[m_pos])) || m_expr[m_pos] == '_'))
+            ++m_pos;
+        const std::string name = m_expr.substr(begin, m_pos - begin);
+        auto fn = kFusionFunctions.find(name);
+        if (fn == kFusionFunctions.end())
+        {
+            auto it = std::find(m_inputs.begin(), m_inputs.end(), name);
+            if (it == m_inputs.end())
+                fail("unknown input " + name);
+            return "v" + std::to_string(it - m_inputs.begin());
+        }
+        expect('(');
+        std::string call = name + "(";
+        for (int i = 0; i < fn->second; ++i)
+        {
+            if (i > 0)
+            {
+                expect(',');
+                call += ", ";
+            }
+            call += sum();
+        }
+        expect(')');
+        return call + ")";
+    }
+
+    std::string unary()
+    {
+        if (accept('-'))
+            return "(-" + unary() + ")";
+        if (accept('+'))
+            return unary();
+        return primary();
+    }
+
+    std::string product()
+    {
+        std::string lhs = unary();
+        for (;;)
+        {
+            if (accept('*'))
+                lhs = "(" + lhs + " * " + unary() + ")";
+            else if (accept('/'))
+                lhs = "(" + lhs + " / " + unary() + ")";
+            else
+                return lhs;
+        }
+    }
+
+    std::string sum()
+    {
+        std::string lhs = product();
+        for (;;)
+        {
+            if (accept('+'))
+                lhs = "(" + lhs + " + " + product() + ")";
+            else if (accept('-'))
+                lhs = "(" + lhs + " - " + product() + ")";
+            else
+                return lhs;
+        }
+    }
+
+public:
+    fusion_parser(const std::string& expr, const std::vector<std::string>& inputs) : m_expr(expr), m_inputs(inputs), m_pos(0) {}
+
+    std::string parse()
+    {
+        std::string body = sum();
+        skip();
+        if (m_pos != m_expr.size())
+            fail("trailing input");
+        return body;
+    }
+};
+
+// Push block and helpers shared by every fused kernel. meta holds the
+// collapsed output shape followed by the strides of each input, input k
+// along axis d at meta[rank * (k + 1) + d].
+static const char* kFusionHeader = R"(#version 450
+
+// generated by fused_elementwise
+layout(push_constant) uniform pushBlock {
+	uint total;
+	uint rank;
+	uint mode;
+};
+
+layout (local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+layout (binding = 0) readonly buffer ssbMeta { uint meta[]; };
+
+float relu(float x) { return max(x, 0.0); }
+vec4 relu(vec4 x) { return max(x, vec4(0.0)); }
+float sigmoid(float x) { return 1.0 / (1.0 + exp(-x)); }
+vec4 sigmoid(vec4 x) { return 1.0 / (1.0 + exp(-x)); }
+float gelu(float x) { return 0.5 * x * (1.0 + tanh(0.7978845608 * (x + 0.044715 * x * x * x))); }
+vec4 gelu(vec4 x) { return 0.5 * x * (1.0 + tanh(0.7978845608 * (x + 0.044715 * x * x * x))); }
+float where(float c, float x, float y) { return c != 0.0 ? x : y; }
+vec4 where(vec4 c, vec4 x, vec4 y) { return mix(y, x, notEqual(c, vec4(0.0))); }
+)";
+
+static std::string generateSource(const std::string& body, int inputs)
+{
+    std::ostringstream src;
+    src << kFusionHeader << "\n";
+    for (int k = 0; k < inputs; ++k)
+    {
+        src << "layout (binding = " << k + 1 << ") readonly buffer ssbX" << k << " { float X" << k << "[]; };\n";
+        src << "layout (binding = " << k + 1 << ") readonly buffer ssbX" << k << "v { vec4 X" << k << "v[]; };\n";
+    }
+    src << "layout (binding = " << inputs + 1 << ") writeonly buffer ssbY { float Y[]; };\n";
+    src << "layout (binding = " << inputs + 1 << ") writeonly buffer ssbYv { vec4 Yv[]; };\n\n";
+
+    std::string params;
+    for (int k = 0; k < inputs; ++k)
+        params += (k > 0 ? ", T v" : "T v") + std::to_string(k);
+    for (const char* type : { "float", "vec4" })
+    {
+        src << "#define T " << type << "\n";
+        src << "T expr(" << params << ") { return " << body << "; }\n";
+        src << "#undef T\n";
+    }
+
+    // mode 0 and 1 are the contiguous paths with a single collapsed axis, an
+    // input either covers Y or is one broadcast value. mode 2 walks the
+    // collapsed shape and reads each input through its strides.
+    std::string vec_args, flat_args, strided_args;
+    for (int k = 0; k < inputs; ++k)
+    {
+        const std::string sep = k > 0 ? ", " : "";
+        const std::string x = "X" + std::to_string(k);
+        const std::string stride = "meta[" + std::to_string(k + 1) + "]";
+        vec_args += sep + "(" + stride + " == 0 ? vec4(" + x + "[0]) : " + x + "v[i])";
+        flat_args += sep + x + "[i * " + stride + "]";
+        strided_args += sep + x + "[o" + std::to_string(k) + "]";
+    }
+    src << "\nvoid main() {\n";
+    src << "\tconst uint step = gl_NumWorkGroups.x * 256;\n";
+    src << "\tif (mode == 0) {\n";
+    src << "\t\tfor (uint i = gl_GlobalInvocationID.x; i < total / 4; i += step)\n";
+    src << "\t\t\tYv[i] = expr(" << vec_args << ");\n";
+    src << "\t\treturn;\n";
+    src << "\t}\n";
+    src << "\tfor (uint i = gl_GlobalInvocationID.x; i < total; i += step) {\n";
+    src << "\t\tif (mode == 1) {\n";
+    src << "\t\t\tY[i] = expr(" << flat_args << ");\n";
+    src << "\t\t\tcontinue;\n";
+    src << "\t\t}\n";
+    src << "\t\tuint rest = i;\n";
+    for (int k = 0; k < inputs; ++k)
+        src << "\t\tuint o" << k << " = 0;\n";
+    src << "\t\tfor (int d = int(rank) - 1; d >= 0; --d) {\n";
+    src << "\t\t\tuint k = rest % meta[d];\n";
+    src << "\t\t\trest /= meta[d];\n";
+    for (int k = 0; k < inputs; ++k)
+        src << "\t\t\to" << k << " += k * meta[rank * " << k + 1 << " + d];\n";
+    src << "\t\t}\n";
+    src << "\t\tY[i] = expr(" << strided_args << ");\n";
+    src << "\t}\n";
+    src << "}\n";
+    return src.str();
+}
+
+// 64 bit FNV-1a, stable across builds unlike std::hash
+static std::string sourceHash(const std::string& source)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : source)
+    {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    std::ostringstream out;
+    out << std::hex << std::setw(16) << std::setfill('0') << h;
+    return out.str();
+}
+
+static std::string kernelCachePath(const std::string& hash)
+{
+    const char* dir = std::getenv("MADML_KERNEL_CACHE");
+    if (!dir)
+        dir = std::getenv("HOME");
+    if (!dir)
+        dir = std::getenv("USERPROFILE");
+    return std::string(dir ? dir : ".") + "/.madml_fused_" + hash + ".spv";
+}
+
+static bool readSpirv(const std::string& path, std::vector<uint32_t>& spv)
+{
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in)
+        return false;
+    const std::streamsize size = in.tellg();
+    if (size < 4 || size % 4 != 0)
+        return false;
+    spv.resize(static_cast<size_t>(size / 4));
+    in.seekg(0);
+    in.read(reinterpret_cast<char*>(spv.data()), size);
+    return in.good() && spv[0] == 0x07230203;
+}
+
+static void writeSpirv(const std::string& path, const std::vector<uint32_t>& spv)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out)
+    {
+        std::cerr << "fused_elementwise: cannot write " << path << "\n";
+        return;
+    }
+    out.write(reinterpret_cast<const char*>(spv.data()), spv.size() * sizeof(uint32_t));
+}
+
+// memory, then disk, then shaderc. Called under kFusionMtx.
+static const std::vector<uint32_t>& fusedSpirv(const std::string& hash, const std::string& source)
+{
+    auto it = kFusionSpirv.find(hash);
+    if (it != kFusionSpirv.end())
+        return it->second;
+
+    std::vector<uint32_t> spv;
+    const std::string path = kernelCachePath(hash);
+    if (!readSpirv(path, spv))
+    {
+        spv = compile("fused_" + hash, source);
+        if (spv.empty())
+        {
+#ifdef USE_SHADERC
+            throw std::runtime_error("fused_elementwise: shaderc failed to compile kernel " + hash);
+#else
+            throw std::runtime_error("fused_elementwise: kernel " + hash + " is not in " + path + " and this build has no USE_SHADERC");
+#endif
+        }
+        writeSpirv(path, spv);
+    }
+    return kFusionSpirv[hash] = std::move(spv);
+}
+
+fused_elementwise::fused_elementwise(const std::string& expr, const std::vector<std::string>& inputs) :
+    m_inputs(static_cast<int>(inputs.size())), m_owns_set_layout(true)
+{
+    if (inputs.empty() || inputs.size() > static_cast<size_t>(kFusionMaxInputs))
+        throw std::runtime_error("fused_elementwise takes between 1 and 8 inputs");
+    m_source = generateSource(fusion_parser(expr, inputs).parse(), m_inputs);
+    m_hash = sourceHash(m_source);
+    m_future = getThreadPool().async(&fused_elementwise::initVulkanThing, &*this, m_inputs + 2);
+    m_param = {};
+    m_type = "fused_elementwise";
+}
+
+// the pipeline belongs to the cache, the set layout too for the layer that built it
+fused_elementwise::~fused_elementwise()
+{
+    m_future.wait();
+    m_pipeline = nullptr;
+    m_pipeline_layout = nullptr;
+    if (!m_owns_set_layout)
+        m_descriptor_set_layout = nullptr;
+}
+
+void fused_elementwise::plan(const std::vector<Shape>& shapes)
+{
+    std::vector<uint32_t> dims;
+    std::vector<std::vector<uint32_t>> strides;
+    collapseBroadcast(shapes, dims, strides);
+
+    std::vector<uint32_t> meta(dims);
+    for (const auto& s : strides)
+        meta.insert(meta.end(), s.begin(), s.end());
+    m_meta = tensor(reinterpret_cast<char*>(meta.data()), Shape{ static_cast<int>(meta.size()) }, Format::kFormatInt32);
+
+    m_shapes = shapes;
+    m_param.rank = static_cast<uint32_t>(dims.size());
+    m_param.total = 1;
+    for (uint32_t d : dims)
+        m_param.total *= d;
+    m_param.mode = dims.size() > 1 ? 2 : m_param.total % 4 == 0 ? 0 : 1;
+    const uint32_t items = m_param.mode == 0 ? m_param.total / 4 : m_param.total;
+    m_group_x = std::min(static_cast<int>((items + 255) / 256), max_compute_work_group_count);
+}
+
+void fused_elementwise::forward(tensor& y, std::vector<tensor>& x)
+{
+    if (static_cast<int>(x.size()) != m_inputs)
+        throw std::runtime_error("fused_elementwise got the wrong number of inputs");
+    std::vector<Shape> shapes;
+    for (tensor& t : x)
+        shapes.push_back(t.getShape());
+    if (shapes != m_shapes)
+        plan(shapes);
+    if (static_cast<uint32_t>(y.count()) != m_param.total)
+        throw std::runtime_error("fused_elementwise output does not match the broadcast shape");
+
+    if (m_pipeline == nullptr)
+    {
+        m_future.wait();
+        std::lock_guard<std::mutex> lock(kFusionMtx);
+        const auto key = std::make_pair(m_device_id, m_hash);
+        auto it = kFusionPipelines.find(key);
+        if (it != kFusionPipelines.end())
+        {
+            // set layouts of fused kernels with the same input count are
+            // identical, so the cached pipeline layout is compatible
+            m_pipeline = it->second.pipeline;
+            m_pipeline_layout = it->second.pipeline_layout;
+        }
+        else
+        {
+            const std::vector<uint32_t>& spv = fusedSpirv(m_hash, m_source);
+            createShaderModule(spv.data(), spv.size() * sizeof(uint32_t));
+            createPipeline(sizeof(fused_param));
+            kFusionPipelines[key] = { m_pipeline, m_pipeline_layout, m_descriptor_set_layout };
+            m_owns_set_layout = false;
+        }
+    }
+
+    bindtensor(m_meta, 0);
+    for (int k = 0; k < m_inputs; ++k)
+        bindtensor(x[k], k + 1);
+    bindtensor(y, m_inputs + 1);
+    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(fused_param));
+}
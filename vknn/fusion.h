@@ -0,0 +1,39 @@
+#pragma once
+
+#include "vknn.h"
+#include "../engine/layer.h"
+
+constexpr int kFusionMaxInputs = 8;
+
+struct fused_param
+{
+    uint32_t total;
+    uint32_t rank;
+    uint32_t mode;
+};
+
+// One kernel for a chain of pointwise ops, e.g. "relu(x * a + b) * mask"
+// with inputs {"x", "a", "b", "mask"}. The expression takes + - * /, unary
+// minus, float literals and relu, sigmoid, tanh, gelu, exp, log, sqrt, abs,
+// pow, min, max, clamp(x, lo, hi) and where(c, x, y). Inputs broadcast like
+// NumPy. The generated GLSL is compiled with shaderc and keyed by its hash:
+// SPIR-V is cached in memory and under MADML_KERNEL_CACHE (the home
+// directory by default), the pipeline in memory per device, so a build
+// without USE_SHADERC still runs kernels found in the disk cache.
+class fused_elementwise : public layer
+{
+    fused_param m_param;
+    std::string m_source;
+    std::string m_hash;
+    int m_inputs;
+    bool m_owns_set_layout;
+    std::vector<Shape> m_shapes;
+    tensor m_meta;
+    void plan(const std::vector<Shape>& shapes);
+public:
+    fused_elementwise(const std::string& expr, const std::vector<std::string>& inputs);
+    ~fused_elementwise();
+    void forward(tensor& y, std::vector<tensor>& x);
+    const std::string& source() const { return m_source; }
+    const std::string& hash() const { return m_hash; }
+};
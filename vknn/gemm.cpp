@@ -2,83 +2,319 @@
 #include "../engine/utils.h"
 
 #include "gemm.h"
-#include <future>
+#include "autotune.h"
 
-gemm::gemm(float alpha, float beta, bool use_bias, bool transpose_x, bool transpose_w) : m_transpose_w(transpose_w), m_transpose_x(transpose_x)
+#include <atomic>
+
+static std::atomic<bool> kHalfAccumulate(false);
+
+gemm::gemm(float alpha, float beta, bool use_bias, bool transpose_x, bool transpose_w) : m_transpose_x(transpose_x), m_transpose_w(transpose_w), m_tiled(false), m_fixed_tile(false), m_fused(false), m_half(false)
 {
-    m_future = std::async(&gemm::initVulkanThing, &*this, 4);
+    m_future = getThreadPool().async(&gemm::initVulkanThing, &*this, 5);
     m_type = "gemm";
     m_param.alpha = alpha;
     m_param.beta = beta;
     m_param.use_bias = use_bias;
-    m_futures.resize(4);
+}
+
+void setGemmHalfAccumulate(bool enable)
+{
+    kHalfAccumulate.store(enable);
+}
+
+bool gemmHalfAccumulate()
+{
+    return kHalfAccumulate.load();
+}
+
+gemm_tile_config selectGemmTile(uint32_t m, uint32_t n, uint32_t k)
+{
+    // every config runs 16 x 16 threads, larger outputs get more work per thread
+    auto tile = [](uint32_t dim) -> uint32_t { return dim >= 64 ? 64 : dim >= 32 ? 32 : 16; };
+    gemm_tile_config cfg;
+    cfg.tile_m = tile(m);
+    cfg.tile_n = tile(n);
+    cfg.tile_k = k >= 16 ? 16 : 8;
+    cfg.wpt_m = cfg.tile_m / 16;
+    cfg.wpt_n = cfg.tile_n / 16;
+    return cfg;
+}
+
+void gemm::setTile(const gemm_tile_config& cfg)
+{
+    m_tile = cfg;
+    m_fixed_tile = true;
+}
+
+void gemm::setEpilogue(const gemm_epilogue& epilogue)
+{
+    if (epilogue.bias > kBiasColumn || epilogue.activation > kActSigmoid)
+        throw std::runtime_error("gemm epilogue out of range");
+    m_epilogue = epilogue;
+    m_fused = true;
+}
+
+gemm_tile_config gemm::chooseTile() const
+{
+    if (m_fixed_tile)
+        return m_tile;
+
+    const gemm_tiled_param& p = m_tiled_param;
+    gemm_tile_config cfg;
+    if (lookupGemmTile(m_device_id, p.m, p.n, p.k, m_transpose_x, m_transpose_w, cfg))
+        return cfg;
+    if (gemmAutotuneEnabled() && m_device_id == defaultDevice())
+        return tuneGemm(p.batchsize, p.m, p.n, p.k, m_transpose_x, m_transpose_w);
+    return selectGemmTile(p.m, p.n, p.k);
+}
+
+void gemm::createTiledPipeline(const gemm_tile_config& cfg)
+{
+    const gemm_tiled_param& p = m_tiled_param;
+    uint32_t spec_data[16] = {
+        cfg.tile_m, cfg.tile_n, cfg.tile_k, cfg.wpt_m, cfg.wpt_n,
+        m_transpose_x, m_transpose_w,
+        // vec4 loads need the contiguous dimension, leading dimension and batch stride to be 16 byte aligned
+        (m_transpose_x ? p.m : p.k) % 4 == 0 && p.lda % 4 == 0 && p.stride_a % 4 == 0,
+        (m_transpose_w ? p.k : p.n) % 4 == 0 && p.ldb % 4 == 0 && p.stride_b % 4 == 0,
+        cfg.tile_n / cfg.wpt_n, cfg.tile_m / cfg.wpt_m,
+        m_epilogue.bias, m_epilogue.activation, m_epilogue.residual
+    };
+    memcpy(&spec_data[14], &m_epilogue.slope, sizeof(float));
+    memcpy(&spec_data[15], &m_epilogue.scale, sizeof(float));
+    VkSpecializationMapEntry entries[16];
+    for (uint32_t i = 0; i < 16; ++i)
+    {
+        entries[i].constantID = i;
+        entries[i].offset = i * sizeof(uint32_t);
+        entries[i].size = sizeof(uint32_t);
+    }
+    VkSpecializationInfo spec_info = {};
+    spec_info.mapEntryCount = 16;
+    spec_info.pMapEntries = entries;
+    spec_info.dataSize = sizeof(spec_data);
+    spec_info.pData = spec_data;
+
+    m_group_x = static_cast<int>(alignSize(p.n, cfg.tile_n)) / cfg.tile_n;
+    m_group_y = static_cast<int>(alignSize(p.m, cfg.tile_m)) / cfg.tile_m;
+    m_group_z = static_cast<int>(p.batchsize);
+    if (m_group_x > max_compute_work_group_count)
+        m_group_x = max_compute_work_group_count;
+    if (m_group_y > max_compute_work_group_count)
+        m_group_y = max_compute_work_group_count;
+    if (m_group_z > max_compute_work_group_count)
+        m_group_z = max_compute_work_group_count;
+
+    m_future.wait();
+    if (!m_half)
+        createShaderModule(gemm_tiled_spv, sizeof(gemm_tiled_spv));
+    else if (gemmHalfAccumulate() && fp16ArithmeticSupported(m_device_id))
+        createShaderModule(gemm_tiled_fp16_math_spv, sizeof(gemm_tiled_fp16_math_spv));
+    else
+        createShaderModule(gemm_tiled_fp16_spv, sizeof(gemm_tiled_fp16_spv));
+    createPipeline(sizeof(gemm_tiled_param), &spec_info);
 }
 
 void gemm::forward(tensor& y, tensor& x, tensor& w, tensor& b)
+{
+    forwardFused(y, x, w, b, y);
+}
+
+void gemm::forwardFused(tensor& y, tensor& x, tensor& w, tensor& b, tensor& r)
 {
     if (m_pipeline == nullptr)
     {
-        int stage = 0;
-        auto out_shape = y.getShape(); // 32 x 38336
-        auto in_shape_1 = x.getShape(); // 9 x 38336
-        auto in_shape_2 = w.getShape(); // 32 x 9
-        auto tmp2 = out_shape.size() > 2 && out_shape[0] == in_shape_1[0] && out_shape[2] == in_shape_2[2]
-            && out_shape[1] == in_shape_1[1];
-
-        if (out_shape[0] == in_shape_1[0] && out_shape[1] == in_shape_2[1]) // mxn & nxk = mxk
-        {
-            m_param.batchsize = out_shape[0];
-            m_param.m = 1;
-            m_param.n = out_shape[1];
-            m_param.k = in_shape_2[1];
-        }
-        else if (out_shape[0] == in_shape_1[1] && out_shape[1] == in_shape_2[1])
-        {
-            m_param.batchsize = 1;
-            m_param.m = out_shape[0];
-            m_param.n = out_shape[1];
-            m_param.k = in_shape_1[0];
-            m_transpose_x = true;
-        }
-        else if (out_shape[0] == in_shape_1[0] && out_shape[1] == in_shape_2[0])
+        auto out_shape = y.getShape();
+        auto in_shape_1 = x.getShape();
+        auto in_shape_2 = w.getShape();
+
+        // y:[batch, m, n] with x:[batch, m, k] batches x against a shared w
+        uint32_t batch = 1;
+        if (out_shape.size() == 3 && in_shape_1.size() == 3 && in_shape_2.size() == 2 && out_shape[0] == in_shape_1[0])
         {
-            m_param.batchsize = 1;
-            m_param.m = out_shape[0];
-            m_param.n = out_shape[1];
-            m_param.k = in_shape_2[1];
-            m_transpose_w = true;
+            batch = out_shape[0];
+            out_shape.erase(out_shape.begin());
+            in_shape_1.erase(in_shape_1.begin());
         }
-        else
+
+        const uint32_t m = out_shape[0];
+        const uint32_t n = out_shape[1];
+        const uint32_t k = m_transpose_x ? in_shape_1[0] : in_shape_1[1];
+        const uint32_t m_x = m_transpose_x ? in_shape_1[1] : in_shape_1[0];
+        const uint32_t k_w = m_transpose_w ? in_shape_2[1] : in_shape_2[0];
+        const uint32_t n_w = m_transpose_w ? in_shape_2[0] : in_shape_2[1];
+        if (m_x != m || n_w != n || k_w != k)
         {
             std::cerr << " GEMM y:[" << out_shape[0] << " " << out_shape[1] << "] X:[" << in_shape_1[0] << " " << in_shape_1[1] << "] Y:[" << in_shape_2[0] << " " << in_shape_2[1] << "]\n";
             std::cerr << "\n";
             throw std::runtime_error("gemm cannot compute");
         }
 
+        if (m_param.use_bias)
+        {
+            // without an explicit epilogue the layout follows the bias size, a
+            // square output takes an [n] bias per column
+            const size_t count = b.count();
+            if (!m_fused)
+            {
+                if (count == static_cast<size_t>(m) * n)
+                    m_epilogue.bias = kBiasElement;
+                else if (count == n)
+                    m_epilogue.bias = kBiasColumn;
+                else if (count == m)
+                    m_epilogue.bias = kBiasRow;
+                else
+                    throw std::runtime_error("gemm bias matches neither the output nor one of its dimensions");
+            }
+            const size_t needed = m_epilogue.bias == kBiasElement ? static_cast<size_t>(m) * n :
+                m_epilogue.bias == kBiasRow ? m : n;
+            if (count < needed)
+                throw std::runtime_error("gemm bias smaller than its epilogue reads");
+        }
+
+        halfPrecision(w, y);
+        if (m_param.use_bias)
+            halfPrecision(b, y);
+        m_half = halfPrecision(x, y);
+
         m_param.total = w.count();
-        m_group_x = static_cast<int>(alignSize(m_param.m, 16)) / 16;
-        m_group_y = static_cast<int>(alignSize(m_param.n, 16)) / 16;
-        m_group_z = static_cast<int>(alignSize(m_param.batchsize, 2)) / 2;
-
-        if (m_group_x > max_compute_work_group_count)
-            m_group_x = max_compute_work_group_count - 1;
-        if (m_group_y > max_compute_work_group_count)
-            m_group_y = max_compute_work_group_count - 1;
-        if (m_group_z > max_compute_work_group_count)
-            m_group_z = max_compute_work_group_count - 1;
-        m_future.wait();
-        if (m_transpose_x)
-            createShaderModule(xt_gemm_spv, sizeof(xt_gemm_spv));
-        else if (m_transpose_w)
-            createShaderModule(wt_gemm_spv, sizeof(wt_gemm_spv));
+        m_param.batchsize = batch;
+        m_param.m = m;
+        m_param.n = n;
+        m_param.k = k;
+
+        // small outputs cannot fill even a handful of tiles, the scalar kernel is cheaper there,
+        // only the tiled kernel has the fused epilogue, row and column biases and the fp16 variants
+        m_tiled = m_half || m_fused || (m_param.use_bias && m_epilogue.bias != kBiasElement) ||
+            static_cast<size_t>(m) * n * batch >= 4096;
+        if (m_tiled)
+        {
+            m_tiled_param.batchsize = batch;
+            m_tiled_param.m = m;
+            m_tiled_param.n = n;
+            m_tiled_param.k = k;
+            m_tiled_param.lda = m_transpose_x ? m : k;
+            m_tiled_param.ldb = m_transpose_w ? k : n;
+            m_tiled_param.ldc = n;
+            m_tiled_param.ldd = n;
+            m_tiled_param.stride_a = m * k;
+            m_tiled_param.stride_b = 0;
+            m_tiled_param.stride_c = 0;
+            m_tiled_param.stride_d = m * n;
+            m_tiled_param.alpha = m_param.alpha;
+            m_tiled_param.beta = m_param.beta;
+            m_tiled_param.use_bias = m_param.use_bias;
+            createTiledPipeline(chooseTile());
+        }
         else
-            createShaderModule(gemm_spv, sizeof(gemm_spv));
-        createPipeline(sizeof(gemm_param));
+        {
+            m_group_x = static_cast<int>(alignSize(m_param.m, 16)) / 16;
+            m_group_y = static_cast<int>(alignSize(m_param.n, 16)) / 16;
+            m_group_z = static_cast<int>(alignSize(m_param.batchsize, 2)) / 2;
+
+            if (m_group_x > max_compute_work_group_count)
+                m_group_x = max_compute_work_group_count - 1;
+            if (m_group_y > max_compute_work_group_count)
+                m_group_y = max_compute_work_group_count - 1;
+            if (m_group_z > max_compute_work_group_count)
+                m_group_z = max_compute_work_group_count - 1;
+            m_future.wait();
+            if (m_transpose_x)
+                createShaderModule(xt_gemm_spv, sizeof(xt_gemm_spv));
+            else if (m_transpose_w)
+                createShaderModule(wt_gemm_spv, sizeof(wt_gemm_spv));
+            else
+                createShaderModule(gemm_spv, sizeof(gemm_spv));
+            createPipeline(sizeof(gemm_param));
+        }
     }
 
     bindtensor(x, 0);
     bindtensor(w, 1);
     bindtensor(b, 2);
     bindtensor(y, 3);
-    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(gemm_param));
+    bindtensor(r, 4);
+    if (m_tiled)
+        recordCommandBuffer(static_cast<void*>(&m_tiled_param), sizeof(gemm_tiled_param));
+    else
+        recordCommandBuffer(static_cast<void*>(&m_param), sizeof(gemm_param));
+}
+
+gemm_strided_batched::gemm_strided_batched(float alpha, float beta, bool use_bias, bool transpose_a, bool transpose_b,
+    std::vector<int>& params) : gemm(alpha, beta, use_bias, transpose_a, transpose_b)
+{
+    if (params.size() != 12)
+        throw std::runtime_error("gemm_strided_batched expects 12 params");
+    for (int p : params)
+    {
+        if (p < 0)
+            throw std::runtime_error("gemm_strided_batched params must be non-negative");
+    }
+    m_type = "gemm_strided_batched";
+    m_tiled = true;
+    m_tiled_param.batchsize = params[0];
+    m_tiled_param.m = params[1];
+    m_tiled_param.n = params[2];
+    m_tiled_param.k = params[3];
+    m_tiled_param.lda = params[4];
+    m_tiled_param.ldb = params[5];
+    m_tiled_param.ldc = params[6];
+    m_tiled_param.ldd = params[7];
+    m_tiled_param.stride_a = params[8];
+    m_tiled_param.stride_b = params[9];
+    m_tiled_param.stride_c = params[10];
+    m_tiled_param.stride_d = params[11];
+    m_tiled_param.alpha = alpha;
+    m_tiled_param.beta = beta;
+    m_tiled_param.use_bias = use_bias;
+}
+
+// number of elements a strided operand spans, rows x cols per batch with leading dimension ld
+static size_t stridedExtent(uint32_t batch, uint32_t rows, uint32_t cols, uint32_t ld, uint32_t stride)
+{
+    if (batch == 0 || rows == 0 || cols == 0)
+        return 0;
+    return static_cast<size_t>(batch - 1) * stride + static_cast<size_t>(rows - 1) * ld + cols;
+}
+
+void gemm_strided_batched::forward(tensor& d, tensor& a, tensor& b, tensor& c)
+{
+    forwardFused(d, a, b, c, d);
+}
+
+void gemm_strided_batched::forwardFused(tensor& d, tensor& a, tensor& b, tensor& c, tensor& r)
+{
+    if (m_pipeline == nullptr)
+    {
+        const gemm_tiled_param& p = m_tiled_param;
+        const size_t a_extent = m_transpose_x ? stridedExtent(p.batchsize, p.k, p.m, p.lda, p.stride_a)
+            : stridedExtent(p.batchsize, p.m, p.k, p.lda, p.stride_a);
+        const size_t b_extent = m_transpose_w ? stridedExtent(p.batchsize, p.n, p.k, p.ldb, p.stride_b)
+            : stridedExtent(p.batchsize, p.k, p.n, p.ldb, p.stride_b);
+        size_t c_extent = 0;
+        if (p.use_bias && m_epilogue.bias == kBiasRow)
+            c_extent = stridedExtent(p.batchsize, p.m, 1, 1, p.stride_c);
+        else if (p.use_bias && m_epilogue.bias == kBiasColumn)
+            c_extent = stridedExtent(p.batchsize, 1, p.n, 0, p.stride_c);
+        else if (p.use_bias)
+            c_extent = stridedExtent(p.batchsize, p.m, p.n, p.ldc, p.stride_c);
+        const size_t d_extent = stridedExtent(p.batchsize, p.m, p.n, p.ldd, p.stride_d);
+        if (a_extent > static_cast<size_t>(a.count()) || b_extent > static_cast<size_t>(b.count()) ||
+            c_extent > static_cast<size_t>(c.count()) || d_extent > static_cast<size_t>(d.count()) ||
+            (m_epilogue.residual && d_extent > static_cast<size_t>(r.count())))
+            throw std::runtime_error("gemm_strided_batched operand smaller than its strides describe");
+        halfPrecision(b, d);
+        if (p.use_bias)
+            halfPrecision(c, d);
+        m_half = halfPrecision(a, d);
+
+        createTiledPipeline(chooseTile());
+    }
+
+    bindtensor(a, 0);
+    bindtensor(b, 1);
+    bindtensor(c, 2);
+    bindtensor(d, 3);
+    bindtensor(r, 4);
+    recordCommandBuffer(static_cast<void*>(&m_tiled_param), sizeof(gemm_tiled_param));
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include "vknn.h"
 #include "../engine/layer.h"
+#include "epilogue.h"
 
 struct gemm_param
 {
@@ -15,15 +16,83 @@ struct gemm_param
     uint32_t k;
 };
 
+struct gemm_tiled_param
+{
+    uint32_t batchsize;
+    uint32_t m;
+    uint32_t n;
+    uint32_t k;
+    uint32_t lda;
+    uint32_t ldb;
+    uint32_t ldc;
+    uint32_t ldd;
+    uint32_t stride_a;
+    uint32_t stride_b;
+    uint32_t stride_c;
+    uint32_t stride_d;
+    float alpha;
+    float beta;
+    uint32_t use_bias;
+};
+
+// tile shape of gemm_tiled.comp, local size is (tile_n / wpt_n, tile_m / wpt_m)
+struct gemm_tile_config
+{
+    uint32_t tile_m;
+    uint32_t tile_n;
+    uint32_t tile_k;
+    uint32_t wpt_m;
+    uint32_t wpt_n;
+};
+
+gemm_tile_config selectGemmTile(uint32_t m, uint32_t n, uint32_t k);
+
+// fp16 gemms read and write half and accumulate in float. With half
+// accumulation enabled, devices with shaderFloat16 also keep the tiles and
+// accumulators in half. Applies to pipelines created afterwards.
+void setGemmHalfAccumulate(bool enable);
+bool gemmHalfAccumulate();
+
 class gemm : public layer
 {
+protected:
     gemm_param m_param;
+    gemm_tiled_param m_tiled_param;
     bool m_transpose_x;
     bool m_transpose_w;
+    bool m_tiled;
+    bool m_fixed_tile;
+    gemm_tile_config m_tile;
+    gemm_epilogue m_epilogue;
+    bool m_fused;
+    bool m_half;
+
+    gemm_tile_config chooseTile() const;
+    void createTiledPipeline(const gemm_tile_config& cfg);
 
 public:
+    // transpose_x and transpose_w give the operand layouts, they are not inferred from the shapes
     explicit gemm(float alpha, float beta, bool use_bias, bool transpose_x = false, bool transpose_w = false);
+    // fp16 operands always take the tiled kernel. Without an epilogue a bias of
+    // m * n, n or m elements is read per element, per column or per row.
     void forward(tensor& y, tensor& x, tensor& w, tensor& b);
+    // r is only read when the epilogue has a residual
+    void forwardFused(tensor& y, tensor& x, tensor& w, tensor& b, tensor& r);
+    // bypasses the tuning database, must be called before the first forward
+    void setTile(const gemm_tile_config& cfg);
+    // forces the tiled kernel, must be called before the first forward
+    void setEpilogue(const gemm_epilogue& epilogue);
+};
+
+// d[i] = alpha * op(a[i]) * op(b[i]) + beta * c[i] for i in [0, batch)
+// params: batch, m, n, k, lda, ldb, ldc, ldd, stride_a, stride_b, stride_c, stride_d
+// strides are in elements, a stride of 0 broadcasts that operand to every batch.
+class gemm_strided_batched : public gemm
+{
+public:
+    gemm_strided_batched(float alpha, float beta, bool use_bias, bool transpose_a, bool transpose_b, std::vector<int>& params);
+    void forward(tensor& d, tensor& a, tensor& b, tensor& c);
+    void forwardFused(tensor& d, tensor& a, tensor& b, tensor& c, tensor& r);
 };
 
 extern void test_gemm();
\ No newline at end of file
@@ -4,7 +4,7 @@
 
 mse::mse(bool reduction)
 {
-    m_future = std::async(&mse::initVulkanThing, &*this, 3);
+    m_future = getThreadPool().async(&mse::initVulkanThing, &*this, 3);
     m_param.reduction = reduction;
 }
 
@@ -31,4 +31,58 @@ void mse::forward(tensor& loss, tensor& l, tensor& t, tensor& dx)
     recordCommandBuffer(static_cast<void*>(&m_param), sizeof(mse_param));
 
     return;
-}
\ No newline at end of file
+}
+
+cross_entropy::cross_entropy(int axis, bool use_weight, int ignore_index) : m_axis(axis), m_use_weight(use_weight)
+{
+    m_future = getThreadPool().async(&cross_entropy::initVulkanThing, &*this, 5);
+    m_type = "cross_entropy";
+    m_param = {};
+    m_param.ignore_index = ignore_index;
+}
+
+void cross_entropy::forward(tensor& loss, tensor& dx, tensor& x, tensor& target, tensor& weight, float grad_scale)
+{
+    if (m_pipeline == nullptr)
+    {
+        const int32_t ignore_index = m_param.ignore_index;
+        m_param = softmaxShape(x.getShape(), m_axis);
+        m_param.ignore_index = ignore_index;
+        const uint32_t samples = m_param.outer * m_param.inner;
+        if (static_cast<uint32_t>(target.count()) < samples || static_cast<uint32_t>(loss.count()) < samples)
+            throw std::runtime_error("cross_entropy needs one target and one loss per sample");
+        if (m_use_weight && static_cast<uint32_t>(weight.count()) < m_param.classes)
+            throw std::runtime_error("cross_entropy needs one weight per class");
+        const uint32_t wide = m_param.inner == 1 && m_param.classes >= kSoftmaxWideRow ? 1 : 0;
+        m_group_x = static_cast<int>(wide ? samples : alignSize(samples, 256) / 256);
+        m_group_x = std::min(m_group_x, max_compute_work_group_count);
+
+        std::vector<uint32_t> spec_data{ 4, wide, m_use_weight ? 1u : 0u };
+        std::vector<VkSpecializationMapEntry> spec_entries(spec_data.size());
+        for (uint32_t i = 0; i < spec_entries.size(); ++i)
+        {
+            spec_entries[i].constantID = i;
+            spec_entries[i].offset = i * sizeof(uint32_t);
+            spec_entries[i].size = sizeof(uint32_t);
+        }
+        VkSpecializationInfo spec_info;
+        spec_info.mapEntryCount = static_cast<uint32_t>(spec_entries.size());
+        spec_info.pMapEntries = spec_entries.data();
+        spec_info.dataSize = spec_data.size() * sizeof(uint32_t);
+        spec_info.pData = spec_data.data();
+
+        m_future.wait();
+        createShaderModule(softmax_spv, sizeof(softmax_spv));
+        createPipeline(sizeof(softmax_param), &spec_info);
+    }
+
+    // the mean reduction changes with the batch, so the scale is pushed on every record
+    m_param.grad_scale = grad_scale;
+    bindtensor(x, 0);
+    bindtensor(target, 1);
+    bindtensor(m_use_weight ? weight : x, 2);
+    bindtensor(dx, 3);
+    bindtensor(loss, 4);
+    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(softmax_param));
+}
+
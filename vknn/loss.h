@@ -2,6 +2,7 @@
 
 #include "vknn.h"
 #include "../engine/layer.h"
+#include "softmax_param.h"
 
 struct mse_param
 {
@@ -17,3 +18,19 @@ public:
     mse(bool reduction);
     void forward(tensor& loss, tensor& l, tensor& t, tensor& dx);
 };
+
+// Fused softmax cross entropy over the class axis. For every sample the
+// kernel writes the loss w[t] * -log softmax(x)[t] to loss and the gradient
+// w[t] * (softmax(x) - onehot(t)) * grad_scale to dx, targets are int32 class
+// indices shaped like x without the class axis. Samples whose target equals
+// ignore_index contribute nothing, weight is only read with use_weight.
+class cross_entropy : public layer
+{
+    softmax_param m_param;
+    int m_axis;
+    bool m_use_weight;
+public:
+    cross_entropy(int axis, bool use_weight, int ignore_index);
+    void forward(tensor& loss, tensor& dx, tensor& x, tensor& target, tensor& weight, float grad_scale);
+};
+
@@ -1 +1,237 @@
-#include "math.h"
\ No newline at end of file
+#include "../engine/common.h"
+#include "../engine/utils.h"
+#include "math.h"
+#include "reduce.h"
+
+int elementwiseArity(int op)
+{
+    if (op < kEwAdd || op > kEwWhere)
+        throw std::runtime_error("unknown elementwise op");
+    if (op <= kEwPow)
+        return 2;
+    return op == kEwWhere ? 3 : 1;
+}
+
+Shape broadcastShape(const Shape& a, const Shape& b)
+{
+    const size_t rank = std::max(a.size(), b.size());
+    Shape out(rank, 1);
+    for (size_t i = 0; i < rank; ++i)
+    {
+        const int da = i < rank - a.size() ? 1 : a[i - (rank - a.size())];
+        const int db = i < rank - b.size() ? 1 : b[i - (rank - b.size())];
+        if (da != db && da != 1 && db != 1)
+            throw std::runtime_error("shapes cannot be broadcast together");
+        out[i] = std::max(da, db);
+    }
+    return out;
+}
+
+elementwise::elementwise(int op, float alpha, float beta, int grad) : m_op(op), m_grad(static_cast<uint32_t>(grad))
+{
+    const int arity = elementwiseArity(op);
+    if (grad < 0 || grad > 2 || (grad > 0 && op == kEwWhere) || (grad == 2 && arity != 2))
+        throw std::runtime_error("elementwise gradient does not exist for this op");
+    m_future = getThreadPool().async(&elementwise::initVulkanThing, &*this, 4);
+    m_param = {};
+    m_param.alpha = alpha;
+    m_param.beta = beta;
+    m_type = "elementwise";
+}
+
+void collapseBroadcast(const std::vector<Shape>& shapes, std::vector<uint32_t>& dims,
+    std::vector<std::vector<uint32_t>>& strides)
+{
+    Shape out;
+    for (const Shape& s : shapes)
+        out = s.empty() ? out : broadcastShape(out, s);
+    const int rank = static_cast<int>(out.size());
+
+    dims.clear();
+    strides.assign(shapes.size(), std::vector<uint32_t>());
+    for (int d = 0; d < rank; ++d)
+    {
+        if (out[d] == 1)
+            continue;
+        const uint32_t size = static_cast<uint32_t>(out[d]);
+        std::vector<uint32_t> axis(shapes.size(), 0);
+        for (size_t o = 0; o < shapes.size(); ++o)
+        {
+            const Shape& s = shapes[o];
+            const int sd = d - (rank - static_cast<int>(s.size()));
+            if (s.empty() || sd < 0 || s[sd] == 1)
+                continue;
+            uint32_t stride = 1;
+            for (size_t k = sd + 1; k < s.size(); ++k)
+                stride *= s[k];
+            axis[o] = stride;
+        }
+        // merge into the previous axis when every operand stays contiguous across both
+        bool merge = !dims.empty();
+        for (size_t o = 0; merge && o < shapes.size(); ++o)
+            merge = strides[o].back() == axis[o] * size;
+        if (merge)
+        {
+            dims.back() *= size;
+            for (size_t o = 0; o < shapes.size(); ++o)
+                strides[o].back() = axis[o];
+            continue;
+        }
+        dims.push_back(size);
+        for (size_t o = 0; o < shapes.size(); ++o)
+            strides[o].push_back(axis[o]);
+    }
+    if (dims.empty())
+    {
+        dims.push_back(1);
+        for (auto& s : strides)
+            s.push_back(0);
+    }
+}
+
+// shapes holds a, b and c, an empty shape marks an operand the op does not read
+void elementwise::plan(const std::vector<Shape>& shapes)
+{
+    std::vector<uint32_t> dims;
+    std::vector<std::vector<uint32_t>> strides;
+    collapseBroadcast(shapes, dims, strides);
+    if (dims.size() > static_cast<size_t>(kElementwiseMaxRank))
+        throw std::runtime_error("elementwise supports up to 6 axes after collapsing");
+
+    m_shapes = shapes;
+    m_param.rank = static_cast<uint32_t>(dims.size());
+    m_param.total = 1;
+    for (size_t d = 0; d < dims.size(); ++d)
+    {
+        m_param.shape[d] = dims[d];
+        m_param.stride_a[d] = strides[0][d];
+        m_param.stride_b[d] = strides[1][d];
+        m_param.stride_c[d] = strides[2][d];
+        m_param.total *= dims[d];
+    }
+
+    // contiguous when every operand that is read covers the output one to one
+    bool contiguous = dims.size() == 1;
+    for (size_t o = 0; o < shapes.size(); ++o)
+        contiguous = contiguous && (shapes[o].empty() || strides[o][0] == 1 || m_param.total == 1);
+    m_param.mode = !contiguous ? 2 : m_param.total % 4 == 0 ? 0 : 1;
+    const uint32_t items = m_param.mode == 0 ? m_param.total / 4 : m_param.total;
+    m_group_x = std::min(static_cast<int>((items + 255) / 256), max_compute_work_group_count);
+}
+
+void elementwise::forward(tensor& y, tensor& a, tensor& b, tensor& c)
+{
+    const int arity = elementwiseArity(m_op);
+    const bool read_b = m_grad == 0 ? arity >= 2 : arity == 2;
+    const bool read_c = m_grad == 0 ? arity == 3 : true;
+    std::vector<Shape> shapes{ a.getShape(), read_b ? b.getShape() : Shape(), read_c ? c.getShape() : Shape() };
+    if (shapes != m_shapes)
+        plan(shapes);
+    if (static_cast<uint32_t>(y.count()) != m_param.total)
+        throw std::runtime_error("elementwise output does not match the broadcast shape");
+
+    if (m_pipeline == nullptr)
+    {
+        std::vector<uint32_t> spec_data{ static_cast<uint32_t>(m_op), m_grad };
+        std::vector<VkSpecializationMapEntry> spec_entries(spec_data.size());
+        for (uint32_t i = 0; i < spec_entries.size(); ++i)
+        {
+            spec_entries[i].constantID = i;
+            spec_entries[i].offset = i * sizeof(uint32_t);
+            spec_entries[i].size = sizeof(uint32_t);
+        }
+        VkSpecializationInfo spec_info;
+        spec_info.mapEntryCount = static_cast<uint32_t>(spec_entries.size());
+        spec_info.pMapEntries = spec_entries.data();
+        spec_info.dataSize = spec_data.size() * sizeof(uint32_t);
+        spec_info.pData = spec_data.data();
+
+        m_future.wait();
+        createShaderModule(elementwise_spv, sizeof(elementwise_spv));
+        createPipeline(sizeof(elementwise_param), &spec_info);
+    }
+
+    // operands the op does not read still need a buffer, a covers the output
+    // whenever the contiguous paths read them
+    bindtensor(a, 0);
+    bindtensor(read_b ? b : a, 1);
+    bindtensor(read_c ? c : a, 2);
+    bindtensor(y, 3);
+    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(elementwise_param));
+}
+
+elementwise_backward::elementwise_backward(int op, float alpha, float beta) : m_op(op)
+{
+    if (elementwiseArity(op) == 3)
+        throw std::runtime_error("where has no elementwise_backward, its gradients are where ops");
+    m_grad_a.reset(new elementwise(op, alpha, beta, 1));
+    if (elementwiseArity(op) == 2)
+        m_grad_b.reset(new elementwise(op, alpha, beta, 2));
+}
+
+elementwise_backward::~elementwise_backward() = default;
+
+// axes of y that an operand of shape s was broadcast along
+static std::vector<int> broadcastAxes(const Shape& s, const Shape& y)
+{
+    std::vector<int> axes;
+    const int lead = static_cast<int>(y.size() - s.size());
+    for (int d = 0; d < static_cast<int>(y.size()); ++d)
+    {
+        if (y[d] != 1 && (d < lead || s[d - lead] == 1))
+            axes.push_back(d);
+    }
+    return axes;
+}
+
+void elementwise_backward::plan(const Shape& a, const Shape& b, const Shape& y)
+{
+    m_shape_a = a;
+    m_shape_b = b;
+    m_shape_y = y;
+    std::vector<int> axes_a = broadcastAxes(a, y);
+    m_reduce_a.reset(axes_a.empty() ? nullptr : new reduce(kReduceSum, axes_a));
+    m_tmp_a = axes_a.empty() ? tensor() : tensor(0.f, y);
+    m_reduce_b.reset();
+    m_tmp_b = tensor();
+    if (m_grad_b != nullptr)
+    {
+        std::vector<int> axes_b = broadcastAxes(b, y);
+        m_reduce_b.reset(axes_b.empty() ? nullptr : new reduce(kReduceSum, axes_b));
+        m_tmp_b = axes_b.empty() ? tensor() : tensor(0.f, y);
+    }
+}
+
+void elementwise_backward::forward(tensor& da, tensor& db, tensor& a, tensor& b, tensor& dy)
+{
+    const bool binary = m_grad_b != nullptr;
+    const Shape y = binary ? broadcastShape(a.getShape(), b.getShape()) : a.getShape();
+    if (dy.getShape() != y)
+        throw std::runtime_error("elementwise_backward dy does not match the broadcast shape");
+    if (a.getShape() != m_shape_a || (binary && b.getShape() != m_shape_b) || dy.getShape() != m_shape_y)
+        plan(a.getShape(), binary ? b.getShape() : Shape(), dy.getShape());
+
+    m_grad_a->forward(m_reduce_a ? m_tmp_a : da, a, b, dy);
+    if (m_reduce_a)
+        m_reduce_a->forward(da, m_tmp_a);
+    if (binary)
+    {
+        m_grad_b->forward(m_reduce_b ? m_tmp_b : db, a, b, dy);
+        if (m_reduce_b)
+            m_reduce_b->forward(db, m_tmp_b);
+    }
+}
+
+int elementwise_backward::runCommandBuffer()
+{
+    m_grad_a->runCommandBuffer();
+    if (m_reduce_a)
+        m_reduce_a->runCommandBuffer();
+    if (m_grad_b)
+    {
+        m_grad_b->runCommandBuffer();
+        if (m_reduce_b)
+            m_reduce_b->runCommandBuffer();
+    }
+    return 1;
+}
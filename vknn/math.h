@@ -0,0 +1,95 @@
+#pragma once
+
+#include "vknn.h"
+#include "../engine/layer.h"
+
+// reduce.h includes this header through vknn.h
+class reduce;
+
+constexpr int kElementwiseMaxRank = 6;
+
+enum elementwise_op
+{
+    kEwAdd = 0,
+    kEwSub = 1,
+    kEwMul = 2,
+    kEwDiv = 3,
+    kEwPow = 4,
+    kEwExp = 5,
+    kEwLog = 6,
+    kEwSqrt = 7,
+    kEwTanh = 8,
+    kEwSigmoid = 9,
+    kEwGelu = 10,
+    kEwClamp = 11,
+    kEwWhere = 12
+};
+
+// operands an op reads, where takes (condition, x, w)
+int elementwiseArity(int op);
+
+// NumPy broadcast of two shapes, aligned at the last axis
+Shape broadcastShape(const Shape& a, const Shape& b);
+
+// Broadcast shape of the operands with unit axes dropped and neighbouring
+// axes merged where every operand stays contiguous across them. dims gets
+// the collapsed sizes and strides[o][d] the element stride of operand o
+// along dims[d], 0 where it broadcasts. An empty shape is an operand that
+// is not read.
+void collapseBroadcast(const std::vector<Shape>& shapes, std::vector<uint32_t>& dims,
+    std::vector<std::vector<uint32_t>>& strides);
+
+struct elementwise_param
+{
+    uint32_t total;
+    uint32_t rank;
+    uint32_t mode;
+    uint32_t shape[kElementwiseMaxRank];
+    uint32_t stride_a[kElementwiseMaxRank];
+    uint32_t stride_b[kElementwiseMaxRank];
+    uint32_t stride_c[kElementwiseMaxRank];
+    float alpha;
+    float beta;
+};
+
+// y = op(a, b, c) broadcast over up to six axes, operands past the op's
+// arity are ignored. alpha and beta are the clamp bounds. With grad 1 or 2
+// it computes dy * d op / d a or d b, c being dy, at the broadcast shape.
+// Unit axes are dropped and neighbouring axes merged when every operand
+// keeps them contiguous, so a layout that collapses to one axis takes the
+// contiguous path, as vec4s when the size allows.
+class elementwise : public layer
+{
+    elementwise_param m_param;
+    int m_op;
+    uint32_t m_grad;
+    std::vector<Shape> m_shapes;
+    void plan(const std::vector<Shape>& shapes);
+public:
+    elementwise(int op, float alpha = 0.f, float beta = 0.f, int grad = 0);
+    void forward(tensor& y, tensor& a, tensor& b, tensor& c);
+};
+
+// Gradients of a unary or binary op. The dy-shaped gradient of an operand
+// that was broadcast is summed over its broadcast axes, otherwise the pass
+// writes straight into da or db. db is left alone for unary ops. The
+// gradients of where are where(cond, dy, 0) and where(cond, 0, dy).
+class elementwise_backward
+{
+    int m_op;
+    std::unique_ptr<elementwise> m_grad_a;
+    std::unique_ptr<elementwise> m_grad_b;
+    std::unique_ptr<reduce> m_reduce_a;
+    std::unique_ptr<reduce> m_reduce_b;
+    tensor m_tmp_a;
+    tensor m_tmp_b;
+    Shape m_shape_a;
+    Shape m_shape_b;
+    Shape m_shape_y;
+    void plan(const Shape& a, const Shape& b, const Shape& y);
+public:
+    elementwise_backward(int op, float alpha = 0.f, float beta = 0.f);
+    ~elementwise_backward();
+    void forward(tensor& da, tensor& db, tensor& a, tensor& b, tensor& dy);
+    int runCommandBuffer();
+};
@@ -1 +1,143 @@
-#include "normalization.h"
\ No newline at end of file
+#include "../engine/common.h"
+#include "../engine/utils.h"
+#include "normalization.h"
+
+norm_layer::norm_layer(int kind, int size, uint32_t mode, float eps, float momentum, bool affine, bool track) :
+    m_kind(kind), m_size(size), m_mode(mode), m_affine(affine), m_track(track)
+{
+    if (kind < kNormBatch || kind > kNormGroup)
+        throw std::runtime_error("unknown normalization kind");
+    if (kind != kNormBatch && size <= 0)
+        throw std::runtime_error("normalization needs a positive group count or normalized size");
+    m_future = getThreadPool().async(&norm_layer::initVulkanThing, &*this, 10);
+    m_param = {};
+    m_param.eps = eps;
+    m_param.momentum = momentum;
+    m_type = kind == kNormBatch ? "batch_norm" : kind == kNormLayer ? "layer_norm" : "group_norm";
+}
+
+void norm_layer::setup(const Shape& shape)
+{
+    const int total = std::accumulate(shape.begin(), shape.end(), 1, std::multiplies<int>());
+    if (m_kind == kNormLayer)
+    {
+        if (total % m_size != 0)
+            throw std::runtime_error("layer_norm size does not divide the input");
+        m_param.outer = total / m_size;
+        m_param.channels = m_size;
+        m_param.inner = 1;
+        m_param.groups = 1;
+    }
+    else
+    {
+        if (shape.size() < 2)
+            throw std::runtime_error("normalization expects [batch, channels, ...]");
+        m_param.outer = shape[0];
+        m_param.channels = shape[1];
+        m_param.inner = total / (shape[0] * shape[1]);
+        m_param.groups = m_kind == kNormGroup ? m_size : 1;
+        if (m_param.channels % m_param.groups != 0)
+            throw std::runtime_error("group_norm channels must be divisible by groups");
+    }
+
+    // one workgroup per statistics set, plus the parameter sums of the group kinds
+    uint32_t work = m_kind == kNormBatch ? m_param.channels : m_param.outer * m_param.groups;
+    if (m_mode == 2 && m_kind != kNormBatch && m_affine)
+        work += m_param.inner == 1 ? (m_param.channels + 31) / 32 : m_param.channels;
+    m_group_x = std::min(static_cast<int>(work), max_compute_work_group_count);
+
+    std::vector<uint32_t> spec_data{ m_kind == kNormBatch ? 0u : 1u, m_mode, m_affine ? 1u : 0u, m_track ? 1u : 0u };
+    std::vector<VkSpecializationMapEntry> spec_entries(spec_data.size());
+    for (uint32_t i = 0; i < spec_entries.size(); ++i)
+    {
+        spec_entries[i].constantID = i;
+        spec_entries[i].offset = i * sizeof(uint32_t);
+        spec_entries[i].size = sizeof(uint32_t);
+    }
+    VkSpecializationInfo spec_info;
+    spec_info.mapEntryCount = static_cast<uint32_t>(spec_entries.size());
+    spec_info.pMapEntries = spec_entries.data();
+    spec_info.dataSize = spec_data.size() * sizeof(uint32_t);
+    spec_info.pData = spec_data.data();
+
+    m_future.wait();
+    createShaderModule(normalization_spv, sizeof(normalization_spv));
+    createPipeline(sizeof(norm_param), &spec_info);
+}
+
+void norm_layer::dispatch(tensor& x, tensor& gamma, tensor& beta, tensor& y, tensor& stats, tensor& running_mean,
+    tensor& running_var, tensor& dy, tensor& dgamma, tensor& dbeta)
+{
+    bindtensor(x, 0);
+    bindtensor(gamma, 1);
+    bindtensor(beta, 2);
+    bindtensor(y, 3);
+    bindtensor(stats, 4);
+    bindtensor(running_mean, 5);
+    bindtensor(running_var, 6);
+    bindtensor(dy, 7);
+    bindtensor(dgamma, 8);
+    bindtensor(dbeta, 9);
+    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(norm_param));
+}
+
+batch_norm::batch_norm(float eps, float momentum, bool affine, bool track_running_stats, bool training) :
+    norm_layer(kNormBatch, 0, training ? 0 : 1, eps, momentum, affine, track_running_stats && training)
+{
+    if (!training && !track_running_stats)
+        throw std::runtime_error("batch_norm inference needs running statistics");
+}
+
+void batch_norm::forward(tensor& y, tensor& x, tensor& gamma, tensor& beta, tensor& running_mean,
+    tensor& running_var, tensor& stats)
+{
+    if (m_pipeline == nullptr)
+        setup(x.getShape());
+    // unused bindings still need a buffer, the kernel never reads them
+    tensor& g = m_affine ? gamma : x;
+    tensor& b = m_affine ? beta : x;
+    dispatch(x, g, b, y, stats, running_mean, running_var, x, x, x);
+}
+
+layer_norm::layer_norm(int normalized_size, float eps, bool affine) :
+    norm_layer(kNormLayer, normalized_size, 0, eps, 0.f, affine, false)
+{
+}
+
+void layer_norm::forward(tensor& y, tensor& x, tensor& gamma, tensor& beta, tensor& stats)
+{
+    if (m_pipeline == nullptr)
+        setup(x.getShape());
+    tensor& g = m_affine ? gamma : x;
+    tensor& b = m_affine ? beta : x;
+    dispatch(x, g, b, y, stats, x, x, x, x, x);
+}
+
+group_norm::group_norm(int groups, float eps, bool affine) :
+    norm_layer(kNormGroup, groups, 0, eps, 0.f, affine, false)
+{
+}
+
+void group_norm::forward(tensor& y, tensor& x, tensor& gamma, tensor& beta, tensor& stats)
+{
+    if (m_pipeline == nullptr)
+        setup(x.getShape());
+    tensor& g = m_affine ? gamma : x;
+    tensor& b = m_affine ? beta : x;
+    dispatch(x, g, b, y, stats, x, x, x, x, x);
+}
+
+norm_backward::norm_backward(int kind, int size, bool affine) : norm_layer(kind, size, 2, 0.f, 0.f, affine, false)
+{
+}
+
+void norm_backward::forward(tensor& dx, tensor& dgamma, tensor& dbeta, tensor& x, tensor& dy, tensor& gamma,
+    tensor& stats)
+{
+    if (m_pipeline == nullptr)
+        setup(x.getShape());
+    tensor& g = m_affine ? gamma : x;
+    tensor& dg = m_affine ? dgamma : dx;
+    tensor& db = m_affine ? dbeta : dx;
+    dispatch(x, g, x, dx, stats, x, x, dy, dg, db);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "vknn.h"
+#include "../engine/layer.h"
+
+// x is viewed as [outer, channels, inner], see normalization.comp
+struct norm_param
+{
+    uint32_t outer;
+    uint32_t channels;
+    uint32_t inner;
+    uint32_t groups;
+    float eps;
+    float momentum;
+};
+
+enum norm_kind
+{
+    kNormBatch = 0,
+    kNormLayer = 1,
+    kNormGroup = 2
+};
+
+// Shared pipeline setup of the normalisation kernels. size is the number of
+// groups for group norm and the normalised element count for layer norm.
+// stats holds mean and 1 / std per statistics set, written by the training
+// forward pass and read by norm_backward.
+class norm_layer : public layer
+{
+protected:
+    norm_param m_param;
+    int m_kind;
+    int m_size;
+    uint32_t m_mode;
+    bool m_affine;
+    bool m_track;
+    void setup(const Shape& shape);
+    void dispatch(tensor& x, tensor& gamma, tensor& beta, tensor& y, tensor& stats, tensor& running_mean,
+        tensor& running_var, tensor& dy, tensor& dgamma, tensor& dbeta);
+public:
+    norm_layer(int kind, int size, uint32_t mode, float eps, float momentum, bool affine, bool track);
+};
+
+// training uses the batch statistics and updates the running ones when
+// track_running_stats is set, inference folds the running statistics into
+// one scale and shift per channel
+class batch_norm : public norm_layer
+{
+public:
+    batch_norm(float eps, float momentum, bool affine, bool track_running_stats, bool training);
+    void forward(tensor& y, tensor& x, tensor& gamma, tensor& beta, tensor& running_mean, tensor& running_var,
+        tensor& stats);
+};
+
+// normalises the trailing normalized_size elements of every row
+class layer_norm : public norm_layer
+{
+public:
+    layer_norm(int normalized_size, float eps, bool affine);
+    void forward(tensor& y, tensor& x, tensor& gamma, tensor& beta, tensor& stats);
+};
+
+class group_norm : public norm_layer
+{
+public:
+    group_norm(int groups, float eps, bool affine);
+    void forward(tensor& y, tensor& x, tensor& gamma, tensor& beta, tensor& stats);
+};
+
+// dx, dgamma and dbeta of any of the three in one dispatch, size as for norm_layer
+class norm_backward : public norm_layer
+{
+public:
+    norm_backward(int kind, int size, bool affine);
+    void forward(tensor& dx, tensor& dgamma, tensor& dbeta, tensor& x, tensor& dy, tensor& gamma, tensor& stats);
+};
@@ -1,11 +1,11 @@
 #include "../engine/common.h"
 #include "../engine/utils.h"
 #include "optimizer.h"
-#include <future>
 
 sgd::sgd(float lr, float momentum, float dampening, float weight_decay, bool nestrov)
 {
-    m_future = std::async(&sgd::initVulkanThing, &*this, 3);
+    m_future = getThreadPool().async(&sgd::initVulkanThing, &*this, 3);
+    m_type = "sgd";
     m_param.lr = lr;
     m_param.momentum = momentum;
     m_param.dampening = dampening;
@@ -21,8 +21,12 @@ void sgd::forward(tensor& p, tensor& dp, tensor& v)
         m_group_x = static_cast<int>(alignSize(m_param.total, 1024)) / 1024;
         if (m_group_x > max_compute_work_group_count)
             m_group_x = max_compute_work_group_count - 1;
+        const bool half = halfPrecision(p, dp);
         m_future.wait();
-        createShaderModule(sgd_spv, sizeof(sgd_spv));
+        if (half)
+            createShaderModule(sgd_fp16_spv, sizeof(sgd_fp16_spv));
+        else
+            createShaderModule(sgd_spv, sizeof(sgd_spv));
         createPipeline(sizeof(sgd_param));
     }
 
@@ -35,7 +39,8 @@ void sgd::forward(tensor& p, tensor& dp, tensor& v)
 
 adam::adam(float lr, float beta_a, float beta_b, float eps, float weight_decay, bool amsgrad)
 {
-    m_future = std::async(&adam::initVulkanThing, &*this, 6);
+    m_future = getThreadPool().async(&adam::initVulkanThing, &*this, 6);
+    m_type = "adam";
     m_param.lr = lr;
     m_param.beta_a = beta_a;
     m_param.beta_b = beta_b;
@@ -52,8 +57,12 @@ void adam::forward(int counter, tensor& p, tensor& dp, tensor& m, tensor& r, ten
         m_group_x = static_cast<int>(alignSize(m_param.total, 1024)) / 1024;
         if (m_group_x > max_compute_work_group_count)
             m_group_x = max_compute_work_group_count - 1;
+        const bool half = halfPrecision(p, dp);
         m_future.wait();
-        createShaderModule(adam_spv, sizeof(adam_spv));
+        if (half)
+            createShaderModule(adam_fp16_spv, sizeof(adam_fp16_spv));
+        else
+            createShaderModule(adam_spv, sizeof(adam_spv));
         createPipeline(sizeof(adam_param));
     }
     m_param.counter = counter;
@@ -69,7 +78,8 @@ void adam::forward(int counter, tensor& p, tensor& dp, tensor& m, tensor& r, ten
 
 adagrad::adagrad(float lr, float eps, float lr_decay, float weight_decay)
 {
-    m_future = std::async(&adagrad::initVulkanThing, &*this, 3);
+    m_future = getThreadPool().async(&adagrad::initVulkanThing, &*this, 3);
+    m_type = "adagrad";
     m_param.lr = lr;
     m_param.eps = eps;
     m_param.lr_decay = lr_decay;
@@ -84,9 +94,12 @@ void adagrad::forward(int counter, tensor& p, tensor& dp, tensor& v)
         m_group_x = static_cast<int>(alignSize(m_param.total, 1024)) / 1024;
         if (m_group_x > max_compute_work_group_count)
             m_group_x = max_compute_work_group_count - 1;
+        const bool half = halfPrecision(p, dp);
         m_future.wait();
-
-        //createShaderModule(adagrad_spv, sizeof(adagrad_spv));
+        if (half)
+            createShaderModule(adagrad_fp16_spv, sizeof(adagrad_fp16_spv));
+        else
+            createShaderModule(adagrad_spv, sizeof(adagrad_spv));
         createPipeline(sizeof(adagrad_param));
     }
     m_param.counter = counter;
@@ -98,7 +111,8 @@ void adagrad::forward(int counter, tensor& p, tensor& dp, tensor& v)
 
 rmsprop::rmsprop(float lr, float alpha, float eps, float weight_decay, float momentum, bool centered)
 {
-    m_future = std::async(&adagrad::initVulkanThing, &*this, 3);
+    m_future = getThreadPool().async(&rmsprop::initVulkanThing, &*this, 3);
+    m_type = "rmsprop";
     m_param.lr = lr;
     m_param.alpha = alpha;
     m_param.eps = eps;
@@ -115,9 +129,12 @@ void rmsprop::forward(tensor& p, tensor& dp, tensor& v)
         m_group_x = static_cast<int>(alignSize(m_param.total, 1024)) / 1024;
         if (m_group_x > max_compute_work_group_count)
             m_group_x = max_compute_work_group_count - 1;
+        const bool half = halfPrecision(p, dp);
         m_future.wait();
-
-        //createShaderModule(rmsprop_spv, sizeof(rmsprop_spv));
+        if (half)
+            createShaderModule(rmsprop_fp16_spv, sizeof(rmsprop_fp16_spv));
+        else
+            createShaderModule(rmsprop_spv, sizeof(rmsprop_spv));
         createPipeline(sizeof(rmsprop_param));
     }
 
@@ -125,4 +142,155 @@ void rmsprop::forward(tensor& p, tensor& dp, tensor& v)
     bindtensor(dp, 1);
     bindtensor(v, 2);
     recordCommandBuffer(static_cast<void*>(&m_param), sizeof(rmsprop_param));
-}
\ No newline at end of file
+}
+constexpr uint32_t multi_tensor_chunk = 4096;
+
+multi_tensor_optimizer::multi_tensor_optimizer(uint32_t algo, bool flag, int state_slots)
+    : m_algo(algo), m_flag(flag), m_state_slots(state_slots), m_table(Format::kFormatInt32), m_chunks(Format::kFormatInt32)
+{
+    m_future = getThreadPool().async(&multi_tensor_optimizer::initVulkanThing, &*this, 2);
+    m_type = "multi_tensor_optimizer";
+    m_param = {};
+    m_param.chunk_size = multi_tensor_chunk;
+    m_param.bias_correction_a = 1.f;
+    m_param.bias_correction_b = 1.f;
+}
+
+void multi_tensor_optimizer::updateParam(int counter)
+{
+    m_param.counter = counter;
+}
+
+void multi_tensor_optimizer::buildTables(std::vector<tensor*>& params, std::vector<tensor*>& grads,
+    std::vector<std::vector<tensor*>>& states)
+{
+    if (grads.size() != params.size() || states.size() != static_cast<size_t>(m_state_slots))
+        throw std::runtime_error("multi_tensor_optimizer expects one gradient per parameter and one list per state slot");
+    for (const auto& slot : states)
+    {
+        if (slot.size() != params.size())
+            throw std::runtime_error("multi_tensor_optimizer state slot does not match the parameters");
+    }
+    if (!bufferDeviceAddressSupported(m_device_id))
+        throw std::runtime_error("multi_tensor_optimizer needs buffer device addresses");
+
+    // param, grad and three state addresses per tensor, unused state slots alias the parameter
+    std::vector<VkDeviceAddress> addresses;
+    addresses.reserve(params.size() * 5);
+    for (size_t i = 0; i < params.size(); ++i)
+    {
+        if (grads[i]->count() != params[i]->count())
+            throw std::runtime_error("multi_tensor_optimizer gradient and parameter sizes differ");
+        const VkDeviceAddress p = params[i]->getBuffer()->getDeviceAddress();
+        addresses.push_back(p);
+        addresses.push_back(grads[i]->getBuffer()->getDeviceAddress());
+        for (int k = 0; k < 3; ++k)
+            addresses.push_back(k < m_state_slots ? states[k][i]->getBuffer()->getDeviceAddress() : p);
+    }
+    if (addresses == m_addresses)
+        return;
+    m_addresses = addresses;
+
+    // tensor_entry is five 64-bit addresses followed by length and padding, 12 words
+    std::vector<uint32_t> table;
+    std::vector<uint32_t> chunks;
+    for (size_t i = 0; i < params.size(); ++i)
+    {
+        for (int k = 0; k < 5; ++k)
+        {
+            const VkDeviceAddress address = addresses[i * 5 + k];
+            table.push_back(static_cast<uint32_t>(address));
+            table.push_back(static_cast<uint32_t>(address >> 32));
+        }
+        const uint32_t length = params[i]->count();
+        table.push_back(length);
+        table.push_back(0);
+        for (uint32_t start = 0; start < length; start += multi_tensor_chunk)
+        {
+            chunks.push_back(static_cast<uint32_t>(i));
+            chunks.push_back(start);
+        }
+    }
+    if (chunks.empty())
+        chunks.assign(2, 0);
+
+    m_table = tensor(reinterpret_cast<char*>(table.data()), Shape{ static_cast<int>(table.size()) }, Format::kFormatInt32);
+    m_chunks = tensor(reinterpret_cast<char*>(chunks.data()), Shape{ static_cast<int>(chunks.size()) }, Format::kFormatInt32);
+    m_param.chunks = static_cast<uint32_t>(chunks.size() / 2);
+    m_group_x = static_cast<int>(m_param.chunks);
+    if (m_group_x > max_compute_work_group_count)
+        m_group_x = max_compute_work_group_count;
+}
+
+void multi_tensor_optimizer::forward(int counter, std::vector<tensor*>& params, std::vector<tensor*>& grads,
+    std::vector<std::vector<tensor*>>& states)
+{
+    buildTables(params, grads, states);
+    if (m_pipeline == nullptr)
+    {
+        const uint32_t spec_data[2] = { m_algo, m_flag };
+        VkSpecializationMapEntry entries[2];
+        for (uint32_t i = 0; i < 2; ++i)
+        {
+            entries[i].constantID = i;
+            entries[i].offset = i * sizeof(uint32_t);
+            entries[i].size = sizeof(uint32_t);
+        }
+        VkSpecializationInfo spec_info = {};
+        spec_info.mapEntryCount = 2;
+        spec_info.pMapEntries = entries;
+        spec_info.dataSize = sizeof(spec_data);
+        spec_info.pData = spec_data;
+
+        m_future.wait();
+        createShaderModule(multi_tensor_optimizer_spv, sizeof(multi_tensor_optimizer_spv));
+        createPipeline(sizeof(multi_tensor_param), &spec_info);
+    }
+    updateParam(counter);
+
+    bindtensor(m_table, 0);
+    bindtensor(m_chunks, 1);
+    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(multi_tensor_param));
+}
+
+multi_tensor_sgd::multi_tensor_sgd(float lr, float momentum, float weight_decay)
+    : multi_tensor_optimizer(0, false, momentum > 0.f ? 1 : 0)
+{
+    m_param.lr = lr;
+    m_param.momentum = momentum;
+    m_param.weight_decay = weight_decay;
+}
+
+multi_tensor_adam::multi_tensor_adam(float lr, float beta_a, float beta_b, float eps, float weight_decay, bool amsgrad)
+    : multi_tensor_optimizer(1, amsgrad, amsgrad ? 3 : 2)
+{
+    m_param.lr = lr;
+    m_param.beta_a = beta_a;
+    m_param.beta_b = beta_b;
+    m_param.eps = eps;
+    m_param.weight_decay = weight_decay;
+}
+
+void multi_tensor_adam::updateParam(int counter)
+{
+    m_param.counter = counter;
+    m_param.bias_correction_a = 1.f - std::pow(m_param.beta_a, static_cast<float>(counter));
+    m_param.bias_correction_b = 1.f - std::pow(m_param.beta_b, static_cast<float>(counter));
+}
+
+multi_tensor_adagrad::multi_tensor_adagrad(float lr, float eps, float weight_decay)
+    : multi_tensor_optimizer(2, false, 1)
+{
+    m_param.lr = lr;
+    m_param.eps = eps;
+    m_param.weight_decay = weight_decay;
+}
+
+multi_tensor_rmsprop::multi_tensor_rmsprop(float lr, float alpha, float eps, float weight_decay)
+    : multi_tensor_optimizer(3, false, 1)
+{
+    m_param.lr = lr;
+    m_param.alpha = alpha;
+    m_param.eps = eps;
+    m_param.weight_decay = weight_decay;
+}
@@ -77,3 +77,70 @@ public:
     rmsprop(float lr, float alpha, float eps, float weight_decay, float momentum, bool centered);
     void forward(tensor& p, tensor& dp, tensor& v);
 };
+
+struct multi_tensor_param
+{
+    uint32_t chunks;
+    uint32_t chunk_size;
+    int counter;
+    float lr;
+    float weight_decay;
+    float momentum;
+    float beta_a;
+    float beta_b;
+    float eps;
+    float alpha;
+    float bias_correction_a;
+    float bias_correction_b;
+};
+
+// Multi-tensor optimizer step: every parameter, gradient and state tensor is
+// reached through its buffer device address from a table on the device, so a
+// whole model is updated with one dispatch and one submit. Needs
+// bufferDeviceAddressSupported on the tensors' device. states[k][i] is state
+// slot k of parameter i, see multi_tensor_optimizer.comp for the slots. The
+// update rules follow the host steps in madml/optimizer.py, weight_decay being
+// the coefficient of their L2 term.
+class multi_tensor_optimizer : public layer
+{
+protected:
+    multi_tensor_param m_param;
+    uint32_t m_algo;
+    bool m_flag;
+    int m_state_slots;
+    std::vector<VkDeviceAddress> m_addresses;
+    tensor m_table;
+    tensor m_chunks;
+
+    multi_tensor_optimizer(uint32_t algo, bool flag, int state_slots);
+    void buildTables(std::vector<tensor*>& params, std::vector<tensor*>& grads, std::vector<std::vector<tensor*>>& states);
+    virtual void updateParam(int counter);
+public:
+    void forward(int counter, std::vector<tensor*>& params, std::vector<tensor*>& grads, std::vector<std::vector<tensor*>>& states);
+    int stateSlots() const { return m_state_slots; }
+};
+
+class multi_tensor_sgd : public multi_tensor_optimizer
+{
+public:
+    multi_tensor_sgd(float lr, float momentum, float weight_decay);
+};
+
+class multi_tensor_adam : public multi_tensor_optimizer
+{
+    void updateParam(int counter) override;
+public:
+    multi_tensor_adam(float lr, float beta_a, float beta_b, float eps, float weight_decay, bool amsgrad);
+};
+
+class multi_tensor_adagrad : public multi_tensor_optimizer
+{
+public:
+    multi_tensor_adagrad(float lr, float eps, float weight_decay);
+};
+
+class multi_tensor_rmsprop : public multi_tensor_optimizer
+{
+public:
+    multi_tensor_rmsprop(float lr, float alpha, float eps, float weight_decay);
+};
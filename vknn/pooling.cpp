@@ -2,11 +2,10 @@
 #include "../engine/utils.h"
 
 #include "pooling.h"
-#include <future>
 
 max_reduce::max_reduce(bool derivative) : m_derivative(derivative)
 {
-    m_future = std::async(&max_reduce::initVulkanThing, &*this, 3);
+    m_future = getThreadPool().async(&max_reduce::initVulkanThing, &*this, 3);
 }
 
 void max_reduce::forward(tensor& y, tensor& col, tensor& max_idx)
@@ -35,3 +34,109 @@ void max_reduce::forward(tensor& y, tensor& col, tensor& max_idx)
     bindtensor(max_idx, 2);
     recordCommandBuffer(static_cast<void*>(&m_param), sizeof(max_reduce_param));
 }
+
+static pool_param poolParam(int mode, std::vector<int>& params, bool count_include_pad)
+{
+    if (mode != kPoolMax && mode != kPoolAvg)
+        throw std::runtime_error("unknown pooling mode");
+    if (params.size() < 20)
+        throw std::runtime_error("pooling expects vol2col params");
+    pool_param p;
+    p.planes = params[0] * params[1];
+    uint32_t* window = &p.kernel_d;
+    for (int i = 2; i < 20; ++i)
+        window[i - 2] = static_cast<uint32_t>(params[i]);
+    p.count_include_pad = count_include_pad ? 1 : 0;
+    return p;
+}
+
+static VkSpecializationInfo poolSpecInfo(std::vector<uint32_t>& data, std::vector<VkSpecializationMapEntry>& entries)
+{
+    entries.resize(data.size());
+    for (uint32_t i = 0; i < entries.size(); ++i)
+    {
+        entries[i].constantID = i;
+        entries[i].offset = i * sizeof(uint32_t);
+        entries[i].size = sizeof(uint32_t);
+    }
+    VkSpecializationInfo info;
+    info.mapEntryCount = static_cast<uint32_t>(entries.size());
+    info.pMapEntries = entries.data();
+    info.dataSize = data.size() * sizeof(uint32_t);
+    info.pData = data.data();
+    return info;
+}
+
+pool_forward::pool_forward(int mode, std::vector<int>& params, bool count_include_pad) :
+    m_param(poolParam(mode, params, count_include_pad)), m_mode(mode)
+{
+    m_future = getThreadPool().async(&pool_forward::initVulkanThing, &*this, 3);
+    m_type = mode == kPoolMax ? "max_pool" : "avg_pool";
+}
+
+void pool_forward::forward(tensor& y, tensor& x, tensor& argmax)
+{
+    const uint32_t pixels = m_param.depth_col * m_param.height_col * m_param.width_col;
+    const uint32_t outputs = m_param.planes * pixels;
+    if (static_cast<uint32_t>(x.count()) != m_param.planes * m_param.depth_vol * m_param.height_vol * m_param.width_vol ||
+        static_cast<uint32_t>(y.count()) != outputs)
+        throw std::runtime_error(m_type + " tensors do not match its params");
+    if (m_mode == kPoolMax && static_cast<uint32_t>(argmax.count()) != outputs)
+        throw std::runtime_error("max_pool argmax must be shaped like the output");
+
+    if (m_pipeline == nullptr)
+    {
+        const uint32_t window = m_param.kernel_d * m_param.kernel_h * m_param.kernel_w;
+        const bool wide = window >= static_cast<uint32_t>(kPoolSubgroupWindow) && subgroupArithmeticSupported(m_device_id);
+        // wide reduces one output per subgroup, sized for subgroups of 32, the
+        // kernel loops over whatever is left for other sizes
+        const uint32_t per_group = wide ? 8 : 256;
+        m_group_x = std::min(static_cast<int>((outputs + per_group - 1) / per_group), max_compute_work_group_count);
+
+        std::vector<uint32_t> spec_data{ static_cast<uint32_t>(m_mode), wide ? 1u : 0u };
+        std::vector<VkSpecializationMapEntry> spec_entries;
+        VkSpecializationInfo spec_info = poolSpecInfo(spec_data, spec_entries);
+        m_future.wait();
+        if (wide)
+            createShaderModule(pool_subgroup_spv, sizeof(pool_subgroup_spv));
+        else
+            createShaderModule(pool_spv, sizeof(pool_spv));
+        createPipeline(sizeof(pool_param), &spec_info);
+    }
+
+    bindtensor(x, 0);
+    bindtensor(y, 1);
+    bindtensor(m_mode == kPoolMax ? argmax : y, 2);
+    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(pool_param));
+}
+
+pool_backward::pool_backward(int mode, std::vector<int>& params, bool count_include_pad) :
+    m_param(poolParam(mode, params, count_include_pad)), m_mode(mode)
+{
+    m_future = getThreadPool().async(&pool_backward::initVulkanThing, &*this, 3);
+    m_type = mode == kPoolMax ? "max_pool_backward" : "avg_pool_backward";
+}
+
+void pool_backward::forward(tensor& dx, tensor& dy, tensor& argmax)
+{
+    const uint32_t inputs = m_param.planes * m_param.depth_vol * m_param.height_vol * m_param.width_vol;
+    if (static_cast<uint32_t>(dx.count()) != inputs ||
+        static_cast<uint32_t>(dy.count()) != m_param.planes * m_param.depth_col * m_param.height_col * m_param.width_col)
+        throw std::runtime_error(m_type + " tensors do not match its params");
+
+    if (m_pipeline == nullptr)
+    {
+        m_group_x = std::min(static_cast<int>((inputs + 255) / 256), max_compute_work_group_count);
+        std::vector<uint32_t> spec_data{ static_cast<uint32_t>(m_mode) };
+        std::vector<VkSpecializationMapEntry> spec_entries;
+        VkSpecializationInfo spec_info = poolSpecInfo(spec_data, spec_entries);
+        m_future.wait();
+        createShaderModule(pool_backward_spv, sizeof(pool_backward_spv));
+        createPipeline(sizeof(pool_param), &spec_info);
+    }
+
+    bindtensor(dy, 0);
+    bindtensor(m_mode == kPoolMax ? argmax : dy, 1);
+    bindtensor(dx, 2);
+    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(pool_param));
+}
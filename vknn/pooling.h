@@ -27,4 +27,61 @@ class max_reduce : public layer
 public:
     max_reduce(bool derivative);
     void forward(tensor& y, tensor& col, tensor& mdx_idx);
-};
\ No newline at end of file
+};
+
+enum pool_mode
+{
+    kPoolMax = 0,
+    kPoolAvg = 1
+};
+
+// windows with at least this many taps are reduced by a whole subgroup
+constexpr int kPoolSubgroupWindow = 32;
+
+struct pool_param
+{
+    uint32_t planes;
+    uint32_t kernel_d;
+    uint32_t kernel_h;
+    uint32_t kernel_w;
+    uint32_t pad_d;
+    uint32_t pad_h;
+    uint32_t pad_w;
+    uint32_t stride_d;
+    uint32_t stride_h;
+    uint32_t stride_w;
+    uint32_t dilation_d;
+    uint32_t dilation_h;
+    uint32_t dilation_w;
+    uint32_t depth_col;
+    uint32_t height_col;
+    uint32_t width_col;
+    uint32_t depth_vol;
+    uint32_t height_vol;
+    uint32_t width_vol;
+    uint32_t count_include_pad;
+};
+
+// Max or average pooling read straight from the NCDHW input, without a
+// vol2col buffer. params use the vol2col layout. Max pooling writes the
+// offset of every maximum within its input plane to argmax (int32, shaped
+// like y, -1 for a window in the padding); average pooling leaves it alone.
+class pool_forward : public layer
+{
+    pool_param m_param;
+    int m_mode;
+public:
+    pool_forward(int mode, std::vector<int>& params, bool count_include_pad = true);
+    void forward(tensor& y, tensor& x, tensor& argmax);
+};
+
+// dx of pool_forward, gathered per input element so overlapping windows need
+// no atomics and dx no zero fill. argmax is only read for max pooling.
+class pool_backward : public layer
+{
+    pool_param m_param;
+    int m_mode;
+public:
+    pool_backward(int mode, std::vector<int>& params, bool count_include_pad = true);
+    void forward(tensor& dx, tensor& dy, tensor& argmax);
+};
@@ -0,0 +1,253 @@
+#include "../engine/common.h"
+#include "../engine/utils.h"
+#include "quantize.h"
+
+constexpr int kGemmInt8Tile = 64;
+
+static VkSpecializationInfo specInfo(std::vector<uint32_t>& data, std::vector<VkSpecializationMapEntry>& entries)
+{
+    entries.resize(data.size());
+    for (uint32_t i = 0; i < entries.size(); ++i)
+    {
+        entries[i].constantID = i;
+        entries[i].offset = i * sizeof(uint32_t);
+        entries[i].size = sizeof(uint32_t);
+    }
+    VkSpecializationInfo info;
+    info.mapEntryCount = static_cast<uint32_t>(entries.size());
+    info.pMapEntries = entries.data();
+    info.dataSize = data.size() * sizeof(uint32_t);
+    info.pData = data.data();
+    return info;
+}
+
+// int8 tensors are read and written as whole words by the kernels
+static void checkInt8(const tensor& t, size_t bytes, const std::string& what)
+{
+    if (t.getFormat() != Format::kFormatInt8)
+        throw std::runtime_error(what + " must be an int8 tensor");
+    if (t.size() < alignSize(bytes, 4))
+        throw std::runtime_error(what + " must hold its int8 values padded to a multiple of 4 bytes");
+}
+
+quantize::quantize(float scale, int zero_point, int cols, int cols_padded, bool dequantize) : m_dequantize(dequantize)
+{
+    if (scale <= 0.f || zero_point < -128 || zero_point > 127 || cols <= 0 || cols_padded < cols)
+        throw std::runtime_error("quantize expects scale > 0, an int8 zero point and cols_padded >= cols");
+    m_future = getThreadPool().async(&quantize::initVulkanThing, &*this, 2);
+    m_type = "quantize";
+    m_param = {};
+    m_param.cols = cols;
+    m_param.cols_padded = cols_padded;
+    m_param.scale = scale;
+    m_param.zero_point = zero_point;
+}
+
+void quantize::forward(tensor& q, tensor& x)
+{
+    if (x.getFormat() != Format::kFormatFp32)
+        throw std::runtime_error("quantize expects an fp32 tensor");
+    if (x.count() % m_param.cols != 0)
+        throw std::runtime_error("quantize input is not a whole number of rows");
+    const uint32_t rows = x.count() / m_param.cols;
+    const size_t bytes = static_cast<size_t>(rows) * m_param.cols_padded;
+    checkInt8(q, bytes, "quantize output");
+
+    if (m_pipeline == nullptr || rows != m_param.rows)
+    {
+        m_param.rows = rows;
+        m_param.total = m_dequantize ? rows * m_param.cols : static_cast<uint32_t>(alignSize(bytes, 4) / 4);
+        m_group_x = std::min(static_cast<int>(alignSize(m_param.total, 256) / 256), max_compute_work_group_count);
+    }
+    if (m_pipeline == nullptr)
+    {
+        std::vector<uint32_t> spec_data{ m_dequantize ? 1u : 0u };
+        std::vector<VkSpecializationMapEntry> spec_entries;
+        VkSpecializationInfo spec_info = specInfo(spec_data, spec_entries);
+        m_future.wait();
+        createShaderModule(quantize_spv, sizeof(quantize_spv));
+        createPipeline(sizeof(quantize_param), &spec_info);
+    }
+
+    bindtensor(x, 0);
+    bindtensor(q, 1);
+    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(quantize_param));
+}
+
+quantized_weight quantizeWeights(const tensor& w)
+{
+    if (w.getFormat() != Format::kFormatFp32 || w.dimNum() < 2)
+        throw std::runtime_error("quantizeWeights expects an fp32 weight with output channels first");
+    quantized_weight q;
+    q.rows = w.getShape()[0];
+    q.cols = w.count() / q.rows;
+    q.cols_padded = static_cast<int>(alignSize(q.cols, 4));
+
+    char* host = w.toHost();
+    const float* src = reinterpret_cast<const float*>(host);
+    std::vector<int8_t> data(static_cast<size_t>(q.rows) * q.cols_padded, 0);
+    std::vector<float> scales(q.rows);
+    std::vector<int> sums(q.rows, 0);
+    for (int r = 0; r < q.rows; ++r)
+    {
+        const float* row = src + static_cast<size_t>(r) * q.cols;
+        float absmax = 0.f;
+        for (int c = 0; c < q.cols; ++c)
+            absmax = std::max(absmax, std::fabs(row[c]));
+        // an all zero row quantizes to zeros under any scale
+        scales[r] = absmax > 0.f ? absmax / 127.f : 1.f;
+        for (int c = 0; c < q.cols; ++c)
+        {
+            const int v = static_cast<int>(std::lround(row[c] / scales[r]));
+            data[static_cast<size_t>(r) * q.cols_padded + c] = static_cast<int8_t>(std::min(std::max(v, -127), 127));
+            sums[r] += data[static_cast<size_t>(r) * q.cols_padded + c];
+        }
+    }
+    delete[] host;
+
+    q.data = tensor(reinterpret_cast<char*>(data.data()), { q.rows, q.cols_padded }, Format::kFormatInt8);
+    q.scales = tensor(scales, { q.rows });
+    q.sums = tensor(reinterpret_cast<char*>(sums.data()), { q.rows }, Format::kFormatInt32);
+    return q;
+}
+
+im2col_int8::im2col_int8(std::vector<int>& params, int zero_point)
+{
+    if (params.size() < 20)
+        throw std::runtime_error("im2col_int8 expects vol2col params");
+    m_future = getThreadPool().async(&im2col_int8::initVulkanThing, &*this, 2);
+    m_type = "im2col_int8";
+    uint32_t* p = &m_param.batch;
+    for (int i = 0; i < 20; ++i)
+        p[i] = static_cast<uint32_t>(params[i]);
+    const size_t k = static_cast<size_t>(m_param.channels) * m_param.kernel_d * m_param.kernel_h * m_param.kernel_w;
+    m_param.k4 = static_cast<uint32_t>(alignSize(k, 4) / 4);
+    m_param.zero_point = zero_point;
+}
+
+void im2col_int8::forward(tensor& col, tensor& vol)
+{
+    const size_t pixels = static_cast<size_t>(m_param.depth_col) * m_param.height_col * m_param.width_col;
+    const size_t vol_size = static_cast<size_t>(m_param.depth_vol) * m_param.height_vol * m_param.width_vol;
+    checkInt8(vol, m_param.batch * m_param.channels * vol_size, "im2col_int8 input");
+    checkInt8(col, m_param.batch * pixels * m_param.k4 * 4, "im2col_int8 col");
+
+    if (m_pipeline == nullptr)
+    {
+        m_group_x = std::min(static_cast<int>(alignSize(m_param.k4, 16) / 16), max_compute_work_group_count);
+        m_group_y = std::min(static_cast<int>(alignSize(pixels, 16) / 16), max_compute_work_group_count);
+        m_group_z = std::min(static_cast<int>(m_param.batch), max_compute_work_group_count);
+        m_future.wait();
+        createShaderModule(im2col_int8_spv, sizeof(im2col_int8_spv));
+        createPipeline(sizeof(im2col_int8_param));
+    }
+
+    bindtensor(vol, 0);
+    bindtensor(col, 1);
+    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(im2col_int8_param));
+}
+
+gemm_int8::gemm_int8(float x_scale, int x_zero, float y_scale, int y_zero, bool use_bias, bool relu, bool int8_out) :
+    m_relu(relu), m_int8_out(int8_out)
+{
+    if (x_scale <= 0.f || (int8_out && y_scale <= 0.f))
+        throw std::runtime_error("gemm_int8 scales must be positive");
+    m_future = getThreadPool().async(&gemm_int8::initVulkanThing, &*this, 6);
+    m_type = "gemm_int8";
+    m_param = {};
+    m_param.a_zero = x_zero;
+    m_param.a_scale = x_scale;
+    m_param.y_scale = y_scale;
+    m_param.y_zero = y_zero;
+    m_param.use_bias = use_bias ? 1 : 0;
+}
+
+void gemm_int8::forward(tensor& y, tensor& x, quantized_weight& w, tensor& b)
+{
+    if (x.count() % w.cols_padded != 0)
+        throw std::runtime_error("gemm_int8 input rows must be padded like the weight");
+    const int m = x.count() / w.cols_padded;
+    forwardStrided(y, x, w, b, 1, m, 0, 0, w.rows, 1);
+}
+
+void gemm_int8::forwardStrided(tensor& y, tensor& x, quantized_weight& w, tensor& b, int batch, int m, int stride_a,
+    int stride_d, int ldd_m, int ldd_n)
+{
+    const uint32_t k4 = static_cast<uint32_t>(w.cols_padded / 4);
+    checkInt8(x, (static_cast<size_t>(batch - 1) * stride_a + static_cast<size_t>(m) * k4) * 4, "gemm_int8 input");
+    const size_t outputs = static_cast<size_t>(batch) * m * w.rows;
+    if (m_int8_out)
+        checkInt8(y, outputs, "gemm_int8 output");
+    else if (y.getFormat() != Format::kFormatFp32 || static_cast<size_t>(y.count()) < outputs)
+        throw std::runtime_error("gemm_int8 fp32 output is too small");
+
+    m_param.batch = batch;
+    m_param.m = m;
+    m_param.n = w.rows;
+    m_param.k4 = k4;
+    m_param.stride_a = stride_a;
+    m_param.stride_d = stride_d;
+    m_param.ldd_m = ldd_m;
+    m_param.ldd_n = ldd_n;
+    m_group_x = std::min(static_cast<int>(alignSize(m_param.n, kGemmInt8Tile) / kGemmInt8Tile), max_compute_work_group_count);
+    m_group_y = std::min(static_cast<int>(alignSize(m_param.m, kGemmInt8Tile) / kGemmInt8Tile), max_compute_work_group_count);
+    m_group_z = std::min(batch, max_compute_work_group_count);
+
+    if (m_pipeline == nullptr)
+    {
+        std::vector<uint32_t> spec_data{ m_int8_out ? 1u : 0u, m_relu ? 1u : 0u };
+        std::vector<VkSpecializationMapEntry> spec_entries;
+        VkSpecializationInfo spec_info = specInfo(spec_data, spec_entries);
+        m_future.wait();
+        if (integerDotProductSupported(m_device_id))
+            createShaderModule(gemm_int8_dot_spv, sizeof(gemm_int8_dot_spv));
+        else
+            createShaderModule(gemm_int8_spv, sizeof(gemm_int8_spv));
+        createPipeline(sizeof(gemm_int8_param), &spec_info);
+    }
+
+    bindtensor(x, 0);
+    bindtensor(w.data, 1);
+    bindtensor(w.scales, 2);
+    bindtensor(w.sums, 3);
+    // the bias binding needs a buffer even when it is not read
+    bindtensor(m_param.use_bias ? b : w.scales, 4);
+    bindtensor(y, 5);
+    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(gemm_int8_param));
+}
+
+conv_int8::conv_int8(std::vector<int>& params, float x_scale, int x_zero, float y_scale, int y_zero, bool use_bias,
+    bool relu, bool int8_out) : m_params(params)
+{
+    if (params.size() != 21 && !(params.size() == 22 && params[21] == 1))
+        throw std::runtime_error("conv_int8 expects vol2col params followed by out_channels, without groups");
+    m_im2col.reset(new im2col_int8(params, x_zero));
+    m_gemm.reset(new gemm_int8(x_scale, x_zero, y_scale, y_zero, use_bias, relu, int8_out));
+}
+
+conv_int8::~conv_int8() = default;
+
+void conv_int8::forward(tensor& y, tensor& x, quantized_weight& w, tensor& b)
+{
+    const int batch = m_params[0];
+    const int pixels = m_params[14] * m_params[15] * m_params[16];
+    const int k4 = static_cast<int>(m_im2col->rowWords());
+    if (w.rows != m_params[20] || w.cols_padded != k4 * 4)
+        throw std::runtime_error("conv_int8 weight does not match the convolution");
+    if (m_col.isEmpty())
+    {
+        m_col = tensor(Format::kFormatInt8);
+        m_col.reshape(nullptr, { batch, pixels, k4 * 4 }, true, Format::kFormatInt8);
+    }
+
+    m_im2col->forward(m_col, x);
+    // D[b, oc, pixel], so the output comes out NCDHW
+    m_gemm->forwardStrided(y, m_col, w, b, batch, pixels, pixels * k4, w.rows * pixels, 1, pixels);
+}
+
+int conv_int8::runCommandBuffer()
+{
+    m_im2col->runCommandBuffer();
+    m_gemm->runCommandBuffer();
+    return 1;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "vknn.h"
+#include "../engine/layer.h"
+
+struct quantize_param
+{
+    uint32_t total;
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t cols_padded;
+    float scale;
+    int32_t zero_point;
+};
+
+// fp32 [rows, cols] <-> int8 [rows, cols_padded], q = round(x / scale) +
+// zero_point. The int8 tensor holds bytes packed four to a word and must be
+// at least rows * cols_padded bytes rounded up to a word. cols_padded is
+// usually cols rounded up to 4 so gemm_int8 can read the rows as words.
+class quantize : public layer
+{
+    quantize_param m_param;
+    bool m_dequantize;
+public:
+    quantize(float scale, int zero_point, int cols, int cols_padded, bool dequantize = false);
+    // quantizing writes q from x, dequantizing writes x from q
+    void forward(tensor& q, tensor& x);
+};
+
+// Weight quantized once at load time: symmetric int8 per output channel,
+// data is [rows, cols_padded] with zero padding, scales and sums hold the
+// scale and the sum of the quantized row of every output channel.
+struct quantized_weight
+{
+    tensor data;
+    tensor scales;
+    tensor sums;
+    int rows;
+    int cols;
+    int cols_padded;
+};
+
+// w is fp32 with the output channels along the first axis, [n, k] for a
+// gemm and [out_channels, in_channels, kd, kh, kw] for a convolution.
+quantized_weight quantizeWeights(const tensor& w);
+
+struct gemm_int8_param
+{
+    uint32_t batch;
+    uint32_t m;
+    uint32_t n;
+    uint32_t k4;
+    uint32_t stride_a;
+    uint32_t stride_d;
+    uint32_t ldd_m;
+    uint32_t ldd_n;
+    int32_t a_zero;
+    float a_scale;
+    float y_scale;
+    int32_t y_zero;
+    uint32_t use_bias;
+};
+
+// y = act(x * w^T + b) for an int8 x [m, k] and a quantized_weight w [n, k],
+// accumulated in int32 and requantized to int8 with (y_scale, y_zero), or
+// written as fp32 when int8_out is false. b is fp32 [n] and only read with
+// use_bias. Uses VK_KHR_shader_integer_dot_product where the device has it.
+class gemm_int8 : public layer
+{
+    gemm_int8_param m_param;
+    bool m_relu;
+    bool m_int8_out;
+public:
+    gemm_int8(float x_scale, int x_zero, float y_scale, int y_zero, bool use_bias, bool relu, bool int8_out = true);
+    void forward(tensor& y, tensor& x, quantized_weight& w, tensor& b);
+    // batch GEMMs of [m, k] rows batch_stride words apart, D[b, m, n] at
+    // b * stride_d + m * ldd_m + n * ldd_n, used by conv_int8
+    void forwardStrided(tensor& y, tensor& x, quantized_weight& w, tensor& b, int batch, int m, int stride_a,
+        int stride_d, int ldd_m, int ldd_n);
+};
+
+struct im2col_int8_param
+{
+    uint32_t batch;
+    uint32_t channels;
+    uint32_t kernel_d;
+    uint32_t kernel_h;
+    uint32_t kernel_w;
+    uint32_t pad_d;
+    uint32_t pad_h;
+    uint32_t pad_w;
+    uint32_t stride_d;
+    uint32_t stride_h;
+    uint32_t stride_w;
+    uint32_t dilation_d;
+    uint32_t dilation_h;
+    uint32_t dilation_w;
+    uint32_t depth_col;
+    uint32_t height_col;
+    uint32_t width_col;
+    uint32_t depth_vol;
+    uint32_t height_vol;
+    uint32_t width_vol;
+    uint32_t k4;
+    int32_t zero_point;
+};
+
+// int8 NCDHW volume to one row of K4 packed words per output pixel, the
+// rows of every batch stacked, K in the (c, kd, kh, kw) weight order
+class im2col_int8 : public layer
+{
+    im2col_int8_param m_param;
+public:
+    im2col_int8(std::vector<int>& params, int zero_point);
+    uint32_t rowWords() const { return m_param.k4; }
+    void forward(tensor& col, tensor& vol);
+};
+
+// int8 convolution over NCDHW tensors as an int8 im2col followed by
+// gemm_int8, which writes the output channel-major. params use the vol2col
+// layout followed by out_channels, groups are not supported.
+class conv_int8
+{
+    std::vector<int> m_params;
+    std::unique_ptr<im2col_int8> m_im2col;
+    std::unique_ptr<gemm_int8> m_gemm;
+    tensor m_col;
+public:
+    conv_int8(std::vector<int>& params, float x_scale, int x_zero, float y_scale, int y_zero, bool use_bias, bool relu,
+        bool int8_out = true);
+    ~conv_int8();
+    void forward(tensor& y, tensor& x, quantized_weight& w, tensor& b);
+    int runCommandBuffer();
+};
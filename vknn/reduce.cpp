@@ -0,0 +1,209 @@
+#include "../engine/common.h"
+#include "../engine/utils.h"
+#include "reduce.h"
+
+// shader opcodes, see reduce.glsl
+static uint32_t shaderOp(int op)
+{
+    switch (op)
+    {
+    case kReduceSum:
+    case kReduceMean:
+        return 0;
+    case kReduceMax:
+        return 1;
+    case kReduceMin:
+        return 2;
+    case kReduceArgmax:
+        return 3;
+    case kReduceL2:
+        return 4;
+    case kReduceLogSumExp:
+        return 5;
+    default:
+        throw std::runtime_error("unknown reduction");
+    }
+}
+
+reduce_pass::reduce_pass(const reduce_param& param, uint32_t op, bool first) : m_param(param), m_op(op), m_first(first)
+{
+    m_future = getThreadPool().async(&reduce_pass::initVulkanThing, &*this, 4);
+    m_type = "reduce";
+}
+
+void reduce_pass::forward(tensor& y, tensor& y_index, tensor& x, tensor& x_index)
+{
+    if (m_pipeline == nullptr)
+    {
+        const uint32_t threads = 256;
+        const uint32_t layout = m_param.inner >= 32 ? 1 : m_param.extent <= 64 ? 2 : 0;
+        uint32_t groups;
+        if (layout == 0)
+            groups = m_param.outer * m_param.inner * m_param.splits;
+        else if (layout == 1)
+            groups = m_param.outer * ((m_param.inner + 31) / 32) * m_param.splits;
+        else
+            groups = (m_param.outer * m_param.inner * m_param.splits + threads - 1) / threads;
+        m_group_x = std::min(static_cast<int>(groups), max_compute_work_group_count);
+
+        std::vector<uint32_t> spec_data{ m_op, m_first ? 1u : 0u, layout };
+        std::vector<VkSpecializationMapEntry> spec_entries(spec_data.size());
+        for (uint32_t i = 0; i < spec_entries.size(); ++i)
+        {
+            spec_entries[i].constantID = i;
+            spec_entries[i].offset = i * sizeof(uint32_t);
+            spec_entries[i].size = sizeof(uint32_t);
+        }
+        VkSpecializationInfo spec_info;
+        spec_info.mapEntryCount = static_cast<uint32_t>(spec_entries.size());
+        spec_info.pMapEntries = spec_entries.data();
+        spec_info.dataSize = spec_data.size() * sizeof(uint32_t);
+        spec_info.pData = spec_data.data();
+
+        m_future.wait();
+        if (subgroupArithmeticSupported(m_device_id))
+            createShaderModule(reduce_spv, sizeof(reduce_spv));
+        else
+            createShaderModule(reduce_shared_spv, sizeof(reduce_shared_spv));
+        createPipeline(sizeof(reduce_param), &spec_info);
+    }
+
+    bindtensor(x, 0);
+    bindtensor(x_index, 1);
+    bindtensor(y, 2);
+    bindtensor(y_index, 3);
+    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(reduce_param));
+}
+
+reduce::reduce(int op, std::vector<int>& axes) : m_op(op), m_axes(axes), m_outputs(0)
+{
+    shaderOp(op);
+}
+
+void reduce::plan(const Shape& shape)
+{
+    const int rank = static_cast<int>(shape.size());
+    std::vector<bool> reduced(rank, m_axes.empty());
+    for (int a : m_axes)
+    {
+        if (a < 0)
+            a += rank;
+        if (a < 0 || a >= rank)
+            throw std::runtime_error("reduce axis out of range");
+        reduced[a] = true;
+    }
+
+    // (size, reduced) runs without unit axes
+    std::vector<std::pair<uint32_t, bool>> runs;
+    uint32_t count = 1;
+    for (int a = 0; a < rank; ++a)
+    {
+        if (shape[a] == 1)
+            continue;
+        if (reduced[a])
+            count *= shape[a];
+        if (!runs.empty() && runs.back().second == reduced[a])
+            runs.back().first *= shape[a];
+        else
+            runs.emplace_back(static_cast<uint32_t>(shape[a]), reduced[a]);
+    }
+    int reduced_runs = 0;
+    for (const auto& run : runs)
+        reduced_runs += run.second ? 1 : 0;
+    // only unit axes are reduced, still one pass so every op finalises
+    if (reduced_runs == 0)
+    {
+        runs.emplace_back(1, true);
+        reduced_runs = 1;
+    }
+    if (m_op == kReduceArgmax && reduced_runs > 1)
+        throw std::runtime_error("argmax reduces over a single axis");
+
+    m_shape = shape;
+    m_passes.clear();
+    m_values.clear();
+    m_indices.clear();
+    const uint32_t op = shaderOp(m_op);
+    bool first = true;
+    while (reduced_runs > 0)
+    {
+        // innermost reduced run first, so the remaining layout stays contiguous
+        size_t g = runs.size() - 1;
+        while (!runs[g].second)
+            --g;
+        reduce_param param = {};
+        param.outer = 1;
+        param.inner = 1;
+        for (size_t i = 0; i < g; ++i)
+            param.outer *= runs[i].first;
+        for (size_t i = g + 1; i < runs.size(); ++i)
+            param.inner *= runs[i].first;
+        param.extent = runs[g].first;
+        param.splits = 1;
+        param.chunk = param.extent;
+        param.scale = 1.f;
+
+        // long runs with few outputs are split so enough workgroups are busy
+        const uint32_t outputs = param.outer * param.inner;
+        if (param.extent > 4096 && outputs < 128)
+        {
+            param.splits = std::min((param.extent + 2047) / 2048, (256 + outputs - 1) / outputs);
+            param.chunk = (param.extent + param.splits - 1) / param.splits;
+            param.splits = (param.extent + param.chunk - 1) / param.chunk;
+        }
+        runs.erase(runs.begin() + g);
+        --reduced_runs;
+
+        std::vector<reduce_param> stages{ param };
+        if (param.splits > 1)
+        {
+            reduce_param merge = param;
+            merge.extent = param.splits;
+            merge.splits = 1;
+            merge.chunk = merge.extent;
+            stages.push_back(merge);
+        }
+        for (size_t s = 0; s < stages.size(); ++s)
+        {
+            reduce_param& p = stages[s];
+            const bool last = reduced_runs == 0 && s + 1 == stages.size();
+            if (last)
+            {
+                if (m_op == kReduceMean)
+                    p.scale = 1.f / static_cast<float>(count);
+                p.post = m_op == kReduceL2 ? 1 : 0;
+            }
+            m_passes.emplace_back(new reduce_pass(p, op, first));
+            first = false;
+            const int n = static_cast<int>(p.outer * p.splits * p.inner);
+            m_outputs = static_cast<uint32_t>(n);
+            m_values.push_back(last && m_op != kReduceArgmax ? tensor() : tensor(0.f, Shape{ n }));
+            m_indices.push_back(!last && m_op == kReduceArgmax ? tensor(0.f, Shape{ n }) : tensor());
+        }
+    }
+}
+
+void reduce::forward(tensor& y, tensor& x)
+{
+    if (m_passes.empty() || x.getShape() != m_shape)
+        plan(x.getShape());
+    if (static_cast<uint32_t>(y.count()) < m_outputs)
+        throw std::runtime_error("reduce output is smaller than the reduced shape");
+
+    for (size_t i = 0; i < m_passes.size(); ++i)
+    {
+        const bool last = i + 1 == m_passes.size();
+        tensor& in = i == 0 ? x : m_values[i - 1];
+        tensor& in_index = i == 0 || m_indices[i - 1].isEmpty() ? in : m_indices[i - 1];
+        tensor& out = m_values[i].isEmpty() ? y : m_values[i];
+        tensor& out_index = last && m_op == kReduceArgmax ? y : m_indices[i].isEmpty() ? out : m_indices[i];
+        m_passes[i]->forward(out, out_index, in, in_index);
+    }
+}
+
+int reduce::runCommandBuffer()
+{
+    for (auto& pass : m_passes)
+        pass->runCommandBuffer();
+    return 1;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "vknn.h"
+#include "../engine/layer.h"
+
+enum reduce_op
+{
+    kReduceSum = 0,
+    kReduceMean = 1,
+    kReduceMax = 2,
+    kReduceMin = 3,
+    kReduceArgmax = 4,
+    kReduceL2 = 5,
+    kReduceLogSumExp = 6
+};
+
+struct reduce_param
+{
+    uint32_t outer;
+    uint32_t extent;
+    uint32_t inner;
+    uint32_t splits;
+    uint32_t chunk;
+    float scale;
+    uint32_t post;
+};
+
+// one dispatch of reduce.comp over [outer, extent, inner], op is the shader
+// opcode, see reduce.glsl
+class reduce_pass : public layer
+{
+    reduce_param m_param;
+    uint32_t m_op;
+    bool m_first;
+public:
+    reduce_pass(const reduce_param& param, uint32_t op, bool first);
+    void forward(tensor& y, tensor& y_index, tensor& x, tensor& x_index);
+};
+
+// Reduces x over axes, negative axes count from the back and an empty list
+// reduces everything. y holds the remaining axes in order. Unit axes are
+// dropped and neighbouring axes of the same kind merged, then every reduced
+// run is one pass, split in two when a long run would leave most of the
+// device idle. argmax reduces a single run and writes int32 indices to y.
+class reduce
+{
+    int m_op;
+    std::vector<int> m_axes;
+    Shape m_shape;
+    uint32_t m_outputs;
+    std::vector<std::unique_ptr<reduce_pass>> m_passes;
+    std::vector<tensor> m_values;
+    std::vector<tensor> m_indices;
+    void plan(const Shape& shape);
+public:
+    reduce(int op, std::vector<int>& axes);
+    void forward(tensor& y, tensor& x);
+    int runCommandBuffer();
+};
@@ -1 +1,247 @@
-#include "rnn.h"
\ No newline at end of file
+#include "../engine/common.h"
+#include "../engine/utils.h"
+#include "rnn.h"
+#include "gemm.h"
+
+int rnnGateCount(int cell)
+{
+    switch (cell)
+    {
+    case kRnnLstm:
+        return 4;
+    case kRnnGru:
+        return 3;
+    case kRnnTanh:
+    case kRnnRelu:
+        return 1;
+    default:
+        throw std::runtime_error("unknown rnn cell");
+    }
+}
+
+// gate slots per hidden unit of the saved activations, the GRU keeps the
+// recurrent part of its n gate as a fourth
+static int rnnSlotCount(int cell)
+{
+    return cell == kRnnGru ? 4 : rnnGateCount(cell);
+}
+
+rnn_cell::rnn_cell(int cell, bool backward, bool use_bias, const rnn_param& param) :
+    m_param(param), m_cell(cell), m_backward(backward), m_use_bias(use_bias)
+{
+    rnnGateCount(cell);
+    m_future = getThreadPool().async(&rnn_cell::initVulkanThing, &*this, 18);
+    m_type = backward ? "rnn_cell_backward" : "rnn_cell";
+}
+
+void rnn_cell::recordSteps()
+{
+    // the backward pass has one extra step for dh0 and dc0
+    const uint32_t steps = m_backward ? m_param.seq + 1 : m_param.seq;
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+    kContextMtx.lock();
+    VK_CHECK_RESULT(vkBeginCommandBuffer(m_cmd_buffer, &begin_info));
+    vkCmdBindPipeline(m_cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+    vkCmdBindDescriptorSets(m_cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout, 0, 1, &m_descriptor_set, 0, nullptr);
+    for (uint32_t i = 0; i < steps; ++i)
+    {
+        rnn_param p = m_param;
+        p.step = !m_backward ? i : i < m_param.seq ? m_param.seq - 1 - i : m_param.seq;
+        vkCmdPushConstants(m_cmd_buffer, m_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(rnn_param), &p);
+        vkCmdDispatch(m_cmd_buffer, m_group_x, m_group_y, m_group_z);
+        if (i + 1 < steps)
+            vkCmdPipelineBarrier(m_cmd_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                1, &barrier, 0, nullptr, 0, nullptr);
+    }
+    VK_CHECK_RESULT(vkEndCommandBuffer(m_cmd_buffer));
+    kContextMtx.unlock();
+}
+
+void rnn_cell::forward(tensor& gx, tensor& w_hh, tensor& b_hh, tensor& h0, tensor& c0, tensor& y, tensor& c,
+    tensor& hp, tensor& hn, tensor& cn, tensor& dy, tensor& dhn, tensor& dcn, tensor& dg, tensor& dgh, tensor& dh0,
+    tensor& dc0, tensor& carry)
+{
+    if (m_pipeline == nullptr)
+    {
+        const int threads = static_cast<int>(m_param.batch * m_param.hidden);
+        m_group_x = std::min((threads + 255) / 256, max_compute_work_group_count);
+
+        std::vector<uint32_t> spec_data{ static_cast<uint32_t>(m_cell), m_backward ? 1u : 0u, m_use_bias ? 1u : 0u };
+        std::vector<VkSpecializationMapEntry> spec_entries(spec_data.size());
+        for (uint32_t i = 0; i < spec_entries.size(); ++i)
+        {
+            spec_entries[i].constantID = i;
+            spec_entries[i].offset = i * sizeof(uint32_t);
+            spec_entries[i].size = sizeof(uint32_t);
+        }
+        VkSpecializationInfo spec_info;
+        spec_info.mapEntryCount = static_cast<uint32_t>(spec_entries.size());
+        spec_info.pMapEntries = spec_entries.data();
+        spec_info.dataSize = spec_data.size() * sizeof(uint32_t);
+        spec_info.pData = spec_data.data();
+
+        m_future.wait();
+        createShaderModule(rnn_cell_spv, sizeof(rnn_cell_spv));
+        createPipeline(sizeof(rnn_param), &spec_info);
+    }
+
+    bindtensor(gx, 0);
+    bindtensor(w_hh, 1);
+    bindtensor(b_hh, 2);
+    bindtensor(h0, 3);
+    bindtensor(c0, 4);
+    bindtensor(y, 5);
+    bindtensor(c, 6);
+    bindtensor(hp, 7);
+    bindtensor(hn, 8);
+    bindtensor(cn, 9);
+    bindtensor(dy, 10);
+    bindtensor(dhn, 11);
+    bindtensor(dcn, 12);
+    bindtensor(dg, 13);
+    bindtensor(dgh, 14);
+    bindtensor(dh0, 15);
+    bindtensor(dc0, 16);
+    bindtensor(carry, 17);
+    recordSteps();
+}
+
+rnn::rnn(int cell, int input_size, int hidden_size, bool use_bias, bool reverse, int y_stride, int y_offset,
+    int state_offset) : m_cell(cell), m_input(input_size), m_hidden(hidden_size), m_use_bias(use_bias),
+    m_reverse(reverse), m_y_stride(y_stride > 0 ? y_stride : hidden_size), m_y_offset(y_offset),
+    m_state_offset(state_offset), m_accumulate_dx(false)
+{
+    rnnGateCount(cell);
+    if (input_size <= 0 || hidden_size <= 0)
+        throw std::runtime_error("rnn sizes must be positive");
+    if (y_offset < 0 || state_offset < 0 || m_y_offset + hidden_size > m_y_stride)
+        throw std::runtime_error("rnn output offset does not fit the output row");
+}
+
+rnn::~rnn() = default;
+
+rnn_param rnn::param() const
+{
+    rnn_param p = {};
+    p.seq = m_shape[0];
+    p.batch = m_shape[1];
+    p.hidden = m_hidden;
+    p.reverse = m_reverse ? 1 : 0;
+    p.state_offset = m_state_offset;
+    p.y_stride = m_y_stride;
+    p.y_offset = m_y_offset;
+    return p;
+}
+
+void rnn::plan(const Shape& shape)
+{
+    if (shape.size() != 3 || shape[2] != m_input)
+        throw std::runtime_error("rnn expects x as [seq, batch, input_size]");
+    m_shape = shape;
+    const int rows = shape[0] * shape[1];
+    const int gh = rnnGateCount(m_cell) * m_hidden;
+    const int slots = rnnSlotCount(m_cell) * m_hidden;
+
+    m_gx = tensor(0.f, Shape{ shape[0], shape[1], slots });
+    m_c = tensor(0.f, m_cell == kRnnLstm ? Shape{ shape[0], shape[1], m_hidden } : Shape{ 1 });
+    m_hp = tensor(0.f, Shape{ shape[0], shape[1], m_hidden });
+    m_dg = tensor(0.f, Shape{ shape[0], shape[1], gh });
+    // x and h paths only differ in the GRU n gate
+    m_dgh = m_cell == kRnnGru ? tensor(0.f, Shape{ shape[0], shape[1], gh }) : m_dg;
+    m_carry = tensor(0.f, Shape{ 2, shape[1], m_hidden });
+    m_ones = tensor(1.f, Shape{ rows });
+
+    // gx = x * w_ih^T + b_ih for every step at once
+    std::vector<int> projection{ 1, rows, gh, m_input, m_input, m_input, 0, slots, 0, 0, 0, 0 };
+    m_projection.reset(new gemm_strided_batched(1.f, 1.f, m_use_bias, false, true, projection));
+    if (m_use_bias)
+    {
+        gemm_epilogue epilogue;
+        epilogue.bias = kBiasColumn;
+        m_projection->setEpilogue(epilogue);
+    }
+    m_cell_forward.reset(new rnn_cell(m_cell, false, m_use_bias, param()));
+    m_cell_backward.reset(new rnn_cell(m_cell, true, m_use_bias, param()));
+
+    // dw_ih = dg^T * x, dw_hh = dgh^T * h_prev, the bias gradients are column sums
+    std::vector<int> dw_ih{ 1, gh, m_input, rows, gh, m_input, 0, m_input, 0, 0, 0, 0 };
+    std::vector<int> dw_hh{ 1, gh, m_hidden, rows, gh, m_hidden, 0, m_hidden, 0, 0, 0, 0 };
+    std::vector<int> db{ 1, 1, gh, rows, rows, gh, 0, gh, 0, 0, 0, 0 };
+    m_dw_ih.reset(new gemm_strided_batched(1.f, 0.f, false, true, false, dw_ih));
+    m_dw_hh.reset(new gemm_strided_batched(1.f, 0.f, false, true, false, dw_hh));
+    m_db_ih.reset(new gemm_strided_batched(1.f, 0.f, false, false, false, db));
+    m_db_hh.reset(new gemm_strided_batched(1.f, 0.f, false, false, false, db));
+    m_dx.reset();
+}
+
+void rnn::forward(tensor& y, tensor& hn, tensor& cn, tensor& x, tensor& h0, tensor& c0, tensor& w_ih, tensor& w_hh,
+    tensor& b_ih, tensor& b_hh)
+{
+    if (m_cell_forward == nullptr || x.getShape() != m_shape)
+        plan(x.getShape());
+    const int gh = rnnGateCount(m_cell) * m_hidden;
+    if (y.count() < m_shape[0] * m_shape[1] * m_y_stride)
+        throw std::runtime_error("rnn output is smaller than [seq, batch, y_stride]");
+    if (w_ih.count() < gh * m_input || w_hh.count() < gh * m_hidden)
+        throw std::runtime_error("rnn weights are smaller than [gates * hidden, input] and [gates * hidden, hidden]");
+
+    m_projection->forward(m_gx, x, w_ih, b_ih);
+    m_cell_forward->forward(m_gx, w_hh, b_hh, h0, c0, y, m_c, m_hp, hn, cn, m_gx, m_gx, m_gx, m_gx, m_gx, m_gx, m_gx,
+        m_gx);
+}
+
+void rnn::backward(tensor& dx, tensor& dh0, tensor& dc0, tensor& dw_ih, tensor& dw_hh, tensor& db_ih, tensor& db_hh,
+    tensor& x, tensor& h0, tensor& c0, tensor& w_ih, tensor& w_hh, tensor& dy, tensor& dhn, tensor& dcn,
+    bool accumulate_dx)
+{
+    if (m_cell_backward == nullptr || x.getShape() != m_shape)
+        throw std::runtime_error("rnn backward needs a forward over the same shape first");
+    if (m_dx == nullptr || m_accumulate_dx != accumulate_dx)
+    {
+        // the second direction of a layer adds its dx to the first one's
+        const int rows = m_shape[0] * m_shape[1];
+        const int gh = rnnGateCount(m_cell) * m_hidden;
+        std::vector<int> params{ 1, rows, m_input, gh, gh, m_input, m_input, m_input, 0, 0, 0, 0 };
+        m_dx.reset(new gemm_strided_batched(1.f, accumulate_dx ? 1.f : 0.f, accumulate_dx, false, false, params));
+        m_accumulate_dx = accumulate_dx;
+    }
+
+    m_cell_backward->forward(m_gx, w_hh, w_hh, h0, c0, dy, m_c, m_hp, m_gx, m_gx, dy, dhn, dcn, m_dg, m_dgh, dh0, dc0,
+        m_carry);
+    m_dx->forward(dx, m_dg, w_ih, dx);
+    m_dw_ih->forward(dw_ih, m_dg, x, dw_ih);
+    m_dw_hh->forward(dw_hh, m_dgh, m_hp, dw_hh);
+    if (m_use_bias)
+    {
+        m_db_ih->forward(db_ih, m_ones, m_dg, db_ih);
+        m_db_hh->forward(db_hh, m_ones, m_dgh, db_hh);
+    }
+}
+
+int rnn::runCommandBuffer()
+{
+    m_projection->runCommandBuffer();
+    m_cell_forward->runCommandBuffer();
+    return 1;
+}
+
+int rnn::runBackward()
+{
+    m_cell_backward->runCommandBuffer();
+    m_dx->runCommandBuffer();
+    m_dw_ih->runCommandBuffer();
+    m_dw_hh->runCommandBuffer();
+    if (m_use_bias)
+    {
+        m_db_ih->runCommandBuffer();
+        m_db_hh->runCommandBuffer();
+    }
+    return 1;
+}
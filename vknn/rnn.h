@@ -0,0 +1,103 @@
+#pragma once
+
+#include "vknn.h"
+#include "../engine/layer.h"
+
+// gemm.h includes this header through vknn.h
+class gemm_strided_batched;
+
+enum rnn_cell_kind
+{
+    kRnnLstm = 0,
+    kRnnGru = 1,
+    kRnnTanh = 2,
+    kRnnRelu = 3
+};
+
+// gates per hidden unit, the rows of w_ih and w_hh are gates * hidden
+int rnnGateCount(int cell);
+
+struct rnn_param
+{
+    uint32_t seq;
+    uint32_t batch;
+    uint32_t hidden;
+    uint32_t step;
+    uint32_t reverse;
+    uint32_t state_offset;
+    uint32_t y_stride;
+    uint32_t y_offset;
+};
+
+// rnn_cell.comp for every time step of one layer and direction, recorded
+// into a single command buffer with a barrier between steps. The backward
+// pass runs the steps last to first and one more for dh0 and dc0.
+class rnn_cell : public layer
+{
+    rnn_param m_param;
+    int m_cell;
+    bool m_backward;
+    bool m_use_bias;
+    void recordSteps();
+public:
+    rnn_cell(int cell, bool backward, bool use_bias, const rnn_param& param);
+    void forward(tensor& gx, tensor& w_hh, tensor& b_hh, tensor& h0, tensor& c0, tensor& y, tensor& c, tensor& hp,
+        tensor& hn, tensor& cn, tensor& dy, tensor& dhn, tensor& dcn, tensor& dg, tensor& dgh, tensor& dh0,
+        tensor& dc0, tensor& carry);
+};
+
+// One layer and direction of an LSTM, GRU or vanilla RNN over a whole
+// sequence. x is [seq, batch, input], w_ih [gates * hidden, input] and
+// w_hh [gates * hidden, hidden] in PyTorch gate order. forward takes the
+// input projections of all steps in one GEMM and then runs the recorded
+// steps, keeping the gates, previous hidden states and cell states for
+// backward. backward runs the steps in reverse and gets dx and the weight
+// gradients from four GEMMs over the whole sequence.
+// y rows are y_stride wide with this direction at y_offset so both
+// directions of a bidirectional layer write one tensor, h0, c0, hn and cn
+// are [layers * directions, batch, hidden] read at state_offset. With
+// accumulate_dx the dx of this direction is added to what dx holds.
+class rnn
+{
+    int m_cell;
+    int m_input;
+    int m_hidden;
+    bool m_use_bias;
+    bool m_reverse;
+    int m_y_stride;
+    int m_y_offset;
+    int m_state_offset;
+    Shape m_shape;
+
+    tensor m_gx;
+    tensor m_c;
+    tensor m_hp;
+    tensor m_dg;
+    tensor m_dgh;
+    tensor m_carry;
+    tensor m_ones;
+
+    std::unique_ptr<gemm_strided_batched> m_projection;
+    std::unique_ptr<rnn_cell> m_cell_forward;
+    std::unique_ptr<rnn_cell> m_cell_backward;
+    std::unique_ptr<gemm_strided_batched> m_dx;
+    std::unique_ptr<gemm_strided_batched> m_dw_ih;
+    std::unique_ptr<gemm_strided_batched> m_dw_hh;
+    std::unique_ptr<gemm_strided_batched> m_db_ih;
+    std::unique_ptr<gemm_strided_batched> m_db_hh;
+    bool m_accumulate_dx;
+
+    rnn_param param() const;
+    void plan(const Shape& shape);
+public:
+    rnn(int cell, int input_size, int hidden_size, bool use_bias, bool reverse, int y_stride = 0, int y_offset = 0,
+        int state_offset = 0);
+    ~rnn();
+    void forward(tensor& y, tensor& hn, tensor& cn, tensor& x, tensor& h0, tensor& c0, tensor& w_ih, tensor& w_hh,
+        tensor& b_ih, tensor& b_hh);
+    void backward(tensor& dx, tensor& dh0, tensor& dc0, tensor& dw_ih, tensor& dw_hh, tensor& db_ih, tensor& db_hh,
+        tensor& x, tensor& h0, tensor& c0, tensor& w_ih, tensor& w_hh, tensor& dy, tensor& dhn, tensor& dcn,
+        bool accumulate_dx);
+    int runCommandBuffer();
+    int runBackward();
+};
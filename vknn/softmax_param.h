@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// outer, classes and inner view the input as [outer, classes, inner] around the softmax axis
+struct softmax_param
+{
+    uint32_t outer;
+    uint32_t classes;
+    uint32_t inner;
+    int32_t ignore_index;
+    float grad_scale;
+};
+
+softmax_param softmaxShape(const std::vector<int>& shape, int axis);
+// rows wider than this get a workgroup each instead of a thread
+constexpr uint32_t kSoftmaxWideRow = 256;
@@ -2,55 +2,171 @@
 #include "../engine/utils.h"
 #include "transform.h"
 
-std::vector<int> prepareStrides(const Shape& shape_before, const Shape& shape_after, Shape& stride)
+// drops unit axes and merges runs of input axes that stay adjacent in the
+// output, dims is the collapsed input shape and perm the collapsed order
+static void collapseAxes(const Shape& shape, const std::vector<int>& order, Shape& dims, std::vector<int>& perm)
 {
-    size_t dims = shape_before.size();
-    stride[2 * dims - 1] = 1;
-    stride[3 * dims - 1] = 1;
+    if (order.size() != shape.size())
+        throw std::runtime_error("transpose order does not match the tensor rank");
+    std::vector<int> kept(shape.size(), -1);
+    Shape kept_dims;
+    for (size_t i = 0; i < shape.size(); ++i)
+    {
+        if (shape[i] != 1)
+        {
+            kept[i] = static_cast<int>(kept_dims.size());
+            kept_dims.push_back(shape[i]);
+        }
+    }
+    std::vector<int> kept_order;
+    for (int axis : order)
+    {
+        if (axis < 0 || axis >= static_cast<int>(shape.size()))
+            throw std::runtime_error("transpose axis out of range");
+        if (kept[axis] >= 0)
+            kept_order.push_back(kept[axis]);
+    }
 
-    for (int64_t i = dims - 2; i >= 0; i--)
+    // runs of the output order that are consecutive input axes, by first input axis
+    std::vector<std::pair<int, int>> runs;
+    for (size_t i = 0; i < kept_order.size(); ++i)
     {
-        stride[dims * 2 + i] = stride[dims * 2 + i + 1] * shape_before[i + 1];
-        stride[dims + i] = stride[dims + i + 1] * shape_after[i + 1];
+        if (i > 0 && kept_order[i] == kept_order[i - 1] + 1)
+            runs.back().second = kept_order[i];
+        else
+            runs.emplace_back(kept_order[i], kept_order[i]);
     }
-    return stride;
+    std::vector<std::pair<int, int>> sorted = runs;
+    std::sort(sorted.begin(), sorted.end());
+
+    dims.clear();
+    for (const auto& run : sorted)
+    {
+        int size = 1;
+        for (int a = run.first; a <= run.second; ++a)
+            size *= kept_dims[a];
+        dims.push_back(size);
+    }
+    perm.clear();
+    for (const auto& run : runs)
+        perm.push_back(static_cast<int>(std::lower_bound(sorted.begin(), sorted.end(), run) - sorted.begin()));
+}
+
+bool transposeIsReshape(const Shape& shape, const std::vector<int>& order)
+{
+    Shape dims;
+    std::vector<int> perm;
+    collapseAxes(shape, order, dims, perm);
+    return perm.size() <= 1;
+}
+
+transpose::transpose(std::vector<int>& order) : m_order(order), m_rank(0), m_planned(false), m_reshape(false)
+{
+    m_future = getThreadPool().async(&transpose::initVulkanThing, &*this, 2);
+    m_type = "transpose";
+    std::memset(&m_param, 0, sizeof(m_param));
 }
 
-transpose::transpose(std::vector<int>& order)
+void transpose::plan(const Shape& shape)
 {
-    m_future = std::async(&transpose::initVulkanThing, &*this, 3);
-    m_param.num_axes = static_cast<int>(order.size());
-    m_stride.resize(order.size() * 3);
-    for (int i = 0; i < order.size(); ++i)
-        m_stride[i] = order[i];
-    m_futures.resize(3);
+    Shape dims;
+    std::vector<int> perm;
+    collapseAxes(shape, m_order, dims, perm);
+    m_planned = true;
+    m_reshape = perm.size() <= 1;
+    if (m_reshape)
+        return;
+    if (perm.size() > kTransposeMaxRank)
+        throw std::runtime_error("transpose supports up to 5 axes after merging adjacent ones");
+
+    m_rank = static_cast<uint32_t>(perm.size());
+    std::vector<uint32_t> stride(m_rank, 1);
+    for (int a = static_cast<int>(m_rank) - 2; a >= 0; --a)
+        stride[a] = stride[a + 1] * dims[a + 1];
+    uint32_t out = 1;
+    for (int i = static_cast<int>(m_rank) - 1; i >= 0; --i)
+    {
+        m_param.shape[i] = dims[perm[i]];
+        m_param.in_stride[i] = stride[perm[i]];
+        m_param.out_stride[i] = out;
+        out *= m_param.shape[i];
+        if (perm[i] == static_cast<int>(m_rank) - 1)
+            m_param.tile_axis = i;
+    }
+    m_param.total = out;
 }
 
 void transpose::forward(tensor& y, tensor& x)
 {
-    if (m_pipeline == nullptr)
+    if (!m_planned)
     {
-        std::vector<int> new_shape(x.dimNum());
-        std::vector<int> old_shape = x.getShape();
-        for (int i = 0; i < old_shape.size(); ++i)
+        plan(x.getShape());
+        if (!m_reshape)
         {
-            new_shape[i] = old_shape[m_stride[i]];
-        }
+            const uint32_t mode = m_param.tile_axis == m_rank - 1 ? 1 : 0;
+            const uint32_t w = m_param.shape[m_rank - 1];
+            m_param.batches = m_param.total / w;
+            if (mode == 0)
+            {
+                const uint32_t h = m_param.shape[m_param.tile_axis];
+                m_param.batches /= h;
+                m_group_x = static_cast<int>(alignSize(h, 32)) / 32;
+                m_group_y = static_cast<int>(alignSize(w, 32)) / 32;
+                m_group_z = static_cast<int>(m_param.batches);
+            }
+            else
+            {
+                m_group_x = static_cast<int>(m_param.batches);
+            }
+            m_group_x = std::min(m_group_x, max_compute_work_group_count);
+            m_group_y = std::min(m_group_y, max_compute_work_group_count);
+            m_group_z = std::min(m_group_z, max_compute_work_group_count);
 
-        m_stride = prepareStrides(old_shape, new_shape, m_stride);
-        m_stride_tensor = tensor((char*)m_stride.data(), std::vector<int>{m_param.num_axes * 3}, Format::kFormatInt32);
-        m_param.total = x.count();
+            std::vector<uint32_t> spec_data{ m_rank, mode };
+            std::vector<VkSpecializationMapEntry> spec_entries(spec_data.size());
+            for (uint32_t i = 0; i < spec_entries.size(); ++i)
+            {
+                spec_entries[i].constantID = i;
+                spec_entries[i].offset = i * sizeof(uint32_t);
+                spec_entries[i].size = sizeof(uint32_t);
+            }
+            VkSpecializationInfo spec_info;
+            spec_info.mapEntryCount = static_cast<uint32_t>(spec_entries.size());
+            spec_info.pMapEntries = spec_entries.data();
+            spec_info.dataSize = spec_data.size() * sizeof(uint32_t);
+            spec_info.pData = spec_data.data();
 
-        m_group_x = static_cast<int>(alignSize(m_param.total, local_sz_x)) / local_sz_x;
-        if (m_group_x > max_compute_work_group_count)
-            m_group_x = max_compute_work_group_count;
+            const bool half = halfPrecision(x, y);
+            m_future.wait();
+            if (half)
+                createShaderModule(transpose_fp16_spv, sizeof(transpose_fp16_spv));
+            else
+                createShaderModule(transpose_spv, sizeof(transpose_spv));
+            createPipeline(sizeof(transpose_param), &spec_info);
+        }
+    }
+
+    if (m_reshape)
+    {
+        // memory order is unchanged, copy only if y is a separate buffer
         m_future.wait();
-        createShaderModule(transpose_spv, sizeof(transpose_spv));
-        createPipeline(sizeof(transpose_param));
+        VkCommandBufferBeginInfo begin_info = {};
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+        kContextMtx.lock();
+        VK_CHECK_RESULT(vkBeginCommandBuffer(m_cmd_buffer, &begin_info));
+        if (x.getBuffer() != y.getBuffer())
+        {
+            VkBufferCopy region = {};
+            region.size = std::min(x.size(), y.size());
+            vkCmdCopyBuffer(m_cmd_buffer, x.getBuffer()->getVkBuffer(), y.getBuffer()->getVkBuffer(), 1, &region);
+        }
+        VK_CHECK_RESULT(vkEndCommandBuffer(m_cmd_buffer));
+        kContextMtx.unlock();
+        return;
     }
 
     bindtensor(x, 0);
-    bindtensor(m_stride_tensor, 1);
-    bindtensor(y, 2);
-    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(transpose_param));  
-}
\ No newline at end of file
+    bindtensor(y, 1);
+    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(transpose_param));
+}
@@ -3,18 +3,35 @@
 #include "vknn.h"
 #include "../engine/layer.h"
 
+constexpr int kTransposeMaxRank = 5;
+
+// shape is the collapsed output shape, in_stride the input stride of each
+// output axis, tile_axis the output axis that is contiguous in the input
 struct transpose_param
 {
-    int total;
-    int num_axes;
+    uint32_t shape[kTransposeMaxRank];
+    uint32_t in_stride[kTransposeMaxRank];
+    uint32_t out_stride[kTransposeMaxRank];
+    uint32_t tile_axis;
+    uint32_t batches;
+    uint32_t total;
 };
 
+// Unit axes are dropped and axes that stay adjacent are merged before any
+// kernel is chosen. A permutation that collapses to a single axis keeps the
+// memory order, it is a reshape and at most a buffer copy is recorded.
 class transpose : public layer
 {
     transpose_param m_param;
-    std::vector<int> m_stride;
-    tensor m_stride_tensor;
+    std::vector<int> m_order;
+    uint32_t m_rank;
+    bool m_planned;
+    bool m_reshape;
+    void plan(const Shape& shape);
 public:
     explicit transpose(std::vector<int>& order);
     void forward(tensor& y, tensor& x);
+    bool isReshape() const { return m_reshape; }
 };
+
+bool transposeIsReshape(const Shape& shape, const std::vector<int>& order);
@@ -1,37 +1,226 @@
 #include <vector>
 #include "vknn.h"
+#include "autotune.h"
+#include "fft.h"
+#include "winograd.h"
 
 PYBIND11_MODULE(vknn, m)
 {
     py::class_<gemm, std::shared_ptr<gemm>>(m, "gemm")
         .def(py::init<float&, float&, bool&, bool&, bool&>())
         .def("forward", &gemm::forward)
+        .def("forward_fused", &gemm::forwardFused)
+        .def("set_epilogue", &gemm::setEpilogue)
         .def("run", &gemm::runCommandBuffer);
 
+    py::class_<gemm_strided_batched, std::shared_ptr<gemm_strided_batched>>(m, "gemm_strided_batched")
+        .def(py::init<float, float, bool, bool, bool, std::vector<int>&>())
+        .def("forward", &gemm_strided_batched::forward)
+        .def("forward_fused", &gemm_strided_batched::forwardFused)
+        .def("set_epilogue", &gemm_strided_batched::setEpilogue)
+        .def("run", &gemm_strided_batched::runCommandBuffer);
+
+    py::class_<gemm_epilogue>(m, "gemm_epilogue")
+        .def(py::init<>())
+        .def_readwrite("bias", &gemm_epilogue::bias)
+        .def_readwrite("activation", &gemm_epilogue::activation)
+        .def_readwrite("residual", &gemm_epilogue::residual)
+        .def_readwrite("slope", &gemm_epilogue::slope)
+        .def_readwrite("scale", &gemm_epilogue::scale);
+
+    m.attr("BIAS_ELEMENT") = static_cast<int>(kBiasElement);
+    m.attr("BIAS_ROW") = static_cast<int>(kBiasRow);
+    m.attr("BIAS_COLUMN") = static_cast<int>(kBiasColumn);
+    m.attr("ACT_NONE") = static_cast<int>(kActNone);
+    m.attr("ACT_RELU") = static_cast<int>(kActRelu);
+    m.attr("ACT_LEAKY_RELU") = static_cast<int>(kActLeakyRelu);
+    m.attr("ACT_SIGMOID") = static_cast<int>(kActSigmoid);
+
+    py::class_<gemm_tile_config>(m, "gemm_tile_config")
+        .def_readonly("tile_m", &gemm_tile_config::tile_m)
+        .def_readonly("tile_n", &gemm_tile_config::tile_n)
+        .def_readonly("tile_k", &gemm_tile_config::tile_k)
+        .def_readonly("wpt_m", &gemm_tile_config::wpt_m)
+        .def_readonly("wpt_n", &gemm_tile_config::wpt_n);
+
+    m.def("tune_gemm", &tuneGemm);
+    m.def("set_autotune", &setGemmAutotune);
+    m.def("load_tuning_db", &loadGemmTuningDb);
+    m.def("set_gemm_half_accumulate", &setGemmHalfAccumulate);
+
     py::class_<vol2col>(m, "vol2col")
         .def(py::init<std::vector<int>&>())
         .def("forward", &vol2col::forward)
         .def("run", &vol2col::runCommandBuffer);
 
     py::class_<col2vol>(m, "col2vol")
-        .def(py::init<std::vector<int>&>())
+        .def(py::init<std::vector<int>&, bool>(), py::arg("params"), py::arg("accumulate") = false)
         .def("forward", &col2vol::forward)
         .def("run", &col2vol::runCommandBuffer);
 
+    py::class_<conv_forward>(m, "conv_forward")
+        .def(py::init<std::vector<int>&, bool>())
+        .def("forward", &conv_forward::forward)
+        .def("forward_fused", &conv_forward::forwardFused)
+        .def("set_epilogue", &conv_forward::setEpilogue)
+        .def("run", &conv_forward::runCommandBuffer);
+
+    py::class_<conv_backward_data>(m, "conv_backward_data")
+        .def(py::init<std::vector<int>&>())
+        .def("forward", &conv_backward_data::forward)
+        .def("run", &conv_backward_data::runCommandBuffer);
+
+    py::class_<conv_backward_weight>(m, "conv_backward_weight")
+        .def(py::init<std::vector<int>&>())
+        .def("forward", &conv_backward_weight::forward)
+        .def("run", &conv_backward_weight::runCommandBuffer);
+
+    py::class_<conv_winograd>(m, "conv_winograd")
+        .def(py::init<std::vector<int>&, bool, int>())
+        .def("forward", &conv_winograd::forward)
+        .def("run", &conv_winograd::runCommandBuffer);
+    m.def("winograd_supported", &winogradSupported);
+
+    py::class_<conv_fft>(m, "conv_fft")
+        .def(py::init<std::vector<int>&, bool>())
+        .def("forward", &conv_fft::forward)
+        .def("run", &conv_fft::runCommandBuffer);
+    m.def("fft_conv_supported", &fftConvSupported);
+
     py::class_<relu>(m, "relu")
         .def(py::init<bool&, bool&>())
         .def("forward", &relu::forward)
         .def("run", &relu::runCommandBuffer);
 
+    py::class_<dropout>(m, "dropout")
+        .def(py::init<float, uint64_t>())
+        .def("forward", &dropout::forward)
+        .def("run", &dropout::runCommandBuffer);
+    py::class_<softmax>(m, "softmax")
+        .def(py::init<int, bool, bool>())
+        .def("forward", &softmax::forward)
+        .def("run", &softmax::runCommandBuffer);
+
+    py::class_<cross_entropy>(m, "cross_entropy")
+        .def(py::init<int, bool, int>())
+        .def("forward", &cross_entropy::forward)
+        .def("run", &cross_entropy::runCommandBuffer);
+
+    py::class_<batch_norm>(m, "batch_norm")
+        .def(py::init<float, float, bool, bool, bool>())
+        .def("forward", &batch_norm::forward)
+        .def("run", &batch_norm::runCommandBuffer);
+
+    py::class_<layer_norm>(m, "layer_norm")
+        .def(py::init<int, float, bool>())
+        .def("forward", &layer_norm::forward)
+        .def("run", &layer_norm::runCommandBuffer);
+
+    py::class_<group_norm>(m, "group_norm")
+        .def(py::init<int, float, bool>())
+        .def("forward", &group_norm::forward)
+        .def("run", &group_norm::runCommandBuffer);
+
+    py::class_<norm_backward>(m, "norm_backward")
+        .def(py::init<int, int, bool>())
+        .def("forward", &norm_backward::forward)
+        .def("run", &norm_backward::runCommandBuffer);
+    m.attr("NORM_BATCH") = static_cast<int>(kNormBatch);
+    m.attr("NORM_LAYER") = static_cast<int>(kNormLayer);
+    m.attr("NORM_GROUP") = static_cast<int>(kNormGroup);
+
+    py::class_<elementwise>(m, "elementwise")
+        .def(py::init<int, float, float, int>())
+        .def("forward", &elementwise::forward)
+        .def("run", &elementwise::runCommandBuffer);
+    py::class_<elementwise_backward>(m, "elementwise_backward")
+        .def(py::init<int, float, float>())
+        .def("forward", &elementwise_backward::forward)
+        .def("run", &elementwise_backward::runCommandBuffer);
+    py::class_<fused_elementwise>(m, "fused_elementwise")
+        .def(py::init<const std::string&, const std::vector<std::string>&>())
+        .def("forward", &fused_elementwise::forward)
+        .def("run", &fused_elementwise::runCommandBuffer)
+        .def_property_readonly("source", &fused_elementwise::source)
+        .def_property_readonly("hash", &fused_elementwise::hash);
+    py::class_<quantize>(m, "quantize")
+        .def(py::init<float, int, int, int, bool>())
+        .def("forward", &quantize::forward)
+        .def("run", &quantize::runCommandBuffer);
+    py::class_<quantized_weight>(m, "quantized_weight")
+        .def_readonly("data", &quantized_weight::data)
+        .def_readonly("scales", &quantized_weight::scales)
+        .def_readonly("sums", &quantized_weight::sums)
+        .def_readonly("rows", &quantized_weight::rows)
+        .def_readonly("cols", &quantized_weight::cols)
+        .def_readonly("cols_padded", &quantized_weight::cols_padded);
+    m.def("quantize_weights", &quantizeWeights);
+    py::class_<gemm_int8>(m, "gemm_int8")
+        .def(py::init<float, int, float, int, bool, bool, bool>())
+        .def("forward", &gemm_int8::forward)
+        .def("run", &gemm_int8::runCommandBuffer);
+    py::class_<conv_int8>(m, "conv_int8")
+        .def(py::init<std::vector<int>&, float, int, float, int, bool, bool, bool>())
+        .def("forward", &conv_int8::forward)
+        .def("run", &conv_int8::runCommandBuffer);
+    m.attr("EW_ADD") = static_cast<int>(kEwAdd);
+    m.attr("EW_SUB") = static_cast<int>(kEwSub);
+    m.attr("EW_MUL") = static_cast<int>(kEwMul);
+    m.attr("EW_DIV") = static_cast<int>(kEwDiv);
+    m.attr("EW_POW") = static_cast<int>(kEwPow);
+    m.attr("EW_EXP") = static_cast<int>(kEwExp);
+    m.attr("EW_LOG") = static_cast<int>(kEwLog);
+    m.attr("EW_SQRT") = static_cast<int>(kEwSqrt);
+    m.attr("EW_TANH") = static_cast<int>(kEwTanh);
+    m.attr("EW_SIGMOID") = static_cast<int>(kEwSigmoid);
+    m.attr("EW_GELU") = static_cast<int>(kEwGelu);
+    m.attr("EW_CLAMP") = static_cast<int>(kEwClamp);
+    m.attr("EW_WHERE") = static_cast<int>(kEwWhere);
+
+    py::class_<rnn>(m, "rnn")
+        .def(py::init<int, int, int, bool, bool, int, int, int>())
+        .def("forward", &rnn::forward)
+        .def("backward", &rnn::backward)
+        .def("run", &rnn::runCommandBuffer)
+        .def("run_backward", &rnn::runBackward);
+    m.attr("RNN_LSTM") = static_cast<int>(kRnnLstm);
+    m.attr("RNN_GRU") = static_cast<int>(kRnnGru);
+    m.attr("RNN_TANH") = static_cast<int>(kRnnTanh);
+    m.attr("RNN_RELU") = static_cast<int>(kRnnRelu);
+
     py::class_<transpose>(m, "transpose")
         .def(py::init<std::vector<int>&>())
         .def("forward", &transpose::forward)
+        .def("is_reshape", &transpose::isReshape)
         .def("run", &transpose::runCommandBuffer);
+    m.def("transpose_is_reshape", &transposeIsReshape);
+
+    py::class_<reduce>(m, "reduce")
+        .def(py::init<int, std::vector<int>&>())
+        .def("forward", &reduce::forward)
+        .def("run", &reduce::runCommandBuffer);
+    m.attr("REDUCE_SUM") = static_cast<int>(kReduceSum);
+    m.attr("REDUCE_MEAN") = static_cast<int>(kReduceMean);
+    m.attr("REDUCE_MAX") = static_cast<int>(kReduceMax);
+    m.attr("REDUCE_MIN") = static_cast<int>(kReduceMin);
+    m.attr("REDUCE_ARGMAX") = static_cast<int>(kReduceArgmax);
+    m.attr("REDUCE_L2") = static_cast<int>(kReduceL2);
+    m.attr("REDUCE_LOGSUMEXP") = static_cast<int>(kReduceLogSumExp);
 
     py::class_<max_reduce>(m, "max_reduce")
         .def(py::init< bool&>())
         .def("forward", &max_reduce::forward)
         .def("run", &max_reduce::runCommandBuffer);
+    py::class_<pool_forward>(m, "pool_forward")
+        .def(py::init<int, std::vector<int>&, bool>())
+        .def("forward", &pool_forward::forward)
+        .def("run", &pool_forward::runCommandBuffer);
+    py::class_<pool_backward>(m, "pool_backward")
+        .def(py::init<int, std::vector<int>&, bool>())
+        .def("forward", &pool_backward::forward)
+        .def("run", &pool_backward::runCommandBuffer);
+    m.attr("POOL_MAX") = static_cast<int>(kPoolMax);
+    m.attr("POOL_AVG") = static_cast<int>(kPoolAvg);
 
     //OPTIMIZERS
     py::class_<sgd>(m, "sgd")
@@ -54,6 +243,23 @@ PYBIND11_MODULE(vknn, m)
         .def("forward", &rmsprop::forward)
         .def("run", &rmsprop::runCommandBuffer);
 
+    py::class_<multi_tensor_optimizer>(m, "multi_tensor_optimizer")
+        .def("forward", &multi_tensor_optimizer::forward)
+        .def("state_slots", &multi_tensor_optimizer::stateSlots)
+        .def("run", &multi_tensor_optimizer::runCommandBuffer);
+
+    py::class_<multi_tensor_sgd, multi_tensor_optimizer>(m, "multi_tensor_sgd")
+        .def(py::init<float, float, float>());
+
+    py::class_<multi_tensor_adam, multi_tensor_optimizer>(m, "multi_tensor_adam")
+        .def(py::init<float, float, float, float, float, bool>());
+
+    py::class_<multi_tensor_adagrad, multi_tensor_optimizer>(m, "multi_tensor_adagrad")
+        .def(py::init<float, float, float>());
+
+    py::class_<multi_tensor_rmsprop, multi_tensor_optimizer>(m, "multi_tensor_rmsprop")
+        .def(py::init<float, float, float, float>());
+
     py::class_<tensor>(m, "tensor")
         .def(py::init<std::vector<float>&, const std::vector<int>&>())
         .def("reshape", &tensor::reShape)
@@ -63,30 +269,54 @@ PYBIND11_MODULE(vknn, m)
         .def("copy", &tensor::copyTo)
         .def("toHost", &tensor::toHost)
         .def("toDevice", &tensor::toDevice);
+    py::class_<fill>(m, "fill")
+        .def(py::init<int>())
+        .def("forward", &fill::forward)
+        .def("run", &fill::runCommandBuffer);
+    m.attr("FILL_CONSTANT") = static_cast<int>(kFillConstant);
+    m.attr("FILL_ARANGE") = static_cast<int>(kFillArange);
+    m.attr("FILL_UNIFORM") = static_cast<int>(kFillUniform);
+    m.attr("FILL_NORMAL") = static_cast<int>(kFillNormal);
+    m.attr("FILL_TRUNCATED_NORMAL") = static_cast<int>(kFillTruncatedNormal);
 
     m.def("cpu_vol2col", &cpu_vol2col);
     m.def("cpu_col2vol", &cpu_col2vol);
 
     m.def("number_physcial_devices", &number_devices);
     m.def("avalible_memory", &avalible_memory);
+    m.def("default_device", &defaultDevice);
+    m.def("set_device", &setDefaultDevice);
+    m.def("select_device", &selectDevice);
+    m.def("device_name", &deviceName);
+    m.def("buffer_device_address_supported", &bufferDeviceAddressSupported);
+    m.def("subgroup_arithmetic_supported", &subgroupArithmeticSupported);
+    m.def("fp16_storage_supported", &fp16StorageSupported);
+    m.def("fp16_arithmetic_supported", &fp16ArithmeticSupported);
+    m.def("integer_dot_product_supported", &integerDotProductSupported);
 
     m.def("init_float", &init_tensor<float>);
     m.def("init_int", &init_tensor<int>);
     m.def("init_char", &init_tensor<char>);
     m.def("init_bool", &init_tensor<bool>);
     m.def("init_double", &init_tensor<double>);
+    m.def("init_half", &init_tensor<uint16_t>);
+
+    m.def("empty_float", &empty_tensor<float>);
+    m.def("empty_half", &empty_tensor<uint16_t>);
 
     m.def("np_to_tensor_float", &np_to_tensor<float>);
     m.def("np_to_tensor_int", &np_to_tensor<int>);
     m.def("np_to_tensor_char", &np_to_tensor<char>);
     m.def("np_to_tensor_bool", &np_to_tensor<bool>);
     m.def("np_to_tensor_double", &np_to_tensor<double>);
+    m.def("np_to_tensor_half", &np_to_tensor<uint16_t>);
 
     m.def("tensor_to_np_float", &tensor_to_np<float>);
     m.def("tensor_to_np_int", &tensor_to_np<int>);
     m.def("tensor_to_np_char", &tensor_to_np<char>);
     m.def("tensor_to_np_bool", &tensor_to_np<bool>);
     m.def("tensor_to_np_double", &tensor_to_np<double>);
+    m.def("tensor_to_np_half", &tensor_to_np<uint16_t>);
 
     m.def("list_to_tensor_float", &list_to_tensor<float>);
     m.def("list_to_tensor_int", &list_to_tensor<int>);
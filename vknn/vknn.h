@@ -11,11 +11,15 @@ namespace py = pybind11;
 #include "spv_shader.h"
 #include "activation.h"
 #include "convolution.h"
+#include "fill.h"
+#include "fusion.h"
 #include "gemm.h"
 #include "loss.h"
 #include "math.h"
 #include "normalization.h"
 #include "pooling.h"
+#include "quantize.h"
+#include "reduce.h"
 #include "rnn.h"
 #include "transform.h"
 #include "optimizer.h"
@@ -42,6 +46,9 @@ tensor init_tensor(py::array_t<T, py::array::c_style | py::array::forcecast> a)
         return tensor((char*)data_ptr, shape, Format::kFormatBool);
     else if (std::is_same<T, uint32_t>::value)
         return tensor((char*)data_ptr, shape, Format::kFormatInt32);
+    // numpy float16 arrays are passed as their uint16 bit pattern
+    else if (std::is_same<T, uint16_t>::value)
+        return tensor((char*)data_ptr, shape, Format::kFormatFp16);
     else
         return tensor(Format::kFormatInvalid);
 }
@@ -0,0 +1,135 @@
+#include "../engine/common.h"
+#include "../engine/utils.h"
+#include "winograd.h"
+
+constexpr int local_sz_x_winograd = 256;
+
+winograd_transform::winograd_transform(const winograd_param& param, winograd_stage stage, uint32_t tile)
+    : m_param(param), m_stage(stage), m_tile(tile)
+{
+    m_future = getThreadPool().async(&winograd_transform::initVulkanThing, &*this, 3);
+    m_type = "winograd_transform";
+}
+
+void winograd_transform::forward(tensor& dst, tensor& src, tensor& b)
+{
+    if (m_pipeline == nullptr)
+    {
+        const size_t tiles = static_cast<size_t>(m_param.batchsize) * m_param.depth * m_param.tiles_h * m_param.tiles_w;
+        size_t total = 0;
+        if (m_stage == winograd_stage::kFilter)
+            total = static_cast<size_t>(m_param.out_channels) * m_param.channels;
+        else if (m_stage == winograd_stage::kInput)
+            total = m_param.channels * tiles;
+        else
+            total = m_param.out_channels * tiles;
+
+        m_group_x = static_cast<int>(alignSize(total, local_sz_x_winograd)) / local_sz_x_winograd;
+        if (m_group_x > max_compute_work_group_count)
+            m_group_x = max_compute_work_group_count;
+
+        VkSpecializationMapEntry entry = { 0, 0, sizeof(uint32_t) };
+        VkSpecializationInfo spec_info = {};
+        spec_info.mapEntryCount = 1;
+        spec_info.pMapEntries = &entry;
+        spec_info.dataSize = sizeof(uint32_t);
+        spec_info.pData = &m_tile;
+
+        m_future.wait();
+        if (m_stage == winograd_stage::kFilter)
+            createShaderModule(winograd_filter_spv, sizeof(winograd_filter_spv));
+        else if (m_stage == winograd_stage::kInput)
+            createShaderModule(winograd_input_spv, sizeof(winograd_input_spv));
+        else
+            createShaderModule(winograd_output_spv, sizeof(winograd_output_spv));
+        createPipeline(sizeof(winograd_param), &spec_info);
+    }
+
+    bindtensor(src, 0);
+    bindtensor(dst, 1);
+    bindtensor(b, 2);
+    recordCommandBuffer(static_cast<void*>(&m_param), sizeof(winograd_param));
+}
+
+bool winogradSupported(std::vector<int>& params)
+{
+    // kernel d h w, pad d, stride d h w, dilation d h w, groups
+    const bool ungrouped = params.size() == 21 || (params.size() == 22 && params[21] == 1);
+    return ungrouped && params[2] == 1 && params[3] == 3 && params[4] == 3 && params[5] == 0 &&
+        params[8] == 1 && params[9] == 1 && params[10] == 1 &&
+        params[11] == 1 && params[12] == 1 && params[13] == 1;
+}
+
+conv_winograd::conv_winograd(std::vector<int>& params, bool use_bias, int tile)
+    : m_tile(tile), m_weight_version(-1), m_filter_pending(false)
+{
+    if (!winogradSupported(params))
+        throw std::runtime_error("winograd needs a 1x3x3 kernel with unit stride and dilation");
+    if (tile != 2 && tile != 4)
+        throw std::runtime_error("winograd tile must be 2 or 4");
+
+    m_param.batchsize = params[0];
+    m_param.channels = params[1];
+    m_param.pad_h = params[6];
+    m_param.pad_w = params[7];
+    m_param.depth = params[14];
+    m_param.height_out = params[15];
+    m_param.width_out = params[16];
+    m_param.height = params[18];
+    m_param.width = params[19];
+    m_param.out_channels = params[20];
+    m_param.tiles_h = (m_param.height_out + tile - 1) / tile;
+    m_param.tiles_w = (m_param.width_out + tile - 1) / tile;
+    m_param.use_bias = use_bias;
+
+    const int alpha = tile + 2;
+    const int tiles = m_param.batchsize * m_param.depth * m_param.tiles_h * m_param.tiles_w;
+    const int co = m_param.out_channels;
+    const int ci = m_param.channels;
+    std::vector<int> gemm_params = {
+        alpha * alpha, co, tiles, ci, // batch, m, n, k
+        ci, tiles, tiles, tiles, // lda, ldb, ldc, ldd
+        co * ci, ci * tiles, 0, co * tiles // stride a, b, c, d
+    };
+
+    m_filter.reset(new winograd_transform(m_param, winograd_stage::kFilter, m_tile));
+    m_input.reset(new winograd_transform(m_param, winograd_stage::kInput, m_tile));
+    m_output.reset(new winograd_transform(m_param, winograd_stage::kOutput, m_tile));
+    m_gemm.reset(new gemm_strided_batched(1.f, 0.f, false, false, false, gemm_params));
+}
+
+void conv_winograd::forward(tensor& y, tensor& x, tensor& w, tensor& b, int weight_version)
+{
+    if (m_u.isEmpty())
+    {
+        const int alpha2 = (m_tile + 2) * (m_tile + 2);
+        const int tiles = m_param.batchsize * m_param.depth * m_param.tiles_h * m_param.tiles_w;
+        m_u = tensor(0.f, Shape{ alpha2, static_cast<int>(m_param.out_channels), static_cast<int>(m_param.channels) });
+        m_v = tensor(0.f, Shape{ alpha2, static_cast<int>(m_param.channels), tiles });
+        m_m = tensor(0.f, Shape{ alpha2, static_cast<int>(m_param.out_channels), tiles });
+    }
+
+    // the transformed filter is reused until the caller reports new weights
+    if (weight_version != m_weight_version)
+    {
+        m_filter->forward(m_u, w, w);
+        m_weight_version = weight_version;
+        m_filter_pending = true;
+    }
+    m_input->forward(m_v, x, x);
+    m_gemm->forward(m_m, m_u, m_v, m_m);
+    m_output->forward(y, m_m, b);
+}
+
+int conv_winograd::runCommandBuffer()
+{
+    if (m_filter_pending)
+    {
+        m_filter->runCommandBuffer();
+        m_filter_pending = false;
+    }
+    m_input->runCommandBuffer();
+    m_gemm->runCommandBuffer();
+    m_output->runCommandBuffer();
+    return 1;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "vknn.h"
+#include "../engine/layer.h"
+#include "gemm.h"
+
+struct winograd_param
+{
+    uint32_t batchsize;
+    uint32_t channels;
+    uint32_t out_channels;
+    uint32_t depth;
+    uint32_t height;
+    uint32_t width;
+    uint32_t pad_h;
+    uint32_t pad_w;
+    uint32_t height_out;
+    uint32_t width_out;
+    uint32_t tiles_h;
+    uint32_t tiles_w;
+    uint32_t use_bias;
+};
+
+enum class winograd_stage
+{
+    kFilter = 0,
+    kInput = 1,
+    kOutput = 2
+};
+
+class winograd_transform : public layer
+{
+    winograd_param m_param;
+    winograd_stage m_stage;
+    uint32_t m_tile;
+public:
+    winograd_transform(const winograd_param& param, winograd_stage stage, uint32_t tile);
+    void forward(tensor& dst, tensor& src, tensor& b);
+};
+
+// 3x3, stride 1, dilation 1 convolution through F(2x2, 3x3) or F(4x4, 3x3):
+// input transform, ALPHA^2 batched GEMMs in the transformed domain and output
+// transform. The filter transform is only rerun when weight_version changes.
+// params use the conv_forward layout (vol2col params followed by out_channels).
+class conv_winograd
+{
+    winograd_param m_param;
+    uint32_t m_tile;
+    int m_weight_version;
+    bool m_filter_pending;
+
+    tensor m_u;
+    tensor m_v;
+    tensor m_m;
+    std::unique_ptr<winograd_transform> m_filter;
+    std::unique_ptr<winograd_transform> m_input;
+    std::unique_ptr<winograd_transform> m_output;
+    std::unique_ptr<gemm_strided_batched> m_gemm;
+
+public:
+    conv_winograd(std::vector<int>& params, bool use_bias, int tile);
+    void forward(tensor& y, tensor& x, tensor& w, tensor& b, int weight_version);
+    int runCommandBuffer();
+};
+
+bool winogradSupported(std::vector<int>& params);